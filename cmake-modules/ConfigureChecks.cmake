@@ -4,3 +4,5 @@ include(CheckSymbolExists)
 check_symbol_exists(scandir dirent.h HAVE_SCANDIR)
 check_include_file (error.h HAVE_ERROR_H)
 check_include_file (search.h HAVE_TSEARCH)
+check_include_file (sys/epoll.h HAVE_SYS_EPOLL_H)
+check_include_file (sys/timerfd.h HAVE_SYS_TIMERFD_H)
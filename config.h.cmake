@@ -1,5 +1,7 @@
 #cmakedefine HAVE_ERROR_H 1
 #cmakedefine HAVE_SCANDIR 1
+#cmakedefine HAVE_SYS_EPOLL_H 1
+#cmakedefine HAVE_SYS_TIMERFD_H 1
 
 #cmakedefine HAVE_GETTEXT 1
 #cmakedefine ENABLE_NLS 1
@@ -2372,6 +2372,9 @@ void comets_handle_game_over(int game_status)
                 {
                     if(sorted_scores[i].connected)
                     {
+                        //Only as many as fit on the screen:
+                        if(loc.y + 2 * loc.h > screen->h)
+                            break;
                         snprintf(str, 64, "%d.\t%s: %d", rank, sorted_scores[i].name, sorted_scores[i].score);
                         rank++;
                         if(sorted_scores[i].mine)
@@ -400,6 +400,9 @@ void comets_draw_misc(MC_MathGame *curr_game, int wave,
         {
             if(LAN_PlayerConnected(i))
             {
+                //Stop at the bottom of the screen - there may be hundreds:
+                if(entries > 0 && loc.y + 2 * loc.h > screen->h)
+                    break;
                 snprintf(str, 64, "%s: %d",  LAN_PlayerName(i),  LAN_PlayerScore(i));
                 if(LAN_PlayerMine(i))
                     score_surf = T4K_BlackOutline(str, fontsize, &yellow);
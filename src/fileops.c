@@ -2153,6 +2153,9 @@ int write_postgame_summary(MC_MathGame* game)
             fprintf(fp, "Percent Correct: (not applicable)\n");
 
         fprintf(fp,"Median Time/Question:\t%g\n",median_time);
+        fprintf(fp,"Mean Time/Question:\t%g\n", MC_MeanTimePerQuestion(game));
+        fprintf(fp,"90th Percentile Time:\t%g\n", MC_TimePerQuestionPercentile(game, 90));
+        fprintf(fp,"99th Percentile Time:\t%g\n", MC_TimePerQuestionPercentile(game, 99));
 
         fprintf(fp, "Mission Accomplished:\t");
         if (MC_MissionAccomplished(game))
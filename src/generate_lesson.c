@@ -65,6 +65,7 @@ int main(int argc,char *argv[])
     MC_MathGame game;
 
     /* Initialize MathCards backend for math questions: */
+    memset(&game, 0, sizeof(game));
     if (!MC_Initialize(&game))
     {
         fprintf(stderr, "\nUnable to initialize MathCards\n");
@@ -0,0 +1,772 @@
+/*
+   loadgen.c:
+
+   Headless load generator for the LAN server. Where testclient.c
+   drives one connection by hand, this opens as many as we like from
+   a single process and plays them all as bots from one event loop,
+   answering questions with a chosen accuracy and think time. It
+   reports how fast the server kept up, so a tuxmathserver can be
+   sized for a school-wide contest without a school full of players.
+
+   Copyright 2026.
+Author: agent.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+loadgen.c is part of "Tux, of Math Command", a.k.a. "tuxmath".
+
+Tuxmath is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+Tuxmath is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/* This must come before #ifdef HAVE_LIBSDL_NET to get "config.h" */
+#include "globals.h"
+
+#ifdef HAVE_LIBSDL_NET
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+
+#include "transtruct.h"
+#include "netmsg.h"
+#include "server.h"
+
+/* Usage: tuxmathloadgen [options]
+
+   --host <name>           server to load (default localhost)
+   --port <n>              port of the first room (DEFAULT_PORT)
+   --rooms <n>             share the bots out over this many rooms,
+                           on the ports following the first (1)
+   --bots <n>              connections to open (16)
+   --accuracy <pct>        percentage of questions answered right (80)
+   --accuracy-spread <pct> each bot's accuracy is drawn evenly from
+                           that plus or minus this much (0)
+   --think <msec>          mean time taken to answer a question (1500)
+   --think-dist <dist>     fixed, uniform (zero to twice the mean) or
+                           exponential (the default)
+   --leave <pct>           chance a bot drops its connection in any one
+                           minute of play (0)
+   --rejoin <msec>         how long a bot that dropped out waits before
+                           connecting again, or -1 for never (5000)
+   --protocol <n>          wire protocol to ask for (NET_PROTOCOL_VERSION)
+   --duration <sec>        how long to run (60)
+   --report <sec>          seconds between progress lines, 0 for none (10)
+   --seed <n>              seeds rand() so runs can be repeated (1)
+   --debug-lan
+
+   Rooms refuse players once their game has started, so the bots in
+   each room wait for each other before saying they are ready, and
+   connect again for another game whenever one ends.  The summary
+   goes to stdout; progress lines and errors go to stderr. The exit
+   status is nonzero if no bot managed to play.
+*/
+
+#define LG_MAX_QUESTIONS MAX_MAX_COMETS  //questions a bot can have on screen
+#define LG_MAX_WAIT 100          //longest msec the loop sleeps
+#define LG_CONNECT_SPACING 5     //msec between connections, so the server's
+                                 //listen backlog doesn't overflow
+#define LG_CONNECT_RETRY 2000    //msec before trying again after being turned away
+#define LG_LOBBY_WAIT 3000       //msec a bot waits for the rest of its room
+#define LG_REGAME_DELAY 1000     //msec after a game ends before reconnecting
+
+enum {
+    THINK_FIXED,
+    THINK_UNIFORM,
+    THINK_EXPONENTIAL
+};
+
+enum {
+    BOT_OFFLINE,      //waiting to connect at next_action
+    BOT_CONNECTING,   //waiting for the server to take it in
+    BOT_LOBBY,        //connected, says it is ready at next_action
+    BOT_READY,        //waiting for GO_TO_GAME
+    BOT_PLAYING,      //drops out at next_action, unless that is 0
+    BOT_GONE          //dropped out for good
+};
+
+/* Counters for the summary: */
+enum {
+    LG_CONNECTS,
+    LG_CONNECT_FAILED,
+    LG_REFUSED,
+    LG_LOST,
+    LG_DROPPED_OUT,
+    LG_GARBLED,
+    LG_SEND_FAILED,
+    LG_GAMES,
+    LG_MSGS_IN,
+    LG_BYTES_IN,
+    LG_MSGS_OUT,
+    LG_QUESTIONS,
+    LG_CORRECT,
+    LG_WRONG,
+    LG_NUM_COUNTERS
+};
+
+typedef struct bot_question {
+    int id;             //-1 if the slot is free
+    int correct;        //whether the bot will get it right
+    Uint32 arrived;     //when the question came in
+    Uint32 due;         //when the bot answers it
+    Uint32 answered;    //when the answer went out, 0 until then
+} bot_question;
+
+typedef struct bot_type {
+    int room;
+    int state;
+    Uint32 next_action;
+    int accuracy;       //percent
+    TCPsocket sock;
+    net_stream stream;
+    bot_question quest[LG_MAX_QUESTIONS];
+    Uint32 next_due;    //earliest unanswered question, 0 if none
+} bot_type;
+
+/* Settings: */
+static char host[NAME_SIZE] = "localhost";
+static int port = DEFAULT_PORT;
+static int num_rooms = 1;
+static int num_bots = 16;
+static int accuracy = 80;
+static int accuracy_spread = 0;
+static int think_mean = 1500;
+static int think_dist = THINK_EXPONENTIAL;
+static int leave_pct = 0;
+static int rejoin_wait = 5000;
+static int protocol = NET_PROTOCOL_VERSION;
+static int duration = 60;
+static int report_interval = 10;
+static unsigned int seed = 1;
+
+static bot_type* bots = NULL;
+static SDLNet_SocketSet socket_set = NULL;
+static unsigned long counters[LG_NUM_COUNTERS];
+/* Msec from sending each answer to the REMOVE_QUESTION for it: */
+static Uint32* latency = NULL;
+static int num_latency = 0;
+static int max_latency = 0;
+
+static int handle_args(int argc, char* argv[]);
+static double random_fraction(void);
+static Uint32 random_wait(int mean, int dist);
+static int bot_connect(bot_type* bot, int n, Uint32 now);
+static void bot_disconnect(bot_type* bot, int state, Uint32 next_action);
+static int bot_send(bot_type* bot, net_msg* msg);
+static void bot_read(bot_type* bot, int n, Uint32 now);
+static void bot_handle_msg(bot_type* bot, int n, net_msg* msg, Uint32 now);
+static void bot_add_question(bot_type* bot, net_msg* msg, Uint32 now);
+static void bot_remove_question(bot_type* bot, int id, Uint32 now);
+static void bot_answer_due(bot_type* bot, Uint32 now);
+static void bot_find_next_due(bot_type* bot);
+static void check_lobbies(Uint32 now);
+static void add_latency(Uint32 msec);
+static int compare_msec(const void* a, const void* b);
+static void print_progress(Uint32 elapsed);
+static void print_summary(Uint32 elapsed);
+
+int main(int argc, char* argv[])
+{
+    Uint32 start, now, next_report, wait;
+    bot_type* bot;
+    int i, j, ready;
+
+    if (!handle_args(argc, argv))
+        exit(EXIT_FAILURE);
+    srand(seed);
+#ifdef SIGPIPE
+    //A server hanging up on a bot shouldn't take the rest down with it:
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    if (SDL_Init(0) == -1)
+    {
+        fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
+        exit(EXIT_FAILURE);
+    }
+    if (SDLNet_Init() < 0)
+    {
+        fprintf(stderr, "SDLNet_Init: %s\n", SDLNet_GetError());
+        exit(EXIT_FAILURE);
+    }
+
+    bots = (bot_type*)calloc(num_bots, sizeof(bot_type));
+    socket_set = SDLNet_AllocSocketSet(num_bots);
+    if (!bots || !socket_set)
+    {
+        fprintf(stderr, "Couldn't allocate %d bots\n", num_bots);
+        exit(EXIT_FAILURE);
+    }
+
+    start = SDL_GetTicks();
+    for (i = 0; i < num_bots; i++)
+    {
+        bot = &bots[i];
+        bot->room = i % num_rooms;
+        bot->state = BOT_OFFLINE;
+        bot->next_action = start + i * LG_CONNECT_SPACING;
+        bot->accuracy = accuracy - accuracy_spread
+            + (int)(random_fraction() * (2 * accuracy_spread + 1));
+        if (bot->accuracy < 0)
+            bot->accuracy = 0;
+        if (bot->accuracy > 100)
+            bot->accuracy = 100;
+        for (j = 0; j < LG_MAX_QUESTIONS; j++)
+            bot->quest[j].id = -1;
+    }
+
+    fprintf(stderr, "%d bots playing %d room(s) on %s:%d for %d seconds\n",
+            num_bots, num_rooms, host, port, duration);
+    next_report = start + report_interval * 1000;
+
+    for (now = start; now - start < (Uint32)duration * 1000; now = SDL_GetTicks())
+    {
+        //Connections due, and anyone who has dropped out:
+        for (i = 0; i < num_bots; i++)
+        {
+            bot = &bots[i];
+            if (bot->state == BOT_OFFLINE && (Sint32)(now - bot->next_action) >= 0)
+            {
+                bot_connect(bot, i, now);
+                now = SDL_GetTicks();
+            }
+            else if (bot->state == BOT_PLAYING && bot->next_action != 0
+                    && (Sint32)(now - bot->next_action) >= 0)
+            {
+                DEBUGMSG(debug_lan, "Bot %d drops out\n", i);
+                counters[LG_DROPPED_OUT]++;
+                if (rejoin_wait < 0)
+                    bot_disconnect(bot, BOT_GONE, 0);
+                else
+                    bot_disconnect(bot, BOT_OFFLINE, now + rejoin_wait);
+            }
+        }
+        check_lobbies(now);
+
+        //Sleep until a message comes in or the next answer is due:
+        wait = LG_MAX_WAIT;
+        for (i = 0; i < num_bots; i++)
+        {
+            if (bots[i].next_due == 0)
+                continue;
+            if ((Sint32)(bots[i].next_due - now) <= 0)
+                wait = 0;
+            else if (bots[i].next_due - now < wait)
+                wait = bots[i].next_due - now;
+        }
+        ready = SDLNet_CheckSockets(socket_set, wait);
+        if (ready == -1)
+        {
+            //Nothing connected yet, or a system error:
+            if (wait > 0)
+                SDL_Delay(wait);
+            ready = 0;
+        }
+
+        now = SDL_GetTicks();
+        for (i = 0; i < num_bots && ready > 0; i++)
+        {
+            bot = &bots[i];
+            if (bot->sock && SDLNet_SocketReady(bot->sock))
+            {
+                ready--;
+                bot_read(bot, i, now);
+            }
+        }
+        for (i = 0; i < num_bots; i++)
+            if (bots[i].next_due != 0 && (Sint32)(now - bots[i].next_due) >= 0)
+                bot_answer_due(&bots[i], now);
+
+        if (report_interval > 0 && (Sint32)(now - next_report) >= 0)
+        {
+            print_progress(now - start);
+            next_report += report_interval * 1000;
+        }
+    }
+
+    now = SDL_GetTicks();
+    for (i = 0; i < num_bots; i++)
+        bot_disconnect(&bots[i], BOT_GONE, 0);
+    print_summary(now - start);
+
+    SDLNet_FreeSocketSet(socket_set);
+    free(bots);
+    free(latency);
+    SDLNet_Quit();
+    SDL_Quit();
+
+    return (counters[LG_QUESTIONS] > 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/* Returns 0 if the arguments don't make sense: */
+static int handle_args(int argc, char* argv[])
+{
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--debug-lan") == 0)
+            debug_status |= debug_lan;
+        else if (i + 1 >= argc)
+            break;
+        else if (strcmp(argv[i], "--host") == 0)
+            snprintf(host, NAME_SIZE, "%s", argv[++i]);
+        else if (strcmp(argv[i], "--port") == 0)
+            port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rooms") == 0)
+            num_rooms = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bots") == 0)
+            num_bots = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--accuracy") == 0)
+            accuracy = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--accuracy-spread") == 0)
+            accuracy_spread = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--think") == 0)
+            think_mean = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--think-dist") == 0)
+        {
+            i++;
+            if (strcmp(argv[i], "fixed") == 0)
+                think_dist = THINK_FIXED;
+            else if (strcmp(argv[i], "uniform") == 0)
+                think_dist = THINK_UNIFORM;
+            else if (strcmp(argv[i], "exponential") == 0)
+                think_dist = THINK_EXPONENTIAL;
+            else
+                break;
+        }
+        else if (strcmp(argv[i], "--leave") == 0)
+            leave_pct = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rejoin") == 0)
+            rejoin_wait = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--protocol") == 0)
+            protocol = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--duration") == 0)
+            duration = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--report") == 0)
+            report_interval = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0)
+            seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        else
+            break;
+    }
+
+    if (i < argc)
+    {
+        fprintf(stderr, "Usage: %s [--host <name>] [--port <n>] [--rooms <n>] [--bots <n>]\n"
+                "  [--accuracy <pct>] [--accuracy-spread <pct>] [--think <msec>]\n"
+                "  [--think-dist fixed|uniform|exponential] [--leave <pct>] [--rejoin <msec>]\n"
+                "  [--protocol <n>] [--duration <sec>] [--report <sec>] [--seed <n>]\n"
+                "  [--debug-lan]\n", argv[0]);
+        return 0;
+    }
+    if (num_bots < 1 || num_rooms < 1 || num_rooms > MAX_ROOMS || duration < 1
+            || protocol < NET_PROTOCOL_LEGACY || protocol > NET_PROTOCOL_VERSION)
+    {
+        fprintf(stderr, "Need at least one bot, 1 to %d rooms, a duration, "
+                "and protocol %d to %d\n", MAX_ROOMS, NET_PROTOCOL_LEGACY, NET_PROTOCOL_VERSION);
+        return 0;
+    }
+    if (think_mean < 0)
+        think_mean = 0;
+    return 1;
+}
+
+
+/* In [0, 1): */
+static double random_fraction(void)
+{
+    return rand() / (RAND_MAX + 1.0);
+}
+
+
+/* Msec drawn from the given distribution: */
+static Uint32 random_wait(int mean, int dist)
+{
+    switch (dist)
+    {
+        case THINK_FIXED:
+            return mean;
+        case THINK_UNIFORM:
+            return (Uint32)(random_fraction() * 2 * mean);
+        default:
+            return (Uint32)(-mean * log(1.0 - random_fraction()));
+    }
+}
+
+
+/* Opens bot n's connection to its room and introduces it: */
+static int bot_connect(bot_type* bot, int n, Uint32 now)
+{
+    IPaddress ip;
+    net_msg msg;
+
+    if (SDLNet_ResolveHost(&ip, host, port + bot->room) == -1
+            || !(bot->sock = SDLNet_TCP_Open(&ip)))
+    {
+        DEBUGMSG(debug_lan, "Bot %d couldn't connect: %s\n", n, SDLNet_GetError());
+        counters[LG_CONNECT_FAILED]++;
+        bot->next_action = now + LG_CONNECT_RETRY;
+        return 0;
+    }
+    SDLNet_TCP_AddSocket(socket_set, bot->sock);
+    counters[LG_CONNECTS]++;
+    Net_ResetStream(&bot->stream);
+    bot->state = BOT_CONNECTING;
+
+    //Ask for the protocol in the old format, as the game does:
+    if (protocol > NET_PROTOCOL_LEGACY)
+    {
+        Net_InitMsg(&msg, NET_OP_PROTOCOL);
+        msg.arg[0] = protocol;
+        bot_send(bot, &msg);
+    }
+    Net_InitMsg(&msg, NET_OP_SET_NAME);
+    snprintf(msg.text, NET_BUF_LEN, "bot%03d", n);
+    bot_send(bot, &msg);
+    //The connection is made as soon as the server's backlog takes it,
+    //but the server only counts us once it has accepted it, which the
+    //answer to this shows:
+    Net_InitMsg(&msg, NET_OP_REQUEST_INDEX);
+    return bot_send(bot, &msg);
+}
+
+
+/* Hangs up (if connected) and forgets the bot's questions: */
+static void bot_disconnect(bot_type* bot, int state, Uint32 next_action)
+{
+    int j;
+
+    if (bot->sock)
+    {
+        SDLNet_TCP_DelSocket(socket_set, bot->sock);
+        SDLNet_TCP_Close(bot->sock);
+        bot->sock = NULL;
+    }
+    for (j = 0; j < LG_MAX_QUESTIONS; j++)
+        bot->quest[j].id = -1;
+    bot->next_due = 0;
+    bot->state = state;
+    bot->next_action = next_action;
+}
+
+
+static int bot_send(bot_type* bot, net_msg* msg)
+{
+    if (!bot->sock)
+        return 0;
+    if (!Net_SendNetMsg(bot->sock, &bot->stream, msg))
+    {
+        counters[LG_SEND_FAILED]++;
+        return 0;
+    }
+    counters[LG_MSGS_OUT]++;
+    return 1;
+}
+
+
+/* Handles everything that has come in for bot n: */
+static void bot_read(bot_type* bot, int n, Uint32 now)
+{
+    net_msg msg;
+    int bytes, status;
+
+    bytes = Net_ReadStream(bot->sock, &bot->stream);
+    if (bytes <= 0)
+    {
+        //The server hangs up on us straight away if the room is full:
+        DEBUGMSG(debug_lan, "Bot %d disconnected\n", n);
+        counters[bot->state == BOT_CONNECTING ? LG_REFUSED : LG_LOST]++;
+        bot_disconnect(bot, BOT_OFFLINE, now + LG_CONNECT_RETRY);
+        return;
+    }
+    counters[LG_BYTES_IN] += bytes;
+
+    //NOTE bot_handle_msg() may disconnect the bot:
+    while (bot->sock && (status = Net_NextMsg(&bot->stream, &msg)) > 0)
+    {
+        counters[LG_MSGS_IN]++;
+        bot_handle_msg(bot, n, &msg, now);
+    }
+    if (bot->sock && status == -1)
+    {
+        fprintf(stderr, "Bot %d received a garbled message - reconnecting\n", n);
+        counters[LG_GARBLED]++;
+        bot_disconnect(bot, BOT_OFFLINE, now + LG_CONNECT_RETRY);
+    }
+}
+
+
+static void bot_handle_msg(bot_type* bot, int n, net_msg* msg, Uint32 now)
+{
+    switch (msg->op)
+    {
+        case NET_OP_PROTOCOL:
+            if (msg->arg[0] >= NET_PROTOCOL_LEGACY && msg->arg[0] <= NET_PROTOCOL_VERSION)
+                bot->stream.protocol = msg->arg[0];
+            break;
+        case NET_OP_SOCKET_INDEX:
+            if (bot->state == BOT_CONNECTING)
+            {
+                bot->state = BOT_LOBBY;
+                bot->next_action = now + LG_LOBBY_WAIT;
+            }
+            break;
+        case NET_OP_PING:
+            msg->op = NET_OP_PONG;
+            bot_send(bot, msg);
+            break;
+        case NET_OP_GAME_IN_PROGRESS:
+            counters[LG_REFUSED]++;
+            bot_disconnect(bot, BOT_OFFLINE, now + LG_CONNECT_RETRY);
+            break;
+        case NET_OP_GO_TO_GAME:
+            bot->state = BOT_PLAYING;
+            bot->next_action = 0;
+            if (leave_pct > 0)
+                bot->next_action = now + 1
+                    + random_wait(60000 * 100 / leave_pct, THINK_EXPONENTIAL);
+            break;
+        case NET_OP_ADD_QUESTION:
+            bot_add_question(bot, msg, now);
+            break;
+        case NET_OP_REMOVE_QUESTION:
+            bot_remove_question(bot, msg->arg[0], now);
+            break;
+        case NET_OP_GAME_HALTED:
+            //The server hangs up on everyone once a game is over:
+            DEBUGMSG(debug_lan, "Bot %d's game is over\n", n);
+            counters[LG_GAMES]++;
+            bot_disconnect(bot, BOT_OFFLINE, now + LG_REGAME_DELAY);
+            break;
+        default:
+            break;
+    }
+}
+
+
+/* Decides now how and when the bot will answer: */
+static void bot_add_question(bot_type* bot, net_msg* msg, Uint32 now)
+{
+    bot_question* q;
+    int j;
+
+    counters[LG_QUESTIONS]++;
+    for (j = 0; j < LG_MAX_QUESTIONS && bot->quest[j].id != -1; j++) {}
+    if (j == LG_MAX_QUESTIONS)
+        return;   //more on screen than the game allows - let it go
+
+    q = &bot->quest[j];
+    q->id = msg->card.question_id;
+    q->correct = (random_fraction() * 100 < bot->accuracy);
+    q->arrived = now;
+    q->due = now + random_wait(think_mean, think_dist);
+    if (q->due == 0)
+        q->due = 1;   //0 means nothing due
+    q->answered = 0;
+    if (bot->next_due == 0 || (Sint32)(q->due - bot->next_due) < 0)
+        bot->next_due = q->due;
+}
+
+
+/* The server is done with question id - if we answered it, that */
+/* is how long it took to hear back:                             */
+static void bot_remove_question(bot_type* bot, int id, Uint32 now)
+{
+    int j;
+
+    for (j = 0; j < LG_MAX_QUESTIONS; j++)
+    {
+        if (bot->quest[j].id != id)
+            continue;
+        if (bot->quest[j].answered != 0)
+            add_latency(now - bot->quest[j].answered);
+        bot->quest[j].id = -1;
+        bot_find_next_due(bot);
+        return;
+    }
+}
+
+
+/* Sends the answers the bot has finished thinking about: */
+static void bot_answer_due(bot_type* bot, Uint32 now)
+{
+    bot_question* q;
+    net_msg msg;
+    int j;
+
+    for (j = 0; j < LG_MAX_QUESTIONS && bot->sock; j++)
+    {
+        q = &bot->quest[j];
+        if (q->id == -1 || q->answered != 0 || (Sint32)(now - q->due) < 0)
+            continue;
+
+        if (q->correct)
+        {
+            Net_InitMsg(&msg, NET_OP_CORRECT_ANSWER);
+            msg.time = (now - q->arrived) / 1000.0;
+            counters[LG_CORRECT]++;
+        }
+        else
+        {
+            Net_InitMsg(&msg, NET_OP_WRONG_ANSWER);
+            counters[LG_WRONG]++;
+        }
+        msg.arg[0] = q->id;
+        q->answered = now;
+        bot_send(bot, &msg);
+    }
+    bot_find_next_due(bot);
+}
+
+
+static void bot_find_next_due(bot_type* bot)
+{
+    bot_question* q;
+    int j;
+
+    bot->next_due = 0;
+    for (j = 0; j < LG_MAX_QUESTIONS; j++)
+    {
+        q = &bot->quest[j];
+        if (q->id == -1 || q->answered != 0)
+            continue;
+        if (bot->next_due == 0 || (Sint32)(q->due - bot->next_due) < 0)
+            bot->next_due = q->due;
+    }
+}
+
+
+/* A room's game starts as soon as everyone connected is ready, and */
+/* nobody can join after that, so bots say they are ready once the  */
+/* rest of their room is connected - or they get tired of waiting:  */
+static void check_lobbies(Uint32 now)
+{
+    int waiting[MAX_ROOMS];
+    net_msg msg;
+    bot_type* bot;
+    int i;
+
+    memset(waiting, 0, sizeof(waiting));
+    for (i = 0; i < num_bots; i++)
+        if (bots[i].state == BOT_OFFLINE || bots[i].state == BOT_CONNECTING)
+            waiting[bots[i].room]++;
+
+    Net_InitMsg(&msg, NET_OP_PLAYER_READY);
+    for (i = 0; i < num_bots; i++)
+    {
+        bot = &bots[i];
+        if (bot->state != BOT_LOBBY)
+            continue;
+        if (waiting[bot->room] == 0 || (Sint32)(now - bot->next_action) >= 0)
+        {
+            bot->state = BOT_READY;
+            bot_send(bot, &msg);
+        }
+    }
+}
+
+
+static void add_latency(Uint32 msec)
+{
+    Uint32* more;
+
+    if (num_latency == max_latency)
+    {
+        more = (Uint32*)realloc(latency, (max_latency * 2 + 1024) * sizeof(Uint32));
+        if (!more)
+            return;
+        latency = more;
+        max_latency = max_latency * 2 + 1024;
+    }
+    latency[num_latency++] = msec;
+}
+
+
+static int compare_msec(const void* a, const void* b)
+{
+    Uint32 x = *(const Uint32*)a, y = *(const Uint32*)b;
+    return (x > y) - (x < y);
+}
+
+
+/* One line on stderr every --report seconds: */
+static void print_progress(Uint32 elapsed)
+{
+    int i, playing = 0, connected = 0;
+
+    for (i = 0; i < num_bots; i++)
+    {
+        connected += (bots[i].sock != NULL);
+        playing += (bots[i].state == BOT_PLAYING);
+    }
+    fprintf(stderr, "%5lu s: %d connected, %d playing, %lu messages in, "
+            "%lu answers, %d replies timed, %lu games finished\n",
+            (unsigned long)(elapsed / 1000), connected, playing,
+            counters[LG_MSGS_IN], counters[LG_CORRECT] + counters[LG_WRONG],
+            num_latency, counters[LG_GAMES]);
+}
+
+
+static void print_summary(Uint32 elapsed)
+{
+    double secs = elapsed / 1000.0;
+    double sum = 0;
+    int i;
+
+    printf("%d bots, %d room(s), protocol %d, %.1f seconds\n",
+            num_bots, num_rooms, protocol, secs);
+    printf("Connections: %lu made, %lu failed, %lu refused, %lu lost, %lu dropped out\n",
+            counters[LG_CONNECTS], counters[LG_CONNECT_FAILED], counters[LG_REFUSED],
+            counters[LG_LOST], counters[LG_DROPPED_OUT]);
+    printf("Errors: %lu garbled, %lu send failures\n",
+            counters[LG_GARBLED], counters[LG_SEND_FAILED]);
+    printf("Throughput: %lu messages in (%.1f/sec), %lu bytes in (%.1f KB/sec), "
+            "%lu messages out (%.1f/sec)\n",
+            counters[LG_MSGS_IN], counters[LG_MSGS_IN] / secs,
+            counters[LG_BYTES_IN], counters[LG_BYTES_IN] / secs / 1024,
+            counters[LG_MSGS_OUT], counters[LG_MSGS_OUT] / secs);
+    printf("Questions: %lu received, %lu answered right, %lu wrong (%.1f answers/sec), "
+            "%lu games finished\n",
+            counters[LG_QUESTIONS], counters[LG_CORRECT], counters[LG_WRONG],
+            (counters[LG_CORRECT] + counters[LG_WRONG]) / secs, counters[LG_GAMES]);
+
+    if (num_latency == 0)
+    {
+        printf("Answer to REMOVE_QUESTION (msec): no samples\n");
+        return;
+    }
+    qsort(latency, num_latency, sizeof(Uint32), compare_msec);
+    for (i = 0; i < num_latency; i++)
+        sum += latency[i];
+    printf("Answer to REMOVE_QUESTION (msec): %d samples, mean %.1f, 50%% <= %lu, "
+            "90%% <= %lu, 99%% <= %lu, max %lu\n",
+            num_latency, sum / num_latency,
+            (unsigned long)latency[(num_latency * 50 + 99) / 100 - 1],
+            (unsigned long)latency[(num_latency * 90 + 99) / 100 - 1],
+            (unsigned long)latency[(num_latency * 99 + 99) / 100 - 1],
+            (unsigned long)latency[num_latency - 1]);
+}
+
+#else
+/* if no SDL_net, do nothing: */
+int main(int argc, char **argv)
+{
+    return 0;
+}
+#endif
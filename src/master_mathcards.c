@@ -34,6 +34,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 #include <wchar.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
 
 
 
@@ -209,6 +210,7 @@ int questions_pending = 0;
 int unanswered = 0;
 int starting_length = 0;
 static int id = 0;
+static MC_Random mc_rng = {0, 1}; //seeded by MC_StartGame()
 
 /* For keeping track of timing data */
 float* time_per_question_list = NULL;
@@ -225,6 +227,10 @@ const MC_FlashCard DEFAULT_CARD = {{'\0'}, {'\0'}, 0, 0, 0}; //empty card to sig
 
 static MC_MathQuestion* generate_list(void);
 static void clear_negatives(void);
+static void rng_seed(MC_Random* rng, uint64_t seed, uint64_t stream);
+static unsigned int rng_next(MC_Random* rng);
+static int rng_below(MC_Random* rng, int n); //uniform in [0, n)
+static double rng_double(MC_Random* rng); //uniform in [0, 1)
 //static int validate_question(int n1, int n2, int n3);
 //static MC_MathQuestion* create_node(int n1, int n2, int op, int ans, int f);
 //static MC_MathQuestion* create_node_from_card(const MC_FlashCard* flashcard);
@@ -367,7 +373,7 @@ int MC_StartGame(void)
     }
 
     /* we know math_opts exists if we make it to here */
-    srand(time(NULL));
+    rng_seed(&mc_rng, (uint64_t)time(NULL), 0);
 
     /* clear out old lists if starting another game: (if not done already) */
     delete_list(question_list);
@@ -1359,9 +1365,6 @@ static int randomize_list(MC_MathQuestion** old_list)
 
     int old_length = list_length(old_tmp);
 
-    /* set random seed: */
-    srand(time(0));
-
 
     /* Allocate vector and set ptrs to nodes in old list: */
 
@@ -1371,7 +1374,7 @@ static int randomize_list(MC_MathQuestion** old_list)
     for (i = 0; i < old_length; i++)
     {
         tmp_vect[i] = old_tmp;
-        tmp_vect[i]->randomizer = rand();
+        tmp_vect[i]->randomizer = (int)(rng_next(&mc_rng) >> 1);
         old_tmp = old_tmp->next;
     }
 
@@ -1424,16 +1427,13 @@ MC_MathQuestion* pick_random(int length, MC_MathQuestion* list)
     int i;
     int rand_node;
 
-    /* set random seed DSB */
-    srand(time(0));
-
     /* if length is zero, get out to avoid divide-by-zero error */
     if (0 == length)
     {
         return list;
     }
 
-    rand_node = rand() % length;
+    rand_node = rng_below(&mc_rng, length);
 
     for (i=1; i < rand_node; i++)
     {
@@ -1510,6 +1510,39 @@ int already_in_list(MC_MathQuestion* list, MC_MathQuestion* ptr)
 // }
 
 
+/* PCG32 random number generator, shared with mathcards.c: */
+static void rng_seed(MC_Random* rng, uint64_t seed, uint64_t stream)
+{
+    rng->state = 0;
+    rng->inc = (stream << 1) | 1;  //must be odd
+    rng_next(rng);
+    rng->state += seed;
+    rng_next(rng);
+}
+
+static unsigned int rng_next(MC_Random* rng)
+{
+    uint64_t old = rng->state;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
+
+    rng->state = old * 6364136223846793005ULL + rng->inc;
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+}
+
+static int rng_below(MC_Random* rng, int n)
+{
+    if (n <= 0)
+        return 0;
+    return (int)(((uint64_t)rng_next(rng) * (uint32_t)n) >> 32);
+}
+
+static double rng_double(MC_Random* rng)
+{
+    return rng_next(rng) / 4294967296.0;
+}
+
+
 /* Compares two floats (needed for sorting in MC_MedianTimePerQuestion) */
 int floatCompare(const void *v1,const void *v2)
 {
@@ -1591,7 +1624,7 @@ MC_FlashCard generate_random_flashcard(void)
 
     //choose a problem type
     do
-        pt = rand() % MC_NUM_PTYPES;
+        pt = rng_below(&mc_rng, MC_NUM_PTYPES);
     while ( (pt == MC_PT_TYPING && !MC_GetOpt(TYPING_PRACTICE_ALLOWED) ) ||
             (pt == MC_PT_ARITHMETIC && !MC_GetOpt(ADDITION_ALLOWED) &&
              !MC_GetOpt(SUBTRACTION_ALLOWED) &&
@@ -1604,7 +1637,7 @@ MC_FlashCard generate_random_flashcard(void)
     {
         DEBUGMSG(debug_mathcards, "Generating typing question\n");
         ret = MC_AllocateFlashcard();
-        num = rand() % (MC_GetOpt(MAX_TYPING_NUM)-MC_GetOpt(MIN_TYPING_NUM) + 1)
+        num = rng_below(&mc_rng, MC_GetOpt(MAX_TYPING_NUM)-MC_GetOpt(MIN_TYPING_NUM) + 1)
             + MC_GetOpt(MIN_TYPING_NUM);
         snprintf(ret.formula_string, MC_FORMULA_LEN, "%d", num);
         snprintf(ret.answer_string, MC_ANSWER_LEN, "%d", num);
@@ -1615,7 +1648,7 @@ MC_FlashCard generate_random_flashcard(void)
     else //if (pt == MC_PT_ARITHMETIC)
     {
         DEBUGMSG(debug_mathcards, "Generating arithmetic question");
-        length = rand() % (MC_GetOpt(MAX_FORMULA_NUMS) -
+        length = rng_below(&mc_rng, MC_GetOpt(MAX_FORMULA_NUMS) -
                 MC_GetOpt(MIN_FORMULA_NUMS) + 1) //avoid div by 0
             +  MC_GetOpt(MIN_FORMULA_NUMS);
         DEBUGMSG(debug_mathcards, " of length %d", length);
@@ -1666,34 +1699,34 @@ MC_FlashCard generate_random_ooo_card_of_length(int length, int reformat)
     {
         DEBUGMSG(debug_mathcards, "\n");
         ret = MC_AllocateFlashcard();
-        for (op = rand() % MC_NUM_OPERS; //pick a random operation
+        for (op = rng_below(&mc_rng, MC_NUM_OPERS); //pick a random operation
                 MC_GetOpt(op + ADDITION_ALLOWED) == 0; //make sure it's allowed
-                op = rand() % MC_NUM_OPERS);
+                op = rng_below(&mc_rng, MC_NUM_OPERS));
 
         DEBUGMSG(debug_mathcards, "Operation is %c\n", operchars[op]);
         /*
            if (op == MC_OPER_ADD)
            {
-           r1 = rand() % (math_opts->iopts[MAX_AUGEND] - math_opts->iopts[MIN_AUGEND] + 1) + math_opts->iopts[MIN_AUGEND];
-           r2 = rand() % (math_opts->iopts[MAX_ADDEND] - math_opts->iopts[MIN_ADDEND] + 1) + math_opts->iopts[MIN_ADDEND];
+           r1 = rng_below(&mc_rng, math_opts->iopts[MAX_AUGEND] - math_opts->iopts[MIN_AUGEND] + 1) + math_opts->iopts[MIN_AUGEND];
+           r2 = rng_below(&mc_rng, math_opts->iopts[MAX_ADDEND] - math_opts->iopts[MIN_ADDEND] + 1) + math_opts->iopts[MIN_ADDEND];
            ans = r1 + r2;
            }
            else if (op == MC_OPER_SUB)
            {
-           r1 = rand() % (math_opts->iopts[MAX_MINUEND] - math_opts->iopts[MIN_MINUEND] + 1) + math_opts->iopts[MIN_MINUEND];
-           r2 = rand() % (math_opts->iopts[MAX_SUBTRAHEND] - math_opts->iopts[MIN_SUBTRAHEND] + 1) + math_opts->iopts[MIN_SUBTRAHEND];
+           r1 = rng_below(&mc_rng, math_opts->iopts[MAX_MINUEND] - math_opts->iopts[MIN_MINUEND] + 1) + math_opts->iopts[MIN_MINUEND];
+           r2 = rng_below(&mc_rng, math_opts->iopts[MAX_SUBTRAHEND] - math_opts->iopts[MIN_SUBTRAHEND] + 1) + math_opts->iopts[MIN_SUBTRAHEND];
            ans = r1 - r2;
            }
            else if (op == MC_OPER_MULT)
            {
-           r1 = rand() % (math_opts->iopts[MAX_MULTIPLIER] - math_opts->iopts[MIN_MULTIPLIER] + 1) + math_opts->iopts[MIN_MULTIPLIER];
-           r2 = rand() % (math_opts->iopts[MAX_MULTIPLICAND] - math_opts->iopts[MIN_MULTIPLICAND] + 1) + math_opts->iopts[MIN_MULTIPLICAND];
+           r1 = rng_below(&mc_rng, math_opts->iopts[MAX_MULTIPLIER] - math_opts->iopts[MIN_MULTIPLIER] + 1) + math_opts->iopts[MIN_MULTIPLIER];
+           r2 = rng_below(&mc_rng, math_opts->iopts[MAX_MULTIPLICAND] - math_opts->iopts[MIN_MULTIPLICAND] + 1) + math_opts->iopts[MIN_MULTIPLICAND];
            ans = r1 * r2;
            }
            else if (op == MC_OPER_DIV)
            {
-           ans = rand() % (math_opts->iopts[MAX_QUOTIENT] - math_opts->iopts[MIN_QUOTIENT] + 1) + math_opts->iopts[MIN_QUOTIENT];
-           r2 = rand() % (math_opts->iopts[MAX_DIVISOR] - math_opts->iopts[MIN_DIVISOR] + 1) + math_opts->iopts[MIN_DIVISOR];
+           ans = rng_below(&mc_rng, math_opts->iopts[MAX_QUOTIENT] - math_opts->iopts[MIN_QUOTIENT] + 1) + math_opts->iopts[MIN_QUOTIENT];
+           r2 = rng_below(&mc_rng, math_opts->iopts[MAX_DIVISOR] - math_opts->iopts[MIN_DIVISOR] + 1) + math_opts->iopts[MIN_DIVISOR];
            if (r2 == 0)
            r2 = 1;
            r1 = ans * r2;
@@ -1708,8 +1741,8 @@ MC_FlashCard generate_random_ooo_card_of_length(int length, int reformat)
 
         else do
         {
-            r1 = rand() % (math_opts->iopts[MAX_AUGEND+4*op] - math_opts->iopts[MIN_AUGEND+4*op] + 1) + math_opts->iopts[MIN_AUGEND+4*op];    
-            r2 = rand() % (math_opts->iopts[MAX_ADDEND+4*op] - math_opts->iopts[MIN_ADDEND+4*op] + 1) + math_opts->iopts[MIN_ADDEND+4*op]; 
+            r1 = rng_below(&mc_rng, math_opts->iopts[MAX_AUGEND+4*op] - math_opts->iopts[MIN_AUGEND+4*op] + 1) + math_opts->iopts[MIN_AUGEND+4*op];    
+            r2 = rng_below(&mc_rng, math_opts->iopts[MAX_ADDEND+4*op] - math_opts->iopts[MIN_ADDEND+4*op] + 1) + math_opts->iopts[MIN_ADDEND+4*op]; 
 
             if (op == MC_OPER_ADD)
                 ans = r1 + r2;
@@ -1754,35 +1787,35 @@ MC_FlashCard generate_random_ooo_card_of_length(int length, int reformat)
             //if the expression has addition or subtraction, we can't assume that
             //introducing multiplication or division will produce a predictable
             //result, so we'll limit ourselves to more addition/subtraction
-            for (op = rand() % 2 ? MC_OPER_ADD : MC_OPER_SUB;
+            for (op = rng_below(&mc_rng, 2) ? MC_OPER_ADD : MC_OPER_SUB;
                     MC_GetOpt(op + ADDITION_ALLOWED) == 0;
-                    op = rand() % 2 ? MC_OPER_ADD : MC_OPER_SUB);
+                    op = rng_below(&mc_rng, 2) ? MC_OPER_ADD : MC_OPER_SUB);
 
         }
         else
         {
             //the existing expression can be treated as a number in itself, so we
             //can do anything to it and be confident of the result.
-            for (op = rand() % MC_NUM_OPERS; //pick a random operation
+            for (op = rng_below(&mc_rng, MC_NUM_OPERS); //pick a random operation
                     MC_GetOpt(op + ADDITION_ALLOWED) == 0; //make sure it's allowed
-                    op = rand() % MC_NUM_OPERS);
+                    op = rng_below(&mc_rng, MC_NUM_OPERS));
         }
         DEBUGMSG(debug_mathcards, "Next operation is %c,",  operchars[op]);
 
         //pick the next operand
         if (op == MC_OPER_ADD)
         {
-            r1 = rand() % (math_opts->iopts[MAX_AUGEND] - math_opts->iopts[MIN_AUGEND] + 1) + math_opts->iopts[MIN_AUGEND];
+            r1 = rng_below(&mc_rng, math_opts->iopts[MAX_AUGEND] - math_opts->iopts[MIN_AUGEND] + 1) + math_opts->iopts[MIN_AUGEND];
             ret.answer += r1;
         }
         else if (op == MC_OPER_SUB)
         {
-            r1 = rand() % (math_opts->iopts[MAX_SUBTRAHEND] - math_opts->iopts[MIN_SUBTRAHEND] + 1) + math_opts->iopts[MIN_SUBTRAHEND];
+            r1 = rng_below(&mc_rng, math_opts->iopts[MAX_SUBTRAHEND] - math_opts->iopts[MIN_SUBTRAHEND] + 1) + math_opts->iopts[MIN_SUBTRAHEND];
             ret.answer -= r1;
         }
         else if (op == MC_OPER_MULT)
         {
-            r1 = rand() % (math_opts->iopts[MAX_MULTIPLICAND] - math_opts->iopts[MIN_MULTIPLICAND] + 1) + math_opts->iopts[MIN_AUGEND];
+            r1 = rng_below(&mc_rng, math_opts->iopts[MAX_MULTIPLICAND] - math_opts->iopts[MIN_MULTIPLICAND] + 1) + math_opts->iopts[MIN_AUGEND];
             ret.answer *= r1;
         }
         else if (op == MC_OPER_DIV)
@@ -1799,7 +1832,7 @@ MC_FlashCard generate_random_ooo_card_of_length(int length, int reformat)
 
         //next append or prepend the new number (might need optimization)
         if (op == MC_OPER_SUB || op == MC_OPER_DIV || //noncommutative, append only
-                rand() % 2)
+                rng_below(&mc_rng, 2))
         {
             snprintf(tempstr, MC_FORMULA_LEN, "%s %c %d", //append
                     ret.formula_string, operchars[op], r1);
@@ -1821,7 +1854,7 @@ MC_FlashCard generate_random_ooo_card_of_length(int length, int reformat)
     {
         DEBUGMSG(debug_mathcards, "Reformatting...\n");
         do {
-            format = rand() % MC_NUM_FORMATS;
+            format = rng_below(&mc_rng, MC_NUM_FORMATS);
         } while (!MC_GetOpt(FORMAT_ANSWER_LAST + format) && 
                 !MC_GetOpt(FORMAT_ADD_ANSWER_LAST + op * 3 + format) );
 
@@ -1863,8 +1896,8 @@ MC_MathQuestion* generate_list(void)
     //randomize list length by a "bell curve" centered on average
     if (length && MC_GetOpt(VARY_LIST_LENGTH) )
     {
-        r1 = (double)rand() / RAND_MAX / 2 + 0.5; //interval (0, 1)
-        r2 = (double)rand() / RAND_MAX / 2 + 0.5; //interval (0, 1)
+        r1 = rng_double(&mc_rng) / 2 + 0.5; //interval (0, 1)
+        r2 = rng_double(&mc_rng) / 2 + 0.5; //interval (0, 1)
         DEBUGMSG(debug_mathcards, "Randoms chosen: %5f, %5f\n", r1, r2);
         delta = sqrt(-2 * log(r1) ) * cos(2 * PI_VAL * r2); //standard normal dist.
         var = length / 10.0; //variance
@@ -2237,7 +2270,7 @@ int find_divisor(int a)
     do
         for (i = 0; i < NPRIMES; ++i) //test each prime
             if (a % smallprimes[i] == 0)  //if it is a prime factor,
-                if (rand() % (i + 1) == 0) //maybe we'll keep it
+                if (rng_below(&mc_rng, i + 1) == 0) //maybe we'll keep it
                     if (div * smallprimes[i] <= MC_GetOpt(MAX_DIVISOR) ) //if we can,
                         div *= smallprimes[i]; //update our real divisor
     //keep going if the divisor is too small
@@ -28,6 +28,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 #include <wchar.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
+#include <limits.h>
 
 
 #include "transtruct.h"
@@ -108,6 +110,70 @@ const char* const MC_OPTION_TEXT[NOPTS+1] = {
     "END_OF_OPTS"
 };
 
+/* MC_OPTION_TEXT indices in strcasecmp() order, so that MC_MapTextToIndex()
+ * can binary search rather than scan. Keep this sorted when adding options -
+ * MC_VerifyOptionListSane() checks it.
+ */
+static const int MC_OPTION_ORDER[NOPTS] = {
+    ADDITION_ALLOWED,
+    ALLOW_NEGATIVES,
+    ARITHMETIC_ALLOWED,
+    AVG_LIST_LENGTH,
+    COMPARISON_ALLOWED,
+    COMPREHENSIVE,
+    COPIES_REPEATED_WRONGS,
+    DIVISION_ALLOWED,
+    FORMAT_ADD_ANSWER_FIRST,
+    FORMAT_ADD_ANSWER_LAST,
+    FORMAT_ADD_ANSWER_MIDDLE,
+    FORMAT_ANSWER_FIRST,
+    FORMAT_ANSWER_LAST,
+    FORMAT_ANSWER_MIDDLE,
+    FORMAT_DIV_ANSWER_FIRST,
+    FORMAT_DIV_ANSWER_LAST,
+    FORMAT_DIV_ANSWER_MIDDLE,
+    FORMAT_MULT_ANSWER_FIRST,
+    FORMAT_MULT_ANSWER_LAST,
+    FORMAT_MULT_ANSWER_MIDDLE,
+    FORMAT_SUB_ANSWER_FIRST,
+    FORMAT_SUB_ANSWER_LAST,
+    FORMAT_SUB_ANSWER_MIDDLE,
+    MAX_ADDEND,
+    MAX_ANSWER,
+    MAX_AUGEND,
+    MAX_COMPARATOR,
+    MAX_COMPARISAND,
+    MAX_DIVISOR,
+    MAX_FORMULA_NUMS,
+    MAX_MINUEND,
+    MAX_MULTIPLICAND,
+    MAX_MULTIPLIER,
+    MAX_QUESTIONS,
+    MAX_QUOTIENT,
+    MAX_SUBTRAHEND,
+    MAX_TYPING_NUM,
+    MIN_ADDEND,
+    MIN_AUGEND,
+    MIN_COMPARATOR,
+    MIN_COMPARISAND,
+    MIN_DIVISOR,
+    MIN_FORMULA_NUMS,
+    MIN_MINUEND,
+    MIN_MULTIPLICAND,
+    MIN_MULTIPLIER,
+    MIN_QUOTIENT,
+    MIN_SUBTRAHEND,
+    MIN_TYPING_NUM,
+    MULTIPLICATION_ALLOWED,
+    PLAY_THROUGH_LIST,
+    QUESTION_COPIES,
+    RANDOMIZE,
+    REPEAT_WRONGS,
+    SUBTRACTION_ALLOWED,
+    TYPING_PRACTICE_ALLOWED,
+    VARY_LIST_LENGTH,
+};
+
 
 
 const int MC_DEFAULTS[] = {
@@ -189,10 +255,11 @@ const int MC_DEFAULTS[] = {
 const int smallprimes[NPRIMES] = {2, 3, 5 ,7, 11, 13, 17, 19, 23};
 //const char operchars[4] = "+-*/";
 const char operchars[4] = "+-x/";
+const int MC_TIME_PERCENTILES[MC_NUM_TIME_PERCENTILES] = {50, 90, 99};
 
-static int id = 0;
-
-const MC_FlashCard DEFAULT_CARD = {{'\0'}, {'\0'}, 0, 0, 0}; //empty card to signal error
+/* NOTE everything at file scope is read-only, so separate games can */
+/* run concurrently in different threads - per-game state belongs   */
+/* in MC_MathGame.                                                   */
 
 /* "private" function prototypes:                        */
 /*                                                       */
@@ -200,53 +267,176 @@ const MC_FlashCard DEFAULT_CARD = {{'\0'}, {'\0'}, 0, 0, 0}; //empty card to sig
 /* the private functions of a C++ class. Declared static */
 /* to give file scope rather than extern scope.          */
 
-static MC_MathQuestion* generate_list(MC_MathGame* game);
+static int generate_list(MC_MathGame* game, MC_Deck* deck);
 static void clear_negatives(MC_MathGame* game);
 //static int validate_question(int n1, int n2, int n3);
-//static MC_MathQuestion* create_node(int n1, int n2, int op, int ans, int f);
-//static MC_MathQuestion* create_node_from_card(const MC_FlashCard* flashcard);
-static MC_MathQuestion* create_node_copy(MC_MathQuestion* other);
-static MC_MathQuestion* insert_node(MC_MathQuestion* first, MC_MathQuestion* current, MC_MathQuestion* new_node);
-static MC_MathQuestion* append_node(MC_MathQuestion* list, MC_MathQuestion* new_node);
-static MC_MathQuestion* remove_node(MC_MathQuestion* first, MC_MathQuestion* n);
-static MC_MathQuestion* delete_list(MC_MathQuestion* list);
-//static int copy_node(MC_MathQuestion* original, MC_MathQuestion* copy);
-static int list_length(MC_MathQuestion* list);
-static int randomize_list(MC_MathQuestion** list);
-
-int comp_randomizer(const void* a, const void* b);
-static MC_MathQuestion* pick_random(int length, MC_MathQuestion* list);
-static int compare_node(MC_MathQuestion* first, MC_MathQuestion* other);
-static int already_in_list(MC_MathQuestion* list, MC_MathQuestion* ptr);
+static int add_wrong_card(MC_MathGame* game, const MC_PackedCard* card); //unless already there
 //static int int_to_bool(int i);
 //static int sane_value(int i);
 //static int abs_value(int i);
-static int floatCompare(const void* v1,const void* v2);
 
-static void print_list(FILE* fp,MC_MathQuestion* list);
-void print_vect_list(FILE* fp, MC_MathQuestion** vect, int length);
+/* Answer time statistics - see MC_TimeStats in mathcards.h: */
+static void time_stats_reset(MC_TimeStats* stats);
+static void quantile_add(MC_Quantile* q, int count, double x); //count includes x
+static double quantile_value(const MC_Quantile* q, int count);
+
+static void print_list(FILE* fp, MC_MathGame* game, MC_Deck* deck);
 
 static void print_counters(MC_MathGame *game);
-//static MC_FlashCard    create_card_from_node(MC_MathQuestion* node);
 
 
+/* Per-game random number generator - see MC_Random in mathcards.h: */
+static void rng_seed(MC_Random* rng, uint64_t seed, uint64_t stream);
+static unsigned int rng_next(MC_Random* rng);
+static int rng_below(MC_Random* rng, int n); //uniform in [0, n)
+static double rng_double(MC_Random* rng); //uniform in [0, 1)
+
+/* Per-game memory arena - see MC_Arena in mathcards.h: */
+static void* arena_alloc(MC_Arena* arena, size_t size);
+static void arena_free(MC_Arena* arena, void* ptr, size_t size); //recycle block
+static void arena_release(MC_Arena* arena); //give everything back to the system
+
+/* Contiguous question deck - see MC_Deck in mathcards.h: */
+static int deck_reserve(MC_Arena* arena, MC_Deck* deck, int n); //make room for n cards
+static void deck_clear(MC_Arena* arena, MC_Deck* deck); //free storage, deck is then empty
+static MC_PackedCard* deck_at(MC_Deck* deck, int i); //i'th card from top
+static MC_PackedCard* deck_push_back(MC_Arena* arena, MC_Deck* deck); //new card on bottom of deck
+static int deck_pop_front(MC_Deck* deck, MC_PackedCard* pc); //draw top card
+static int deck_insert_random(MC_Arena* arena, MC_Random* rng, MC_Deck* deck, const MC_PackedCard* pc);
+static void deck_shuffle(MC_Random* rng, MC_Deck* deck);
+
+/* Cards "in play" - see MC_ActiveSet in mathcards.h: */
+static int active_add(MC_Arena* arena, MC_ActiveSet* set, const MC_PackedCard* pc);
+static int active_find(MC_ActiveSet* set, int id); //slot of card with id, or -1
+static void active_remove(MC_ActiveSet* set, int slot);
+static void active_clear(MC_Arena* arena, MC_ActiveSet* set);
+
+/* Repeats of wrong answers - see MC_RepeatQueue in mathcards.h: */
+static int repeat_schedule(MC_MathGame* game, const MC_PackedCard* pc, int copies);
+static int repeat_pop_due(MC_MathGame* game, MC_PackedCard* pc); //0 if nothing due
+static int repeat_due(MC_MathGame* game); //draw at which a new copy should come up
+static void repeat_sift_up(MC_RepeatQueue* queue, int i);
+static void repeat_sift_down(MC_RepeatQueue* queue, int i);
+static int cards_in_list(MC_MathGame* game); //deck plus repeats still to come
+
+/* Content index - see MC_CardIndex in mathcards.h: */
+static unsigned int card_hash(MC_MathGame* game, const MC_PackedCard* pc);
+static int index_find(MC_MathGame* game, MC_CardIndex* index, MC_Deck* deck, const MC_PackedCard* pc);
+static int index_add(MC_Arena* arena, MC_MathGame* game, MC_CardIndex* index, MC_Deck* deck, int pos);
+static void index_clear(MC_Arena* arena, MC_CardIndex* index);
+
+/* Packed cards - see MC_PackedCard in mathcards.h: */
+static void card_render(MC_MathGame* game, const MC_PackedCard* pc, MC_FlashCard* fc);
+static int card_pack_text(MC_MathGame* game, const MC_FlashCard* fc, MC_PackedCard* pc);
+static int card_result(MC_Operation op, int n1, int n2); //the "c" in "a op b = c"
+static void card_format(char* buf, int len, const char* fmt, int n1, int n2, char c);
+static void clear_card_text(MC_MathGame* game);
+static void clear_lists(MC_MathGame* game); //forget all cards, release the arena
+
+/* Saved games - see MC_SaveState(). Everything is little-endian, and */
+/* the body is built up (or read) in memory to keep the stdio calls   */
+/* down to a handful per file:                                        */
+typedef struct _state_buf {
+    unsigned char* data;
+    size_t length;
+    size_t capacity;
+    size_t pos;              /* read position                           */
+    int ok;                  /* cleared by any overrun or failed alloc  */
+} state_buf;
+
+static void state_put(state_buf* buf, const void* data, size_t n);
+static void state_put_u32(state_buf* buf, uint32_t v);
+static void state_put_u64(state_buf* buf, uint64_t v);
+static void state_put_double(state_buf* buf, double v);
+static void state_put_card(state_buf* buf, const MC_PackedCard* pc);
+static void state_put_text(state_buf* buf, const char* text, int size);
+static void state_get(state_buf* buf, void* data, size_t n);
+static uint32_t state_get_u32(state_buf* buf);
+static uint64_t state_get_u64(state_buf* buf);
+static double state_get_double(state_buf* buf);
+static int state_get_count(state_buf* buf, size_t record_size); //-1 if implausible
+static int state_get_card(MC_MathGame* game, state_buf* buf, MC_PackedCard* pc);
+static void state_get_text(state_buf* buf, char* text, int size);
+static int state_get_deck(MC_MathGame* game, state_buf* buf, MC_Deck* deck);
+static int state_load_body(MC_MathGame* game, state_buf* buf);
+static uint32_t state_checksum(const unsigned char* data, size_t n);
+
 /* Functions for new mathcards architecture */
-static void free_node(MC_MathQuestion* mq); //wrapper for free() that also frees card
-static MC_FlashCard generate_random_flashcard(MC_MathGame* game);
-static MC_FlashCard generate_random_ooo_card_of_length(MC_MathGame* game, int length, int reformat);
-static MC_MathQuestion* allocate_node(void); //allocate space for a node
-static int compare_card(const MC_FlashCard* a, const MC_FlashCard* b); //test for identical cards
+/* moving cards in and out of play, shared by the one-card and batch APIs: */
+static int draw_question(MC_MathGame* game, MC_FlashCard* fc);
+static int retire_correct(MC_MathGame* game, int slot, float t); //returns points
+static void retire_wrong(MC_MathGame* game, int slot);
+
+static int generate_random_flashcards(MC_MathGame* game, MC_Deck* deck, int n);
+static void bulk_random(uint64_t key, uint64_t counter, uint32_t* out, int n);
+static unsigned int scale_below(uint32_t r, int n); //r as a number in [0, n)
+static int random_operands(MC_MathGame* game, MC_Operation* op, int* r1, int* r2, int* ans);
+static MC_Format random_format(MC_MathGame* game, MC_Operation op);
+static int build_samplers(MC_MathGame* game);
+static int build_operand_table(MC_MathGame* game, MC_Operation op, MC_OperandTable* table);
+static int second_operand_range(MC_MathGame* game, MC_Operation op, int x, int* lo, int* hi);
+static int build_divisor_table(MC_MathGame* game);
+static void sample_operands(MC_Random* rng, const MC_OperandTable* table, int* x, int* y);
+static int compare_card(MC_MathGame* game, const MC_PackedCard* a, const MC_PackedCard* b); //test for identical cards
+static int compare_node(MC_MathGame* game, const MC_PackedCard* first, const MC_PackedCard* other); //1 if identical
 static int find_divisor(MC_MathGame* game, int a); //return a random positive divisor of a
 static int calc_num_valid_questions(MC_MathGame* game);
-static MC_MathQuestion* add_all_valid(MC_MathGame* game, MC_ProblemType pt, MC_MathQuestion* list, MC_MathQuestion** end_of_list);
-static MC_MathQuestion* find_node(MC_MathQuestion* list, int num);
+static int comprehensive_formats(MC_MathGame* game, MC_Operation k, MC_Format* formats);
+static int comprehensive_card(MC_MathGame* game, int index, MC_PackedCard* pc);
+static int make_arithmetic_card(MC_MathGame* game, MC_Operation k, int i, int j, MC_Format f, MC_PackedCard* pc);
+
+/* Lazily evaluated pseudo-random permutation of [0, n), used to draw   */
+/* COMPREHENSIVE questions without generating the whole question space: */
+typedef struct _index_perm {
+    unsigned int n;
+    unsigned int half_bits;
+    unsigned int keys[4];
+} index_perm;
+
+static void perm_init(MC_Random* rng, index_perm* perm, unsigned int n);
+static unsigned int perm_index(const index_perm* perm, unsigned int i);
+
+/* Order of operations questions ("3 + 4 x 5 = ?") as expression trees.  */
+/* Since they are written without parentheses, the trees always have    */
+/* the shape of a sum of terms, each term a chain of x and ÷, and are   */
+/* kept as their operands and operators in writing order. The value is */
+/* kept up to date as operands are added, so the bounds on it (and on  */
+/* the operands) are enforced as the tree is built rather than checked */
+/* afterwards:                                                           */
+#define MC_MAX_EXPR_NUMS 5       /* longest that always fits in MC_FORMULA_LEN */
+#define MC_MAX_ENUM_TREES (1 << 24) /* largest COMPREHENSIVE set listed in full */
+
+typedef struct _expr_tree {
+    int nums[MC_MAX_EXPR_NUMS];
+    MC_Operation ops[MC_MAX_EXPR_NUMS - 1];  /* ops[i] is between nums[i] and nums[i+1] */
+    int length;              /* number of operands                       */
+    int sum;                 /* value of the terms before the last one   */
+    int term;                /* value of the last term                   */
+    int sign;                /* 1 or -1, whether the last term is added  */
+    int difficulty;
+} expr_tree;
+
+static void expr_start(expr_tree* e, MC_Operation op, int n1, int n2);
+static int expr_value(const expr_tree* e);
+static int expr_operand_range(MC_MathGame* game, MC_Operation op, int* lo, int* hi); //allowed next operands
+static int expr_next_range(MC_MathGame* game, const expr_tree* e, MC_Operation op, int* lo, int* hi); //those in bounds
+static int expr_append(MC_MathGame* game, expr_tree* e, MC_Operation op, int n);
+static int expr_determinate(const expr_tree* e, int k); //can nums[k] be worked out from the rest?
+static int expr_pack(MC_MathGame* game, const expr_tree* e, MC_Format f, int id, MC_PackedCard* pc);
+static int floor_div(int a, int b);
+static int ceil_div(int a, int b);
+static void formula_lengths(MC_MathGame* game, int* shortest, int* longest);
+static int random_expr_card(MC_MathGame* game, int length, int id, MC_PackedCard* pc);
+static int expr_tree_count(MC_MathGame* game, int length, int* pairs, int* steps);
+static int expr_tree_card(MC_MathGame* game, int length, int index, MC_PackedCard* pc);
 //Determine how many points to give player based on question
 //difficulty and how fast it was answered.
 //TODO we may want to play with this a bit
 static int calc_score(int difficulty, float t);
 
 //Create formula_string in i18n-friendly fashion:
-static int create_formula_str(char* form_str, int n1, int n2, int op, int format);
+static int create_formula_str(MC_MathGame* game, char* form_str, int n1, int n2, int op, int format);
+static void translate_formulas(MC_MathGame* game);
 
 
 
@@ -274,9 +464,26 @@ int MC_Initialize(MC_MathGame* game)
     game->math_opts = malloc(sizeof(MC_Options));
 
     /* Zero out lists. Only YOU can prevent undefined behaviour!*/
-    game->question_list = NULL;
-    game->active_quests = NULL;
-    game->wrong_quests = NULL;
+    /* A seed from MC_SetRandomSeed() is kept, even one set before we */
+    /* got here. Otherwise seed from the clock, using the game's      */
+    /* address to pick the stream so that games set up in the same    */
+    /* second still differ:                                            */
+    if (game->fixed_seed)
+        rng_seed(&game->rng, game->seed, 0);
+    else
+        rng_seed(&game->rng, (uint64_t)time(NULL), (uint64_t)(uintptr_t)game);
+    game->next_card_id = 0;
+
+    memset(&game->arena, 0, sizeof(MC_Arena));
+    memset(&game->samplers, 0, sizeof(MC_Samplers));
+    memset(&game->question_list, 0, sizeof(MC_Deck));
+    memset(&game->wrong_quests, 0, sizeof(MC_Deck));
+    memset(&game->wrong_index, 0, sizeof(MC_CardIndex));
+    memset(&game->active_quests, 0, sizeof(MC_ActiveSet));
+    memset(&game->repeats, 0, sizeof(MC_RepeatQueue));
+    clear_card_text(game);
+    translate_formulas(game);
+    time_stats_reset(&game->answer_times);
 
     /* bail out if no struct */
     if (!game->math_opts)
@@ -338,29 +545,32 @@ int MC_StartGame(MC_MathGame* game)
     }
 
     /* we know math_opts exists if we make it to here */
-    srand(time(NULL));
+    /* If a seed was given, every game starts the sequence over so it */
+    /* can be reproduced exactly; otherwise we just carry on with the */
+    /* game's own sequence, which was seeded by MC_Initialize().      */
+    if (game->fixed_seed)
+        rng_seed(&game->rng, game->seed, 0);
 
     /* clear out old lists if starting another game: (if not done already) */
-    delete_list(game->question_list);
-    game->question_list = NULL;
-    delete_list(game->wrong_quests);
-    game->wrong_quests = NULL;
-    delete_list(game->active_quests);
-    game->active_quests = NULL;
+    clear_lists(game);
+    translate_formulas(game);
 
-    /* clear the time list */
-    if (game->time_per_question_list != NULL)
+    /* work out once which questions the options allow, so that each */
+    /* random card can be drawn straight from the tables:             */
+    if (!build_samplers(game))
     {
-        free(game->time_per_question_list);
-        game->time_per_question_list = NULL;
-        game->length_time_per_question_list = 0;
-        game->length_alloc_time_per_question_list = 0;
+        fprintf(stderr, "\nError building question tables - MC_StartGame() failed\n");
+        return 0;
     }
 
-    game->question_list = generate_list(game);
-    game->next_wrong_quest = NULL;
+    /* clear the time statistics */
+    time_stats_reset(&game->answer_times);
+
+    /* a list cut short by an error is no list at all: */
+    if (!generate_list(game, &game->question_list))
+        deck_clear(&game->arena, &game->question_list);
     /* initialize counters for new game: */
-    game->quest_list_length = list_length(game->question_list);
+    game->quest_list_length = game->question_list.length;
 
 
     /* Note: the distinction between quest_list_length and  */
@@ -378,7 +588,7 @@ int MC_StartGame(MC_MathGame* game)
     }
 
     /* make sure list now exists and has non-zero length: */
-    if (game->question_list && game->quest_list_length)
+    if (game->quest_list_length)
     {
         DEBUGMSG(debug_mathcards, "\nGame set up successfully");
         DEBUGMSG(debug_mathcards, "\nLeaving MC_StartGame()\n");
@@ -409,27 +619,23 @@ int MC_StartGameUsingWrongs(MC_MathGame* game)
     /* Note: if not initialized, control will pass to       */
     /* MC_StartGame() via else clause so don't need to test */
     /* for initialization here                              */
-    if (game->wrong_quests &&
-            list_length(game->wrong_quests))
+    if (game->wrong_quests.length)
     {
         DEBUGMSG(debug_mathcards, "\nNon-zero length wrong_quests list found, will");
         DEBUGMSG(debug_mathcards, "\nuse for new game list:");
 
-        /* initialize lists for new game: */
-        delete_list(game->question_list);
-        if(!randomize_list(&(game->wrong_quests)))
-        {
-            fprintf(stderr, "Error during randomization of wrong_quests!\n");
-            /* Punt on trying wrong question list, just run normal game */
-            return MC_StartGame(game);
-        }
+        /* initialize lists for new game - the wrong_quests deck */
+        /* simply becomes the new question deck:                */
+        deck_clear(&game->arena, &game->question_list);
+        deck_shuffle(&game->rng, &game->wrong_quests);
         game->question_list = game->wrong_quests;
-        game->wrong_quests = 0;
-        game->next_wrong_quest = 0;
-        delete_list(game->active_quests);
-        game->active_quests = 0;
+        memset(&game->wrong_quests, 0, sizeof(MC_Deck));
+        index_clear(&game->arena, &game->wrong_index);
+        active_clear(&game->arena, &game->active_quests);
+        arena_free(&game->arena, game->repeats.heap, game->repeats.capacity * sizeof(MC_Repeat));
+        memset(&game->repeats, 0, sizeof(MC_RepeatQueue));
         /* initialize counters for new game: */
-        game->quest_list_length = list_length(game->question_list);
+        game->quest_list_length = game->question_list.length;
         game->unanswered = game->starting_length = game->quest_list_length;
         game->answered_correctly = 0;
         game->answered_wrong = 0;
@@ -437,7 +643,7 @@ int MC_StartGameUsingWrongs(MC_MathGame* game)
 
         if (debug_status & debug_mathcards) {
             print_counters(game);
-            print_list(stdout, game->question_list);
+            print_list(stdout, game, &game->question_list);
             printf("\nLeaving MC_StartGameUsingWrongs()\n");
         }
 
@@ -465,9 +671,6 @@ int MC_NextQuestion(MC_MathGame* game, MC_FlashCard* fc)
 {
     DEBUGMSG(debug_mathcards, "\nEntering MC_NextQuestion()\n");
 
-    /* (so we can move the node into active_quests:) */
-    MC_MathQuestion* ptr;
-
     if (!fc )
     {
         fprintf(stderr, "\nNull MC_FlashCard* argument!\n");
@@ -475,9 +678,7 @@ int MC_NextQuestion(MC_MathGame* game, MC_FlashCard* fc)
         return 0;
     }
 
-    if (!game->question_list ||
-            /*      !game->next_question || */
-            !list_length(game->question_list) )
+    if (!cards_in_list(game))
     {
         DEBUGMSG(debug_mathcards, "\nquestion_list invalid or empty");
         DEBUGMSG(debug_mathcards, "\nLeaving MC_NextQuestion()\n");
@@ -485,16 +686,13 @@ int MC_NextQuestion(MC_MathGame* game, MC_FlashCard* fc)
         return 0;
     }
 
-    /* 'draw' - copy over the first question */
-    MC_CopyCard(&(game->question_list->card), fc);
-
-    /* take first question node out of list and move it into active_quests list: */
-    ptr = game->question_list;
-    game->question_list = remove_node(game->question_list, ptr);
-    //  free_node(ptr);
+    if (!draw_question(game, fc))
+    {
+        fprintf(stderr, "\nMC_NextQuestion() - could not add card to active_quests\n");
+        return 0;
+    }
     game->quest_list_length--;
     game->questions_pending++;
-    game->active_quests = append_node(game->active_quests, ptr);
 
     if (debug_status & debug_mathcards) {
         printf("\nnext question is:");
@@ -515,10 +713,11 @@ int MC_AnsweredCorrectly(MC_MathGame* game, int id, float t)
 {
     DEBUGMSG(debug_mathcards, "\nEntering MC_AnsweredCorrectly()");
 
-    MC_MathQuestion* quest = NULL;
+    MC_FlashCard shown;
+    int slot;
     int points = 0;
 
-    if(!game->active_quests) // No questions currently "in play" - something is wrong:
+    if(!game->active_quests.length) // No questions currently "in play" - something is wrong:
     {
         fprintf(stderr, "MC_AnsweredCorrectly() - active_quests empty\n");
         return 0;
@@ -526,66 +725,32 @@ int MC_AnsweredCorrectly(MC_MathGame* game, int id, float t)
 
     DEBUGMSG(debug_mathcards, "\nQuestion id was: %d\n", id);
 
-    //First take the question out of the active_quests list
-    quest = game->active_quests;  
-    // Loop until quest is NULL or we find card with same id:
-    while(quest && (id != quest->card.question_id))
-        quest = quest->next;
-    if(!quest) // Means we didn't find matching card - something is wrong:
+    //First find the question in the active_quests set:
+    slot = active_find(&game->active_quests, id);
+    if(slot < 0) // Means we didn't find matching card - something is wrong:
     {
         fprintf(stderr, "MC_AnsweredCorrectly() - matching question not found!\n");
         return 0;
     }
 
-    /* Calculate how many points the player should receive, based on */
-    /* difficulty and time required to answer it:                    */
-    points = calc_score(quest->card.difficulty, t);
-
     DEBUGCODE(debug_mathcards)
     {
         printf("\nQuestion was:");
-        print_card(quest->card);
-        printf("Player recieves %d points\n", points);
+        card_render(game, &game->active_quests.cards[slot], &shown);
+        print_card(shown);
     }
 
-
-    //We found a matching question, now we take it out of the 
-    //"active_quests" list and either put it back into the 
-    //main question list in a random location, or delete it:
-    game->active_quests = remove_node(game->active_quests, quest);
+    points = retire_correct(game, slot, t);
     game->questions_pending--;  //the length of the 'active_quests' list
     game->answered_correctly++;
 
-    if (!game->math_opts->iopts[PLAY_THROUGH_LIST])
-        /* reinsert question into question list at random location */
-    {
-        DEBUGMSG(debug_mathcards, "\nReinserting question into list");
-
-        MC_MathQuestion* rand_spot;
-        /* put it into list */
-        rand_spot = pick_random(game->quest_list_length, game->question_list);
-        game->question_list = insert_node(game->question_list, rand_spot, quest);
-        game->quest_list_length++;
-        /* unanswered does not change - was not decremented when */
-        /* question allocated!                                   */
-    }
-    else
-    {
-        DEBUGMSG(debug_mathcards, "\nNot reinserting question into list");
-        free_node(quest);
-        /* not recycling questions so fewer questions remain:      */
-        game->unanswered--;
-    }
-
     DEBUGCODE(debug_mathcards)
     {
+        printf("Player recieves %d points\n", points);
         print_counters(game);
         printf("\nLeaving MC_AnsweredCorrectly()\n");
     }
 
-    /* Record the time it took to answer: */ 
-    MC_AddTimeToList(game, t);
-
     return points;
 }
 
@@ -602,9 +767,10 @@ int MC_NotAnsweredCorrectly(MC_MathGame* game, int id)
 {
     DEBUGMSG(debug_mathcards, "\nEntering MC_NotAnsweredCorrectly()");
 
-    MC_MathQuestion* quest = NULL;
+    MC_FlashCard shown;
+    int slot;
 
-    if(!game->active_quests) // No questions currently "in play" - something is wrong:
+    if(!game->active_quests.length) // No questions currently "in play" - something is wrong:
     {
         fprintf(stderr, "MC_NotAnsweredCorrectly() - active_quests empty\n");
         return 0;
@@ -612,80 +778,124 @@ int MC_NotAnsweredCorrectly(MC_MathGame* game, int id)
 
     DEBUGMSG(debug_mathcards, "\nQuestion id was: %d\n", id);
 
-    //First take the question out of the active_quests list
-    quest = game->active_quests;  
-    // Loop until quest is NULL or we find card with same id:
-    while(quest && (id != quest->card.question_id))
-        quest = quest->next;
-    if(!quest) // Means we didn't find matching card - something is wrong:
+    //First find the question in the active_quests set:
+    slot = active_find(&game->active_quests, id);
+    if(slot < 0) // Means we didn't find matching card - something is wrong:
     {
         fprintf(stderr, "MC_NotAnsweredCorrectly() - matching question not found!\n");
         return 0;
     }
 
-    DEBUGMSG(debug_mathcards, "\nMatching question is:");
-    print_card(quest->card);
+    DEBUGCODE(debug_mathcards)
+    {
+        printf("\nMatching question is:");
+        card_render(game, &game->active_quests.cards[slot], &shown);
+        print_card(shown);
+    }
 
+    retire_wrong(game, slot);
+    game->questions_pending--;  //the length of the 'active_quests' list
+    game->answered_wrong++;
 
-    /* if desired, put question back in list so student sees it again */
-    if (game->math_opts->iopts[REPEAT_WRONGS])
+    DEBUGCODE(debug_mathcards)
     {
-        int i;
-        MC_MathQuestion* quest_copy;
-        MC_MathQuestion* rand_loc;
+        print_counters(game);
+        printf("\nLeaving MC_NotAnswered_Correctly()\n");
+    }
 
-        DEBUGMSG(debug_mathcards, "\nAdding %d copies to question_list:", game->math_opts->iopts[COPIES_REPEATED_WRONGS]);
+    return 1;
+}
 
-        DEBUGCODE(debug_mathcards)
-        {
-            print_counters(game);
-            printf("\nLeaving MC_AnsweredCorrectly()\n");
-        }
 
-        /* can put in more than one copy (to drive the point home!) */
-        for (i = 0; i < game->math_opts->iopts[COPIES_REPEATED_WRONGS]; i++)
+/*  MC_NextQuestions() draws up to n questions at once into */
+/*  cards[], e.g. a whole wave's worth. Returns the number  */
+/*  drawn, which is less than n if the list runs out.       */
+int MC_NextQuestions(MC_MathGame* game, MC_FlashCard* cards, int n)
+{
+    int i;
+
+    DEBUGMSG(debug_mathcards, "\nEntering MC_NextQuestions(), n = %d\n", n);
+
+    if (!cards || n <= 0)
+        return 0;
+    if (n > cards_in_list(game))
+        n = cards_in_list(game);
+
+    for (i = 0; i < n; i++)
+    {
+        if (!draw_question(game, &cards[i]))
         {
-            quest_copy = create_node_copy(quest);
-            rand_loc = pick_random(game->quest_list_length, game->question_list);
-            game->question_list = insert_node(game->question_list, rand_loc, quest_copy);
-            game->quest_list_length++;
+            fprintf(stderr, "\nMC_NextQuestions() - could not add card to active_quests\n");
+            break;
         }
-        /* unanswered stays the same if a single copy recycled or */
-        /* increases by 1 for each "extra" copy reinserted:       */
-        game->unanswered += (game->math_opts->iopts[COPIES_REPEATED_WRONGS] - 1);
     }
-    else
+    game->quest_list_length -= i;
+    game->questions_pending += i;
+
+    DEBUGCODE(debug_mathcards)
     {
-        DEBUGMSG(debug_mathcards, "\nNot repeating wrong answers\n");
-        /* not repeating questions so list gets shorter:      */
-        game->unanswered--;
+        printf("\n%d questions drawn", i);
+        print_counters(game);
+        printf("\n\nLeaving MC_NextQuestions()\n");
     }
 
-    //Take the question out of the active_quests list and add it to
-    //the wrong_quests list, unless an identical question is already
-    //in the wrong_quests list:
-    game->active_quests = remove_node(game->active_quests, quest);
-    game->questions_pending--;  //the length of the 'active_quests' list
-    game->answered_wrong++;
+    return i;
+}
 
-    /* add question to wrong_quests list: */
-    if (!already_in_list(game->wrong_quests, quest)) /* avoid duplicates */
-    {
-        DEBUGMSG(debug_mathcards, "\nAdding to wrong_quests list");
-        game->wrong_quests = append_node(game->wrong_quests, quest);
-    }
-    else /* avoid memory leak */
+
+/*  MC_RecordAnswers() applies a batch of answers, e.g. all */
+/*  those that came in during one server tick, exactly as  */
+/*  the same calls to MC_AnsweredCorrectly() and           */
+/*  MC_NotAnsweredCorrectly() in order would. Each record's */
+/*  "points" and "recorded" fields are filled in. Returns  */
+/*  the number of answers recorded.                         */
+int MC_RecordAnswers(MC_MathGame* game, MC_AnswerRecord* answers, int n)
+{
+    int i, slot;
+    int correct = 0, wrong = 0;
+
+    DEBUGMSG(debug_mathcards, "\nEntering MC_RecordAnswers(), n = %d\n", n);
+
+    if (!answers)
+        return 0;
+
+    for (i = 0; i < n; i++)
     {
-        free_node(quest);
+        answers[i].points = 0;
+        answers[i].recorded = 0;
+
+        slot = active_find(&game->active_quests, answers[i].question_id);
+        if (slot < 0)
+        {
+            fprintf(stderr, "MC_RecordAnswers() - question id = %d not found!\n",
+                    answers[i].question_id);
+            continue;
+        }
+
+        if (answers[i].correct)
+        {
+            answers[i].points = retire_correct(game, slot, answers[i].time);
+            correct++;
+        }
+        else
+        {
+            retire_wrong(game, slot);
+            wrong++;
+        }
+        answers[i].recorded = 1;
     }
+    game->questions_pending -= correct + wrong;
+    game->answered_correctly += correct;
+    game->answered_wrong += wrong;
 
     DEBUGCODE(debug_mathcards)
     {
+        printf("\n%d correct and %d wrong answers recorded", correct, wrong);
         print_counters(game);
-        printf("\nLeaving MC_NotAnswered_Correctly()\n");
+        printf("\nLeaving MC_RecordAnswers()\n");
     }
 
-    return 1;
+    return correct + wrong;
 }
 
 
@@ -731,46 +941,27 @@ int MC_ListQuestionsLeft(MC_MathGame* game)
 /*  succeeds, 0 otherwise.                              */
 int MC_AddTimeToList(MC_MathGame* game, float t)
 {
-    int newsize = 0;
-    float *newlist;
+    int i;
+    MC_TimeStats* stats = &game->answer_times;
 
     //Bail if time invalid:
     if(t < 0)
         return 0;
 
-    /* This list will be allocated in an STL-like manner: when the       */
-    /* list gets full, allocate an additional amount of storage equal    */
-    /* to the current size of the list, so that only O(logN) allocations */
-    /* will ever be needed. We therefore have to keep track of 2 sizes:  */
-    /* the allocated size, and the actual number of items currently on   */
-    /* the list.                                                         */
-    if (game->length_time_per_question_list >= game->length_alloc_time_per_question_list) {
-        /* The list is full, allocate more space */
-        newsize = 2*game->length_time_per_question_list;
-        if (newsize == 0)
-            newsize = 100;
-        newlist = realloc(game->time_per_question_list, newsize*sizeof(float));
-        if (newlist == NULL)
-        {
-            DEBUGMSG(debug_mathcards,"\nError: allocation for time_per_question_list failed\n");
-            return 0;
-        }
-        game->time_per_question_list = newlist;
-        game->length_alloc_time_per_question_list = newsize;
-    }
-
-    /* Append the time to the list */
-    game->time_per_question_list[game->length_time_per_question_list++] = t;
+    /* Nothing is stored - the time just updates the running totals */
+    /* and the quantile estimates:                                  */
+    stats->count++;
+    stats->total += t;
+    for (i = 0; i < MC_NUM_TIME_PERCENTILES; i++)
+        quantile_add(&stats->quantiles[i], stats->count, t);
     return 1;
 }
 
 /* Frees heap memory used in program:                   */
 void MC_EndGame(MC_MathGame* game)
 {
-    delete_list(game->question_list);
-    game->question_list = 0;
-    delete_list(game->wrong_quests);
-    game->wrong_quests = 0;
+    memset(&game->samplers, 0, sizeof(MC_Samplers));
+    clear_lists(game);
 
     if (game->math_opts)
     {
@@ -778,131 +969,345 @@ void MC_EndGame(MC_MathGame* game)
         game->math_opts = 0;
     }
 
-    free(game->time_per_question_list);
-    game->time_per_question_list = NULL;
-    game->length_alloc_time_per_question_list = 0;
-    game->length_time_per_question_list = 0;
+    time_stats_reset(&game->answer_times);
 }
 
 
 
-/* prints struct to file */
-void MC_PrintMathOptions(MC_MathGame* game, FILE* fp, int verbose)
+/* Layout of a saved game (see MC_SaveState() in mathcards.h):    */
+/*   header: magic, version, body length - three 32-bit words     */
+/*   body:   the sizes the rest depends on, then the options, the */
+/*           random number generator, counters, timing data, the */
+/*           card_text table, the question, wrong and active      */
+/*           lists, and the repeat heap in heap order             */
+/*   a 32-bit FNV-1a checksum of the body                         */
+/* The version must be bumped whenever the body changes.          */
+#define MC_STATE_MAGIC 0x5453434du      /* "MCST" */
+#define MC_STATE_VERSION 1
+#define MC_STATE_MAX_BYTES (1u << 30)
+#define MC_STATE_CARD_BYTES 20
+
+int MC_SaveState(MC_MathGame* game, FILE* fp)
 {
-    int i, vcommentsprimed = 0;
-    //comments when writing out verbose...perhaps they can go somewhere less conspicuous
-    static char* vcomments[NOPTS];
-    if (!vcommentsprimed) //we only want to initialize these once
-    {
-        vcommentsprimed = 1;
-        for (i = 0; i < NOPTS; ++i)
-            vcomments[i] = NULL;
-        vcomments[PLAY_THROUGH_LIST] =
-            "\n############################################################\n"
-            "#                                                          #\n"
-            "#                  General Math Options                    #\n"
-            "#                                                          #\n"
-            "# If 'play_through_list' is true, Tuxmath will ask each    #\n"
-            "# question in an internally-generated list. The list is    #\n"
-            "# generated based on the question ranges selected below.   #\n"
-            "# The game ends when no questions remain.                  #\n"
-            "# If 'play_through_list' is false, the game continues      #\n"
-            "# until all cities are destroyed.                          #\n"
-            "# Default is 1 (i.e. 'true' or 'yes').                     #\n"
-            "#                                                          #\n"
-            "# 'question_copies' is the number of times each question   #\n"
-            "# will be asked. It can be 1 to 10 - Default is 1.         #\n"
-            "#                                                          #\n"
-            "# 'repeat_wrongs' tells Tuxmath whether to reinsert        #\n"
-            "# incorrectly answered questions into the list to be       #\n"
-            "# asked again. Default is 1 (yes).                         #\n"
-            "#                                                          #\n"
-            "# 'copies_repeated_wrongs' gives the number of times an    #\n"
-            "# incorrectly answered question will reappear. Default     #\n"
-            "# is 1.                                                    #\n"
-            "#                                                          #\n"
-            "# The defaults for these values result in a 'mission'      #\n"
-            "# for Tux that is accomplished by answering all            #\n"
-            "# questions correctly with at least one surviving city.    #\n"
-            "############################################################\n\n";
-
-        vcomments[FORMAT_ADD_ANSWER_LAST] =
-            "\n############################################################\n"
-            "# The 'format_<op>_answer_<place>  options control         #\n"
-            "# generation of questions with the answer in different     #\n"
-            "# places in the equation.  i.e.:                           #\n"
-            "#                                                          #\n"
-            "#    format_add_answer_last:    2 + 2 = ?                  #\n"
-            "#    format_add_answer_first:   ? + 2 = 4                  #\n"
-            "#    format_add_answer_middle:  2 + ? = 4                  #\n"
-            "#                                                          #\n"
-            "# By default, 'format_answer_first' is enabled and the     #\n"
-            "# other two formats are disabled.  Note that the options   #\n"
-            "# are not mutually exclusive - the question list may       #\n"
-            "# contain questions with different formats.                #\n"
-            "#                                                          #\n"
-            "# The formats are set independently for each of the four   #\n"
-            "# math operations.                                         #\n"
-            "############################################################\n\n";
-
-        vcomments[ALLOW_NEGATIVES] =
-            "\n############################################################\n"
-            "# 'allow_negatives' allows or disallows use of negative    #\n"
-            "# numbers as both operands and answers.  Default is 0      #\n"
-            "# (no), which disallows questions like:                    #\n"
-            "#          2 - 4 = ?                                       #\n"
-            "# Note: this option must be enabled in order to set the    #\n"
-            "# operand ranges to include negatives (see below). If it   #\n"
-            "# is changed from 1 (yes) to 0 (no), any negative          #\n"
-            "# operand limits will be reset to 0.                       #\n"
-            "############################################################\n\n";
-
-        vcomments[MAX_ANSWER] =
-            "\n############################################################\n"
-            "# 'max_answer' is the largest absolute value allowed in    #\n"
-            "# any value in a question (not only the answer). Default   #\n"
-            "# is 144. It can be set as high as 999.                    #\n"
-            "############################################################\n\n";
-
-        vcomments[MAX_QUESTIONS] =
-            "\n############################################################\n"
-            "# 'max_questions' is limit of the length of the question   #\n"
-            "# list. Default is 5000 - only severe taskmasters will     #\n"
-            "# need to raise it.                                        #\n"
-            "############################################################\n\n";
-
-        vcomments[RANDOMIZE] =
-            "\n############################################################\n"
-            "# If 'randomize' selected, the list will be shuffled       #\n"
-            "# at the start of the game.  Default is 1 (yes).           #\n"
-            "############################################################\n\n";
-
-        vcomments[ADDITION_ALLOWED] =
-            "\n############################################################\n"
-            "#                                                          #\n"
-            "#                 Math Operations Allowed                  #\n"
-            "#                                                          #\n"
-            "# These options enable questions for each of the four math #\n"
-            "# operations.  All are 1 (yes) by default.                 #\n"
-            "############################################################\n\n";
-
-        vcomments[MIN_AUGEND] =
-            "\n############################################################\n"
-            "#                                                          #\n"
-            "#      Minimum and Maximum Values for Operand Ranges       #\n"
-            "#                                                          #\n"
-            "# Operand limits can be set to any integer up to the       #\n"
-            "# value of 'max_answer'.  If 'allow_negatives' is set to 1 #\n"
-            "# (yes), either negative or positive values can be used.   #\n"
-            "# Tuxmath will generate questions for every value in the   #\n"
-            "# specified range. The maximum must be greater than or     #\n"
-            "# equal to the corresponding minimum for any questions to  #\n"
-            "# be generated for that operation.                         #\n"
-            "############################################################\n\n";
+    state_buf buf;
+    state_buf head;
+    unsigned char head_data[12];
+    unsigned char sum_data[4];
+    int i, j;
+
+    DEBUGMSG(debug_mathcards, "\nEntering MC_SaveState()\n");
+
+    if (!game || !game->math_opts || !fp)
+    {
+        fprintf(stderr, "\nMC_SaveState() - game not initialized or no file\n");
+        return 0;
+    }
+
+    memset(&buf, 0, sizeof(state_buf));
+    buf.ok = 1;
+
+    state_put_u32(&buf, NOPTS);
+    state_put_u32(&buf, MC_NUM_TIME_PERCENTILES);
+    state_put_u32(&buf, MC_FORMULA_LEN);
+    state_put_u32(&buf, MC_ANSWER_LEN);
+    for (i = 0; i < NOPTS; i++)
+        state_put_u32(&buf, game->math_opts->iopts[i]);
+
+    state_put_u64(&buf, game->rng.state);
+    state_put_u64(&buf, game->rng.inc);
+    state_put_u32(&buf, game->seed);
+    state_put_u32(&buf, game->fixed_seed);
+    state_put_u32(&buf, game->next_card_id);
+
+    state_put_u32(&buf, game->quest_list_length);
+    state_put_u32(&buf, game->answered_correctly);
+    state_put_u32(&buf, game->answered_wrong);
+    state_put_u32(&buf, game->questions_pending);
+    state_put_u32(&buf, game->unanswered);
+    state_put_u32(&buf, game->starting_length);
+
+    state_put_u32(&buf, game->answer_times.count);
+    state_put_double(&buf, game->answer_times.total);
+    for (i = 0; i < MC_NUM_TIME_PERCENTILES; i++)
+    {
+        MC_Quantile* q = &game->answer_times.quantiles[i];
+        state_put_double(&buf, q->p);
+        for (j = 0; j < 5; j++)
+        {
+            state_put_double(&buf, q->heights[j]);
+            state_put_u32(&buf, q->positions[j]);
+            state_put_double(&buf, q->desired[j]);
+        }
+    }
+
+    state_put_u32(&buf, game->card_text_length);
+    for (i = 0; i < game->card_text_length; i++)
+    {
+        state_put_text(&buf, game->card_text[i].formula_string, MC_FORMULA_LEN);
+        state_put_text(&buf, game->card_text[i].answer_string, MC_ANSWER_LEN);
+    }
+
+    state_put_u32(&buf, game->question_list.length);
+    for (i = 0; i < game->question_list.length; i++)
+        state_put_card(&buf, deck_at(&game->question_list, i));
+    state_put_u32(&buf, game->wrong_quests.length);
+    for (i = 0; i < game->wrong_quests.length; i++)
+        state_put_card(&buf, deck_at(&game->wrong_quests, i));
+    state_put_u32(&buf, game->active_quests.length);
+    for (i = 0; i < game->active_quests.length; i++)
+        state_put_card(&buf, &game->active_quests.cards[i]);
+
+    state_put_u32(&buf, game->repeats.draws);
+    state_put_u32(&buf, game->repeats.length);
+    for (i = 0; i < game->repeats.length; i++)
+    {
+        state_put_card(&buf, &game->repeats.heap[i].card);
+        state_put_u32(&buf, game->repeats.heap[i].due);
+        state_put_u32(&buf, game->repeats.heap[i].copies);
+    }
+
+    if (!buf.ok || buf.length > MC_STATE_MAX_BYTES)
+    {
+        fprintf(stderr, "\nMC_SaveState() - could not build saved game\n");
+        free(buf.data);
+        return 0;
+    }
+
+    /* header and checksum go in small fixed buffers of their own: */
+    memset(&head, 0, sizeof(state_buf));
+    head.data = head_data;
+    head.capacity = sizeof(head_data);
+    head.ok = 1;
+    state_put_u32(&head, MC_STATE_MAGIC);
+    state_put_u32(&head, MC_STATE_VERSION);
+    state_put_u32(&head, (uint32_t)buf.length);
+    head.data = sum_data;
+    head.length = 0;
+    head.capacity = sizeof(sum_data);
+    state_put_u32(&head, state_checksum(buf.data, buf.length));
+
+    if (fwrite(head_data, 1, sizeof(head_data), fp) != sizeof(head_data)
+            || fwrite(buf.data, 1, buf.length, fp) != buf.length
+            || fwrite(sum_data, 1, sizeof(sum_data), fp) != sizeof(sum_data))
+    {
+        fprintf(stderr, "\nMC_SaveState() - error writing saved game\n");
+        free(buf.data);
+        return 0;
+    }
+
+    DEBUGMSG(debug_mathcards, "Saved %lu bytes\n", (unsigned long)buf.length);
+    DEBUGMSG(debug_mathcards, "Leaving MC_SaveState()\n");
+    free(buf.data);
+    return 1;
+}
+
+
+int MC_LoadState(MC_MathGame* game, FILE* fp)
+{
+    state_buf buf;
+    unsigned char head_data[12];
+    unsigned char sum_data[4];
+    uint32_t version, length, sum;
+
+    DEBUGMSG(debug_mathcards, "\nEntering MC_LoadState()\n");
+
+    if (!game || !fp)
+        return 0;
+
+    /* check the header, then read and check the whole body before */
+    /* touching the game, so a torn or corrupt file changes nothing: */
+    if (fread(head_data, 1, sizeof(head_data), fp) != sizeof(head_data))
+    {
+        fprintf(stderr, "\nMC_LoadState() - saved game truncated\n");
+        return 0;
+    }
+    memset(&buf, 0, sizeof(state_buf));
+    buf.data = head_data;
+    buf.length = sizeof(head_data);
+    buf.ok = 1;
+    if (state_get_u32(&buf) != MC_STATE_MAGIC)
+    {
+        fprintf(stderr, "\nMC_LoadState() - not a saved game\n");
+        return 0;
+    }
+    version = state_get_u32(&buf);
+    length = state_get_u32(&buf);
+    if (version != MC_STATE_VERSION)
+    {
+        fprintf(stderr, "\nMC_LoadState() - saved game is version %u, expected %d\n",
+                version, MC_STATE_VERSION);
+        return 0;
+    }
+    if (length > MC_STATE_MAX_BYTES)
+    {
+        fprintf(stderr, "\nMC_LoadState() - saved game too large\n");
+        return 0;
+    }
+
+    memset(&buf, 0, sizeof(state_buf));
+    buf.data = malloc(length ? length : 1);
+    buf.length = length;
+    buf.ok = 1;
+    if (!buf.data)
+    {
+        fprintf(stderr, "\nMC_LoadState() - could not allocate %u bytes\n", length);
+        return 0;
+    }
+    if (fread(buf.data, 1, length, fp) != length
+            || fread(sum_data, 1, sizeof(sum_data), fp) != sizeof(sum_data))
+    {
+        fprintf(stderr, "\nMC_LoadState() - saved game truncated\n");
+        free(buf.data);
+        return 0;
+    }
+    sum = sum_data[0] | (uint32_t)sum_data[1] << 8
+        | (uint32_t)sum_data[2] << 16 | (uint32_t)sum_data[3] << 24;
+    if (sum != state_checksum(buf.data, length))
+    {
+        fprintf(stderr, "\nMC_LoadState() - saved game is corrupt\n");
+        free(buf.data);
+        return 0;
+    }
+
+    if (!game->math_opts && !MC_Initialize(game))
+    {
+        free(buf.data);
+        return 0;
+    }
+
+    if (!state_load_body(game, &buf))
+    {
+        fprintf(stderr, "\nMC_LoadState() - saved game does not match this version of MathCards\n");
+        clear_lists(game);
+        game->quest_list_length = game->unanswered = game->starting_length = 0;
+        game->questions_pending = 0;
+        free(buf.data);
+        return 0;
+    }
+
+    free(buf.data);
 
+    if (debug_status & debug_mathcards) {
+        print_counters(game);
+        printf("\nLeaving MC_LoadState()\n");
     }
+    return 1;
+}
 
 
+
+/* prints struct to file */
+void MC_PrintMathOptions(MC_MathGame* game, FILE* fp, int verbose)
+{
+    int i;
+    //comments when writing out verbose...perhaps they can go somewhere less conspicuous
+    //NOTE not static, so concurrent callers don't race filling it in
+    const char* vcomments[NOPTS];
+    for (i = 0; i < NOPTS; ++i)
+        vcomments[i] = NULL;
+    vcomments[PLAY_THROUGH_LIST] =
+        "\n############################################################\n"
+        "#                                                          #\n"
+        "#                  General Math Options                    #\n"
+        "#                                                          #\n"
+        "# If 'play_through_list' is true, Tuxmath will ask each    #\n"
+        "# question in an internally-generated list. The list is    #\n"
+        "# generated based on the question ranges selected below.   #\n"
+        "# The game ends when no questions remain.                  #\n"
+        "# If 'play_through_list' is false, the game continues      #\n"
+        "# until all cities are destroyed.                          #\n"
+        "# Default is 1 (i.e. 'true' or 'yes').                     #\n"
+        "#                                                          #\n"
+        "# 'question_copies' is the number of times each question   #\n"
+        "# will be asked. It can be 1 to 10 - Default is 1.         #\n"
+        "#                                                          #\n"
+        "# 'repeat_wrongs' tells Tuxmath whether to reinsert        #\n"
+        "# incorrectly answered questions into the list to be       #\n"
+        "# asked again. Default is 1 (yes).                         #\n"
+        "#                                                          #\n"
+        "# 'copies_repeated_wrongs' gives the number of times an    #\n"
+        "# incorrectly answered question will reappear. Default     #\n"
+        "# is 1.                                                    #\n"
+        "#                                                          #\n"
+        "# The defaults for these values result in a 'mission'      #\n"
+        "# for Tux that is accomplished by answering all            #\n"
+        "# questions correctly with at least one surviving city.    #\n"
+        "############################################################\n\n";
+
+    vcomments[FORMAT_ADD_ANSWER_LAST] =
+        "\n############################################################\n"
+        "# The 'format_<op>_answer_<place>  options control         #\n"
+        "# generation of questions with the answer in different     #\n"
+        "# places in the equation.  i.e.:                           #\n"
+        "#                                                          #\n"
+        "#    format_add_answer_last:    2 + 2 = ?                  #\n"
+        "#    format_add_answer_first:   ? + 2 = 4                  #\n"
+        "#    format_add_answer_middle:  2 + ? = 4                  #\n"
+        "#                                                          #\n"
+        "# By default, 'format_answer_first' is enabled and the     #\n"
+        "# other two formats are disabled.  Note that the options   #\n"
+        "# are not mutually exclusive - the question list may       #\n"
+        "# contain questions with different formats.                #\n"
+        "#                                                          #\n"
+        "# The formats are set independently for each of the four   #\n"
+        "# math operations.                                         #\n"
+        "############################################################\n\n";
+
+    vcomments[ALLOW_NEGATIVES] =
+        "\n############################################################\n"
+        "# 'allow_negatives' allows or disallows use of negative    #\n"
+        "# numbers as both operands and answers.  Default is 0      #\n"
+        "# (no), which disallows questions like:                    #\n"
+        "#          2 - 4 = ?                                       #\n"
+        "# Note: this option must be enabled in order to set the    #\n"
+        "# operand ranges to include negatives (see below). If it   #\n"
+        "# is changed from 1 (yes) to 0 (no), any negative          #\n"
+        "# operand limits will be reset to 0.                       #\n"
+        "############################################################\n\n";
+
+    vcomments[MAX_ANSWER] =
+        "\n############################################################\n"
+        "# 'max_answer' is the largest absolute value allowed in    #\n"
+        "# any value in a question (not only the answer). Default   #\n"
+        "# is 144. It can be set as high as 999.                    #\n"
+        "############################################################\n\n";
+
+    vcomments[MAX_QUESTIONS] =
+        "\n############################################################\n"
+        "# 'max_questions' is limit of the length of the question   #\n"
+        "# list. Default is 5000 - only severe taskmasters will     #\n"
+        "# need to raise it.                                        #\n"
+        "############################################################\n\n";
+
+    vcomments[RANDOMIZE] =
+        "\n############################################################\n"
+        "# If 'randomize' selected, the list will be shuffled       #\n"
+        "# at the start of the game.  Default is 1 (yes).           #\n"
+        "############################################################\n\n";
+
+    vcomments[ADDITION_ALLOWED] =
+        "\n############################################################\n"
+        "#                                                          #\n"
+        "#                 Math Operations Allowed                  #\n"
+        "#                                                          #\n"
+        "# These options enable questions for each of the four math #\n"
+        "# operations.  All are 1 (yes) by default.                 #\n"
+        "############################################################\n\n";
+
+    vcomments[MIN_AUGEND] =
+        "\n############################################################\n"
+        "#                                                          #\n"
+        "#      Minimum and Maximum Values for Operand Ranges       #\n"
+        "#                                                          #\n"
+        "# Operand limits can be set to any integer up to the       #\n"
+        "# value of 'max_answer'.  If 'allow_negatives' is set to 1 #\n"
+        "# (yes), either negative or positive values can be used.   #\n"
+        "# Tuxmath will generate questions for every value in the   #\n"
+        "# specified range. The maximum must be greater than or     #\n"
+        "# equal to the corresponding minimum for any questions to  #\n"
+        "# be generated for that operation.                         #\n"
+        "############################################################\n\n";
+
     DEBUGMSG(debug_mathcards, "\nEntering MC_PrintMathOptions()\n");
 
     /* bail out if no struct */
@@ -925,9 +1330,9 @@ void MC_PrintMathOptions(MC_MathGame* game, FILE* fp, int verbose)
 
 int MC_PrintQuestionList(MC_MathGame* game, FILE* fp)
 {
-    if (fp && game->question_list)
+    if (fp && game->question_list.length)
     {
-        print_list(fp, game->question_list);
+        print_list(fp, game, &game->question_list);
         return 1;
     }
     else
@@ -945,9 +1350,9 @@ int MC_PrintWrongList(MC_MathGame* game, FILE* fp)
         return 0;
     }
 
-    if (game->wrong_quests)
+    if (game->wrong_quests.length)
     {
-        print_list(fp, game->wrong_quests);
+        print_list(fp, game, &game->wrong_quests);
     }
     else
     {
@@ -966,7 +1371,7 @@ int MC_StartingListLength(MC_MathGame* game)
 
 int MC_WrongListLength(MC_MathGame* game)
 {
-    return list_length(game->wrong_quests);
+    return game->wrong_quests.length;
 }
 
 int MC_NumAnsweredCorrectly(MC_MathGame* game)
@@ -981,6 +1386,25 @@ int MC_NumNotAnsweredCorrectly(MC_MathGame* game)
 }
 
 
+size_t MC_PeakMemoryUsage(MC_MathGame* game)
+{
+    return game->arena.peak_reserved;
+}
+
+size_t MC_MemoryAllocations(MC_MathGame* game)
+{
+    return game->arena.chunks_allocated;
+}
+
+
+void MC_SetRandomSeed(MC_MathGame* game, unsigned int seed)
+{
+    game->seed = seed;
+    game->fixed_seed = 1;
+    rng_seed(&game->rng, seed, 0);
+}
+
+
 int MC_MakeFlashcard(char* buf, MC_FlashCard* fc)
 {
     int i = 0,tab = 0, s = 0;
@@ -1022,11 +1446,29 @@ int MC_MakeFlashcard(char* buf, MC_FlashCard* fc)
 /* Report the median time per question */
 float MC_MedianTimePerQuestion(MC_MathGame* game)
 {
-    if (game->length_time_per_question_list == 0)
+    return MC_TimePerQuestionPercentile(game, 50);
+}
+
+
+float MC_MeanTimePerQuestion(MC_MathGame* game)
+{
+    if (game->answer_times.count == 0)
         return 0;
+    return game->answer_times.total / game->answer_times.count;
+}
+
+
+float MC_TimePerQuestionPercentile(MC_MathGame* game, int percentile)
+{
+    int i;
 
-    qsort(game->time_per_question_list, game->length_time_per_question_list, sizeof(float), floatCompare);
-    return game->time_per_question_list[game->length_time_per_question_list/2];
+    for (i = 0; i < MC_NUM_TIME_PERCENTILES; i++)
+        if (MC_TIME_PERCENTILES[i] == percentile)
+            return quantile_value(&game->answer_times.quantiles[i],
+                                  game->answer_times.count);
+
+    fprintf(stderr, "MC_TimePerQuestionPercentile(): %d'th percentile not tracked\n", percentile);
+    return 0;
 }
 
 
@@ -1071,743 +1513,2502 @@ void clear_negatives(MC_MathGame* game)
 
 
 
-// MC_MathQuestion* create_node_from_card(const MC_FlashCard* flashcard)
-// {
-//   MC_MathQuestion* ret = allocate_node();
-//   MC_CopyCard(flashcard, &(ret->card));
-//   return ret;
-// }
-
-// /* FIXME take care of strings */
-// /* this one copies the contents, including pointers; both nodes must be allocated */
-// int copy_node(MC_MathQuestion* original, MC_MathQuestion* copy)
-// {
-//   if (!original)
-//   {
-//     fprintf(stderr, "\nIn copy_node(): invalid 'original' pointer arg.\n");
-//     return 0;
-//   }
-//   if (!copy)
-//   {
-//     fprintf(stderr, "\nIn copy_node(): invalid 'copy' pointer arg.\n");
-//     return 0;
-//   }
-// 
-//   copy_card(&(original->card), &(copy->card) );
-// 
-//   copy->next = original->next;
-//   copy->previous = original->previous;
-//   copy->randomizer = original->randomizer;
-//   return 1;
-// }
-
+/* Implementation of the per-game random number generator.  This is    */
+/* O'Neill's PCG32 (XSH-RR variant): 64 bits of state, 32-bit output.  */
+/* Each game has its own, so games never disturb each other's sequence */
+/* and need no locking, and a game can be replayed from its seed.      */
 
+static void rng_seed(MC_Random* rng, uint64_t seed, uint64_t stream)
+{
+    rng->state = 0;
+    rng->inc = (stream << 1) | 1;  //must be odd
+    rng_next(rng);
+    rng->state += seed;
+    rng_next(rng);
+}
 
 
-/* this puts the node into the list AFTER the node pointed to by current */
-/* and returns a pointer to the top of the modified list  */
-MC_MathQuestion* insert_node(MC_MathQuestion* first,
-        MC_MathQuestion* current,
-        MC_MathQuestion* new_node)
+static unsigned int rng_next(MC_Random* rng)
 {
-    /* return pointer to list unchanged if new_node doesn't exist*/
-    if (!new_node)
-        return first;
-    /* if current doesn't exist, new_node is first */
-    if (!current)
-    {
-        new_node->previous = 0;
-        new_node->next =0;
-        first = new_node;
-        return first;
-    }
+    uint64_t old = rng->state;
+    uint32_t xorshifted = (uint32_t)(((old >> 18) ^ old) >> 27);
+    uint32_t rot = (uint32_t)(old >> 59);
 
-    if (current->next)  /* avoid error if at end of list */
-        current->next->previous = new_node;
-    new_node->next = current->next;
-    current->next = new_node;
-    new_node->previous = current;
-    return first;
+    rng->state = old * 6364136223846793005ULL + rng->inc;
+    return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
 }
 
 
-
-/* adds the new node to the end of the list */
-MC_MathQuestion* append_node(MC_MathQuestion* list, MC_MathQuestion* new_node)
+/* Returns a number in [0, n), or 0 if n is not positive. Uses a */
+/* multiply and shift rather than '%', which is faster and not   */
+/* biased toward small values the way 'rand() % n' is.           */
+static int rng_below(MC_Random* rng, int n)
 {
-    MC_MathQuestion* ptr;
-    /* return pointer to list unchanged if new_node doesn't exist*/
-    if (!new_node)
-    {
-        return list;
-    }
+    if (n <= 0)
+        return 0;
+    return (int)(((uint64_t)rng_next(rng) * (uint32_t)n) >> 32);
+}
 
-    /* if list does not exist, new_node is the first (and only) node */
-    if (!list)
-    {
-        return new_node;
-    }
-    /* otherwise, go to end of list */
-    ptr = list;
-    while (ptr->next)
-    {
-        ptr = ptr->next;
-    }
 
-    ptr->next = new_node;
-    new_node->previous = ptr;
-    new_node->next = 0;
-    return list;
+static double rng_double(MC_Random* rng)
+{
+    return rng_next(rng) / 4294967296.0;
 }
 
 
 
-/* this takes the node out of the list but does not delete it */
-/* and returns a pointer to the top of the modified list  */
-MC_MathQuestion* remove_node(MC_MathQuestion* first, MC_MathQuestion* n)
-{
-    if (!n || !first)
-        return first;
-    /* special case if first node being removed */
-    if (n == first)
-        first = first->next;
+/* Implementation of the per-game arena.  Memory comes from the system */
+/* in chunks of at least MC_ARENA_CHUNK_SIZE bytes; requests are rounded */
+/* up to a power of two so that recycled blocks can be kept on one free */
+/* list per size class and handed out again without any searching.     */
 
-    if (n->previous)
-        n->previous->next = n->next;
-    if (n->next)
-        n->next->previous = n->previous;
-    n->previous = 0;
-    n->next = 0;
-    return first;
-}
+#define MC_ARENA_CHUNK_SIZE 65536
+#define MC_ARENA_MIN_CLASS 6        /* smallest block is 64 bytes */
 
+typedef struct _MC_ArenaChunk {
+    struct _MC_ArenaChunk* next;
+    size_t size;                    /* bytes of data following header */
+    double align;                   /* pads header to keep data aligned */
+} MC_ArenaChunk;
 
 
-/* frees memory for entire list and returns null pointer */
-MC_MathQuestion* delete_list(MC_MathQuestion* list)
+static int arena_class(size_t size)
 {
-    MC_MathQuestion* tmp_ptr;
-    while (list)
-    {
-        tmp_ptr = list->next;
-        free_node (list);
-        list = tmp_ptr;
-    }
-    return list;
+    int c = MC_ARENA_MIN_CLASS;
+    while (c < MC_ARENA_CLASSES - 1 && ((size_t)1 << c) < size)
+        c++;
+    return c;
 }
 
 
+static MC_ArenaChunk* arena_new_chunk(MC_Arena* arena, size_t size)
+{
+    MC_ArenaChunk* chunk = malloc(sizeof(MC_ArenaChunk) + size);
+    if (!chunk)
+        return NULL;
+    chunk->size = size;
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->reserved += sizeof(MC_ArenaChunk) + size;
+    arena->chunks_allocated++;
+    if (arena->reserved > arena->peak_reserved)
+        arena->peak_reserved = arena->reserved;
+    return chunk;
+}
+
 
-void print_list(FILE* fp, MC_MathQuestion* list)
+static void* arena_alloc(MC_Arena* arena, size_t size)
 {
-    if (!list)
+    int c = arena_class(size);
+    size_t bytes = (size_t)1 << c;
+    void* ret;
+    MC_ArenaChunk* chunk;
+
+    if (size > bytes) //larger than biggest class - should never happen
+        return NULL;
+
+    /* Reuse a recycled block if there is one: */
+    if (arena->free_blocks[c])
     {
-        fprintf(fp, "\nprint_list(): list empty or pointer invalid\n");
-        return;
+        ret = arena->free_blocks[c];
+        arena->free_blocks[c] = *(void**)ret;
+        arena->in_use += bytes;
+        return ret;
     }
 
-    MC_MathQuestion* ptr = list;
-    while (ptr)
+    /* Big blocks get a chunk to themselves so the current chunk */
+    /* can go on being used for small ones:                       */
+    if (bytes > MC_ARENA_CHUNK_SIZE / 4)
     {
-        fprintf(fp, "%s\n", ptr->card.formula_string);
-        ptr = ptr->next;
+        chunk = arena_new_chunk(arena, bytes);
+        if (!chunk)
+            return NULL;
+        arena->in_use += bytes;
+        return chunk + 1;
     }
-}
 
-
-void print_vect_list(FILE* fp, MC_MathQuestion** vect, int length)
-{
-    if (!vect)
+    if ((size_t)(arena->end - arena->next) < bytes)
     {
-        fprintf(fp, "\nprint_vect_list(): list empty or pointer invalid\n");
-        return;
+        chunk = arena_new_chunk(arena, MC_ARENA_CHUNK_SIZE);
+        if (!chunk)
+            return NULL;
+        arena->next = (char*)(chunk + 1);
+        arena->end = arena->next + MC_ARENA_CHUNK_SIZE;
     }
 
-    int i = 0;
-    DEBUGMSG(debug_mathcards, "Entering print_vect_list()\n");
-    for(i = 0; i < length; i++)
-        fprintf(fp, "%s\n", vect[i]->card.formula_string);
-
-    DEBUGMSG(debug_mathcards, "Leaving print_vect_list()\n");
+    ret = arena->next;
+    arena->next += bytes;
+    arena->in_use += bytes;
+    return ret;
 }
 
 
-
-void print_card(MC_FlashCard card)
+static void arena_free(MC_Arena* arena, void* ptr, size_t size)
 {
-    printf("\nprint_card():\n");
-    printf("question_id: %d\nformula_string: %s\nanswer_string: %s\n"
-            "answer: %d\ndifficulty: %d\n\n",
-            card.question_id,
-            card.formula_string,
-            card.answer_string,
-            card.answer,
-            card.difficulty);
+    int c;
+
+    if (!ptr || !size)
+        return;
+    c = arena_class(size);
+    *(void**)ptr = arena->free_blocks[c];
+    arena->free_blocks[c] = ptr;
+    arena->in_use -= (size_t)1 << c;
 }
 
-/* This sends the values of all "global" counters and the */
-/* lengths of the question lists to stdout - for debugging */
-void print_counters(MC_MathGame *game)
+
+/* Frees every chunk at once. The peak usage is kept so it can still */
+/* be reported after the game is over.                                */
+static void arena_release(MC_Arena* arena)
 {
-    printf("\nquest_list_length = \t%d", game->quest_list_length);
-    printf("\nlist_length(question_list) = \t%d", list_length(game->question_list));
-    printf("\nstarting_length = \t%d", game->starting_length);
-    printf("\nunanswered = \t%d", game->unanswered);
-    printf("\nanswered_correctly = \t%d", game->answered_correctly);
-    printf("\nanswered_wrong = \t%d", game->answered_wrong);
-    printf("\nlist_length(wrong_quests) = \t%d", list_length(game->wrong_quests));
-    printf("\nquestions_pending = \t%d", game->questions_pending);
-    printf("\nlist_length(active_quests) = \t%d", list_length(game->active_quests));
+    MC_ArenaChunk* chunk;
+    size_t peak = arena->peak_reserved;
+    size_t allocated = arena->chunks_allocated;
+
+    while (arena->chunks)
+    {
+        chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        free(chunk);
+    }
+    memset(arena, 0, sizeof(MC_Arena));
+    arena->peak_reserved = peak;
+    arena->chunks_allocated = allocated;
 }
 
 
 
+/* Implementation of the question deck.  The deck is a ring buffer with */
+/* a power-of-two capacity, so the i'th card from the top always lives   */
+/* in slot (head + i) & (capacity - 1).                                  */
+
+/* Makes sure there is room for at least n cards, preserving the current */
+/* contents. Returns 1 if successful, 0 if allocation failed.            */
+static int deck_reserve(MC_Arena* arena, MC_Deck* deck, int n)
+{
+    MC_PackedCard* new_cards = NULL;
+    int new_capacity;
+    int i;
+
+    if (n <= deck->capacity)
+        return 1;
 
+    new_capacity = deck->capacity ? deck->capacity : 64;
+    while (new_capacity < n)
+        new_capacity *= 2;
 
+    new_cards = arena_alloc(arena, new_capacity * sizeof(MC_PackedCard));
+    if (!new_cards)
+    {
+        fprintf(stderr, "deck_reserve() - could not allocate %d cards\n", new_capacity);
+        return 0;
+    }
 
-// 
-// /* FIXME take care of strings */
-// 
-// MC_FlashCard create_card_from_node(MC_MathQuestion* node)
-// {
-//   MC_FlashCard fc;
-//   if (!node)
-//     return DEFAULT_CARD;
-//   fc = MC_AllocateFlashcard();
-//   copy_card(&(node->card), &fc);
-//   return fc;
-// }
+    /* "unroll" the ring so the top card ends up in slot 0: */
+    for (i = 0; i < deck->length; i++)
+        new_cards[i] = *deck_at(deck, i);
 
+    arena_free(arena, deck->cards, deck->capacity * sizeof(MC_PackedCard));
+    deck->cards = new_cards;
+    deck->head = 0;
+    deck->capacity = new_capacity;
+    return 1;
+}
 
 
-/* a "copy constructor", so to speak */
-/* FIXME perhaps should return newly allocated list if more than one node DSB */
-MC_MathQuestion* create_node_copy(MC_MathQuestion* other)
+static void deck_clear(MC_Arena* arena, MC_Deck* deck)
 {
-    MC_MathQuestion* ret = allocate_node();
-    if (ret)
-        MC_CopyCard(&(other->card), &(ret->card) );
-    return ret;
+    arena_free(arena, deck->cards, deck->capacity * sizeof(MC_PackedCard));
+    deck->cards = NULL;
+    deck->head = deck->length = deck->capacity = 0;
 }
 
 
-int list_length(MC_MathQuestion* list)
+static MC_PackedCard* deck_at(MC_Deck* deck, int i)
 {
-    int length = 0;
-    while (list)
-    {
-        length++;
-        list = list->next;
-    }
-    return length;
+    return &deck->cards[(deck->head + i) & (deck->capacity - 1)];
 }
 
 
+/* Adds a blank card to the bottom of the deck and returns a pointer */
+/* to it for the caller to fill in, or NULL if allocation failed.   */
+static MC_PackedCard* deck_push_back(MC_Arena* arena, MC_Deck* deck)
+{
+    MC_PackedCard* pc;
+
+    if (deck->length >= deck->capacity
+            && !deck_reserve(arena, deck, deck->length + 1))
+        return NULL;
+
+    pc = deck_at(deck, deck->length);
+    memset(pc, 0, sizeof(MC_PackedCard));
+    deck->length++;
+    return pc;
+}
 
 
+/* Takes the top card off the deck, copying it into pc if pc is not */
+/* NULL. Returns 1 if successful, 0 if the deck was empty.          */
+static int deck_pop_front(MC_Deck* deck, MC_PackedCard* pc)
+{
+    if (!deck->length)
+        return 0;
 
+    if (pc)
+        *pc = deck->cards[deck->head];
+    deck->head = (deck->head + 1) & (deck->capacity - 1);
+    deck->length--;
+    return 1;
+}
 
-/* This is a new implementation written in an attempt to avoid       */
-/* the O(n^2) performance problems seen with the old randomization   */
-/* function. The list is created as a vector, but is for now still   */
-/* made a linked list to minimize changes needed elsewhere.          */
-/* The argument is a pointer to the top of the old list.  This extra */
-/* level of indirection allows the list to be shuffled "in-place".   */
-/* The function returns 1 if successful, 0 on errors.                */
 
-static int randomize_list(MC_MathQuestion** old_list)
+/* Puts a copy of pc back into the deck at a random position.  The card */
+/* goes on the bottom and is then swapped with a random card, which     */
+/* takes its place on the bottom - this is O(1) instead of the O(n)     */
+/* walk needed to splice into the middle of a list.  As in the old      */
+/* linked-list version, a card is never put back on top of the deck     */
+/* unless the deck was empty. Returns 1 if successful, 0 otherwise.     */
+static int deck_insert_random(MC_Arena* arena, MC_Random* rng, MC_Deck* deck, const MC_PackedCard* pc)
 {
-    MC_MathQuestion* old_tmp = *old_list;
-    MC_MathQuestion** tmp_vect = NULL;
+    MC_PackedCard* bottom;
+    MC_PackedCard* spot;
+    MC_PackedCard tmp;
 
-    int i = 0;
-    if (!old_list || !*old_list) //invalid/empty list
+    bottom = deck_push_back(arena, deck);
+    if (!bottom)
         return 0;
+    *bottom = *pc;
 
-    int old_length = list_length(old_tmp);
-
-    /* set random seed: */
-    srand(time(0));
+    if (deck->length > 2)
+    {
+        spot = deck_at(deck, 1 + rng_below(rng, deck->length - 1));
+        tmp = *spot;
+        *spot = *bottom;
+        *bottom = tmp;
+    }
+    return 1;
+}
 
 
-    /* Allocate vector and set ptrs to nodes in old list: */
+/* Fisher-Yates shuffle of the deck in place: */
+static void deck_shuffle(MC_Random* rng, MC_Deck* deck)
+{
+    int i, j;
+    MC_PackedCard tmp;
+    MC_PackedCard* a;
+    MC_PackedCard* b;
 
-    /* Allocate a list of pointers, not space for the nodes themselves: */
-    tmp_vect = (MC_MathQuestion**)malloc(sizeof(MC_MathQuestion*) * old_length);
-    /* Set each pointer in the vector to the corresponding node: */
-    for (i = 0; i < old_length; i++)
+    for (i = deck->length - 1; i > 0; i--)
     {
-        tmp_vect[i] = old_tmp;
-        tmp_vect[i]->randomizer = rand();
-        old_tmp = old_tmp->next;
+        j = rng_below(rng, i + 1);
+        a = deck_at(deck, i);
+        b = deck_at(deck, j);
+        tmp = *a;
+        *a = *b;
+        *b = tmp;
     }
+}
+
 
-    /* Now simply sort on 'tmp_vect[i]->randomizer' to shuffle list: */
-    qsort(tmp_vect, old_length,
-            sizeof(MC_MathQuestion*),
-            comp_randomizer);
+/* Implementation of the active_quests set.  The index is an open-  */
+/* addressed table with linear probing, kept at most half full, so  */
+/* lookups terminate quickly and removal can use backward shifting  */
+/* instead of tombstones.                                           */
 
-    /* Re-create pointers to provide linked-list functionality:      */
-    /* (stop at 'old_length-1' because we dereference tmp_vect[i+1]) */
-    for(i = 0; i < old_length - 1; i++)
+static unsigned int active_hash(const MC_ActiveSet* set, int id)
+{
+    return ((unsigned int)id * 2654435761u) & (set->index_size - 1);
+}
+
+
+static void active_index_insert(MC_ActiveSet* set, int slot)
+{
+    unsigned int h = active_hash(set, set->cards[slot].question_id);
+
+    while (set->index[h] != -1)
+        h = (h + 1) & (set->index_size - 1);
+    set->index[h] = slot;
+}
+
+
+/* Returns the position in the index that refers to the given slot: */
+static unsigned int active_index_position(const MC_ActiveSet* set, int slot)
+{
+    unsigned int h = active_hash(set, set->cards[slot].question_id);
+
+    while (set->index[h] != slot)
+        h = (h + 1) & (set->index_size - 1);
+    return h;
+}
+
+
+/* Puts a copy of pc "in play". Returns 1 if successful, 0 otherwise. */
+static int active_add(MC_Arena* arena, MC_ActiveSet* set, const MC_PackedCard* pc)
+{
+    if (set->length >= set->capacity)
     {
-        if (!tmp_vect[i])
+        int new_capacity = set->capacity ? set->capacity * 2 : 16;
+        MC_PackedCard* new_cards = NULL;
+        int* new_index = NULL;
+        int i;
+
+        new_cards = arena_alloc(arena, new_capacity * sizeof(MC_PackedCard));
+        new_index = arena_alloc(arena, 2 * new_capacity * sizeof(int));
+        if (!new_cards || !new_index)
         {
-            fprintf(stderr, "Invalid pointer!\n");
+            fprintf(stderr, "active_add() - could not allocate %d cards\n", new_capacity);
+            arena_free(arena, new_cards, new_capacity * sizeof(MC_PackedCard));
+            arena_free(arena, new_index, 2 * new_capacity * sizeof(int));
             return 0;
         }
-        tmp_vect[i]->next = tmp_vect[i+1];
-        tmp_vect[i+1]->previous = tmp_vect[i];
+        if (set->length)
+            memcpy(new_cards, set->cards, set->length * sizeof(MC_PackedCard));
+        arena_free(arena, set->cards, set->capacity * sizeof(MC_PackedCard));
+        arena_free(arena, set->index, set->index_size * sizeof(int));
+        set->cards = new_cards;
+        set->index = new_index;
+        set->index_size = 2 * new_capacity;
+        set->capacity = new_capacity;
+
+        /* rebuild the index at its new size: */
+        for (i = 0; i < set->index_size; i++)
+            set->index[i] = -1;
+        for (i = 0; i < set->length; i++)
+            active_index_insert(set, i);
     }
-    /* Handle end cases: */
-    tmp_vect[0]->previous = NULL;
-    tmp_vect[old_length-1]->next = NULL;
 
-    /* Now arrange for arg pointer to indirectly point to first element! */
-    *old_list = tmp_vect[0];
-    free(tmp_vect);
+    set->cards[set->length] = *pc;
+    active_index_insert(set, set->length);
+    set->length++;
     return 1;
 }
 
 
-
-/* This is needed for qsort(): */
-int comp_randomizer (const void* a, const void* b)
+/* Returns the slot of a card with the given id, or -1 if none is in play: */
+static int active_find(MC_ActiveSet* set, int id)
 {
+    unsigned int h;
 
-    int int1 = (*(const struct MC_MathQuestion **) a)->randomizer;
-    int int2 = (*(const struct MC_MathQuestion **) b)->randomizer;
-
-    if (int1 > int2)
-        return 1;
-    else if (int1 == int2)
-        return 0;
-    else
+    if (!set->length)
         return -1;
+
+    h = active_hash(set, id);
+    while (set->index[h] != -1)
+    {
+        if (set->cards[set->index[h]].question_id == id)
+            return set->index[h];
+        h = (h + 1) & (set->index_size - 1);
+    }
+    return -1;
 }
 
-MC_MathQuestion* pick_random(int length, MC_MathQuestion* list)
+
+/* Takes the card in the given slot out of play.  The last card is moved */
+/* into the vacated slot so the array stays dense.                       */
+static void active_remove(MC_ActiveSet* set, int slot)
 {
-    int i;
-    int rand_node;
+    unsigned int mask = set->index_size - 1;
+    unsigned int h, next, home;
+    int last = set->length - 1;
+
+    if (slot < 0 || slot > last)
+        return;
 
-    /* set random seed DSB */
-    srand(time(0));
+    /* Remove from index, shifting back any later entries in the same */
+    /* probe run that would otherwise become unreachable:             */
+    h = active_index_position(set, slot);
+    next = (h + 1) & mask;
+    while (set->index[next] != -1)
+    {
+        home = active_hash(set, set->cards[set->index[next]].question_id);
+        if (((next - home) & mask) >= ((next - h) & mask))
+        {
+            set->index[h] = set->index[next];
+            h = next;
+        }
+        next = (next + 1) & mask;
+    }
+    set->index[h] = -1;
 
-    /* if length is zero, get out to avoid divide-by-zero error */
-    if (0 == length)
+    /* Fill the hole with the last card: */
+    if (slot != last)
     {
-        return list;
+        h = active_index_position(set, last);
+        set->cards[slot] = set->cards[last];
+        set->index[h] = slot;
     }
+    set->length--;
+}
+
+
+static void active_clear(MC_Arena* arena, MC_ActiveSet* set)
+{
+    arena_free(arena, set->cards, set->capacity * sizeof(MC_PackedCard));
+    arena_free(arena, set->index, set->index_size * sizeof(int));
+    set->cards = NULL;
+    set->index = NULL;
+    set->length = set->capacity = set->index_size = 0;
+}
+
+
 
-    rand_node = rand() % length;
 
-    for (i=1; i < rand_node; i++)
+/* Implementation of the repeat queue, a binary min-heap on due: */
+
+/* Schedules copies repeats of pc, the first at a random point in the */
+/* rest of the list. Returns 1 if successful, 0 otherwise.            */
+static int repeat_schedule(MC_MathGame* game, const MC_PackedCard* pc, int copies)
+{
+    MC_RepeatQueue* queue = &game->repeats;
+    MC_Repeat* r;
+
+    if (queue->length >= queue->capacity)
     {
-        if (list)
-            list = list->next;
+        int new_capacity = queue->capacity ? queue->capacity * 2 : 16;
+        MC_Repeat* new_heap = arena_alloc(&game->arena, new_capacity * sizeof(MC_Repeat));
+
+        if (!new_heap)
+        {
+            fprintf(stderr, "repeat_schedule() - could not allocate %d repeats\n", new_capacity);
+            return 0;
+        }
+        if (queue->length)
+            memcpy(new_heap, queue->heap, queue->length * sizeof(MC_Repeat));
+        arena_free(&game->arena, queue->heap, queue->capacity * sizeof(MC_Repeat));
+        queue->heap = new_heap;
+        queue->capacity = new_capacity;
     }
 
-    return list;
+    r = &queue->heap[queue->length];
+    r->card = *pc;
+    r->due = repeat_due(game);
+    r->copies = copies;
+    queue->length++;
+    queue->copies += copies;
+    repeat_sift_up(queue, queue->length - 1);
+    return 1;
 }
 
-/* compares fields other than pointers */
-int compare_node(MC_MathQuestion* first, MC_MathQuestion* other)
+
+/* If a repeat is due (or the deck has run out), copies it into pc,  */
+/* reschedules the card if it has copies left, and returns 1. If no */
+/* repeat is due, returns 0 and the deck should be drawn from.      */
+static int repeat_pop_due(MC_MathGame* game, MC_PackedCard* pc)
 {
-    if (!first || !other)
+    MC_RepeatQueue* queue = &game->repeats;
+    MC_Repeat* top = queue->heap;
+
+    if (!queue->length)
         return 0;
-    if (compare_card(&(first->card), &(first->card) ) ) //cards are equal
-        return 1;
-    else
+    if (top->due > queue->draws && game->question_list.length)
         return 0;
+
+    *pc = top->card;
+    top->copies--;
+    queue->copies--;
+    if (top->copies > 0)
+        top->due = repeat_due(game);
+    else
+        *top = queue->heap[--queue->length];
+    if (queue->length)
+        repeat_sift_down(queue, 0);
+    return 1;
 }
 
-/* check to see if list already contains an identical node */
-int already_in_list(MC_MathQuestion* list, MC_MathQuestion* ptr)
+
+/* As with putting a card back into the deck at random, a repeat comes */
+/* up somewhere in the rest of the list, but never as the very next   */
+/* card unless nothing else is left. draws is the number of the      */
+/* latest draw, so the next one is draws + 1:                          */
+static int repeat_due(MC_MathGame* game)
 {
-    if (!list || !ptr)
-        return 0;
+    int left = game->question_list.length + game->repeats.copies;
+
+    return game->repeats.draws + 2 + rng_below(&game->rng, left);
+}
+
+
+static void repeat_sift_up(MC_RepeatQueue* queue, int i)
+{
+    MC_Repeat tmp = queue->heap[i];
+    int parent;
 
-    while (list)
+    while (i > 0)
     {
-        if (compare_node(list, ptr))
-            return 1;
-        list = list->next;
+        parent = (i - 1) / 2;
+        if (queue->heap[parent].due <= tmp.due)
+            break;
+        queue->heap[i] = queue->heap[parent];
+        i = parent;
     }
-    return 0;
+    queue->heap[i] = tmp;
 }
 
-// /* to prevent option settings in math_opts from getting set to */
-// /* values other than 0 or 1                                    */
-// int int_to_bool(int i)
-// {
-//   if (i)
-//     return 1;
-//   else
-//     return 0;
-// }
 
-// /* prevent values from getting into math_opts that are outside */
-// /* the range that can be handled by the program (i.e. more     */
-// /* than three digits; also disallow negatives if that has been */
-// /* selected.                                                   */
-// int sane_value(int i)
-// {
-//   if (i > MC_GLOBAL_MAX)
-//     i = MC_GLOBAL_MAX;
-//   else if (i < -MC_GLOBAL_MAX)
-//     i = -MC_GLOBAL_MAX;
-// 
-//   if (i < 0
-//    && math_opts
-//    && !math_opts->iopts[ALLOW_NEGATIVES])
-//   {
-//     i = 0;
-//   }
-// 
-//   return i;
-// }
+static void repeat_sift_down(MC_RepeatQueue* queue, int i)
+{
+    MC_Repeat tmp = queue->heap[i];
+    int child;
 
-// int abs_value(int i)
-// {
-//   if (i > 0)
-//     return i;
-//   else
-//     return -i;
-// }
+    while ((child = 2 * i + 1) < queue->length)
+    {
+        if (child + 1 < queue->length
+                && queue->heap[child + 1].due < queue->heap[child].due)
+            child++;
+        if (tmp.due <= queue->heap[child].due)
+            break;
+        queue->heap[i] = queue->heap[child];
+        i = child;
+    }
+    queue->heap[i] = tmp;
+}
 
 
-/* Compares two floats (needed for sorting in MC_MedianTimePerQuestion) */
-int floatCompare(const void *v1,const void *v2)
+static int cards_in_list(MC_MathGame* game)
 {
-    float f1,f2;
+    return game->question_list.length + game->repeats.copies;
+}
 
-    f1 = *((float *) v1);
-    f2 = *((float *) v2);
 
-    if (f1 < f2)
-        return -1;
-    else if (f1 > f2)
-        return 1;
+
+
+/* Implementation of the content index. Like the active set's index, */
+/* it is open-addressed with linear probing and kept at most half    */
+/* full. Cards are only ever added to an indexed deck, so there is   */
+/* no removal.                                                       */
+
+/* FNV-1a over everything compare_card() looks at: */
+static unsigned int card_hash(MC_MathGame* game, const MC_PackedCard* pc)
+{
+    unsigned int h = 2166136261u;
+    int vals[4];
+    const unsigned char* p;
+    int i;
+
+    vals[0] = pc->kind;
+    vals[1] = pc->style;
+    vals[2] = pc->answer;
+    vals[3] = 0;
+    if (pc->kind == MC_CARD_TEXT)
+    {
+        for (p = (const unsigned char*)game->card_text[pc->n1].formula_string;
+                *p && p < (const unsigned char*)game->card_text[pc->n1].formula_string + MC_FORMULA_LEN; p++)
+            h = (h ^ *p) * 16777619u;
+    }
     else
-        return 0;
+    {
+        vals[3] = pc->n1 * 31 + pc->n2;
+    }
+    p = (const unsigned char*)vals;
+    for (i = 0; i < (int)sizeof(vals); i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h;
 }
 
 
+/* Returns the position in deck of a card identical to pc, or -1: */
+static int index_find(MC_MathGame* game, MC_CardIndex* index, MC_Deck* deck, const MC_PackedCard* pc)
+{
+    unsigned int h;
 
-/****************************************************
-  Functions for new mathcards architecture
- ****************************************************/
+    if (!index->size)
+        return -1;
+    h = card_hash(game, pc) & (index->size - 1);
+    while (index->slots[h] != -1)
+    {
+        if (compare_node(game, deck_at(deck, index->slots[h]), pc))
+            return index->slots[h];
+        h = (h + 1) & (index->size - 1);
+    }
+    return -1;
+}
 
-void MC_CopyCard(const MC_FlashCard* src, MC_FlashCard* dest)
+
+/* Indexes the card at position pos in deck, which must already hold */
+/* pos + 1 cards. Returns 1 if successful, 0 otherwise.              */
+static int index_add(MC_Arena* arena, MC_MathGame* game, MC_CardIndex* index, MC_Deck* deck, int pos)
 {
-    if (!src || !dest)
-        return;
-    DEBUGMSG(debug_mathcards, "Copying '%s' to '%s', ", src->formula_string,dest->formula_string);
-    DEBUGMSG(debug_mathcards, "copying '%s' to '%s'\n", src->answer_string, dest->answer_string);
-    strncpy(dest->formula_string, src->formula_string, MC_FORMULA_LEN);
-    strncpy(dest->answer_string, src->answer_string, MC_ANSWER_LEN);
-    DEBUGMSG(debug_mathcards, "Card is: '%s', '%s'\n", dest->formula_string, dest->answer_string);
-    dest->answer = src->answer;
-    dest->difficulty = src->difficulty;
-    dest->question_id = src->question_id;
+    unsigned int h;
+    int i;
+
+    if (2 * deck->length > index->size)
+    {
+        int new_size = index->size ? index->size * 2 : 64;
+        int* new_slots = arena_alloc(arena, new_size * sizeof(int));
+
+        if (!new_slots)
+        {
+            fprintf(stderr, "index_add() - could not allocate index of %d\n", new_size);
+            return 0;
+        }
+        arena_free(arena, index->slots, index->size * sizeof(int));
+        index->slots = new_slots;
+        index->size = new_size;
+
+        /* rebuild at the new size, including pos itself: */
+        for (i = 0; i < index->size; i++)
+            index->slots[i] = -1;
+        for (i = 0; i < deck->length; i++)
+        {
+            h = card_hash(game, deck_at(deck, i)) & (index->size - 1);
+            while (index->slots[h] != -1)
+                h = (h + 1) & (index->size - 1);
+            index->slots[h] = i;
+        }
+        return 1;
+    }
+
+    h = card_hash(game, deck_at(deck, pos)) & (index->size - 1);
+    while (index->slots[h] != -1)
+        h = (h + 1) & (index->size - 1);
+    index->slots[h] = pos;
+    return 1;
 }
 
-void free_node(MC_MathQuestion* mq) //no, not that freenode.
+
+static void index_clear(MC_Arena* arena, MC_CardIndex* index)
 {
-    if (!mq)
-        return;
-    DEBUGMSG(debug_mathcards, "Freeing card: %s", mq->card.formula_string);
-    free(mq);
+    arena_free(arena, index->slots, index->size * sizeof(int));
+    index->slots = NULL;
+    index->size = 0;
+}
+
+
+
+
+/* Moving cards in and out of play. These leave questions_pending and */
+/* the answered counters to the caller, so the batch functions can    */
+/* update them once per batch:                                        */
+
+/* 'draw' - take the top card off the deck and put it "in play". */
+/* The list must not be empty. Returns 1 on success, 0 otherwise: */
+static int draw_question(MC_MathGame* game, MC_FlashCard* fc)
+{
+    MC_PackedCard card;
+
+    /* a repeat of a wrong answer may have come due: */
+    game->repeats.draws++;
+    if (!repeat_pop_due(game, &card))
+        deck_pop_front(&game->question_list, &card);
+    if (!active_add(&game->arena, &game->active_quests, &card))
+        return 0;
+    /* only now is the question written out as text: */
+    card_render(game, &card, fc);
+    return 1;
 }
 
-MC_MathQuestion* allocate_node()
+
+/* The card in active slot 'slot' was answered correctly in t seconds. */
+/* Returns the points earned:                                           */
+static int retire_correct(MC_MathGame* game, int slot, float t)
 {
-    MC_MathQuestion* ret = NULL;
-    ret = malloc(sizeof(MC_MathQuestion) );
-    if (!ret)
+    MC_PackedCard* quest = &game->active_quests.cards[slot];
+
+    /* Calculate how many points the player should receive, based on */
+    /* difficulty and time required to answer it:                    */
+    int points = calc_score(quest->difficulty, t);
+
+    //Now we either put it back into the main question list in a random
+    //location, or discard it, and then take it out of the "active_quests" set:
+    if (!game->math_opts->iopts[PLAY_THROUGH_LIST])
+        /* reinsert question into question list at random location */
     {
-        printf("Could not allocate space for a new node!\n");
-        return NULL;
+        DEBUGMSG(debug_mathcards, "\nReinserting question into list");
+
+        if (deck_insert_random(&game->arena, &game->rng, &game->question_list, quest))
+            game->quest_list_length++;
+        /* unanswered does not change - was not decremented when */
+        /* question allocated!                                   */
+    }
+    else
+    {
+        DEBUGMSG(debug_mathcards, "\nNot reinserting question into list");
+        /* not recycling questions so fewer questions remain:      */
+        game->unanswered--;
     }
 
-    ret->card = MC_AllocateFlashcard();
-    ret->next = ret->previous = NULL;
+    active_remove(&game->active_quests, slot);
 
-    return ret;
+    /* Record the time it took to answer: */ 
+    MC_AddTimeToList(game, t);
+
+    return points;
+}
+
+
+/* The card in active slot 'slot' was not answered correctly: */
+static void retire_wrong(MC_MathGame* game, int slot)
+{
+    MC_PackedCard* quest = &game->active_quests.cards[slot];
+
+    /* if desired, put question back in list so student sees it again */
+    if (game->math_opts->iopts[REPEAT_WRONGS])
+    {
+        int copies = game->math_opts->iopts[COPIES_REPEATED_WRONGS];
+
+        DEBUGMSG(debug_mathcards, "\nAdding %d copies to question_list:", copies);
+
+        /* can put in more than one copy (to drive the point home!) */
+        /* - they come up one at a time from the repeat queue:      */
+        if (copies > 0 && repeat_schedule(game, quest, copies))
+            game->quest_list_length += copies;
+        /* unanswered stays the same if a single copy recycled or */
+        /* increases by 1 for each "extra" copy reinserted:       */
+        game->unanswered += (game->math_opts->iopts[COPIES_REPEATED_WRONGS] - 1);
+    }
+    else
+    {
+        DEBUGMSG(debug_mathcards, "\nNot repeating wrong answers\n");
+        /* not repeating questions so list gets shorter:      */
+        game->unanswered--;
+    }
+
+    //Add the question to the wrong_quests list, unless an identical
+    //question is already there, then take it out of the active_quests set:
+    add_wrong_card(game, quest);
+
+    active_remove(&game->active_quests, slot);
+}
+
+
+
+
+/* Implementation of packed cards: */
+
+/* Writes out the text of a packed card, as handed to the user interface: */
+static void card_render(MC_MathGame* game, const MC_PackedCard* pc, MC_FlashCard* fc)
+{
+    MC_Operation op = (pc->style & ~MC_STYLE_PLAIN) / MC_NUM_FORMATS;
+    MC_Format f = (pc->style & ~MC_STYLE_PLAIN) % MC_NUM_FORMATS;
+    int result;
+
+    fc->question_id = pc->question_id;
+    fc->answer = pc->answer;
+    fc->difficulty = pc->difficulty;
+
+    switch (pc->kind)
+    {
+        case MC_CARD_TYPING:
+            card_format(fc->formula_string, MC_FORMULA_LEN, "%d", pc->n1, 0, 0);
+            card_format(fc->answer_string, MC_ANSWER_LEN, "%d", pc->n1, 0, 0);
+            break;
+
+        case MC_CARD_ARITHMETIC:
+            result = card_result(op, pc->n1, pc->n2);
+            if (pc->style & MC_STYLE_PLAIN)
+            {
+                /* as written by expr_pack() */
+                if (f == MC_FORMAT_ANS_FIRST)
+                    card_format(fc->formula_string, MC_FORMULA_LEN, "? %c %d = %d",
+                            pc->n2, result, operchars[op]);
+                else if (f == MC_FORMAT_ANS_MIDDLE)
+                    card_format(fc->formula_string, MC_FORMULA_LEN, "%d %c ? = %d",
+                            pc->n1, result, operchars[op]);
+                else
+                    card_format(fc->formula_string, MC_FORMULA_LEN, "%d %c %d = ?",
+                            pc->n1, pc->n2, operchars[op]);
+                card_format(fc->answer_string, MC_ANSWER_LEN, "%d", pc->answer, 0, 0);
+            }
+            else if (f == MC_FORMAT_ANS_FIRST)
+            {
+                card_format(fc->answer_string, MC_ANSWER_LEN, "%d", pc->n1, 0, 0);
+                create_formula_str(game, fc->formula_string, pc->n2, result, op, f);
+            }
+            else if (f == MC_FORMAT_ANS_MIDDLE)
+            {
+                card_format(fc->answer_string, MC_ANSWER_LEN, "%d", pc->n2, 0, 0);
+                create_formula_str(game, fc->formula_string, pc->n1, result, op, f);
+            }
+            else
+            {
+                card_format(fc->answer_string, MC_ANSWER_LEN, "%d", result, 0, 0);
+                create_formula_str(game, fc->formula_string, pc->n1, pc->n2, op, f);
+            }
+            break;
+
+        case MC_CARD_TEXT:
+            memcpy(fc->formula_string, game->card_text[pc->n1].formula_string, MC_FORMULA_LEN);
+            memcpy(fc->answer_string, game->card_text[pc->n1].answer_string, MC_ANSWER_LEN);
+            break;
+
+        default:
+            fc->formula_string[0] = '\0';
+            fc->answer_string[0] = '\0';
+    }
+}
+
+
+/* Packs a card whose text can't be regenerated from its numbers, */
+/* keeping the text in the game's card_text table. Returns 1 if   */
+/* successful, 0 if allocation failed.                            */
+static int card_pack_text(MC_MathGame* game, const MC_FlashCard* fc, MC_PackedCard* pc)
+{
+    memset(pc, 0, sizeof(MC_PackedCard));
+    pc->question_id = fc->question_id;
+    pc->answer = fc->answer;
+    pc->difficulty = fc->difficulty;
+    pc->kind = MC_CARD_TEXT;
+
+    if (game->card_text_length >= game->card_text_capacity)
+    {
+        int new_capacity = game->card_text_capacity ? 2 * game->card_text_capacity : 64;
+        MC_CardText* new_text = arena_alloc(&game->arena, new_capacity * sizeof(MC_CardText));
+
+        if (!new_text)
+        {
+            fprintf(stderr, "card_pack_text() - could not allocate %d entries\n", new_capacity);
+            return 0;
+        }
+        if (game->card_text_length)
+            memcpy(new_text, game->card_text, game->card_text_length * sizeof(MC_CardText));
+        arena_free(&game->arena, game->card_text, game->card_text_capacity * sizeof(MC_CardText));
+        game->card_text = new_text;
+        game->card_text_capacity = new_capacity;
+    }
+
+    pc->n1 = game->card_text_length++;
+    memcpy(game->card_text[pc->n1].formula_string, fc->formula_string, MC_FORMULA_LEN);
+    memcpy(game->card_text[pc->n1].answer_string, fc->answer_string, MC_ANSWER_LEN);
+    return 1;
+}
+
+
+/* Cut-down snprintf() for card text, which is written out every time */
+/* a card is drawn: the first "%d" takes n1, the second n2, and "%c"  */
+/* takes c. Any other conversion (e.g. from a translation) is left to */
+/* the real snprintf().                                               */
+static void card_format(char* buf, int len, const char* fmt, int n1, int n2, char c)
+{
+    char* out = buf;
+    char* end = buf + len - 1;
+    char digits[12];
+    unsigned int u;
+    int nd, args = 0;
+    const char* f;
+
+    for (f = fmt; *f && out < end; f++)
+    {
+        if (*f != '%')
+        {
+            *out++ = *f;
+            continue;
+        }
+        f++;
+        if (*f == 'c')
+            *out++ = c;
+        else if (*f == 'd' && args < 2)
+        {
+            int n = args++ ? n2 : n1;
+
+            if (n < 0)
+            {
+                *out++ = '-';
+                u = -(unsigned int)n;
+            }
+            else
+                u = n;
+            nd = 0;
+            do
+            {
+                digits[nd++] = '0' + u % 10;
+                u /= 10;
+            } while (u);
+            while (nd && out < end)
+                *out++ = digits[--nd];
+        }
+        else
+        {
+            snprintf(buf, len, fmt, n1, n2);
+            return;
+        }
+    }
+    *out = '\0';
+}
+
+
+static int card_result(MC_Operation op, int n1, int n2)
+{
+    switch (op)
+    {
+        case MC_OPER_ADD:
+            return n1 + n2;
+        case MC_OPER_SUB:
+            return n1 - n2;
+        case MC_OPER_MULT:
+            return n1 * n2;
+        case MC_OPER_DIV:
+            return n2 ? n1 / n2 : 0;
+        default:
+            return 0;
+    }
+}
+
+
+/* Forgets the card_text table - its storage belongs to the arena: */
+static void clear_card_text(MC_MathGame* game)
+{
+    game->card_text = NULL;
+    game->card_text_length = 0;
+    game->card_text_capacity = 0;
+}
+
+
+/* Forgets every card the game holds. They all live in the arena, */
+/* so one release takes care of them.                             */
+static void clear_lists(MC_MathGame* game)
+{
+    memset(&game->question_list, 0, sizeof(MC_Deck));
+    memset(&game->wrong_quests, 0, sizeof(MC_Deck));
+    memset(&game->wrong_index, 0, sizeof(MC_CardIndex));
+    memset(&game->active_quests, 0, sizeof(MC_ActiveSet));
+    memset(&game->repeats, 0, sizeof(MC_RepeatQueue));
+    clear_card_text(game);
+    arena_release(&game->arena);
+}
+
+void print_list(FILE* fp, MC_MathGame* game, MC_Deck* deck)
+{
+    int i;
+    MC_FlashCard card;
+
+    if (!deck || !deck->length)
+    {
+        fprintf(fp, "\nprint_list(): list empty or pointer invalid\n");
+        return;
+    }
+
+    for (i = 0; i < deck->length; i++)
+    {
+        card_render(game, deck_at(deck, i), &card);
+        fprintf(fp, "%s\n", card.formula_string);
+    }
+}
+
+
+
+void print_card(MC_FlashCard card)
+{
+    printf("\nprint_card():\n");
+    printf("question_id: %d\nformula_string: %s\nanswer_string: %s\n"
+            "answer: %d\ndifficulty: %d\n\n",
+            card.question_id,
+            card.formula_string,
+            card.answer_string,
+            card.answer,
+            card.difficulty);
+}
+
+/* This sends the values of all "global" counters and the */
+/* lengths of the question lists to stdout - for debugging */
+void print_counters(MC_MathGame *game)
+{
+    printf("\nquest_list_length = \t%d", game->quest_list_length);
+    printf("\nlength of question_list = \t%d", game->question_list.length);
+    printf("\nstarting_length = \t%d", game->starting_length);
+    printf("\nunanswered = \t%d", game->unanswered);
+    printf("\nanswered_correctly = \t%d", game->answered_correctly);
+    printf("\nanswered_wrong = \t%d", game->answered_wrong);
+    printf("\nlength of wrong_quests = \t%d", game->wrong_quests.length);
+    printf("\nquestions_pending = \t%d", game->questions_pending);
+    printf("\nlength of active_quests = \t%d", game->active_quests.length);
+}
+
+
+
+/* compares fields other than pointers */
+static int compare_node(MC_MathGame* game, const MC_PackedCard* first, const MC_PackedCard* other)
+{
+    if (!first || !other)
+        return 0;
+    if (!compare_card(game, first, other) ) //cards are equal
+        return 1;
+    else
+        return 0;
+}
+
+/* Adds card to the wrong_quests list unless an identical card is */
+/* already there. Returns 1 if it was added, 0 otherwise.         */
+static int add_wrong_card(MC_MathGame* game, const MC_PackedCard* card)
+{
+    MC_PackedCard* wrong = NULL;
+
+    if (!card)
+        return 0;
+    if (index_find(game, &game->wrong_index, &game->wrong_quests, card) >= 0)
+        return 0; /* avoid duplicates */
+
+    DEBUGMSG(debug_mathcards, "\nAdding to wrong_quests list");
+    wrong = deck_push_back(&game->arena, &game->wrong_quests);
+    if (!wrong)
+        return 0;
+    *wrong = *card;
+    if (!index_add(&game->arena, game, &game->wrong_index, &game->wrong_quests,
+                game->wrong_quests.length - 1))
+    {
+        game->wrong_quests.length--;
+        return 0;
+    }
+    return 1;
+}
+
+// /* to prevent option settings in math_opts from getting set to */
+// /* values other than 0 or 1                                    */
+// int int_to_bool(int i)
+// {
+//   if (i)
+//     return 1;
+//   else
+//     return 0;
+// }
+
+// /* prevent values from getting into math_opts that are outside */
+// /* the range that can be handled by the program (i.e. more     */
+// /* than three digits; also disallow negatives if that has been */
+// /* selected.                                                   */
+// int sane_value(int i)
+// {
+//   if (i > MC_GLOBAL_MAX)
+//     i = MC_GLOBAL_MAX;
+//   else if (i < -MC_GLOBAL_MAX)
+//     i = -MC_GLOBAL_MAX;
+// 
+//   if (i < 0
+//    && math_opts
+//    && !math_opts->iopts[ALLOW_NEGATIVES])
+//   {
+//     i = 0;
+//   }
+// 
+//   return i;
+// }
+
+// int abs_value(int i)
+// {
+//   if (i > 0)
+//     return i;
+//   else
+//     return -i;
+// }
+
+
+/* Answer time statistics: */
+
+static void time_stats_reset(MC_TimeStats* stats)
+{
+    int i;
+
+    memset(stats, 0, sizeof(MC_TimeStats));
+    for (i = 0; i < MC_NUM_TIME_PERCENTILES; i++)
+        stats->quantiles[i].p = MC_TIME_PERCENTILES[i] / 100.0;
+}
+
+
+/* Adds the count'th observation x to a P-squared quantile estimate. */
+/* The first five observations are simply kept in sorted order:      */
+static void quantile_add(MC_Quantile* q, int count, double x)
+{
+    int i, k;
+    double* h = q->heights;
+    int* n = q->positions;
+
+    if (count <= 5)
+    {
+        /* insertion sort into the first count slots */
+        for (i = count - 1; i > 0 && h[i - 1] > x; i--)
+            h[i] = h[i - 1];
+        h[i] = x;
+        if (count == 5)
+        {
+            for (i = 0; i < 5; i++)
+                n[i] = i;
+            q->desired[0] = 0;
+            q->desired[1] = 2 * q->p;
+            q->desired[2] = 4 * q->p;
+            q->desired[3] = 2 + 2 * q->p;
+            q->desired[4] = 4;
+        }
+        return;
+    }
+
+    /* Find the cell x falls in, stretching the ends if need be: */
+    if (x < h[0])
+    {
+        h[0] = x;
+        k = 0;
+    }
+    else if (x >= h[4])
+    {
+        h[4] = x;
+        k = 3;
+    }
+    else
+        for (k = 0; x >= h[k + 1]; k++)
+            ;
+
+    for (i = k + 1; i < 5; i++)
+        n[i]++;
+    q->desired[1] += q->p / 2;
+    q->desired[2] += q->p;
+    q->desired[3] += (1 + q->p) / 2;
+    q->desired[4] += 1;
+
+    /* Move the middle markers back toward where they should be: */
+    for (i = 1; i < 4; i++)
+    {
+        double d = q->desired[i] - n[i];
+        int step;
+        double hp;
+
+        if (!((d >= 1 && n[i + 1] - n[i] > 1) || (d <= -1 && n[i - 1] - n[i] < -1)))
+            continue;
+        step = (d > 0) ? 1 : -1;
+
+        /* piecewise-parabolic prediction, or linear if that overshoots */
+        hp = h[i] + (double)step / (n[i + 1] - n[i - 1])
+            * ((n[i] - n[i - 1] + step) * (h[i + 1] - h[i]) / (n[i + 1] - n[i])
+               + (n[i + 1] - n[i] - step) * (h[i] - h[i - 1]) / (n[i] - n[i - 1]));
+        if (h[i - 1] < hp && hp < h[i + 1])
+            h[i] = hp;
+        else
+            h[i] += step * (h[i + step] - h[i]) / (n[i + step] - n[i]);
+        n[i] += step;
+    }
+}
+
+
+static double quantile_value(const MC_Quantile* q, int count)
+{
+    int i;
+
+    if (count <= 0)
+        return 0;
+    if (count >= 5)
+        return q->heights[2];
+    /* exact for small samples */
+    i = (int)(q->p * count);
+    if (i > count - 1)
+        i = count - 1;
+    return q->heights[i];
+}
+
+
+
+/* Implementation of saved games: */
+
+static void state_put(state_buf* buf, const void* data, size_t n)
+{
+    if (!buf->ok)
+        return;
+    if (buf->length + n > buf->capacity)
+    {
+        size_t new_capacity = buf->capacity ? buf->capacity : 4096;
+        unsigned char* new_data;
+
+        while (new_capacity < buf->length + n)
+            new_capacity *= 2;
+        new_data = realloc(buf->data, new_capacity);
+        if (!new_data)
+        {
+            buf->ok = 0;
+            return;
+        }
+        buf->data = new_data;
+        buf->capacity = new_capacity;
+    }
+    memcpy(buf->data + buf->length, data, n);
+    buf->length += n;
+}
+
+
+static void state_put_u32(state_buf* buf, uint32_t v)
+{
+    unsigned char b[4];
+
+    b[0] = v;
+    b[1] = v >> 8;
+    b[2] = v >> 16;
+    b[3] = v >> 24;
+    state_put(buf, b, 4);
+}
+
+
+static void state_put_u64(state_buf* buf, uint64_t v)
+{
+    state_put_u32(buf, (uint32_t)v);
+    state_put_u32(buf, (uint32_t)(v >> 32));
+}
+
+
+/* doubles are written as their IEEE 754 bit patterns: */
+static void state_put_double(state_buf* buf, double v)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &v, sizeof(bits));
+    state_put_u64(buf, bits);
+}
+
+
+static void state_put_card(state_buf* buf, const MC_PackedCard* pc)
+{
+    unsigned char b[MC_STATE_CARD_BYTES];
+    int fields[4];
+    int i;
+
+    fields[0] = pc->question_id;
+    fields[1] = pc->answer;
+    fields[2] = pc->n1;
+    fields[3] = pc->n2;
+    for (i = 0; i < 4; i++)
+    {
+        b[4 * i] = fields[i];
+        b[4 * i + 1] = (unsigned int)fields[i] >> 8;
+        b[4 * i + 2] = (unsigned int)fields[i] >> 16;
+        b[4 * i + 3] = (unsigned int)fields[i] >> 24;
+    }
+    b[16] = (unsigned short)pc->difficulty;
+    b[17] = (unsigned short)pc->difficulty >> 8;
+    b[18] = pc->kind;
+    b[19] = pc->style;
+    state_put(buf, b, MC_STATE_CARD_BYTES);
+}
+
+
+/* Text is written as a length byte and the characters, without */
+/* the padding of its fixed-size array:                          */
+static void state_put_text(state_buf* buf, const char* text, int size)
+{
+    unsigned char n = 0;
+
+    while (n < size - 1 && n < 255 && text[n])
+        n++;
+    state_put(buf, &n, 1);
+    state_put(buf, text, n);
+}
+
+
+static void state_get(state_buf* buf, void* data, size_t n)
+{
+    if (!buf->ok || buf->length - buf->pos < n)
+    {
+        buf->ok = 0;
+        memset(data, 0, n);
+        return;
+    }
+    memcpy(data, buf->data + buf->pos, n);
+    buf->pos += n;
+}
+
+
+static uint32_t state_get_u32(state_buf* buf)
+{
+    unsigned char b[4];
+
+    state_get(buf, b, 4);
+    return b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24;
+}
+
+
+static uint64_t state_get_u64(state_buf* buf)
+{
+    uint64_t lo = state_get_u32(buf);
+
+    return lo | (uint64_t)state_get_u32(buf) << 32;
+}
+
+
+static double state_get_double(state_buf* buf)
+{
+    uint64_t bits = state_get_u64(buf);
+    double v;
+
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+
+static void state_get_text(state_buf* buf, char* text, int size)
+{
+    unsigned char n;
+
+    state_get(buf, &n, 1);
+    if (n >= size)
+        buf->ok = 0;
+    if (!buf->ok)
+    {
+        text[0] = '\0';
+        return;
+    }
+    state_get(buf, text, n);
+    text[n] = '\0';
+}
+
+
+/* Reads the length of a list whose entries take record_size bytes */
+/* each, and checks that the rest of the body can hold them:       */
+static int state_get_count(state_buf* buf, size_t record_size)
+{
+    uint32_t n = state_get_u32(buf);
+
+    if (!buf->ok || n > INT_MAX / 2 || n > (buf->length - buf->pos) / record_size)
+    {
+        buf->ok = 0;
+        return -1;
+    }
+    return n;
+}
+
+
+/* Reads a card, checking it can be rendered. Returns 1 if so: */
+static int state_get_card(MC_MathGame* game, state_buf* buf, MC_PackedCard* pc)
+{
+    unsigned char b[MC_STATE_CARD_BYTES];
+    int i;
+
+    state_get(buf, b, MC_STATE_CARD_BYTES);
+    if (!buf->ok)
+        return 0;
+
+    memset(pc, 0, sizeof(MC_PackedCard));
+    pc->question_id = (int)(b[0] | (uint32_t)b[1] << 8 | (uint32_t)b[2] << 16 | (uint32_t)b[3] << 24);
+    pc->answer = (int)(b[4] | (uint32_t)b[5] << 8 | (uint32_t)b[6] << 16 | (uint32_t)b[7] << 24);
+    pc->n1 = (int)(b[8] | (uint32_t)b[9] << 8 | (uint32_t)b[10] << 16 | (uint32_t)b[11] << 24);
+    pc->n2 = (int)(b[12] | (uint32_t)b[13] << 8 | (uint32_t)b[14] << 16 | (uint32_t)b[15] << 24);
+    pc->difficulty = (short)(b[16] | b[17] << 8);
+    pc->kind = b[18];
+    pc->style = b[19];
+
+    switch (pc->kind)
+    {
+        case MC_CARD_TYPING:
+            return 1;
+        case MC_CARD_ARITHMETIC:
+            i = pc->style & ~MC_STYLE_PLAIN;
+            return i < MC_NUM_OPERS * MC_NUM_FORMATS;
+        case MC_CARD_TEXT:
+            return pc->n1 >= 0 && pc->n1 < game->card_text_length;
+        default:
+            return 0;
+    }
+}
+
+
+/* Replaces deck (which must be empty) with a list read from buf: */
+static int state_get_deck(MC_MathGame* game, state_buf* buf, MC_Deck* deck)
+{
+    MC_PackedCard* pc;
+    int i, n = state_get_count(buf, MC_STATE_CARD_BYTES);
+
+    if (n < 0 || !deck_reserve(&game->arena, deck, n))
+        return 0;
+    for (i = 0; i < n; i++)
+    {
+        pc = deck_push_back(&game->arena, deck);
+        if (!pc || !state_get_card(game, buf, pc))
+            return 0;
+    }
+    return 1;
+}
+
+
+/* Sets the game up from a saved body that has passed its checksum. */
+/* Returns 1 if successful, 0 if the body doesn't make sense (in    */
+/* which case the game is left half loaded for the caller to clear).*/
+static int state_load_body(MC_MathGame* game, state_buf* buf)
+{
+    MC_RepeatQueue* queue = &game->repeats;
+    MC_TimeStats* times = &game->answer_times;
+    MC_PackedCard pc;
+    int i, j, n;
+
+    if (state_get_u32(buf) != NOPTS
+            || state_get_u32(buf) != MC_NUM_TIME_PERCENTILES
+            || state_get_u32(buf) != MC_FORMULA_LEN
+            || state_get_u32(buf) != MC_ANSWER_LEN)
+        return 0;
+    for (i = 0; i < NOPTS; i++)
+        game->math_opts->iopts[i] = (int)state_get_u32(buf);
+
+    game->rng.state = state_get_u64(buf);
+    game->rng.inc = state_get_u64(buf);
+    game->seed = state_get_u32(buf);
+    game->fixed_seed = (int)state_get_u32(buf);
+    game->next_card_id = (int)state_get_u32(buf);
+
+    game->quest_list_length = (int)state_get_u32(buf);
+    game->answered_correctly = (int)state_get_u32(buf);
+    game->answered_wrong = (int)state_get_u32(buf);
+    game->questions_pending = (int)state_get_u32(buf);
+    game->unanswered = (int)state_get_u32(buf);
+    game->starting_length = (int)state_get_u32(buf);
+
+    times->count = (int)state_get_u32(buf);
+    times->total = state_get_double(buf);
+    for (i = 0; i < MC_NUM_TIME_PERCENTILES; i++)
+    {
+        MC_Quantile* q = &times->quantiles[i];
+        q->p = state_get_double(buf);
+        for (j = 0; j < 5; j++)
+        {
+            q->heights[j] = state_get_double(buf);
+            q->positions[j] = (int)state_get_u32(buf);
+            q->desired[j] = state_get_double(buf);
+        }
+    }
+    if (!buf->ok)
+        return 0;
+
+    /* now the lists, from scratch, with samplers to match the options */
+    /* in case more questions get generated later:                     */
+    clear_lists(game);
+    translate_formulas(game);
+    if (!build_samplers(game))
+        return 0;
+
+    n = state_get_count(buf, 2);
+    if (n > 0)
+    {
+        game->card_text_capacity = 64;
+        while (game->card_text_capacity < n)
+            game->card_text_capacity *= 2;
+        game->card_text = arena_alloc(&game->arena, game->card_text_capacity * sizeof(MC_CardText));
+        if (!game->card_text)
+        {
+            game->card_text_capacity = 0;
+            return 0;
+        }
+        for (i = 0; i < n; i++)
+        {
+            state_get_text(buf, game->card_text[i].formula_string, MC_FORMULA_LEN);
+            state_get_text(buf, game->card_text[i].answer_string, MC_ANSWER_LEN);
+        }
+        if (!buf->ok)
+            return 0;
+        game->card_text_length = n;
+    }
+    else if (n < 0)
+        return 0;
+
+    if (!state_get_deck(game, buf, &game->question_list))
+        return 0;
+    if (!state_get_deck(game, buf, &game->wrong_quests))
+        return 0;
+    for (i = 0; i < game->wrong_quests.length; i++)
+    {
+        if (!index_add(&game->arena, game, &game->wrong_index, &game->wrong_quests, i))
+            return 0;
+    }
+
+    n = state_get_count(buf, MC_STATE_CARD_BYTES);
+    if (n < 0)
+        return 0;
+    for (i = 0; i < n; i++)
+    {
+        if (!state_get_card(game, buf, &pc)
+                || !active_add(&game->arena, &game->active_quests, &pc))
+            return 0;
+    }
+
+    /* the heap is restored in its saved order so that repeats that */
+    /* are due together still come up in the same order:            */
+    queue->draws = (int)state_get_u32(buf);
+    n = state_get_count(buf, MC_STATE_CARD_BYTES + 8);
+    if (n < 0)
+        return 0;
+    if (n > 0)
+    {
+        queue->capacity = 16;
+        while (queue->capacity < n)
+            queue->capacity *= 2;
+        queue->heap = arena_alloc(&game->arena, queue->capacity * sizeof(MC_Repeat));
+        if (!queue->heap)
+        {
+            queue->capacity = 0;
+            return 0;
+        }
+    }
+    for (i = 0; i < n; i++)
+    {
+        MC_Repeat* r = &queue->heap[i];
+        if (!state_get_card(game, buf, &r->card))
+            return 0;
+        r->due = (int)state_get_u32(buf);
+        r->copies = (int)state_get_u32(buf);
+        if (r->copies <= 0 || r->copies > INT_MAX - queue->copies
+                || (i > 0 && queue->heap[(i - 1) / 2].due > r->due))
+            return 0;
+        queue->copies += r->copies;
+        queue->length++;
+    }
+
+    /* anything left over means the file isn't what we think it is: */
+    return buf->ok && buf->pos == buf->length;
+}
+
+
+/* FNV-1a, as for card_hash(): */
+static uint32_t state_checksum(const unsigned char* data, size_t n)
+{
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        h = (h ^ data[i]) * 16777619u;
+    return h;
+}
+
+
+/****************************************************
+  Functions for new mathcards architecture
+ ****************************************************/
+
+void MC_CopyCard(const MC_FlashCard* src, MC_FlashCard* dest)
+{
+    if (!src || !dest)
+        return;
+    DEBUGMSG(debug_mathcards, "Copying '%s' to '%s', ", src->formula_string,dest->formula_string);
+    DEBUGMSG(debug_mathcards, "copying '%s' to '%s'\n", src->answer_string, dest->answer_string);
+    strncpy(dest->formula_string, src->formula_string, MC_FORMULA_LEN);
+    strncpy(dest->answer_string, src->answer_string, MC_ANSWER_LEN);
+    DEBUGMSG(debug_mathcards, "Card is: '%s', '%s'\n", dest->formula_string, dest->answer_string);
+    dest->answer = src->answer;
+    dest->difficulty = src->difficulty;
+    dest->question_id = src->question_id;
+}
+
+/*
+   The function that does the central dirty work pertaining to flashcard
+   creation. Extensible to just about any kind of math problem, perhaps
+   with the exception of those with multiple answers, such as "8 + 2 > ?"
+   Simply specify how the problem is presented to the user, and the
+   answer the game should look for, as numbers.
+
+   Cards are made MC_BULK_CARDS at a time onto the bottom of the deck:
+   the random numbers for a whole batch come first, from a counter-based
+   generator whose loop has no dependence from one number to the next
+   (so the compiler can vectorize it), and each card is then just table
+   lookups and arithmetic on its own numbers. The samplers only ever
+   give valid questions, so nothing needs to be filtered out, and no
+   text is written until a card is drawn. Longer order of operations
+   questions are built one at a time by random_expr_card().
+   Returns 1 if successful, 0 if the deck couldn't be made big enough
+   or a question couldn't be made.
+   */
+#define MC_BULK_CARDS 256
+
+/* The random numbers each card gets, stored field by field: */
+enum {
+    BULK_TYPE,
+    BULK_LENGTH,
+    BULK_OPER,
+    BULK_SLOT,
+    BULK_KEEP,
+    BULK_SECOND,
+    BULK_FORMAT,
+    BULK_FIELDS
+};
+
+static int generate_random_flashcards(MC_MathGame* game, MC_Deck* deck, int n)
+{
+    MC_Samplers* samplers = &game->samplers;
+    uint32_t rnd[BULK_FIELDS * MC_BULK_CARDS];
+    uint32_t* r;
+    uint64_t key, counter = 0;
+    int min_length = MC_GetOpt(game, MIN_FORMULA_NUMS);
+    int lengths = MC_GetOpt(game, MAX_FORMULA_NUMS) - min_length + 1;
+    int min_typing = MC_GetOpt(game, MIN_TYPING_NUM);
+    int typing_nums = MC_GetOpt(game, MAX_TYPING_NUM) - min_typing + 1;
+    const MC_OperandTable* table;
+    MC_PackedCard* pc;
+    MC_ProblemType pt;
+    MC_Operation op;
+    MC_Format format;
+    int done, count, i, k, x, y, ans, length, nf;
+
+    DEBUGMSG(debug_mathcards, "Entering generate_random_flashcards() for %d cards\n", n);
+
+    if (n <= 0)
+        return 1;
+    if (!deck_reserve(&game->arena, deck, deck->length + n))
+        return 0;
+
+    //each batch gets its own run of the counter, and the game's own
+    //generator just picks where the runs start
+    key = (uint64_t)rng_next(&game->rng) << 32 | rng_next(&game->rng);
+
+    for (done = 0; done < n; done += count)
+    {
+        count = (n - done < MC_BULK_CARDS) ? n - done : MC_BULK_CARDS;
+        bulk_random(key, counter, rnd, BULK_FIELDS * MC_BULK_CARDS);
+        counter += BULK_FIELDS * MC_BULK_CARDS / 2;
+
+        for (i = 0; i < count; i++)
+        {
+            r = rnd + i;
+            pc = deck_at(deck, deck->length);
+            memset(pc, 0, sizeof(MC_PackedCard));
+            pc->question_id = ++game->next_card_id;
+            deck->length++;
+
+            //choose one of the allowed problem types
+            if (samplers->num_types > 0)
+                pt = samplers->types[scale_below(r[BULK_TYPE * MC_BULK_CARDS], samplers->num_types)];
+            else
+                pt = MC_PT_ARITHMETIC;
+
+            if (pt == MC_PT_TYPING) //typing practice
+            {
+                x = min_typing + scale_below(r[BULK_SECOND * MC_BULK_CARDS], typing_nums);
+                pc->kind = MC_CARD_TYPING;
+                pc->n1 = x;
+                pc->answer = x;
+                pc->difficulty = 10;
+                continue;
+            }
+
+            length = min_length + scale_below(r[BULK_LENGTH * MC_BULK_CARDS], lengths);
+            //build_samplers() made sure there are valid questions, so
+            //these only fail if we run out of memory - but a blank card
+            //must never be dealt either way
+            if (length > 2)
+            {
+                if (!random_expr_card(game, length, pc->question_id, pc))
+                {
+                    deck->length--;
+                    return 0;
+                }
+                continue;
+            }
+            if (samplers->num_opers == 0)
+            {
+                deck->length--;
+                return 0;
+            }
+
+            /* Plain "a op b = c" questions are kept as numbers, in the */
+            /* same style as random_expr_card() writes longer ones.    */
+            /* The operation is uniform over those with any valid      */
+            /* questions, and the operands uniform over the valid      */
+            /* pairs for that operation (see sample_operands()):       */
+            op = samplers->opers[scale_below(r[BULK_OPER * MC_BULK_CARDS], samplers->num_opers)];
+            table = &samplers->operands[op];
+            k = scale_below(r[BULK_SLOT * MC_BULK_CARDS], table->count);
+            if (r[BULK_KEEP * MC_BULK_CARDS] >= table->keep[k])
+                k = table->alias[k];
+            x = table->first_min + k;
+            y = table->second_min[k] + scale_below(r[BULK_SECOND * MC_BULK_CARDS], table->second_count[k]);
+
+            switch (op)
+            {
+                case MC_OPER_ADD:
+                    ans = x + y;
+                    break;
+                case MC_OPER_SUB:
+                    ans = x - y;
+                    break;
+                case MC_OPER_MULT:
+                    ans = x * y;
+                    break;
+                default:
+                    ans = x;
+                    x *= y;
+            }
+
+            nf = samplers->num_formats[op];
+            format = nf ? samplers->formats[op][scale_below(r[BULK_FORMAT * MC_BULK_CARDS], nf)]
+                : MC_FORMAT_ANS_LAST;
+            pc->kind = MC_CARD_ARITHMETIC;
+            pc->style = (op * MC_NUM_FORMATS + format) | MC_STYLE_PLAIN;
+            pc->n1 = x;
+            pc->n2 = y;
+            pc->answer = (format == MC_FORMAT_ANS_FIRST) ? x
+                : (format == MC_FORMAT_ANS_MIDDLE) ? y : ans;
+            pc->difficulty = op + 1;
+        }
+    }
+    //TODO comparison problems (e.g. "6 ? 9", "<")
+
+    DEBUGCODE(debug_mathcards)
+    {
+        MC_FlashCard card;
+        for (i = deck->length - n; i < deck->length; i++)
+        {
+            card_render(game, deck_at(deck, i), &card);
+            print_card(card);
+        }
+    }
+    DEBUGMSG(debug_mathcards, "Exiting generate_random_flashcards()\n");
+    return 1;
+}
+
+
+/* Fills out[0..n) (n even) with the random numbers numbered counter */
+/* onwards of the stream selected by key. This is SplitMix64 - each */
+/* pair of numbers is a hash of its own position, so they can all   */
+/* be computed side by side.                                        */
+static void bulk_random(uint64_t key, uint64_t counter, uint32_t* out, int n)
+{
+    uint64_t z;
+    int i;
+
+    for (i = 0; i < n / 2; i++)
+    {
+        z = key + (counter + i) * 0x9e3779b97f4a7c15ull;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        z ^= z >> 31;
+        out[2 * i] = (uint32_t)z;
+        out[2 * i + 1] = (uint32_t)(z >> 32);
+    }
+}
+
+
+/* Same mapping as rng_below(), for numbers drawn elsewhere: */
+static unsigned int scale_below(uint32_t r, int n)
+{
+    if (n <= 0)
+        return 0;
+    return (unsigned int)(((uint64_t)r * (uint32_t)n) >> 32);
+}
+
+/* Implementation of order of operations questions - see expr_tree above. */
+
+/* Starts a tree with the question "n1 op n2", which must be valid: */
+static void expr_start(expr_tree* e, MC_Operation op, int n1, int n2)
+{
+    e->nums[0] = n1;
+    e->nums[1] = n2;
+    e->ops[0] = op;
+    e->length = 2;
+    e->sum = 0;
+    e->sign = 1;
+    switch (op)
+    {
+        case MC_OPER_ADD:
+            e->sum = n1;
+            e->term = n2;
+            break;
+        case MC_OPER_SUB:
+            e->sum = n1;
+            e->term = n2;
+            e->sign = -1;
+            break;
+        case MC_OPER_MULT:
+            e->term = n1 * n2;
+            break;
+        default:
+            e->term = n1 / n2;
+    }
+    e->difficulty = op + 1;
+}
+
+
+static int expr_value(const expr_tree* e)
+{
+    return e->sum + e->sign * e->term;
+}
+
+
+/* The operands allowed after op, from the second operand options  */
+/* (addend, subtrahend, multiplicand, divisor). Returns 0 if none: */
+static int expr_operand_range(MC_MathGame* game, MC_Operation op, int* lo, int* hi)
+{
+    if (op == MC_OPER_DIV)
+    {
+        *lo = MC_GetOpt(game, MIN_DIVISOR);
+        *hi = MC_GetOpt(game, MAX_DIVISOR);
+        if (*lo < 1)
+            *lo = 1; //don't divide by zero
+    }
+    else
+    {
+        *lo = MC_GetOpt(game, MIN_ADDEND + 4 * op);
+        *hi = MC_GetOpt(game, MAX_ADDEND + 4 * op);
+    }
+    return *lo <= *hi;
+}
+
+
+//integer division rounding down and up, for any signs:
+static int floor_div(int a, int b)
+{
+    int q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+static int ceil_div(int a, int b)
+{
+    int q = a / b;
+    return (a % b != 0 && (a < 0) == (b < 0)) ? q + 1 : q;
+}
+
+
+/* Narrows the operands allowed after op down to those that keep the   */
+/* value in range (from 0, or -MAX_ANSWER with negatives, to          */
+/* MAX_ANSWER). Divisors must also divide the last term, which isn't  */
+/* a range, so that is left to the caller. Returns 0 if none are left. */
+static int expr_next_range(MC_MathGame* game, const expr_tree* e, MC_Operation op, int* lo, int* hi)
+{
+    int max = MC_GetOpt(game, MAX_ANSWER);
+    int min = MC_GetOpt(game, ALLOW_NEGATIVES) ? -max : 0;
+    int value = expr_value(e);
+    int c, a, b;
+
+    if (!expr_operand_range(game, op, lo, hi))
+        return 0;
+
+    switch (op)
+    {
+        case MC_OPER_ADD: // min <= value + n <= max
+            a = min - value;
+            b = max - value;
+            break;
+        case MC_OPER_SUB: // min <= value - n <= max
+            a = value - max;
+            b = value - min;
+            break;
+        case MC_OPER_MULT: // min <= sum + c * n <= max
+            c = e->sign * e->term;
+            if (c == 0)
+                return e->sum >= min && e->sum <= max;
+            if (c > 0)
+            {
+                a = ceil_div(min - e->sum, c);
+                b = floor_div(max - e->sum, c);
+            }
+            else
+            {
+                a = ceil_div(max - e->sum, c);
+                b = floor_div(min - e->sum, c);
+            }
+            break;
+        default: // dividing moves the value toward sum, so stays in range
+            return 1;
+    }
+    if (a > *lo)
+        *lo = a;
+    if (b < *hi)
+        *hi = b;
+    return *lo <= *hi;
+}
+
+
+/* Adds "op n" to the end of the tree if that gives a valid question.   */
+/* Returns 1 if it did, 0 otherwise (leaving the tree as it was).       */
+static int expr_append(MC_MathGame* game, expr_tree* e, MC_Operation op, int n)
+{
+    int lo, hi;
+
+    if (e->length >= MC_MAX_EXPR_NUMS
+            || !expr_next_range(game, e, op, &lo, &hi)
+            || n < lo || n > hi)
+        return 0;
+
+    switch (op)
+    {
+        case MC_OPER_ADD:
+        case MC_OPER_SUB:
+            e->sum = expr_value(e);
+            e->term = n;
+            e->sign = (op == MC_OPER_ADD) ? 1 : -1;
+            break;
+        case MC_OPER_MULT:
+            e->term *= n;
+            break;
+        default:
+            if (e->term % n != 0)
+                return 0;
+            e->term /= n;
+    }
+    e->nums[e->length] = n;
+    e->ops[e->length - 1] = op;
+    e->length++;
+    e->difficulty += (e->length - 1) + op;
+    return 1;
+}
+
+
+/* A number can be asked for ("? + 3 x 4 = 20") only if the answer  */
+/* would be unique, i.e. the value doesn't stay the same whatever  */
+/* it is. Each term is a product of some operands over a product of */
+/* others (its divisors), so that means a hidden factor must not be */
+/* multiplied by zero, and a hidden divisor must not divide zero.   */
+static int expr_determinate(const expr_tree* e, int k)
+{
+    int first = k, last = k, i;
+
+    //find the term holding nums[k]
+    while (first > 0 && (e->ops[first - 1] == MC_OPER_MULT || e->ops[first - 1] == MC_OPER_DIV))
+        first--;
+    while (last < e->length - 1 && (e->ops[last] == MC_OPER_MULT || e->ops[last] == MC_OPER_DIV))
+        last++;
+
+    for (i = first; i <= last; i++)
+    {
+        if (i == k && !(k > first && e->ops[k - 1] == MC_OPER_DIV))
+            continue; //the hidden factor itself
+        if (i > first && e->ops[i - 1] == MC_OPER_DIV)
+            continue; //divisors are never zero
+        if (e->nums[i] == 0)
+            return 0;
+    }
+    return 1;
+}
+
+
+/* Writes the tree out as a card in the style of the plain two-operand */
+/* cards, asking for the first operand, the second, or the value.      */
+/* Returns 1 if successful, 0 if the format is no good for this tree.  */
+static int expr_pack(MC_MathGame* game, const expr_tree* e, MC_Format f, int id, MC_PackedCard* pc)
+{
+    MC_FlashCard fc;
+    char* out = fc.formula_string;
+    char* end = fc.formula_string + MC_FORMULA_LEN;
+    int hidden = (f == MC_FORMAT_ANS_FIRST) ? 0 : (f == MC_FORMAT_ANS_MIDDLE) ? 1 : -1;
+    int i;
+
+    if (hidden >= 0 && !expr_determinate(e, hidden))
+        return 0;
+
+    for (i = 0; i < e->length; i++)
+    {
+        if (i > 0)
+            out += snprintf(out, end - out, " %c ", operchars[e->ops[i - 1]]);
+        if (i == hidden)
+            out += snprintf(out, end - out, "?");
+        else
+            out += snprintf(out, end - out, "%d", e->nums[i]);
+    }
+    if (hidden >= 0)
+        snprintf(out, end - out, " = %d", expr_value(e));
+    else
+        snprintf(out, end - out, " = ?");
+
+    fc.answer = (hidden >= 0) ? e->nums[hidden] : expr_value(e);
+    snprintf(fc.answer_string, MC_ANSWER_LEN, "%d", fc.answer);
+    fc.difficulty = e->difficulty;
+    fc.question_id = id;
+    return card_pack_text(game, &fc, pc);
+}
+
+
+/* The range of question lengths asked for by MIN_FORMULA_NUMS and */
+/* MAX_FORMULA_NUMS, limited to what we can write out:            */
+static void formula_lengths(MC_MathGame* game, int* shortest, int* longest)
+{
+    *shortest = MC_GetOpt(game, MIN_FORMULA_NUMS);
+    *longest = MC_GetOpt(game, MAX_FORMULA_NUMS);
+    if (*shortest < 2)
+        *shortest = 2;
+    if (*shortest > MC_MAX_EXPR_NUMS)
+        *shortest = MC_MAX_EXPR_NUMS;
+    if (*longest > MC_MAX_EXPR_NUMS)
+        *longest = MC_MAX_EXPR_NUMS;
+    if (*longest < *shortest)
+        *longest = *shortest;
+}
+
+
+/* Builds a random question of the given number of operands in one pass: */
+/* each step picks among the operations that can still be done, then an */
+/* operand for it from those that keep the value in range. If no step   */
+/* is possible the question is left shorter. Returns 1 if successful.   */
+static int random_expr_card(MC_MathGame* game, int length, int id, MC_PackedCard* pc)
+{
+    MC_Samplers* samplers = &game->samplers;
+    MC_Operation op, feasible[MC_NUM_OPERS];
+    int lo[MC_NUM_OPERS], hi[MC_NUM_OPERS];
+    int r1, r2, ans, i, n, num_feasible;
+    MC_Format format;
+    expr_tree e;
+
+    if (!random_operands(game, &op, &r1, &r2, &ans))
+        return 0;
+    expr_start(&e, op, r1, r2);
+    if (length > MC_MAX_EXPR_NUMS)
+        length = MC_MAX_EXPR_NUMS;
+
+    while (e.length < length)
+    {
+        num_feasible = 0;
+        for (i = 0; i < samplers->num_allowed; i++)
+        {
+            op = samplers->allowed[i];
+            if (!expr_next_range(game, &e, op, &lo[op], &hi[op]))
+                continue;
+            if (op == MC_OPER_DIV)
+            {
+                //need a divisor of the last term in the table
+                n = e.term < 0 ? -e.term : e.term;
+                if (n > samplers->max_dividend
+                        || samplers->divisor_start[n + 1] == samplers->divisor_start[n])
+                    continue;
+            }
+            feasible[num_feasible++] = op;
+        }
+        if (!num_feasible)
+        {
+            DEBUGMSG(debug_mathcards, "Question stops at %d operands\n", e.length);
+            break;
+        }
+
+        op = feasible[rng_below(&game->rng, num_feasible)];
+        if (op == MC_OPER_DIV)
+            n = find_divisor(game, e.term);
+        else
+            n = lo[op] + rng_below(&game->rng, hi[op] - lo[op] + 1);
+        expr_append(game, &e, op, n);
+    }
+
+    //the format goes by the first operation, as it holds the
+    //numbers that FORMAT_ANSWER_FIRST and _MIDDLE ask for
+    format = random_format(game, e.ops[0]);
+    if (expr_pack(game, &e, format, id, pc))
+        return 1;
+    return expr_pack(game, &e, MC_FORMAT_ANS_LAST, id, pc);
+}
+
+
+/* Number of (possibly invalid) trees of the given length that      */
+/* expr_tree_card() enumerates: every first pair of operands, times */
+/* every (operation, operand) step for each further operand, times  */
+/* the three formats. Also gives the number of pairs and steps.     */
+/* Returns -1 if there are more than MC_MAX_ENUM_TREES.             */
+static int expr_tree_count(MC_MathGame* game, int length, int* pairs, int* steps)
+{
+    int k, lo, hi, n_first, n_second;
+    double total;
+
+    *pairs = *steps = 0;
+    for (k = MC_OPER_ADD; k < MC_NUM_OPERS; ++k)
+    {
+        if (!MC_GetOpt(game, k + ADDITION_ALLOWED))
+            continue;
+        n_first = MC_GetOpt(game, MAX_AUGEND + 4 * k) - MC_GetOpt(game, MIN_AUGEND + 4 * k) + 1;
+        n_second = MC_GetOpt(game, MAX_ADDEND + 4 * k) - MC_GetOpt(game, MIN_ADDEND + 4 * k) + 1;
+        if (n_first > 0 && n_second > 0)
+            *pairs += n_first * n_second;
+        if (expr_operand_range(game, k, &lo, &hi))
+            *steps += hi - lo + 1;
+    }
+
+    total = (double)*pairs * MC_NUM_FORMATS;
+    for (k = 2; k < length; k++)
+        total *= *steps;
+    if (total > MC_MAX_ENUM_TREES)
+        return -1;
+    return (int)total;
+}
+
+
+/* Maps an index in [0, expr_tree_count()) to a tree of the given   */
+/* length - with the format varying fastest, then the last operand, */
+/* and so on back to the first pair, in the same order as for the   */
+/* two operand questions. Returns 1 and fills in pc if the question */
+/* is valid, 0 if it is screened out. Sets too large to list are    */
+/* taken as MC_MAX_ENUM_TREES slots, each a random tree.             */
+static int expr_tree_card(MC_MathGame* game, int length, int index, MC_PackedCard* pc)
+{
+    int step[MC_MAX_EXPR_NUMS];
+    int pairs, steps, k, i, n_first, n_second, lo, hi, s;
+    MC_Format f, formats[MC_NUM_FORMATS];
+    MC_PackedCard pair;
+    expr_tree e;
+
+    k = expr_tree_count(game, length, &pairs, &steps);
+    if (k < 0)
+        return random_expr_card(game, length, 0, pc);
+    if (index >= k)
+        return 0;
+
+    f = index % MC_NUM_FORMATS;
+    index /= MC_NUM_FORMATS;
+    for (i = length - 1; i >= 2; i--)
+    {
+        step[i] = index % steps;
+        index /= steps;
+    }
+
+    //the first pair, screened just like a two operand question
+    for (k = MC_OPER_ADD; k < MC_NUM_OPERS; ++k)
+    {
+        if (!MC_GetOpt(game, k + ADDITION_ALLOWED))
+            continue;
+        n_first = MC_GetOpt(game, MAX_AUGEND + 4 * k) - MC_GetOpt(game, MIN_AUGEND + 4 * k) + 1;
+        n_second = MC_GetOpt(game, MAX_ADDEND + 4 * k) - MC_GetOpt(game, MIN_ADDEND + 4 * k) + 1;
+        if (n_first <= 0 || n_second <= 0)
+            continue;
+        if (index < n_first * n_second)
+            break;
+        index -= n_first * n_second;
+    }
+    if (k == MC_NUM_OPERS
+            || !make_arithmetic_card(game, k,
+                MC_GetOpt(game, MIN_AUGEND + 4 * k) + index / n_second,
+                MC_GetOpt(game, MIN_ADDEND + 4 * k) + index % n_second,
+                MC_FORMAT_ANS_LAST, &pair))
+        return 0;
+    expr_start(&e, k, pair.n1, pair.n2);
+
+    //then each further (operation, operand)
+    for (i = 2; i < length; i++)
+    {
+        s = step[i];
+        for (k = MC_OPER_ADD; k < MC_NUM_OPERS; ++k)
+        {
+            if (!MC_GetOpt(game, k + ADDITION_ALLOWED)
+                    || !expr_operand_range(game, k, &lo, &hi))
+                continue;
+            if (s <= hi - lo)
+                break;
+            s -= hi - lo + 1;
+        }
+        if (k == MC_NUM_OPERS || !expr_append(game, &e, k, lo + s))
+            return 0;
+    }
+
+    //only the formats allowed for the first operation
+    for (i = comprehensive_formats(game, e.ops[0], formats) - 1; i >= 0; i--)
+        if (formats[i] == f)
+            break;
+    if (i < 0)
+        return 0;
+    return expr_pack(game, &e, f, 0, pc);
+}
+
+
+
+/* Picks a random allowed operation and two operands in range for it,  */
+/* giving "r1 op r2 = ans". Returns 1 if successful, 0 otherwise.       */
+/* The operation is uniform over those with any valid questions, and  */
+/* the operands uniform over the valid pairs for that operation.      */
+static int random_operands(MC_MathGame* game, MC_Operation* op, int* r1, int* r2, int* ans)
+{
+    MC_Samplers* samplers = &game->samplers;
+
+    if (samplers->num_opers == 0)
+    {
+        DEBUGMSG(debug_mathcards, "No allowed operation has any valid questions\n");
+        return 0;
+    }
+
+    *op = samplers->opers[rng_below(&game->rng, samplers->num_opers)];
+    DEBUGMSG(debug_mathcards, "Operation is %c\n", operchars[*op]);
+
+    //choose two numbers in the proper range and get their result
+    sample_operands(&game->rng, &samplers->operands[*op], r1, r2);
+
+    if (*op == MC_OPER_ADD)
+        *ans = *r1 + *r2;
+    if (*op == MC_OPER_SUB)
+        *ans = *r1 - *r2;
+    if (*op == MC_OPER_MULT)
+        *ans = *r1 * *r2;
+    if (*op == MC_OPER_DIV)  
+    {
+        *ans = *r1;
+        *r1 *= *r2;
+    }
+
+    return 1;
+}
+
+
+/* Picks a random allowed question format for operation op: */
+static MC_Format random_format(MC_MathGame* game, MC_Operation op)
+{
+    int n = game->samplers.num_formats[op];
+
+    if (n == 0)
+        return MC_FORMAT_ANS_LAST;
+    return game->samplers.formats[op][rng_below(&game->rng, n)];
 }
 
-/*
-   The function that does the central dirty work pertaining to flashcard
-   creation. Extensible to just about any kind of math problem, perhaps
-   with the exception of those with multiple answers, such as "8 + 2 > ?"
-   Simply specify how the problem is presented to the user, and the
-   answer the game should look for, as strings.
-   */
-MC_FlashCard generate_random_flashcard(MC_MathGame* game)
+
+/* Fills in game->samplers from the current options. Everything lives */
+/* in the arena, so this must be redone after each arena_release().   */
+/* Returns 1 on success, 0 if we ran out of memory or some allowed    */
+/* type of question has no valid questions at all.                    */
+static int build_samplers(MC_MathGame* game)
 {
-    int num;
-    int length;
-    MC_ProblemType pt;
-    MC_FlashCard ret;
-    static int generate_random_flashcard_id=0;
+    MC_Samplers* samplers = &game->samplers;
+    int op, f, i;
 
-    generate_random_flashcard_id+=1;
-    DEBUGMSG(debug_mathcards, "Entering generate_random_flashcard()\n");
-    DEBUGMSG(debug_mathcards, "ID is %d\n",generate_random_flashcard_id);
+    memset(samplers, 0, sizeof(MC_Samplers));
 
-    //choose a problem type
-    do
-        pt = rand() % MC_NUM_PTYPES;
-    while ( (pt == MC_PT_TYPING && !MC_GetOpt(game, TYPING_PRACTICE_ALLOWED) ) ||
-            (pt == MC_PT_ARITHMETIC && !MC_GetOpt(game, ADDITION_ALLOWED) &&
-             !MC_GetOpt(game, SUBTRACTION_ALLOWED) &&
-             !MC_GetOpt(game, MULTIPLICATION_ALLOWED) &&
-             !MC_GetOpt(game, DIVISION_ALLOWED) ) ||
-            (pt == MC_PT_COMPARISON && !MC_GetOpt(game, COMPARISON_ALLOWED) )
-          );
-
-    if (pt == MC_PT_TYPING) //typing practice
-    {
-        DEBUGMSG(debug_mathcards, "Generating typing question\n");
-        ret = MC_AllocateFlashcard();
-        num = rand() % (MC_GetOpt(game, MAX_TYPING_NUM)-MC_GetOpt(game, MIN_TYPING_NUM) + 1)
-            + MC_GetOpt(game, MIN_TYPING_NUM);
-        snprintf(ret.formula_string, MC_FORMULA_LEN, "%d", num);
-        snprintf(ret.answer_string, MC_ANSWER_LEN, "%d", num);
-        ret.answer = num;
-        ret.difficulty = 10;
-        ret.question_id=generate_random_flashcard_id;
-    }
-    else //if (pt == MC_PT_ARITHMETIC)
-    {
-        DEBUGMSG(debug_mathcards, "Generating arithmetic question");
-        length = rand() % (MC_GetOpt(game, MAX_FORMULA_NUMS) -
-                MC_GetOpt(game, MIN_FORMULA_NUMS) + 1) //avoid div by 0
-            +  MC_GetOpt(game, MIN_FORMULA_NUMS);
-        DEBUGMSG(debug_mathcards, " of length %d", length);
-        ret = generate_random_ooo_card_of_length(game, length, 1);
+    for (op = MC_OPER_ADD; op < MC_NUM_OPERS; ++op)
+    {
+        if (!MC_GetOpt(game, op + ADDITION_ALLOWED) )
+            continue;
 
-        if (debug_status & debug_mathcards) {
-            print_card(ret);
-        }
+        samplers->allowed[samplers->num_allowed++] = op;
+        if (op == MC_OPER_ADD || op == MC_OPER_SUB)
+            samplers->additive[samplers->num_additive++] = op;
+
+        if (!build_operand_table(game, op, &samplers->operands[op]) )
+            return 0;
+        if (samplers->operands[op].total > 0)
+            samplers->opers[samplers->num_opers++] = op;
+
+        for (f = 0; f < MC_NUM_FORMATS; ++f)
+            if (MC_GetOpt(game, FORMAT_ANSWER_LAST + f) ||
+                    MC_GetOpt(game, FORMAT_ADD_ANSWER_LAST + op * 3 + f) )
+                samplers->formats[op][samplers->num_formats[op]++] = f;
     }
-    //TODO comparison problems (e.g. "6 ? 9", "<")
 
-    DEBUGMSG(debug_mathcards, "Exiting generate_random_flashcard()\n");
+    if (MC_GetOpt(game, TYPING_PRACTICE_ALLOWED) )
+        samplers->types[samplers->num_types++] = MC_PT_TYPING;
+    if (samplers->num_allowed > 0)
+        samplers->types[samplers->num_types++] = MC_PT_ARITHMETIC;
+    if (MC_GetOpt(game, COMPARISON_ALLOWED) )
+        samplers->types[samplers->num_types++] = MC_PT_COMPARISON;
 
-    return ret;
-}
+    //all but typing questions are drawn from the operand tables
+    if (samplers->num_types == 0)
+    {
+        fprintf(stderr, "build_samplers() - no type of question allowed\n");
+        return 0;
+    }
+    for (i = 0; i < samplers->num_types; ++i)
+        if (samplers->types[i] != MC_PT_TYPING && samplers->num_opers == 0)
+        {
+            fprintf(stderr, "build_samplers() - no allowed operation has any valid questions\n");
+            return 0;
+        }
 
-/*
-   Recursively generate an order of operations problem. Hopefully this won't
-   raise performance issues. Difficulty is calculated based on the length of
-   the formula and on the operators used. Problems have a 'base' difficulty of
-   1 for binary operations, 3 for 3 numbers, 6, 10, etc. Each operator adds to
-   the score: 0, 1, 2, and 3 respectively for addition, subtraction,
-   multiplication and division.If reformat is 0, FORMAT_ANS_LAST will be used,
-   otherwise a format is chosen at random.
-   */
+    return build_divisor_table(game);
+}
 
-/* FIXME we should consider rewriting this - it currently generates some
-   questions with indeterminate answers (e.g. ? * 0 = 0) that seem to be 
-   impossible to prevent using the current scheme with recursive string
-   operations.
-   */
 
-MC_FlashCard generate_random_ooo_card_of_length(MC_MathGame* game, int length, int reformat)
+/* For first operand x of operation op, works out the interval [lo, hi] */
+/* of second operands giving a valid question (answer no bigger than   */
+/* MAX_ANSWER, and not negative unless ALLOW_NEGATIVES). On entry lo   */
+/* and hi hold the second operand's range from the options. Returns   */
+/* the number of valid second operands, which may be 0.                */
+static int second_operand_range(MC_MathGame* game, MC_Operation op, int x, int* lo, int* hi)
 {
-    int format = 0;
-    int r1 = 0;
-    int r2 = 0;
-    int ans = 0;
-    char tempstr[MC_FORMULA_LEN];
-    MC_FlashCard ret;
-    MC_Operation op;
-
-    id += 1;
-    DEBUGMSG(debug_mathcards, ".");
-    if (length > MAX_FORMULA_NUMS)
-        return DEFAULT_CARD;
-    if (length <= 2)
-    {
-        DEBUGMSG(debug_mathcards, "\n");
-        ret = MC_AllocateFlashcard();
-        for (op = rand() % MC_NUM_OPERS; //pick a random operation
-                MC_GetOpt(game, op + ADDITION_ALLOWED) == 0; //make sure it's allowed
-                op = rand() % MC_NUM_OPERS);
-
-        DEBUGMSG(debug_mathcards, "Operation is %c\n", operchars[op]);
-        /*
-           if (op == MC_OPER_ADD)
-           {
-           r1 = rand() % (math_opts->iopts[MAX_AUGEND] - math_opts->iopts[MIN_AUGEND] + 1) + math_opts->iopts[MIN_AUGEND];
-           r2 = rand() % (math_opts->iopts[MAX_ADDEND] - math_opts->iopts[MIN_ADDEND] + 1) + math_opts->iopts[MIN_ADDEND];
-           ans = r1 + r2;
-           }
-           else if (op == MC_OPER_SUB)
-           {
-           r1 = rand() % (math_opts->iopts[MAX_MINUEND] - math_opts->iopts[MIN_MINUEND] + 1) + math_opts->iopts[MIN_MINUEND];
-           r2 = rand() % (math_opts->iopts[MAX_SUBTRAHEND] - math_opts->iopts[MIN_SUBTRAHEND] + 1) + math_opts->iopts[MIN_SUBTRAHEND];
-           ans = r1 - r2;
-           }
-           else if (op == MC_OPER_MULT)
-           {
-           r1 = rand() % (math_opts->iopts[MAX_MULTIPLIER] - math_opts->iopts[MIN_MULTIPLIER] + 1) + math_opts->iopts[MIN_MULTIPLIER];
-           r2 = rand() % (math_opts->iopts[MAX_MULTIPLICAND] - math_opts->iopts[MIN_MULTIPLICAND] + 1) + math_opts->iopts[MIN_MULTIPLICAND];
-           ans = r1 * r2;
-           }
-           else if (op == MC_OPER_DIV)
-           {
-           ans = rand() % (math_opts->iopts[MAX_QUOTIENT] - math_opts->iopts[MIN_QUOTIENT] + 1) + math_opts->iopts[MIN_QUOTIENT];
-           r2 = rand() % (math_opts->iopts[MAX_DIVISOR] - math_opts->iopts[MIN_DIVISOR] + 1) + math_opts->iopts[MIN_DIVISOR];
-           if (r2 == 0)
-           r2 = 1;
-           r1 = ans * r2;
-           }
-           */
-        if (op > MC_OPER_DIV || op < MC_OPER_ADD)
-        {
-            DEBUGMSG(debug_mathcards, "Invalid operator: value %d\n", op);
-            return DEFAULT_CARD;
-        }
-        //choose two numbers in the proper range and get their result
+    int max_answer = MC_GetOpt(game, MAX_ANSWER);
+    int negatives = MC_GetOpt(game, ALLOW_NEGATIVES);
 
-        else do
-        {
-            r1 = rand() % (game->math_opts->iopts[MAX_AUGEND+4*op] - game->math_opts->iopts[MIN_AUGEND+4*op] + 1) + game->math_opts->iopts[MIN_AUGEND+4*op];    
-            r2 = rand() % (game->math_opts->iopts[MAX_ADDEND+4*op] - game->math_opts->iopts[MIN_ADDEND+4*op] + 1) + game->math_opts->iopts[MIN_ADDEND+4*op]; 
-
-            if (op == MC_OPER_ADD)
-                ans = r1 + r2;
-            if (op == MC_OPER_SUB)
-                ans = r1 - r2;
-            if (op == MC_OPER_MULT)
-                ans = r1 * r2;
-            if (op == MC_OPER_DIV)  
+    switch (op)
+    {
+        case MC_OPER_ADD: // x + y <= max_answer, x + y >= 0
+            if (*hi > max_answer - x)
+                *hi = max_answer - x;
+            if (!negatives && *lo < -x)
+                *lo = -x;
+            break;
+        case MC_OPER_SUB: // x - y <= max_answer, x - y >= 0
+            if (*lo < x - max_answer)
+                *lo = x - max_answer;
+            if (!negatives && *hi > x)
+                *hi = x;
+            break;
+        case MC_OPER_MULT: // x * y <= max_answer, x * y >= 0
+            if (x > 0)
             {
-                if (r2 == 0)
-                    r2 = 1;
-                ret.difficulty = r1;
-                r1 *= r2;
-                ans = ret.difficulty;
+                //floor(max_answer / x), rounding down for negative max_answer too
+                int q = max_answer / x;
+                if (q * x > max_answer)
+                    --q;
+                if (*hi > q)
+                    *hi = q;
+                if (!negatives && *lo < 0)
+                    *lo = 0;
             }
-        } while ( (ans < 0 && !MC_GetOpt(game, ALLOW_NEGATIVES)) || ans > MC_GetOpt(game, MAX_ANSWER) );
+            else if (x < 0)
+            {
+                //ceil(max_answer / x)
+                int q = max_answer / x;
+                if (q * x > max_answer)
+                    ++q;
+                if (*lo < q)
+                    *lo = q;
+                if (!negatives && *hi > 0)
+                    *hi = 0;
+            }
+            else if (max_answer < 0)
+                return 0;
+            break;
+        case MC_OPER_DIV: // the answer is x itself
+            if ((x < 0 && !negatives) || x > max_answer)
+                return 0;
+            break;
+        default:
+            return 0;
+    }
+
+    return *hi >= *lo ? *hi - *lo + 1 : 0;
+}
 
 
-        DEBUGMSG(debug_mathcards, "Constructing answer_string\n");
-        snprintf(ret.answer_string, MC_ANSWER_LEN, "%d", ans);
-        DEBUGMSG(debug_mathcards, "Constructing formula_string\n");
-        snprintf(ret.formula_string, MC_FORMULA_LEN, "%d %c %d",
-                r1, operchars[op], r2);
-        ret.answer = ans;
-        DEBUGMSG(debug_mathcards, "int answer is %d\n", ret.answer);
-        ret.difficulty = op + 1;
+/* Builds the table of valid (first, second) operand pairs for op. For  */
+/* each first operand the valid second operands form one interval, so  */
+/* we keep that interval and an alias table (Vose's method) over first */
+/* operands weighted by interval length. Drawing a first operand from  */
+/* the alias table and a second one from its interval then gives every */
+/* valid pair the same chance, in constant time.                       */
+static int build_operand_table(MC_MathGame* game, MC_Operation op, MC_OperandTable* table)
+{
+    int first_min = MC_GetOpt(game, MIN_AUGEND + 4 * op);
+    int first_max = MC_GetOpt(game, MAX_AUGEND + 4 * op);
+    int second_min = MC_GetOpt(game, MIN_ADDEND + 4 * op);
+    int second_max = MC_GetOpt(game, MAX_ADDEND + 4 * op);
+    int n;
+    int i, num_small = 0, num_large = 0;
+    double* prob;
+    int* small;
+    int* large;
+
+    //an empty range just means its minimum, as the options always did
+    if (first_max < first_min)
+        first_max = first_min;
+    if (second_max < second_min)
+        second_max = second_min;
+    //and divisors start at 1, like those in build_divisor_table()
+    if (op == MC_OPER_DIV && second_min < 1)
+        second_min = 1;
+    n = first_max - first_min + 1;
+
+    memset(table, 0, sizeof(MC_OperandTable));
+    table->first_min = first_min;
+    table->count = n;
+    table->second_min = arena_alloc(&game->arena, n * sizeof(int));
+    table->second_count = arena_alloc(&game->arena, n * sizeof(int));
+    table->keep = arena_alloc(&game->arena, n * sizeof(unsigned int));
+    table->alias = arena_alloc(&game->arena, n * sizeof(int));
+    if (!table->second_min || !table->second_count || !table->keep || !table->alias)
+        return 0;
 
-    }
-    else //recurse
+    for (i = 0; i < n; ++i)
     {
-        ret = generate_random_ooo_card_of_length(game, length - 1, 0);
+        int lo = second_min, hi = second_max;
+        table->second_count[i] = second_operand_range(game, op, first_min + i, &lo, &hi);
+        table->second_min[i] = lo;
+        table->total += table->second_count[i];
+    }
+    DEBUGMSG(debug_mathcards, "%ld valid operand pairs for %c\n", table->total, operchars[op]);
+    if (table->total == 0)
+        return 1;
 
-        if (strchr(ret.formula_string, '+') || strchr(ret.formula_string, '-') )
-        {
-            //if the expression has addition or subtraction, we can't assume that
-            //introducing multiplication or division will produce a predictable
-            //result, so we'll limit ourselves to more addition/subtraction
-            for (op = rand() % 2 ? MC_OPER_ADD : MC_OPER_SUB;
-                    MC_GetOpt(game, op + ADDITION_ALLOWED) == 0;
-                    op = rand() % 2 ? MC_OPER_ADD : MC_OPER_SUB);
+    //scratch space, handed back to the arena once the table is built
+    prob = arena_alloc(&game->arena, n * sizeof(double));
+    small = arena_alloc(&game->arena, n * sizeof(int));
+    large = arena_alloc(&game->arena, n * sizeof(int));
+    if (!prob || !small || !large)
+        return 0;
 
-        }
+    for (i = 0; i < n; ++i)
+    {
+        prob[i] = (double)table->second_count[i] * n / table->total;
+        if (prob[i] < 1.0)
+            small[num_small++] = i;
         else
-        {
-            //the existing expression can be treated as a number in itself, so we
-            //can do anything to it and be confident of the result.
-            for (op = rand() % MC_NUM_OPERS; //pick a random operation
-                    MC_GetOpt(game, op + ADDITION_ALLOWED) == 0; //make sure it's allowed
-                    op = rand() % MC_NUM_OPERS);
-        }
-        DEBUGMSG(debug_mathcards, "Next operation is %c,",  operchars[op]);
-
-        //pick the next operand
-        if (op == MC_OPER_ADD)
-        {
-            r1 = rand() % (game->math_opts->iopts[MAX_AUGEND] - game->math_opts->iopts[MIN_AUGEND] + 1) + game->math_opts->iopts[MIN_AUGEND];
-            ret.answer += r1;
-        }
-        else if (op == MC_OPER_SUB)
-        {
-            r1 = rand() % (game->math_opts->iopts[MAX_SUBTRAHEND] - game->math_opts->iopts[MIN_SUBTRAHEND] + 1) + game->math_opts->iopts[MIN_SUBTRAHEND];
-            ret.answer -= r1;
-        }
-        else if (op == MC_OPER_MULT)
-        {
-            r1 = rand() % (game->math_opts->iopts[MAX_MULTIPLICAND] - game->math_opts->iopts[MIN_MULTIPLICAND] + 1) + game->math_opts->iopts[MIN_AUGEND];
-            ret.answer *= r1;
-        }
-        else if (op == MC_OPER_DIV)
-        {
-            r1 = find_divisor(game, ret.answer);
-            ret.answer /= r1;
-        }
+            large[num_large++] = i;
+    }
+    while (num_small > 0 && num_large > 0)
+    {
+        int s = small[--num_small];
+        int l = large[--num_large];
+        table->keep[s] = (unsigned int)(prob[s] * 4294967296.0);
+        table->alias[s] = l;
+        prob[l] -= 1.0 - prob[s];
+        if (prob[l] < 1.0)
+            small[num_small++] = l;
         else
-        {
-            ; //invalid operator
-        }
-        DEBUGMSG(debug_mathcards, " operand is %d\n", r1);
-        DEBUGMSG(debug_mathcards, "Answer: %d\n", ret.answer);
+            large[num_large++] = l;
+    }
+    //whatever is left over (only rounding error) is always kept
+    while (num_large > 0)
+    {
+        i = large[--num_large];
+        table->keep[i] = UINT_MAX;
+        table->alias[i] = i;
+    }
+    while (num_small > 0)
+    {
+        i = small[--num_small];
+        table->keep[i] = UINT_MAX;
+        table->alias[i] = i;
+    }
 
-        //next append or prepend the new number (might need optimization)
-        if (op == MC_OPER_SUB || op == MC_OPER_DIV || //noncommutative, append only
-                rand() % 2)
-        {
-            snprintf(tempstr, MC_FORMULA_LEN, "%s %c %d", //append
-                    ret.formula_string, operchars[op], r1);
-            strncpy(ret.formula_string, tempstr, MC_FORMULA_LEN);
-        }
-        else //we're prepending
-        {
-            snprintf(tempstr, MC_FORMULA_LEN, "%d %c %s", //append
-                    r1, operchars[op], ret.formula_string);
-            strncpy(ret.formula_string, tempstr, MC_FORMULA_LEN);
-        }
+    arena_free(&game->arena, large, n * sizeof(int));
+    arena_free(&game->arena, small, n * sizeof(int));
+    arena_free(&game->arena, prob, n * sizeof(double));
+    return 1;
+}
 
-        //finally update the answer and score
-        snprintf(ret.answer_string, MC_ANSWER_LEN, "%d", ret.answer);
-        ret.difficulty += (length - 1) + op;
-    }
 
-    if (reformat)
-    {
-        DEBUGMSG(debug_mathcards, "Reformatting...\n");
-        do {
-            format = rand() % MC_NUM_FORMATS;
-        } while (!MC_GetOpt(game, FORMAT_ANSWER_LAST + format) && 
-                !MC_GetOpt(game, FORMAT_ADD_ANSWER_LAST + op * 3 + format) );
+/* Draws a uniformly random valid operand pair from a non-empty table: */
+static void sample_operands(MC_Random* rng, const MC_OperandTable* table, int* x, int* y)
+{
+    int i = rng_below(rng, table->count);
+
+    if (rng_next(rng) >= table->keep[i])
+        i = table->alias[i];
+    *x = table->first_min + i;
+    *y = table->second_min[i] + rng_below(rng, table->second_count[i]);
+}
+
+
+/* Lists, for every dividend 0..MC_GLOBAL_MAX, its divisors that lie  */
+/* within [MIN_DIVISOR, MAX_DIVISOR] (never 0), so find_divisor() can */
+/* just pick one. The lists are packed back to back in divisors[],   */
+/* the one for n starting at divisor_start[n].                        */
+static int build_divisor_table(MC_MathGame* game)
+{
+    MC_Samplers* samplers = &game->samplers;
+    int max_dividend = MC_GLOBAL_MAX;
+    int lo = MC_GetOpt(game, MIN_DIVISOR);
+    int hi = MC_GetOpt(game, MAX_DIVISOR);
+    int* fill;
+    int n, d, total = 0;
+
+    if (lo < 1)
+        lo = 1; //don't divide by zero
+    samplers->max_dividend = max_dividend;
+    samplers->divisor_start = arena_alloc(&game->arena, (max_dividend + 2) * sizeof(int));
+    fill = arena_alloc(&game->arena, (max_dividend + 1) * sizeof(int));
+    if (!samplers->divisor_start || !fill)
+        return 0;
 
-        strncat(ret.formula_string, " = ?", MC_FORMULA_LEN - strlen(ret.formula_string) );
-        DEBUGMSG(debug_mathcards, "Formula_string: %s\n", ret.formula_string);
-        reformat_arithmetic(&ret, format );     
+    //count the divisors of each n, then lay the lists out
+    memset(fill, 0, (max_dividend + 1) * sizeof(int));
+    for (d = lo; d <= hi; ++d)
+        for (n = 0; n <= max_dividend; n += d)
+            ++fill[n];
+    for (n = 0; n <= max_dividend; ++n)
+    {
+        samplers->divisor_start[n] = total;
+        total += fill[n];
+        fill[n] = samplers->divisor_start[n];
     }
-    ret.question_id = id;
+    samplers->divisor_start[max_dividend + 1] = total;
 
-    DEBUGMSG(debug_mathcards, "At end of generate_rand_ooo_card_of_length():\n");
-    print_card(ret);
+    samplers->divisors = arena_alloc(&game->arena, (total + 1) * sizeof(int));
+    if (!samplers->divisors)
+        return 0;
+    for (d = lo; d <= hi; ++d)
+        for (n = 0; n <= max_dividend; n += d)
+            samplers->divisors[fill[n]++] = d;
 
-    return ret;
+    arena_free(&game->arena, fill, (max_dividend + 1) * sizeof(int));
+    DEBUGMSG(debug_mathcards, "Divisor table has %d entries\n", total);
+    return 1;
 }
 
 
 
-MC_MathQuestion* generate_list(MC_MathGame* game)
+/* Fills the (empty) deck with questions according to the current     */
+/* options. Returns the number of questions generated, 0 on errors.    */
+int generate_list(MC_MathGame* game, MC_Deck* deck)
 {
-    int i, j;
+    int i;
     int length = MC_GetOpt(game, AVG_LIST_LENGTH);
     int cl; //raw length
     double r1, r2, delta, var; //randomizers for list length
-    MC_MathQuestion* list = NULL;
-    MC_MathQuestion* end_of_list = NULL;
-    MC_MathQuestion* tnode = NULL;
+    MC_PackedCard card;
+    index_perm perm;
+    int randomize, pos, passes, found_this_pass;
 
     if (debug_status & debug_mathcards)
         MC_PrintMathOptions(game, stdout, 0);
@@ -1815,14 +4016,14 @@ MC_MathQuestion* generate_list(MC_MathGame* game)
     if (!(MC_GetOpt(game, ARITHMETIC_ALLOWED) ||
                 MC_GetOpt(game, TYPING_PRACTICE_ALLOWED) ||
                 MC_GetOpt(game, COMPARISON_ALLOWED) ) )
-        return NULL;
+        return 0;
 
     //FIXME - remind me, why are we doing this??
     //randomize list length by a "bell curve" centered on average
     if (length && MC_GetOpt(game, VARY_LIST_LENGTH) )
     {
-        r1 = (double)rand() / RAND_MAX / 2 + 0.5; //interval (0, 1)
-        r2 = (double)rand() / RAND_MAX / 2 + 0.5; //interval (0, 1)
+        r1 = rng_double(&game->rng) / 2 + 0.5; //interval (0, 1)
+        r2 = rng_double(&game->rng) / 2 + 0.5; //interval (0, 1)
         DEBUGMSG(debug_mathcards, "Randoms chosen: %5f, %5f\n", r1, r2);
         delta = sqrt(-2 * log(r1) ) * cos(2 * PI_VAL * r2); //standard normal dist.
         var = length / 10.0; //variance
@@ -1836,124 +4037,122 @@ MC_MathQuestion* generate_list(MC_MathGame* game)
     if (MC_GetOpt(game, COMPREHENSIVE)) //generate all
     {
         int num_valid_questions; //How many questions the COMPREHENSIVE list specifies
-        int cycles_needed;       //How many times we need to generate it to get enough
 
         num_valid_questions = calc_num_valid_questions(game);
         if(num_valid_questions == 0)
         {
             fprintf(stderr, "generate_list() - no valid questions\n");
-            return NULL;
+            return 0;
         }
 
-        cycles_needed = length/num_valid_questions;
-
-        if((cycles_needed * num_valid_questions) < length)
-            cycles_needed++;
-
         DEBUGMSG(debug_mathcards, "In generate_list() - COMPREHENSIVE method requested\n");
-        DEBUGMSG(debug_mathcards, "num_valid_questions = %d\t cycles_needed = %d\n",
-                num_valid_questions, cycles_needed);
-
-        for (i = MC_PT_TYPING; i < MC_NUM_PTYPES; ++i)
+        DEBUGMSG(debug_mathcards, "num_valid_questions = %d\n", num_valid_questions);
+
+        /* We never build the full list of valid questions - instead we  */
+        /* walk through the indices [0, num_valid_questions) in order    */
+        /* (or in a lazily evaluated random order if RANDOMIZE is set),  */
+        /* turning each index straight into a card and skipping the ones */
+        /* that are screened out, until the deck is long enough. If the  */
+        /* deck needs more than one pass, each pass is another copy of   */
+        /* the list, just like the old "cycles" of add_all_valid().      */
+        if (!deck_reserve(&game->arena, deck, length))
         {
-            if (!MC_GetOpt(game, i + TYPING_PRACTICE_ALLOWED))
-                continue;
-            for (j = 0; j < cycles_needed; j++)
-                list = add_all_valid(game, i, list, &end_of_list);
+            fprintf(stderr, "In generate_list() - allocation failed!\n");
+            return 0;
         }
 
+        randomize = MC_GetOpt(game, RANDOMIZE);
+        if (randomize)
+            perm_init(&game->rng, &perm, num_valid_questions);
 
-        if (MC_GetOpt(game, RANDOMIZE) )
+        pos = 0;
+        passes = 1;
+        found_this_pass = 0;
+        while (deck->length < length)
         {
-            DEBUGMSG(debug_mathcards, "Randomizing list\n");
-            randomize_list(&list);
+            if (pos == num_valid_questions) //start another copy of the list
+            {
+                if (!found_this_pass) //every question screened out
+                    break;
+                if (randomize)
+                    perm_init(&game->rng, &perm, num_valid_questions);
+                pos = 0;
+                passes++;
+                found_this_pass = 0;
+            }
+
+            if (comprehensive_card(game,
+                        randomize ? (int)perm_index(&perm, pos) : pos,
+                        &card))
+            {
+                *deck_push_back(&game->arena, deck) = card;
+                found_this_pass++;
+            }
+            pos++;
         }
 
-        if (length)
+        /* Mix the copies together if we needed more than one pass: */
+        if (randomize && passes > 1)
         {
-            cl = list_length(list);
-            // NOTE this should no longer happen - we run the COMPREHENSIVE
-            // generation until we have enough questions.
-            if (length > cl) //if not enough questions, pad out with randoms
-            {
-                DEBUGMSG(debug_mathcards, "Padding out list from %d to %d questions\n", cl, length);
-                for (i = cl; i < length; ++i)
-                {
-                    tnode = malloc(sizeof(MC_MathQuestion) );
-                    if(!tnode)
-                    {
-                        fprintf(stderr, "In generate_list() - allocation failed!\n");
-                        delete_list(list);
-                        return NULL;
-                    }
+            DEBUGMSG(debug_mathcards, "Randomizing list\n");
+            deck_shuffle(&game->rng, deck);
+        }
 
-                    tnode->card = generate_random_flashcard(game);
-                    list = insert_node(list, end_of_list, tnode);
-                    end_of_list = tnode;
-                    //          DEBUGMSG(debug_mathcards, "%d.", list_length(list) );
-                }
-            }
-            else if (length < cl) //if too many questions, chop off tail end of list
+        cl = deck->length;
+        if (length > cl) //if not enough questions, pad out with randoms
+        {
+            DEBUGMSG(debug_mathcards, "Padding out list from %d to %d questions\n", cl, length);
+            if (!generate_random_flashcards(game, deck, length - cl))
             {
-                DEBUGMSG(debug_mathcards, "Cutting list to %d questions\n", length);
-                end_of_list = find_node(list, length);
-                delete_list(end_of_list->next);
-                end_of_list->next = NULL;
+                fprintf(stderr, "In generate_list() - could not make questions!\n");
+                return 0;
             }
         }
     }
 
     /* Here we are just generating random questions, one at a */
     /* time until we have enough                              */
-    /* NOTE generate_random_flashcard() has some bugs, so only */
-    /* use this method if we need multiple operand questions   */
     else 
     {
         DEBUGMSG(debug_mathcards, "In generate_list() - COMPREHENSIVE method NOT requested\n");
 
-        for (i = 0; i < length; ++i)
+        if (!generate_random_flashcards(game, deck, length))
         {
-            tnode = malloc(sizeof(MC_MathQuestion) );
-            if(!tnode)
-            {
-                fprintf(stderr, "In generate_list() - allocation failed!\n");
-                delete_list(list);
-                return NULL;
-            }
-
-            tnode->card = generate_random_flashcard(game);
-            list = insert_node(list, end_of_list, tnode);
-            end_of_list = tnode;
+            fprintf(stderr, "In generate_list() - could not make questions!\n");
+            return 0;
         }
     }
-    /* Now just put the question_id values in: */
 
-    {
-        int i = 1;
-        MC_MathQuestion* ptr = list;
-        while(ptr->next)
-        {
-            ptr->card.question_id = i;
-            ptr = ptr->next;
-            i++;
-        }
-    }
+    /* Now just put the question_id values in: */
+    for (i = 0; i < deck->length; i++)
+        deck_at(deck, i)->question_id = i + 1;
 
-    return list;
+    return deck->length;
 }
 
 /* NOTE - returns 0 (i.e. "false") if *identical*, and */
 /* 1 (i.e. "true") if *different* - counterintuitive,  */
 /* but same behavior as e.g. strcmp()                  */
 
-static int compare_card(const MC_FlashCard* a, const MC_FlashCard* b)
+static int compare_card(MC_MathGame* game, const MC_PackedCard* a, const MC_PackedCard* b)
 {
-    if (strncmp(a->formula_string, b->formula_string, MC_FORMULA_LEN) )
+    /* Same numbers give the same text, so only cards that carry */
+    /* their text need to have it compared:                      */
+    if (a->kind != b->kind || a->style != b->style)
+        return 1;
+    if (a->kind == MC_CARD_TEXT)
+    {
+        if (strncmp(game->card_text[a->n1].formula_string,
+                    game->card_text[b->n1].formula_string, MC_FORMULA_LEN) )
+            return 1;
+        if (strncmp(game->card_text[a->n1].answer_string,
+                    game->card_text[b->n1].answer_string, MC_ANSWER_LEN) )
+            return 1;
+    }
+    else if (a->n1 != b->n1 || a->n2 != b->n2)
         return 1;
-    if (strncmp(a->answer_string, b->answer_string, MC_ANSWER_LEN) )
+    if (a->answer != b->answer)
         return 1;
-    if (a->answer != b->answer);
-    return 1;
 
     return 0; //the cards are identical
 }
@@ -1967,28 +4166,23 @@ MC_FlashCard MC_AllocateFlashcard(void)
 
     //NOTE strings now simply hard-coded to MC_FORMULA_LEN (= 40) and
     //MC_ANSWER_LEN (= 5) instead of tailoring them to save a few bytes - DSB
-    //  DEBUGMSG(debug_mathcards, "Allocating %d + %d bytes for flashcard\n",
-    //            max_formula_size + 1, max_answer_size + 1);
-    //  ret.formula_string = malloc( (max_formula_size + 1) * sizeof(char));
-    //  ret.answer_string = malloc( (max_answer_size + 1) * sizeof(char));
-    //   if (!ret.formula_string || !ret.answer_string)
-    //     {
-    //     free(ret.formula_string);
-    //     free(ret.answer_string);
-    //     printf("Couldn't allocate space for a new flashcard!\n");
-    //     ret = DEFAULT_CARD;
-    //     }
     return ret;
 }
 
 
 unsigned int MC_MapTextToIndex(const char* text)
 {
-    int i;
-    for (i = 0; i < NOPTS; ++i)
+    int lo = 0, hi = NOPTS - 1;
+    while (lo <= hi)
     {
-        if (!strcasecmp(text, MC_OPTION_TEXT[i]) )
-            return i;
+        int mid = (lo + hi) / 2;
+        int cmp = strcasecmp(text, MC_OPTION_TEXT[MC_OPTION_ORDER[mid]]);
+        if (cmp == 0)
+            return MC_OPTION_ORDER[mid];
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
     }
     DEBUGMSG(debug_mathcards, "'%s' isn't a math option\n", text);
     return NOT_VALID_OPTION;
@@ -2150,7 +4344,20 @@ int MC_GetOp(MC_MathGame* game, const char* param)
 
 int MC_VerifyOptionListSane(void)
 {
-    return strcmp(MC_OPTION_TEXT[NOPTS], "END_OF_OPTS") == 0;
+    int i;
+    if (strcmp(MC_OPTION_TEXT[NOPTS], "END_OF_OPTS") != 0)
+        return 0;
+    /* lookup table must be strictly ascending, which also rules out */
+    /* duplicates, so with NOPTS in-range entries it is a permutation */
+    for (i = 0; i < NOPTS; ++i)
+    {
+        if (MC_OPTION_ORDER[i] < 0 || MC_OPTION_ORDER[i] >= NOPTS)
+            return 0;
+        if (i > 0 && strcasecmp(MC_OPTION_TEXT[MC_OPTION_ORDER[i - 1]],
+                                MC_OPTION_TEXT[MC_OPTION_ORDER[i]]) >= 0)
+            return 0;
+    }
+    return 1;
 }
 
 int MC_MaxFormulaSize(void)
@@ -2184,10 +4391,23 @@ int find_divisor(MC_MathGame* game, int a)
     int div = 1; //the divisor to return
     int realisticpasses = 3; //reasonable time after which a minimum should be met
     int i;
+    int n = a < 0 ? -a : a;
+
+    //normally we can just look it up:
+    if (game->samplers.divisor_start && n <= game->samplers.max_dividend)
+    {
+        int first = game->samplers.divisor_start[n];
+        int count = game->samplers.divisor_start[n + 1] - first;
+        if (count == 0)
+            return 1; //no divisor in range, so keep the answer as it is
+        return game->samplers.divisors[first + rng_below(&game->rng, count)];
+    }
+
+    //otherwise fall back on building one from small primes
     do
         for (i = 0; i < NPRIMES; ++i) //test each prime
             if (a % smallprimes[i] == 0)  //if it is a prime factor,
-                if (rand() % (i + 1) == 0) //maybe we'll keep it
+                if (rng_below(&game->rng, i + 1) == 0) //maybe we'll keep it
                     if (div * smallprimes[i] <= MC_GetOpt(game, MAX_DIVISOR) ) //if we can,
                         div *= smallprimes[i]; //update our real divisor
     //keep going if the divisor is too small
@@ -2197,331 +4417,294 @@ int find_divisor(MC_MathGame* game, int a)
 }
 
 
-//Computes (approximately) the number of questions that will be returned
-//by add_all_valid() as specified by the current options. This does not 
-//take into account screening out of invalid questions, such
-//as divide-by-zero and questions like "0 x ? = 0".
+//Computes the number of questions in the COMPREHENSIVE question space as
+//specified by the current options, i.e. the range of indices accepted by
+//comprehensive_card(). This does not take into account screening out of
+//invalid questions, such as divide-by-zero and questions like "0 x ? = 0".
 static int calc_num_valid_questions(MC_MathGame* game)
 {
     int total_questions = 0;
     int k = 0;
+    int shortest, longest, length, n, pairs, steps;
+    MC_Format formats[MC_NUM_FORMATS];
+
     //First add the number of typing questions
-    if (MC_GetOpt(game, TYPING_PRACTICE_ALLOWED))
-        total_questions += (MC_GetOpt(game, MAX_TYPING_NUM) - MC_GetOpt(game, MIN_TYPING_NUM));
+    if (MC_GetOpt(game, TYPING_PRACTICE_ALLOWED)
+            && MC_GetOpt(game, MAX_TYPING_NUM) >= MC_GetOpt(game, MIN_TYPING_NUM))
+        total_questions += (MC_GetOpt(game, MAX_TYPING_NUM) - MC_GetOpt(game, MIN_TYPING_NUM) + 1);
+
+    if (!MC_GetOpt(game, ARITHMETIC_ALLOWED))
+        return total_questions;
+
+    //Questions with more than two operands come after the others,
+    //a block for each length:
+    formula_lengths(game, &shortest, &longest);
+    for (length = (shortest > 3) ? shortest : 3; length <= longest; length++)
+    {
+        n = expr_tree_count(game, length, &pairs, &steps);
+        total_questions += (n < 0) ? MC_MAX_ENUM_TREES : n;
+    }
+    if (shortest > 2)
+        return total_questions;
 
     //Now add how many questions we will have for each operation:
     for (k = MC_OPER_ADD; k < MC_NUM_OPERS; ++k)
     {
-        int num_this_oper = 0;
-        int formats_this_oper = 0;
+        int n_first, n_second;
 
         if (!MC_GetOpt(game, k + ADDITION_ALLOWED) )
             continue;
 
         //calculate number of ordered pairs of first and second operands:
         //note the "+ 1" is due to the ranges being inclusive
-        num_this_oper = (MC_GetOpt(game, MAX_AUGEND + 4 * k) - MC_GetOpt(game, MIN_AUGEND + 4 * k) + 1)
-            *
-            (MC_GetOpt(game, MAX_ADDEND + 4 * k) - MC_GetOpt(game, MIN_ADDEND + 4 * k) + 1);
-        //check what formats are allowed
-        if (MC_GetOpt(game, FORMAT_ANSWER_LAST) && MC_GetOpt(game, FORMAT_ADD_ANSWER_LAST + k * 3))
-            formats_this_oper++;
-        if (MC_GetOpt(game, FORMAT_ANSWER_FIRST) && MC_GetOpt(game, FORMAT_ADD_ANSWER_FIRST + k * 3))
-            formats_this_oper++;
-        if (MC_GetOpt(game, FORMAT_ANSWER_MIDDLE) && MC_GetOpt(game, FORMAT_ADD_ANSWER_MIDDLE + k * 3))
-            formats_this_oper++;
-        //Get total of e.g. addition questions:
-        num_this_oper *= formats_this_oper;
-        //add to overall total:
-        total_questions += num_this_oper;
+        n_first = MC_GetOpt(game, MAX_AUGEND + 4 * k) - MC_GetOpt(game, MIN_AUGEND + 4 * k) + 1;
+        n_second = MC_GetOpt(game, MAX_ADDEND + 4 * k) - MC_GetOpt(game, MIN_ADDEND + 4 * k) + 1;
+        if (n_first <= 0 || n_second <= 0)
+            continue;
+
+        //Get total of e.g. addition questions and add to overall total:
+        total_questions += n_first * n_second * comprehensive_formats(game, k, formats);
     }
 
     //TODO will also need to count up the COMPARISON questions once
     //they are implemented
-    {
-    }
 
     DEBUGMSG(debug_mathcards, "calc_num_valid_questions():\t%d\n", total_questions);
     return total_questions;
 }
 
 
+//Fills in the formats allowed for operation k, in the order they
+//appear in the COMPREHENSIVE list, and returns how many there are.
+static int comprehensive_formats(MC_MathGame* game, MC_Operation k, MC_Format* formats)
+{
+    int f, n = 0;
 
+    for (f = MC_FORMAT_ANS_LAST; f < MC_NUM_FORMATS; f++)
+        if (MC_GetOpt(game, FORMAT_ANSWER_LAST + f) && MC_GetOpt(game, FORMAT_ADD_ANSWER_LAST + k * 3 + f))
+            formats[n++] = f;
+    return n;
+}
 
-//NOTE end_of_list** needs to be doubly indirect because otherwise the end does not
-//get updated in the calling code
-//NOTE the difficulty is set as add = 1, sub = 2, mult = 3, div = 4, plus a 2 point
-//bonus if the format is a "missing number".
-MC_MathQuestion* add_all_valid(MC_MathGame* game,
-        MC_ProblemType pt,
-        MC_MathQuestion* list,
-        MC_MathQuestion** end_of_list)
-{
-    int i, j;
-    int ans = 0, tmp;
-    MC_Operation k;
-    MC_MathQuestion* tnode;
 
-    DEBUGMSG(debug_mathcards, "Entering add_all_valid(%d)\n", pt);
-    DEBUGMSG(debug_mathcards, "List already has %d questions\n", list_length(list));
+//Maps an index in [0, calc_num_valid_questions()) directly to a card of
+//the COMPREHENSIVE list. The order is typing questions first, then for
+//each allowed operation every (first value, second value, format) triple
+//with the format varying fastest - the same order the questions used to
+//be generated in - and then the longer questions allowed by
+//MIN/MAX_FORMULA_NUMS, by length (see expr_tree_card()). Returns 1 and
+//fills in pc if the question is valid, 0 if it is screened out.
+static int comprehensive_card(MC_MathGame* game, int index, MC_PackedCard* pc)
+{
+    int k, i, j, nf, n_first, n_second, block;
+    int shortest, longest, length;
+    MC_Format formats[MC_NUM_FORMATS];
 
-    //make sure this problem type is actually allowed
-    if (!MC_GetOpt(game, pt + TYPING_PRACTICE_ALLOWED) )
-        return list;
+    if (index < 0)
+        return 0;
 
-    //add all typing questions in range
-    if (pt == MC_PT_TYPING)
+    if (MC_GetOpt(game, TYPING_PRACTICE_ALLOWED))
     {
-        DEBUGMSG(debug_mathcards, "Adding typing...\n");
-        for (i = MC_GetOpt(game, MIN_TYPING_NUM); i <= MC_GetOpt(game, MAX_TYPING_NUM); ++i)
+        block = MC_GetOpt(game, MAX_TYPING_NUM) - MC_GetOpt(game, MIN_TYPING_NUM) + 1;
+        if (block > 0)
         {
-            DEBUGMSG(debug_mathcards, "(%d)\n", i);
-            tnode = allocate_node();
-            if(!tnode)
+            if (index < block)
             {
-                fprintf(stderr, "In add_all_valid() - allocate_node() failed!\n");
-                delete_list(list);
-                return NULL;
+                i = MC_GetOpt(game, MIN_TYPING_NUM) + index;
+                memset(pc, 0, sizeof(MC_PackedCard));
+                pc->kind = MC_CARD_TYPING;
+                pc->n1 = i;
+                pc->answer = i;
+                pc->difficulty = 1;
+                return 1;
             }
-
-            snprintf(tnode->card.formula_string, MC_FORMULA_LEN, "%d", i);
-            snprintf(tnode->card.answer_string, MC_ANSWER_LEN, "%d", i);
-            tnode->card.answer = i;
-            tnode->card.difficulty = 1;
-            list = insert_node(list, *end_of_list, tnode);
-            *end_of_list = tnode;
+            index -= block;
         }
     }
 
-    //add all allowed arithmetic questions
-    else if (MC_PT_ARITHMETIC)
+    if (!MC_GetOpt(game, ARITHMETIC_ALLOWED))
+        return 0;
+
+    formula_lengths(game, &shortest, &longest);
+    for (k = MC_OPER_ADD; shortest <= 2 && k < MC_NUM_OPERS; ++k)
     {
-        DEBUGMSG(debug_mathcards, "Adding arithmetic...\n");
+        if (!MC_GetOpt(game, k + ADDITION_ALLOWED) )
+            continue;
 
-        // The k loop iterates through the four arithmetic operations:
-        // k = 0 means addition
-        // k = 1 means subtraction
-        // k = 2 means multiplication
-        // k = 3 means division
-        for (k = MC_OPER_ADD; k < MC_NUM_OPERS; ++k)
+        n_first = MC_GetOpt(game, MAX_AUGEND + 4 * k) - MC_GetOpt(game, MIN_AUGEND + 4 * k) + 1;
+        n_second = MC_GetOpt(game, MAX_ADDEND + 4 * k) - MC_GetOpt(game, MIN_ADDEND + 4 * k) + 1;
+        nf = comprehensive_formats(game, k, formats);
+        if (n_first <= 0 || n_second <= 0 || !nf)
+            continue;
+
+        block = n_first * n_second * nf;
+        if (index >= block)
         {
-            if (!MC_GetOpt(game, k + ADDITION_ALLOWED) )
-                continue;
-            DEBUGMSG(debug_mathcards, "\n*%d*\n", k);
+            index -= block;
+            continue;
+        }
 
-            // The i loop iterates through the first value in the question:
-            for (i = MC_GetOpt(game, MIN_AUGEND + 4 * k); i <= MC_GetOpt(game, MAX_AUGEND + 4 * k); ++i)
-            {
-                DEBUGMSG(debug_mathcards, "\n%d:\n", i);
+        i = MC_GetOpt(game, MIN_AUGEND + 4 * k) + index / (n_second * nf);
+        j = MC_GetOpt(game, MIN_ADDEND + 4 * k) + (index / nf) % n_second;
+        return make_arithmetic_card(game, k, i, j, formats[index % nf], pc);
+    }
 
-                // The j loop iterates through the second value in the question:
-                for (j = MC_GetOpt(game, MIN_ADDEND + 4 * k); j <= MC_GetOpt(game, MAX_ADDEND + 4 * k); ++j)
-                {
-                    // Generate the third number according to the operation.
-                    // Although it is called "ans", it will not be the actual
-                    // answer if it is a "missing number" type problem
-                    // (e.g. "3 x ? = 12")
-                    // We also filter out invalid questions here
-                    switch (k)
-                    {
-                        case MC_OPER_ADD:
-                            {
-                                ans = i + j;
-                                // throw anything over MAX_ANSWER
-                                if (ans > MC_GetOpt(game, MAX_ANSWER))
-                                    continue;
-                                break;
-                            }
-                        case MC_OPER_SUB:
-                            {
-                                ans = i - j;
-                                // throw out negatives if they aren't allowed:
-                                if (ans < 0 && !MC_GetOpt(game, ALLOW_NEGATIVES))
-                                    continue;
-                                // throw anything over MAX_ANSWER
-                                if (ans > MC_GetOpt(game, MAX_ANSWER))
-                                    continue;
-                                break;
-                            }
-                        case MC_OPER_MULT:
-                            {
-                                ans = i * j;
-                                // throw anything over MAX_ANSWER
-                                if (ans > MC_GetOpt(game, MAX_ANSWER))
-                                    continue;
-                                break;
-                            }
-                        case MC_OPER_DIV:
-                            {
-                                // throw anything over MAX_ANSWER
-                                if (i * j > MC_GetOpt(game, MAX_ANSWER))
-                                    continue;
-
-                                tmp = i;
-                                i *= j;
-                                ans = j;
-                                j = tmp;
-                                break;
-                            }
-                        default:
-                            fprintf(stderr, "Unrecognized operation type: %d\n", k);
-                            continue;
-                    }
+    for (length = (shortest > 3) ? shortest : 3; length <= longest; length++)
+    {
+        block = expr_tree_count(game, length, &n_first, &n_second);
+        if (block < 0)
+            block = MC_MAX_ENUM_TREES;
+        if (index < block)
+            return expr_tree_card(game, length, index, pc);
+        index -= block;
+    }
+
+    //TODO comparison questions
+    return 0;
+}
 
-                    DEBUGMSG(debug_mathcards, "Generating: %d %c %d = %d\n", i, operchars[k], j, ans);
 
-                    //add each format, provided it's allowed in general and for this op
+//Builds the question for operation k on the first and second values i and
+//j (for division, these are the divisor and quotient), with the answer in
+//the place given by format f. Returns 1 if successful, 0 if the question is
+//screened out.
+//NOTE the difficulty is set as add = 1, sub = 2, mult = 3, div = 4, plus a 2 point
+//bonus if the format is a "missing number".
+static int make_arithmetic_card(MC_MathGame* game,
+        MC_Operation k, int i, int j, MC_Format f,
+        MC_PackedCard* pc)
+{
+    int ans = 0;
 
-                    // Questions like "a + b = ?"
-                    if (MC_GetOpt(game, FORMAT_ANSWER_LAST) && MC_GetOpt(game, FORMAT_ADD_ANSWER_LAST + k * 3))
-                    {
-                        // Avoid division by zero:
-                        if (k == MC_OPER_DIV && j == 0)
-                        {
-                            // need to restore i and j to original values so loop works:
-                            j = ans;
-                            i = tmp;
-                            continue;
-                        }
-
-                        tnode = allocate_node();
-                        if(!tnode)
-                        {
-                            fprintf(stderr, "In add_all_valid() - allocate_node() failed!\n");
-                            delete_list(list);
-                            return NULL;
-                        }
-
-                        snprintf(tnode->card.answer_string, MC_ANSWER_LEN, "%d", ans);
-                        //snprintf(tnode->card.formula_string, MC_FORMULA_LEN,
-                        //         "%d %c %d = ?", i, operchars[k], j);
-                        create_formula_str(tnode->card.formula_string, i, j, k, MC_FORMAT_ANS_LAST);
-                        tnode->card.difficulty = k + 1;
-                        tnode->card.answer = ans;
-                        list = insert_node(list, *end_of_list, tnode);
-                        *end_of_list = tnode;
-                    }
+    // Generate the third number according to the operation.
+    // Although it is called "ans", it will not be the actual
+    // answer if it is a "missing number" type problem
+    // (e.g. "3 x ? = 12")
+    // We also filter out invalid questions here
+    switch (k)
+    {
+        case MC_OPER_ADD:
+            ans = i + j;
+            break;
+        case MC_OPER_SUB:
+            ans = i - j;
+            // throw out negatives if they aren't allowed:
+            if (ans < 0 && !MC_GetOpt(game, ALLOW_NEGATIVES))
+                return 0;
+            break;
+        case MC_OPER_MULT:
+            ans = i * j;
+            break;
+        case MC_OPER_DIV:
+            // throw anything over MAX_ANSWER
+            if (i * j > MC_GetOpt(game, MAX_ANSWER))
+                return 0;
+            // "i * j / i = j":
+            ans = j;
+            j = i;
+            i = ans * j;
+            break;
+        default:
+            fprintf(stderr, "Unrecognized operation type: %d\n", k);
+            return 0;
+    }
+    // throw anything over MAX_ANSWER
+    if (ans > MC_GetOpt(game, MAX_ANSWER))
+        return 0;
 
+    // Screen out formats that don't make sense for these numbers:
+    switch (f)
+    {
+        // Questions like "a + b = ?"
+        case MC_FORMAT_ANS_LAST:
+            // Avoid division by zero:
+            if (k == MC_OPER_DIV && j == 0)
+                return 0;
+            break;
 
-                    // Questions like "? + b = c"
-                    if (MC_GetOpt(game, FORMAT_ANSWER_FIRST) && MC_GetOpt(game, FORMAT_ADD_ANSWER_FIRST + k * 3) )
-                    {
-                        // Avoid questions with indeterminate answer:
-                        // e.g. "? x 0 = 0"
-                        if (k == MC_OPER_MULT && j == 0)
-                        {
-                            continue;
-                        }
-                        // Avoid division by zero:
-                        if (k == MC_OPER_DIV && j == 0)
-                        {
-                            // need to restore i and j to original values so loop works:
-                            j = ans;
-                            i = tmp;
-                            continue;
-                        }
-
-                        tnode = allocate_node();
-                        if(!tnode)
-                        {
-                            fprintf(stderr, "In add_all_valid() - allocate_node() failed!\n");
-                            delete_list(list);
-                            return NULL;
-                        }
-
-                        snprintf(tnode->card.answer_string, MC_ANSWER_LEN, "%d", i);
-                        create_formula_str(tnode->card.formula_string, j, ans, k, MC_FORMAT_ANS_FIRST);
-                        //snprintf(tnode->card.formula_string, MC_FORMULA_LEN,
-                        //         "? %c %d = %d", operchars[k], j, ans);
-                        tnode->card.answer = ans;
-                        tnode->card.difficulty = k + 3;
-                        list = insert_node(list, *end_of_list, tnode);
-                        *end_of_list = tnode;
-                    }
+        // Questions like "? + b = c"
+        case MC_FORMAT_ANS_FIRST:
+            // Avoid questions with indeterminate answer (e.g. "? x 0 = 0")
+            // and division by zero:
+            if ((k == MC_OPER_MULT || k == MC_OPER_DIV) && j == 0)
+                return 0;
+            break;
 
+        // Questions like "a + ? = c"
+        case MC_FORMAT_ANS_MIDDLE:
+            // Avoid questions with indeterminate answer:
+            // e.g. "0 x ? = 0", "0 / ? = 0"
+            if ((k == MC_OPER_MULT || k == MC_OPER_DIV) && i == 0)
+                return 0;
+            break;
 
-                    // Questions like "a + ? = c"
-                    if (MC_GetOpt(game, FORMAT_ANSWER_MIDDLE) && MC_GetOpt(game, FORMAT_ADD_ANSWER_MIDDLE + k * 3))
-                    {
-                        // Avoid questions with indeterminate answer:
-                        // e.g. "0 x ? = 0"
-                        if (k == MC_OPER_MULT && i == 0)
-                            continue;
-
-                        // e.g. "0 / ? = 0"
-                        if (k == MC_OPER_DIV && i == 0)
-                        {
-                            // need to restore i and j to original values so loop works:
-                            j = ans;
-                            i = tmp;
-                            continue;
-                        }
-
-                        tnode = allocate_node();
-                        if(!tnode)
-                        {
-                            fprintf(stderr, "In add_all_valid() - allocate_node() failed!\n");
-                            delete_list(list);
-                            return NULL;
-                        }
-
-                        snprintf(tnode->card.answer_string, MC_ANSWER_LEN, "%d", j);
-                        create_formula_str(tnode->card.formula_string, i, ans, k, MC_FORMAT_ANS_MIDDLE);
-                        //snprintf(tnode->card.formula_string, MC_FORMULA_LEN,
-                        //         "%d %c ? = %d", i, operchars[k], ans);
-                        tnode->card.answer = ans;
-                        tnode->card.difficulty = k + 3;
-                        list = insert_node(list, *end_of_list, tnode);
-                        *end_of_list = tnode;
-                    }
-                    //If we divided, reset i and j so loop works correctly
-                    if (k == MC_OPER_DIV)
-                    {
-                        j = ans;
-                        i = tmp;
-                        DEBUGMSG(debug_mathcards, "resetting to %d %d\n", j, i);
-                    }
-                }
-            }
-        }
+        default:
+            return 0;
     }
-    //add all comparison questions (TODO implement them!)
-    else if (pt == MC_PT_COMPARISON)
-    {
-        for (i = MC_GetOpt(game, MIN_COMPARATOR); i < MC_GetOpt(game, MAX_COMPARATOR); ++i)
-        {
-            for (j = MC_GetOpt(game, MIN_COMPARISAND); j < MC_GetOpt(game, MAX_COMPARISAND); ++j)
-            {
-                tnode = allocate_node();
-                if(!tnode)
-                {
-                    fprintf(stderr, "In add_all_valid() - allocate_node() failed!\n");
-                    delete_list(list);
-                    return NULL;
-                }
 
-                snprintf(tnode->card.formula_string, MC_FORMULA_LEN, "%d ? %d", i,j);
-                snprintf(tnode->card.answer_string, MC_ANSWER_LEN,
-                        i < j ? "<" : 
-                        i > j ? ">" : 
-                        "=");
-                tnode->card.difficulty = 1;
-                list = insert_node(list, *end_of_list, tnode);
-                *end_of_list = tnode;
-            }
-        }
-    }
-    DEBUGMSG(debug_mathcards, "Exiting add_all_valid()\n");  
-    DEBUGMSG(debug_mathcards, "List now has %d questions\n\n", list_length(list));
+    // The text is only written out when the card is drawn:
+    memset(pc, 0, sizeof(MC_PackedCard));
+    pc->kind = MC_CARD_ARITHMETIC;
+    pc->style = k * MC_NUM_FORMATS + f;
+    pc->n1 = i;
+    pc->n2 = j;
+    pc->answer = ans;
+    pc->difficulty = (f == MC_FORMAT_ANS_LAST) ? k + 1 : k + 3;
+
+    DEBUGMSG(debug_mathcards, "Generating: %d %c %d, format %d\n", i, operchars[k], j, f);
+    return 1;
+}
+
+
+
+/* The permutation is a small Feistel network over the smallest even */
+/* power of two >= n; results that fall outside [0, n) are fed back  */
+/* in ("cycle walking"), which keeps it a bijection on [0, n). Each  */
+/* index costs a few multiplies, and no table is ever built.         */
+static void perm_init(MC_Random* rng, index_perm* perm, unsigned int n)
+{
+    int i;
 
-    return list;
+    perm->n = n;
+    perm->half_bits = 1;
+    while (perm->half_bits < 15 && (1u << (2 * perm->half_bits)) < n)
+        perm->half_bits++;
+    for (i = 0; i < 4; i++)
+        perm->keys[i] = rng_next(rng);
 }
 
-MC_MathQuestion* find_node(MC_MathQuestion* list, int num)
+
+static unsigned int perm_round(unsigned int x, unsigned int key)
+{
+    x ^= key;
+    x *= 0x9E3779B1u;
+    x ^= x >> 15;
+    x *= 0x85EBCA77u;
+    x ^= x >> 13;
+    return x;
+}
+
+
+static unsigned int perm_index(const index_perm* perm, unsigned int i)
 {
-    while (--num > 0 && list)
-        list = list->next;
-    return list;
+    unsigned int mask = (1u << perm->half_bits) - 1;
+    unsigned int l, r, tmp;
+    int round;
+
+    do
+    {
+        l = i >> perm->half_bits;
+        r = i & mask;
+        for (round = 0; round < 4; round++)
+        {
+            tmp = r;
+            r = l ^ (perm_round(r, perm->keys[round]) & mask);
+            l = tmp;
+        }
+        i = (l << perm->half_bits) | r;
+    } while (i >= perm->n);
+
+    return i;
 }
 
 void reformat_arithmetic(MC_FlashCard* card, MC_Format f)
@@ -2569,21 +4752,32 @@ static int calc_score(int difficulty, float t)
     return (difficulty * SCORE_COEFFICIENT)/t;
 }
 
-static int create_formula_str(char* formula_str, int n1, int n2, int op, int format)
+static const char format_strings[MC_NUM_OPERS][MC_NUM_FORMATS][32] = {
+    {N_("%d + %d = ?"), N_("? + %d = %d"), N_("%d + ? = %d")},
+    {N_("%d - %d = ?"), N_("? - %d = %d"), N_("%d - ? = %d")},
+    {N_("%d x %d = ?"), N_("? x %d = %d"), N_("%d x ? = %d")},
+    {N_("%d ÷ %d = ?"), N_("? ÷ %d = %d"), N_("%d ÷ ? = %d")}
+};
+
+/* Looks up the translations once per game rather than every time */
+/* a card is drawn:                                                */
+static void translate_formulas(MC_MathGame* game)
 {
-    const char format_strings[MC_NUM_OPERS][MC_NUM_FORMATS][32] = {
-        {N_("%d + %d = ?"), N_("? + %d = %d"), N_("%d + ? = %d")},
-        {N_("%d - %d = ?"), N_("? - %d = %d"), N_("%d - ? = %d")},
-        {N_("%d x %d = ?"), N_("? x %d = %d"), N_("%d x ? = %d")},
-        {N_("%d ÷ %d = ?"), N_("? ÷ %d = %d"), N_("%d ÷ ? = %d")}
-    };
+    int op, format;
+
+    for (op = 0; op < MC_NUM_OPERS; op++)
+        for (format = 0; format < MC_NUM_FORMATS; format++)
+            game->formula_formats[op][format] = _(format_strings[op][format]);
+}
 
+static int create_formula_str(MC_MathGame* game, char* formula_str, int n1, int n2, int op, int format)
+{
     if(!formula_str)
         return 0;
 
-    snprintf(formula_str, MC_FORMULA_LEN,
-            _(format_strings[op][format]),
-            n1, n2);
+    card_format(formula_str, MC_FORMULA_LEN,
+            game->formula_formats[op][format],
+            n1, n2, 0);
 
     DEBUGMSG(debug_mathcards, "n1 = %d\tn2 = %d\top = %d\tformat = "
             "%dformat_strings[op][format] = %s\tformula: %s\n",
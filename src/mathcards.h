@@ -17,6 +17,8 @@ Copyright: See COPYING file that comes with this distribution (briefly, GNU GPL
 #ifndef MATHCARDS_H
 #define MATHCARDS_H
 
+#include <stdio.h>
+#include <stdint.h>
 #include "transtruct.h"
 
 
@@ -50,8 +52,9 @@ typedef enum _MC_Format {
    Indices for the various integer options. These are NOT the actual values!
    Actual values are accessed as such: options.iopts[PLAY_THROUGH_LIST] = val;
    Creating additional [integral] options is now centralized--it should only
-   be necessary to add to this list, the list of text, and the list of
-   defaults. (Besides actually using the new options!)
+   be necessary to add to this list, the list of text, the sorted lookup
+   order in mathcards.c, and the list of defaults. (Besides actually using
+   the new options!)
    */
 enum {
     NOT_VALID_OPTION = -1     ,
@@ -153,19 +156,179 @@ typedef struct _MC_Options
 
 
 
-/* struct for node in math "flashcard" list */
-typedef struct MC_MathQuestion {
-    MC_FlashCard card;
-    struct MC_MathQuestion* next;
-    struct MC_MathQuestion* previous;
-    int randomizer;
-} MC_MathQuestion;
+/* State of the per-game pseudo-random number generator (PCG32), */
+/* used for all question generation and shuffling:               */
+typedef struct _MC_Random {
+    uint64_t state;
+    uint64_t inc;
+} MC_Random;
+
+/* Per-game memory arena from which the question lists are allocated.  */
+/* Blocks are carved off large chunks by bumping a pointer; blocks that */
+/* are given back mid-game (e.g. when a list grows) are kept on a free  */
+/* list by power-of-two size class for reuse, and everything is handed */
+/* back to the system in one go by MC_EndGame().                        */
+#define MC_ARENA_CLASSES 32
+
+typedef struct _MC_Arena {
+    struct _MC_ArenaChunk* chunks;         /* all chunks, newest first  */
+    char* next;                            /* bump pointer              */
+    char* end;                             /* end of current chunk      */
+    void* free_blocks[MC_ARENA_CLASSES];   /* recycled blocks by class  */
+    size_t in_use;                         /* bytes handed out          */
+    size_t reserved;                       /* bytes obtained by malloc  */
+    size_t peak_reserved;                  /* high-water mark of above  */
+    size_t chunks_allocated;               /* mallocs made, ever        */
+} MC_Arena;
+
+/* Compact form in which the question lists hold their cards.  Only   */
+/* the numbers are kept - the formula and answer text is rendered into */
+/* an MC_FlashCard when a card is handed out or printed. Cards that    */
+/* can't be described this way (e.g. questions with more than two      */
+/* operands) keep their text in the game's card_text table instead.    */
+typedef enum _MC_CardKind {
+    MC_CARD_TYPING,          /* n1 is the number to type                */
+    MC_CARD_ARITHMETIC,      /* "n1 op n2 = result", with one blank     */
+    MC_CARD_TEXT             /* n1 is the slot in card_text             */
+} MC_CardKind;
+
+typedef struct _MC_PackedCard {
+    int question_id;
+    int answer;              /* same as MC_FlashCard.answer             */
+    int n1, n2;
+    short difficulty;
+    unsigned char kind;      /* MC_CardKind                             */
+    unsigned char style;     /* op * MC_NUM_FORMATS + format, plus     */
+                             /* MC_STYLE_PLAIN for untranslated text    */
+} MC_PackedCard;
+
+#define MC_STYLE_PLAIN 0x80
+
+typedef struct _MC_CardText {
+    char formula_string[MC_FORMULA_LEN];
+    char answer_string[MC_ANSWER_LEN];
+} MC_CardText;
+
+/* "Deck" of flashcards - the cards are kept contiguously in a ring   */
+/* buffer so that drawing off the top of the pile, putting a card back */
+/* in at a random spot, and appending are all O(1) operations.         */
+/* capacity is always zero or a power of two.                          */
+typedef struct _MC_Deck {
+    MC_PackedCard* cards;
+    int head;                /* slot holding the top card              */
+    int length;              /* number of cards currently in the deck  */
+    int capacity;            /* number of allocated slots              */
+} MC_Deck;
+
+/* Streaming estimate of one quantile of the answer times, using the */
+/* P-squared algorithm (Jain & Chlamtac, 1985): five markers track   */
+/* the minimum, the maximum, the quantile itself and the two points  */
+/* halfway to it, and are nudged toward their ideal positions as     */
+/* each time arrives. Memory is constant and nothing is ever sorted. */
+typedef struct _MC_Quantile {
+    double p;                /* which quantile, 0 < p < 1               */
+    double heights[5];       /* marker values                           */
+    int positions[5];        /* actual marker positions                 */
+    double desired[5];       /* ideal marker positions                  */
+} MC_Quantile;
+
+/* The answer-time percentiles that are tracked: */
+#define MC_NUM_TIME_PERCENTILES 3
+extern const int MC_TIME_PERCENTILES[MC_NUM_TIME_PERCENTILES];  /* 50, 90, 99 */
+
+typedef struct _MC_TimeStats {
+    int count;
+    double total;
+    MC_Quantile quantiles[MC_NUM_TIME_PERCENTILES];
+} MC_TimeStats;
+
+/* Tables for drawing random questions without retrying, rebuilt by  */
+/* MC_StartGame() from the current options.  For a given first       */
+/* operand the allowed second operands always form a single range,   */
+/* so the valid pairs for an operation are described by one range    */
+/* per first operand, and an alias table over the first operands     */
+/* (weighted by range length) picks a pair uniformly in O(1).        */
+typedef struct _MC_OperandTable {
+    int first_min;           /* first operand in slot 0                 */
+    int count;               /* number of first operand values          */
+    int* second_min;         /* slot i allows second operands           */
+    int* second_count;       /*   second_min[i] .. + second_count[i]-1  */
+    unsigned int* keep;      /* alias table: keep slot i with           */
+    int* alias;              /*   probability keep[i] / 2^32, else alias */
+    long total;              /* number of valid pairs                   */
+} MC_OperandTable;
+
+typedef struct _MC_Samplers {
+    MC_ProblemType types[MC_NUM_PTYPES];   /* problem types allowed     */
+    int num_types;
+    MC_Operation opers[MC_NUM_OPERS];      /* operations with valid pairs */
+    int num_opers;
+    MC_Operation allowed[MC_NUM_OPERS];    /* every allowed operation   */
+    int num_allowed;
+    MC_Operation additive[2];              /* allowed of + and -        */
+    int num_additive;
+    MC_Format formats[MC_NUM_OPERS][MC_NUM_FORMATS];
+    int num_formats[MC_NUM_OPERS];
+    MC_OperandTable operands[MC_NUM_OPERS];
+    int* divisors;           /* allowed divisors of n are divisors[i] for */
+    int* divisor_start;      /*   divisor_start[n] <= i < divisor_start[n+1] */
+    int max_dividend;
+} MC_Samplers;
+
+/* Cards currently "in play" - kept in a dense array, with an open-    */
+/* addressed hash table mapping question_id to array slot so answers  */
+/* can be matched up without scanning. Note that ids need not be      */
+/* unique (e.g. repeated wrong answers), so the index may hold several */
+/* entries for one id - any of them is a valid match.                 */
+typedef struct _MC_ActiveSet {
+    MC_PackedCard* cards;
+    int length;
+    int capacity;
+    int* index;              /* slot numbers, -1 if empty              */
+    int index_size;          /* power of two, at least 2 * capacity    */
+} MC_ActiveSet;
+
+/* Wrongly answered cards waiting to come round again. Rather than    */
+/* shuffling COPIES_REPEATED_WRONGS copies into the deck, each card   */
+/* is kept once, with the number of copies still owed and the draw    */
+/* at which the next one is due, in a binary min-heap ordered by due. */
+typedef struct _MC_Repeat {
+    MC_PackedCard card;
+    int due;                 /* number of the draw it is due at        */
+    int copies;              /* times it is still to come up           */
+} MC_Repeat;
+
+typedef struct _MC_RepeatQueue {
+    MC_Repeat* heap;
+    int length;
+    int capacity;
+    int copies;              /* total of copies over the whole heap    */
+    int draws;               /* number of the latest draw this game    */
+} MC_RepeatQueue;
+
+/* Hash index over the contents of a deck's cards (not their ids), so */
+/* an identical card can be found without comparing with every one.  */
+typedef struct _MC_CardIndex {
+    int* slots;              /* positions in the deck, -1 if empty     */
+    int size;                /* zero or a power of two                 */
+} MC_CardIndex;
 
 typedef struct _MC_MathGame {
-    MC_MathQuestion* question_list;
-    MC_MathQuestion* wrong_quests;
-    MC_MathQuestion* active_quests;
-    MC_MathQuestion* next_wrong_quest;
+    MC_Random rng;
+    unsigned int seed;       /* used if fixed_seed is set */
+    int fixed_seed;
+    int next_card_id;        /* serial number for generated cards */
+    MC_Arena arena;
+    MC_Samplers samplers;
+    MC_Deck question_list;
+    MC_Deck wrong_quests;
+    MC_CardIndex wrong_index;    /* for avoiding duplicates in wrong_quests */
+    MC_ActiveSet active_quests;
+    MC_RepeatQueue repeats;
+    MC_CardText* card_text;  /* text of MC_CARD_TEXT cards              */
+    int card_text_length;
+    int card_text_capacity;
+    const char* formula_formats[MC_NUM_OPERS][MC_NUM_FORMATS];  /* translated */
     int quest_list_length;
     int answered_correctly;
     int answered_wrong;
@@ -174,12 +337,20 @@ typedef struct _MC_MathGame {
     int starting_length;
 
     /* For keeping track of timing data */
-    float* time_per_question_list;
-    int length_time_per_question_list;
-    int length_alloc_time_per_question_list;
+    MC_TimeStats answer_times;
     MC_Options* math_opts;
 } MC_MathGame;
 
+/* One answer for MC_RecordAnswers(): the caller fills in the first */
+/* three fields, and MathCards fills in the last two.               */
+typedef struct _MC_AnswerRecord {
+    int question_id;
+    int correct;             /* nonzero if answered correctly          */
+    float time;              /* seconds taken to answer                */
+    int points;              /* points earned (correct answers only)   */
+    int recorded;            /* 1 if the question was in play          */
+} MC_AnswerRecord;
+
 
 /* "public" function prototypes: these functions are how */
 /* a user interface communicates with MathCards:         */
@@ -192,7 +363,9 @@ typedef struct _MC_MathGame {
 /*  has not been called. It only needs to be called once, */
 /*  i.e when the program is starting, not at the beginning*/
 /*  of each math game for the player. Returns 1 if        */
-/*  successful, 0 otherwise.                              */
+/*  successful, 0 otherwise. A new game must start out    */
+/*  zeroed (calloc() or memset()), as this keeps any seed */
+/*  already given to MC_SetRandomSeed().                  */
 int MC_Initialize(MC_MathGame* game);
 
 /*  MC_StartGame() generates the list of math questions   */
@@ -233,6 +406,14 @@ int MC_AnsweredCorrectly(MC_MathGame* game, int id, float t);
 /*  answered correctly. Returns 1 if no errors.           */
 int MC_NotAnsweredCorrectly(MC_MathGame* game, int id);
 
+/*  Batch versions of the above, for callers (such as the   */
+/*  server) handling many questions at a time.             */
+/*  MC_NextQuestions() fills in up to n cards, returning   */
+/*  how many it drew. MC_RecordAnswers() records n answers  */
+/*  in order, returning how many matched a question in play.*/
+int MC_NextQuestions(MC_MathGame* game, MC_FlashCard* cards, int n);
+int MC_RecordAnswers(MC_MathGame* game, MC_AnswerRecord* answers, int n);
+
 /*  Like MC_NextQuestion(), but takes "flashcard" from    */
 /*  pile of incorrectly answered questions.               */
 /*  Returns 1 if question found, 0 if list empty/invalid  */
@@ -261,6 +442,21 @@ int MC_AddTimeToList(MC_MathGame* game, float t);
 /*  user interface program exits.                         */
 void MC_EndGame(MC_MathGame* game);
 
+/*  MC_SaveState() writes everything needed to carry on    */
+/*  with the current game - options, question lists, cards  */
+/*  in play, wrong answers, counters and timing data - to   */
+/*  fp in a compact, versioned binary format, so a restarted */
+/*  program can pick up where it left off. MC_LoadState()   */
+/*  replaces the game's state with one read back from fp.   */
+/*  Both return 1 if successful, 0 otherwise. A file that   */
+/*  is missing, truncated, corrupt or of another version is */
+/*  turned down before the game is touched, so the game     */
+/*  carries on as it was. Only if a file that passes those  */
+/*  checks still can't be read back is the game left with   */
+/*  no questions, to be started afresh with MC_StartGame(). */
+int MC_SaveState(MC_MathGame* game, FILE* fp);
+int MC_LoadState(MC_MathGame* game, FILE* fp);
+
 /*  Prints contents of math_opts struct in human-readable   */
 /*  form to given file. "verbose" tells the function to     */
 /*  write a lot of descriptive "help"-type info for each    */
@@ -274,7 +470,24 @@ int MC_StartingListLength(MC_MathGame* game);
 int MC_WrongListLength(MC_MathGame* game);
 int MC_NumAnsweredCorrectly(MC_MathGame* game);
 int MC_NumNotAnsweredCorrectly(MC_MathGame* game);
+/* Answer time statistics (in seconds) - these are estimates kept up */
+/* to date as answers come in, so they are cheap to call at any time: */
 float MC_MedianTimePerQuestion(MC_MathGame* game);
+float MC_MeanTimePerQuestion(MC_MathGame* game);
+/* percentile must be one of MC_TIME_PERCENTILES: */
+float MC_TimePerQuestionPercentile(MC_MathGame* game, int percentile);
+/* Most memory (in bytes) held for question lists at any one time - */
+/* useful for sizing servers that host many games:                  */
+size_t MC_PeakMemoryUsage(MC_MathGame* game);
+/* Number of times memory has been requested from the system for */
+/* question lists since MC_Initialize():                          */
+size_t MC_MemoryAllocations(MC_MathGame* game);
+/* Makes question generation reproducible: every MC_StartGame() */
+/* after this restarts the random sequence from the given seed. */
+/* It may be called before MC_Initialize(), and the seed lasts  */
+/* through MC_EndGame(). Without it, each game is seeded from   */
+/* the clock.                                                   */
+void MC_SetRandomSeed(MC_MathGame* game, unsigned int seed);
 void print_card(MC_FlashCard card);
 
 /********************************************
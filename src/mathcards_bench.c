@@ -0,0 +1,768 @@
+/* mathcards_bench.c
+
+   A standalone benchmark for the mathcards engine. Plays games from
+   the shipped lesson files and from some synthetic option presets
+   (large decks, repeated wrong answers, multi-operand questions),
+   and reports questions answered per second, memory allocations
+   and peak memory as JSON, so that changes that slow down big
+   games get noticed. It also checks that many games played at once
+   on separate threads don't interfere with each other.
+
+   Copyright 2009, 2010, 2011.
+Author: David Bruce.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+
+mathcards_bench.c is part of "Tux, of Math Command", a.k.a. "tuxmath".
+
+Tuxmath is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+Tuxmath is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include "globals.h"
+#include "options.h"
+#include "mathcards.h"
+#include "fileops.h"
+
+/* Usage: mathcards_bench [lessonfile ...]
+
+   With no arguments, every shipped lesson (lesson00, lesson01, ...)
+   is benchmarked along with the presets below. Results go to stdout
+   as a single JSON object; errors go to stderr. Exit status is
+   nonzero if any run fails, the reentrancy check finds cross-talk,
+   the option name lookups disagree with a plain linear search, or a
+   game saved and loaded midway plays on differently from the original.
+*/
+
+/* Questions answered in each run - games are restarted as needed: */
+#define BENCH_ANSWERS 200000
+/* Roughly the number of comets on screen at once: */
+#define CARDS_IN_PLAY 10
+/* Lessons are tried as lesson00, lesson01 ... up to this many: */
+#define MAX_LESSONS 100
+
+/* Synthetic option presets, each a list of option/value pairs */
+/* applied on top of the MathCards defaults:                    */
+#define MAX_PRESET_SETTINGS 24
+
+typedef struct preset_type {
+    const char* name;
+    int settings[MAX_PRESET_SETTINGS][2];
+} preset_type;
+
+static const preset_type presets[] = {
+    {"defaults", {
+        {NOT_VALID_OPTION, 0}}},
+    {"random_100k", {
+        {COMPREHENSIVE, 0}, {AVG_LIST_LENGTH, 100000}, {PLAY_THROUGH_LIST, 0},
+        {ADDITION_ALLOWED, 1}, {SUBTRACTION_ALLOWED, 1},
+        {MULTIPLICATION_ALLOWED, 1}, {DIVISION_ALLOWED, 1},
+        {NOT_VALID_OPTION, 0}}},
+    {"comprehensive_large", {
+        {COMPREHENSIVE, 1}, {AVG_LIST_LENGTH, 100000}, {PLAY_THROUGH_LIST, 0},
+        {ADDITION_ALLOWED, 1}, {SUBTRACTION_ALLOWED, 1},
+        {MULTIPLICATION_ALLOWED, 1}, {DIVISION_ALLOWED, 1},
+        {MAX_AUGEND, 99}, {MAX_ADDEND, 99}, {MAX_MINUEND, 99}, {MAX_SUBTRAHEND, 99},
+        {MAX_MULTIPLIER, 99}, {MAX_MULTIPLICAND, 99}, {MAX_DIVISOR, 99}, {MAX_QUOTIENT, 99},
+        {MAX_ANSWER, 999},
+        {NOT_VALID_OPTION, 0}}},
+    {"repeat_wrongs", {
+        {COMPREHENSIVE, 0}, {AVG_LIST_LENGTH, 10000}, {PLAY_THROUGH_LIST, 1},
+        {REPEAT_WRONGS, 1}, {COPIES_REPEATED_WRONGS, 3},
+        {NOT_VALID_OPTION, 0}}},
+    {"multi_operand", {
+        {COMPREHENSIVE, 0}, {AVG_LIST_LENGTH, 10000}, {PLAY_THROUGH_LIST, 0},
+        {MIN_FORMULA_NUMS, 3}, {MAX_FORMULA_NUMS, 4},
+        {NOT_VALID_OPTION, 0}}},
+    {"comprehensive_multi_operand", {
+        {COMPREHENSIVE, 1}, {AVG_LIST_LENGTH, 10000}, {PLAY_THROUGH_LIST, 0},
+        {MIN_FORMULA_NUMS, 3}, {MAX_FORMULA_NUMS, 4},
+        {NOT_VALID_OPTION, 0}}},
+    {"typing", {
+        {COMPREHENSIVE, 0}, {AVG_LIST_LENGTH, 10000}, {PLAY_THROUGH_LIST, 0},
+        {TYPING_PRACTICE_ALLOWED, 1}, {ARITHMETIC_ALLOWED, 0},
+        {ADDITION_ALLOWED, 0}, {SUBTRACTION_ALLOWED, 0},
+        {MULTIPLICATION_ALLOWED, 0}, {DIVISION_ALLOWED, 0},
+        {NOT_VALID_OPTION, 0}}},
+};
+#define NUM_PRESETS (sizeof(presets)/sizeof(presets[0]))
+
+/* Saved game check - a large game is saved after this many answers, */
+/* loaded into a second game, and both are played on the same way:  */
+#define SAVE_AFTER 50000
+#define SAVE_PLAY_ON 50000
+
+/* Seed check - how many answers each seeded game is played for: */
+#define SEED_ANSWERS 2000
+
+/* Reentrancy check - each game is played once alone and once while */
+/* all the others are running, and must come out the same:          */
+#define STRESS_GAMES 256
+#define STRESS_THREADS 8
+#define STRESS_ANSWERS 2000
+
+/* Declarations needed for the auxillary functions */
+char **lesson_list_titles = NULL;
+char **lesson_list_filenames = NULL;
+int num_lessons = 0;
+
+int read_high_scores_fp(FILE* fp)
+{
+    /* This is a stub to let things compile */
+    return 1;
+}
+
+void initialize_scores(void)
+{
+    /* This is a stub to let things compile */
+}
+
+static unsigned int stress_serial[STRESS_GAMES];
+static unsigned int stress_parallel[STRESS_GAMES];
+static int stress_next_game = 0;
+static pthread_mutex_t stress_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int bench_game(MC_MathGame* game, const char* name, const char* source, int first);
+static int bench_lesson(const char* filename, int first);
+static int bench_preset(const preset_type* preset, int first);
+static long peak_rss_kb(void);
+static unsigned int hash_card(unsigned int h, const MC_FlashCard* fc);
+static unsigned int play_stress_game(int n);
+static void* stress_worker(void* data);
+static int check_reentrancy(void);
+static int linear_lookup(const char* const* names, int n, const char* text);
+static int check_option_lookup(void);
+static unsigned int play_on(MC_MathGame* game, MC_FlashCard* in_play, int* in_play_ok, int from, int to);
+static int check_saved_game(void);
+static unsigned int play_seeded(MC_MathGame* game);
+static int check_early_seed(void);
+static int check_no_questions(void);
+
+int main(int argc, char* argv[])
+{
+    int i, runs = 0, failures = 0;
+    unsigned int n;
+    char lesson[PATH_MAX];
+    FILE* fp;
+
+    /* initialize game_options struct with defaults DSB */
+    if (!Opts_Initialize())
+    {
+        fprintf(stderr, "\nUnable to initialize game_options\n");
+        exit(1);
+    }
+
+    printf("{\n  \"answers_per_run\": %d,\n  \"runs\": [", BENCH_ANSWERS);
+
+    if (argc > 1)
+    {
+        for (i = 1; i < argc; i++)
+        {
+            if (bench_lesson(argv[i], runs == 0))
+                runs++;
+            else
+                failures++;
+        }
+    }
+    else
+    {
+        /* All the shipped lessons, for as long as they can be found: */
+        for (i = 0; i < MAX_LESSONS; i++)
+        {
+            snprintf(lesson, sizeof(lesson), "%s/missions/lessons/lesson%02d", DATA_PREFIX, i);
+            fp = fopen(lesson, "r");
+            if (!fp)
+                break;
+            fclose(fp);
+            if (bench_lesson(lesson, runs == 0))
+                runs++;
+            else
+                failures++;
+        }
+        if (i == 0)
+            fprintf(stderr, "No lesson files found under %s\n", DATA_PREFIX);
+
+        for (n = 0; n < NUM_PRESETS; n++)
+        {
+            if (bench_preset(&presets[n], runs == 0))
+                runs++;
+            else
+                failures++;
+        }
+    }
+
+    printf("\n  ],\n");
+    if (!check_option_lookup())
+        failures++;
+    if (!check_saved_game())
+        failures++;
+    if (!check_early_seed())
+        failures++;
+    if (!check_no_questions())
+        failures++;
+    i = check_reentrancy();
+    printf("  \"reentrancy\": {\"games\": %d, \"threads\": %d, \"ok\": %s},\n",
+            STRESS_GAMES, STRESS_THREADS, i ? "true" : "false");
+    printf("  \"peak_rss_kb\": %ld\n}\n", peak_rss_kb());
+
+    return (failures || !i) ? 1 : 0;
+}
+
+
+/* Reads the lesson into a fresh game and benchmarks it: */
+static int bench_lesson(const char* filename, int first)
+{
+    MC_MathGame game;
+    const char* name;
+    int ret;
+
+    memset(&game, 0, sizeof(game));
+    if (!MC_Initialize(&game))
+    {
+        fprintf(stderr, "Unable to initialize MathCards\n");
+        return 0;
+    }
+    if (!read_named_config_file(&game, filename))
+    {
+        fprintf(stderr, "Could not read lesson %s\n", filename);
+        MC_EndGame(&game);
+        return 0;
+    }
+
+    name = strrchr(filename, '/');
+    name = name ? name + 1 : filename;
+    ret = bench_game(&game, name, "lesson", first);
+    MC_EndGame(&game);
+    return ret;
+}
+
+
+/* Applies the preset to a fresh game and benchmarks it: */
+static int bench_preset(const preset_type* preset, int first)
+{
+    MC_MathGame game;
+    int i, ret;
+
+    memset(&game, 0, sizeof(game));
+    if (!MC_Initialize(&game))
+    {
+        fprintf(stderr, "Unable to initialize MathCards\n");
+        return 0;
+    }
+    for (i = 0; i < MAX_PRESET_SETTINGS && preset->settings[i][0] != NOT_VALID_OPTION; i++)
+        MC_SetOpt(&game, preset->settings[i][0], preset->settings[i][1]);
+
+    ret = bench_game(&game, preset->name, "preset", first);
+    MC_EndGame(&game);
+    return ret;
+}
+
+
+/* Plays games with the current options, starting a new one whenever */
+/* the questions run out, until BENCH_ANSWERS have been answered -   */
+/* mostly right, sometimes wrong, like a real player. Writes one     */
+/* JSON object for the run and returns 1, or returns 0 on failure.   */
+static int bench_game(MC_MathGame* game, const char* name, const char* source, int first)
+{
+    int k, answered = 0, games = 0, live, list_length = 0;
+    clock_t start, start_game_ticks = 0, t;
+    double secs;
+    MC_FlashCard in_play[CARDS_IN_PLAY];
+    int in_play_ok[CARDS_IN_PLAY];
+
+    /* Same questions and answers every time: */
+    MC_SetRandomSeed(game, 1);
+
+    start = clock();
+    while (answered < BENCH_ANSWERS)
+    {
+        t = clock();
+        if (!MC_StartGame(game))
+        {
+            fprintf(stderr, "MC_StartGame() failed for %s\n", name);
+            return 0;
+        }
+        start_game_ticks += clock() - t;
+        if (games++ == 0)
+            list_length = MC_StartingListLength(game);
+
+        live = 0;
+        for (k = 0; k < CARDS_IN_PLAY; k++)
+        {
+            in_play_ok[k] = MC_NextQuestion(game, &in_play[k]);
+            live += in_play_ok[k];
+        }
+        if (!live)
+        {
+            fprintf(stderr, "No questions generated for %s\n", name);
+            return 0;
+        }
+
+        for (k = 0; live > 0 && answered < BENCH_ANSWERS; k = (k + 1) % CARDS_IN_PLAY)
+        {
+            if (!in_play_ok[k])
+                continue;
+            if ((in_play[k].question_id + answered) % 4)
+                MC_AnsweredCorrectly(game, in_play[k].question_id, 1.0);
+            else
+                MC_NotAnsweredCorrectly(game, in_play[k].question_id);
+            answered++;
+            in_play_ok[k] = MC_NextQuestion(game, &in_play[k]);
+            if (!in_play_ok[k])
+                live--;
+        }
+    }
+    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%s\n    {\"name\": \"%s\", \"source\": \"%s\", \"list_length\": %d, "
+            "\"games\": %d, \"answers\": %d, \"seconds\": %.3f, "
+            "\"cards_per_sec\": %.0f, \"start_game_ms\": %.3f, "
+            "\"allocations\": %lu, \"peak_list_bytes\": %lu, \"peak_rss_kb\": %ld}",
+            first ? "" : ",", name, source, list_length,
+            games, answered, secs,
+            secs > 0 ? answered / secs : 0.0,
+            1000.0 * start_game_ticks / CLOCKS_PER_SEC / games,
+            (unsigned long)MC_MemoryAllocations(game),
+            (unsigned long)MC_PeakMemoryUsage(game),
+            peak_rss_kb());
+    fflush(stdout);
+    return 1;
+}
+
+
+/* High-water mark of the whole process's resident memory so far: */
+static long peak_rss_kb(void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; //bytes on Mac OS X
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+
+/* FNV-1a over everything the player would see: */
+static unsigned int hash_card(unsigned int h, const MC_FlashCard* fc)
+{
+    const char* c;
+
+    for (c = fc->formula_string; *c; c++)
+        h = (h ^ (unsigned char)*c) * 16777619u;
+    for (c = fc->answer_string; *c; c++)
+        h = (h ^ (unsigned char)*c) * 16777619u;
+    h = (h ^ (unsigned int)fc->question_id) * 16777619u;
+    return (h ^ (unsigned int)fc->answer) * 16777619u;
+}
+
+
+/* Plays game n start to finish with a fixed seed and returns a */
+/* fingerprint of the questions asked and the final counters:   */
+static unsigned int play_stress_game(int n)
+{
+    int k, answered, live = 0;
+    unsigned int h = 2166136261u;
+    MC_MathGame game;
+    MC_FlashCard in_play[CARDS_IN_PLAY];
+    int in_play_ok[CARDS_IN_PLAY];
+
+    memset(&game, 0, sizeof(game));
+    if (!MC_Initialize(&game))
+        return 0;
+    MC_SetRandomSeed(&game, n);
+    /* Alternate between the list-based and random generators: */
+    MC_SetOpt(&game, COMPREHENSIVE, n % 2);
+    MC_SetOpt(&game, AVG_LIST_LENGTH, 50 + n);
+    MC_SetOpt(&game, PLAY_THROUGH_LIST, 1);
+    MC_SetOpt(&game, REPEAT_WRONGS, 1);
+    MC_SetOpt(&game, COPIES_REPEATED_WRONGS, 1 + n % 3);
+
+    if (!MC_StartGame(&game))
+    {
+        MC_EndGame(&game);
+        return 0;
+    }
+
+    for (k = 0; k < CARDS_IN_PLAY; k++)
+    {
+        in_play_ok[k] = MC_NextQuestion(&game, &in_play[k]);
+        if (in_play_ok[k])
+        {
+            h = hash_card(h, &in_play[k]);
+            live++;
+        }
+    }
+
+    for (answered = 0; answered < STRESS_ANSWERS && live > 0; answered++)
+    {
+        k = answered % CARDS_IN_PLAY;
+        if (!in_play_ok[k])
+            continue;
+        /* Answer pattern depends only on the game and the card: */
+        if ((in_play[k].answer + answered + n) % 5)
+            MC_AnsweredCorrectly(&game, in_play[k].question_id, 1.0);
+        else
+            MC_NotAnsweredCorrectly(&game, in_play[k].question_id);
+        in_play_ok[k] = MC_NextQuestion(&game, &in_play[k]);
+        if (in_play_ok[k])
+            h = hash_card(h, &in_play[k]);
+        else
+            live--;
+    }
+
+    h = (h ^ (unsigned int)MC_NumAnsweredCorrectly(&game)) * 16777619u;
+    h = (h ^ (unsigned int)MC_NumNotAnsweredCorrectly(&game)) * 16777619u;
+    h = (h ^ (unsigned int)MC_TotalQuestionsLeft(&game)) * 16777619u;
+    MC_EndGame(&game);
+    return h;
+}
+
+
+static void* stress_worker(void* data)
+{
+    int n;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&stress_lock);
+        n = stress_next_game++;
+        pthread_mutex_unlock(&stress_lock);
+        if (n >= STRESS_GAMES)
+            return NULL;
+        stress_parallel[n] = play_stress_game(n);
+    }
+}
+
+
+/* Returns 1 if every game came out the same on its own and run */
+/* alongside the others, 0 otherwise:                           */
+static int check_reentrancy(void)
+{
+    int n, failures = 0;
+    pthread_t threads[STRESS_THREADS];
+
+    for (n = 0; n < STRESS_GAMES; n++)
+        stress_serial[n] = play_stress_game(n);
+
+    for (n = 0; n < STRESS_THREADS; n++)
+        pthread_create(&threads[n], NULL, stress_worker, NULL);
+    for (n = 0; n < STRESS_THREADS; n++)
+        pthread_join(threads[n], NULL);
+
+    for (n = 0; n < STRESS_GAMES; n++)
+    {
+        if (stress_serial[n] == 0 || stress_serial[n] != stress_parallel[n])
+        {
+            fprintf(stderr, "Game %d differs when run concurrently (%08x vs %08x)\n",
+                    n, stress_serial[n], stress_parallel[n]);
+            failures++;
+        }
+    }
+    return failures == 0;
+}
+
+
+/* The behavior MC_MapTextToIndex() and Opts_MapTextToIndex() */
+/* used to have, as a reference for check_option_lookup():    */
+static int linear_lookup(const char* const* names, int n, const char* text)
+{
+    int i;
+    for (i = 0; i < n; i++)
+        if (!strcasecmp(text, names[i]))
+            return i;
+    return -1;
+}
+
+
+/* Checks the option name lookups against linear_lookup() for every  */
+/* name in either table, in upper, lower and mixed case, and for     */
+/* near misses. Times parse_option()'s lookup pattern on the way and */
+/* prints a JSON member. Returns 1 if they all agree, 0 otherwise.   */
+static int check_option_lookup(void)
+{
+    const char* extras[] = {"", "END_OF_OPTS", "A", "ZZZ", "MAX", "MIN_",
+                            "USE_", "FORMAT_ANSWER", "RANDOMIZED",
+                            "ADDITION_ALLOWED ", " USE_TTS", "MAX_AUGEND_"};
+    char probe[3][MC_FORMULA_LEN];
+    const char* name;
+    int i, j, v, n = 0, failures = 0;
+    int total = NOPTS + NUM_GLOBAL_OPTS + sizeof(extras) / sizeof(extras[0]);
+    long lookups = 0;
+    volatile int sink = 0;
+    clock_t start;
+    double secs;
+
+    if (!MC_VerifyOptionListSane() || !Opts_VerifyOptionListSane())
+    {
+        fprintf(stderr, "Option lookup tables are not sorted\n");
+        failures++;
+    }
+
+    for (i = 0; i < total; i++)
+    {
+        if (i < NOPTS)
+            name = MC_OPTION_TEXT[i];
+        else if (i < NOPTS + NUM_GLOBAL_OPTS)
+            name = OPTION_TEXT[i - NOPTS];
+        else
+            name = extras[i - NOPTS - NUM_GLOBAL_OPTS];
+
+        snprintf(probe[0], MC_FORMULA_LEN, "%s", name);
+        snprintf(probe[1], MC_FORMULA_LEN, "%s", name);
+        snprintf(probe[2], MC_FORMULA_LEN, "%s", name);
+        for (j = 0; probe[1][j]; j++)
+        {
+            probe[1][j] = tolower(probe[1][j]);
+            if (j % 2)
+                probe[2][j] = tolower(probe[2][j]);
+        }
+
+        for (j = 0; j < 3; j++, n++)
+        {
+            v = linear_lookup(MC_OPTION_TEXT, NOPTS, probe[j]);
+            if ((int)MC_MapTextToIndex(probe[j]) != v)
+            {
+                fprintf(stderr, "MC_MapTextToIndex(\"%s\") = %d, expected %d\n",
+                        probe[j], (int)MC_MapTextToIndex(probe[j]), v);
+                failures++;
+            }
+            v = linear_lookup(OPTION_TEXT, NUM_GLOBAL_OPTS, probe[j]);
+            if ((int)Opts_MapTextToIndex(probe[j]) != v)
+            {
+                fprintf(stderr, "Opts_MapTextToIndex(\"%s\") = %d, expected %d\n",
+                        probe[j], (int)Opts_MapTextToIndex(probe[j]), v);
+                failures++;
+            }
+        }
+    }
+
+    /* Math option first, then global, as parse_option() does: */
+    start = clock();
+    for (i = 0; i < 20000; i++)
+    {
+        for (j = 0; j < NOPTS + NUM_GLOBAL_OPTS; j++, lookups++)
+        {
+            name = j < NOPTS ? MC_OPTION_TEXT[j] : OPTION_TEXT[j - NOPTS];
+            v = MC_MapTextToIndex(name);
+            if (v == -1)
+                v = Opts_MapTextToIndex(name);
+            sink += v;
+        }
+    }
+    secs = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("  \"option_lookup\": {\"probes\": %d, \"lookups_per_sec\": %.0f, \"ok\": %s},\n",
+            n, secs > 0 ? lookups / secs : 0.0, failures ? "false" : "true");
+    return failures == 0;
+}
+
+
+/* Answers the cards in play in turn from answer number 'from' up to */
+/* 'to', like bench_game() does, and returns a fingerprint of the    */
+/* questions asked and the counters at the end:                      */
+static unsigned int play_on(MC_MathGame* game, MC_FlashCard* in_play, int* in_play_ok, int from, int to)
+{
+    unsigned int h = 2166136261u;
+    int k, answered;
+
+    for (answered = from; answered < to; answered++)
+    {
+        k = answered % CARDS_IN_PLAY;
+        if (!in_play_ok[k])
+            continue;
+        if ((in_play[k].question_id + answered) % 4)
+            MC_AnsweredCorrectly(game, in_play[k].question_id, 1.0 + k);
+        else
+            MC_NotAnsweredCorrectly(game, in_play[k].question_id);
+        in_play_ok[k] = MC_NextQuestion(game, &in_play[k]);
+        if (in_play_ok[k])
+            h = hash_card(h, &in_play[k]);
+    }
+    h = (h ^ (unsigned int)MC_NumAnsweredCorrectly(game)) * 16777619u;
+    h = (h ^ (unsigned int)MC_NumNotAnsweredCorrectly(game)) * 16777619u;
+    h = (h ^ (unsigned int)MC_TotalQuestionsLeft(game)) * 16777619u;
+    h = (h ^ (unsigned int)MC_WrongListLength(game)) * 16777619u;
+    return (h ^ (unsigned int)(1000 * MC_MedianTimePerQuestion(game))) * 16777619u;
+}
+
+
+/* Saves a game with repeated wrong answers pending partway through, */
+/* loads it into a second game, and checks that both carry on alike. */
+/* Prints a JSON member with the size and timings, and returns 1 if */
+/* the games matched, 0 otherwise.                                   */
+static int check_saved_game(void)
+{
+    MC_MathGame game, copy;
+    MC_FlashCard in_play[CARDS_IN_PLAY], copy_in_play[CARDS_IN_PLAY];
+    int in_play_ok[CARDS_IN_PLAY], copy_in_play_ok[CARDS_IN_PLAY];
+    int k, ok = 0;
+    long bytes = 0;
+    clock_t t, save_ticks = 0, load_ticks = 0;
+    FILE* fp = NULL;
+
+    memset(&game, 0, sizeof(game));
+    memset(&copy, 0, sizeof(copy));
+    if (!MC_Initialize(&game) || !MC_Initialize(&copy))
+        goto done;
+    MC_SetRandomSeed(&game, 1);
+    MC_SetOpt(&game, AVG_LIST_LENGTH, 100000);
+    MC_SetOpt(&game, PLAY_THROUGH_LIST, 1);
+    MC_SetOpt(&game, REPEAT_WRONGS, 1);
+    MC_SetOpt(&game, COPIES_REPEATED_WRONGS, 3);
+    MC_SetOpt(&game, MIN_FORMULA_NUMS, 2);
+    MC_SetOpt(&game, MAX_FORMULA_NUMS, 3);
+    if (!MC_StartGame(&game))
+        goto done;
+    for (k = 0; k < CARDS_IN_PLAY; k++)
+        in_play_ok[k] = MC_NextQuestion(&game, &in_play[k]);
+    play_on(&game, in_play, in_play_ok, 0, SAVE_AFTER);
+
+    fp = tmpfile();
+    if (!fp)
+        goto done;
+    t = clock();
+    if (!MC_SaveState(&game, fp))
+        goto done;
+    save_ticks = clock() - t;
+    bytes = ftell(fp);
+    rewind(fp);
+    t = clock();
+    if (!MC_LoadState(&copy, fp))
+        goto done;
+    load_ticks = clock() - t;
+
+    /* the cards in play are the user interface's business: */
+    for (k = 0; k < CARDS_IN_PLAY; k++)
+    {
+        copy_in_play[k] = in_play[k];
+        copy_in_play_ok[k] = in_play_ok[k];
+    }
+    ok = play_on(&game, in_play, in_play_ok, SAVE_AFTER, SAVE_AFTER + SAVE_PLAY_ON)
+        == play_on(&copy, copy_in_play, copy_in_play_ok, SAVE_AFTER, SAVE_AFTER + SAVE_PLAY_ON);
+    if (!ok)
+        fprintf(stderr, "Loaded game plays differently from the one saved\n");
+
+done:
+    if (fp)
+        fclose(fp);
+    MC_EndGame(&game);
+    MC_EndGame(&copy);
+    printf("  \"saved_game\": {\"bytes\": %ld, \"save_ms\": %.3f, \"load_ms\": %.3f, \"ok\": %s},\n",
+            bytes, 1000.0 * save_ticks / CLOCKS_PER_SEC,
+            1000.0 * load_ticks / CLOCKS_PER_SEC, ok ? "true" : "false");
+    return ok;
+}
+
+
+
+/* Starts the game and plays it for SEED_ANSWERS answers, returning */
+/* a fingerprint of what was asked, or 0 if it wouldn't start:      */
+static unsigned int play_seeded(MC_MathGame* game)
+{
+    MC_FlashCard in_play[CARDS_IN_PLAY];
+    int in_play_ok[CARDS_IN_PLAY];
+    unsigned int h = 2166136261u;
+    int k;
+
+    if (!MC_StartGame(game))
+        return 0;
+    for (k = 0; k < CARDS_IN_PLAY; k++)
+    {
+        in_play_ok[k] = MC_NextQuestion(game, &in_play[k]);
+        if (in_play_ok[k])
+            h = hash_card(h, &in_play[k]);
+    }
+    return h ^ play_on(game, in_play, in_play_ok, 0, SEED_ANSWERS);
+}
+
+
+/* Seeds one game before MC_Initialize() and another after it, and    */
+/* checks that both ask the same questions - and again once each has  */
+/* been through MC_EndGame() and started over. Prints a JSON member   */
+/* and returns 1 if they matched, 0 otherwise.                        */
+static int check_early_seed(void)
+{
+    MC_MathGame early, late;
+    unsigned int h[4] = {0, 0, 0, 0};
+    int pass, ok;
+
+    memset(&early, 0, sizeof(early));
+    memset(&late, 0, sizeof(late));
+    /* MC_StartGame() initializes this one itself: */
+    MC_SetRandomSeed(&early, 5);
+    if (MC_Initialize(&late))
+    {
+        MC_SetRandomSeed(&late, 5);
+        for (pass = 0; pass < 2; pass++)
+        {
+            h[2 * pass] = play_seeded(&early);
+            h[2 * pass + 1] = play_seeded(&late);
+            MC_EndGame(&early);
+            MC_EndGame(&late);
+        }
+    }
+    MC_EndGame(&early);
+    MC_EndGame(&late);
+
+    ok = h[0] && h[0] == h[1] && h[0] == h[2] && h[0] == h[3];
+    if (!ok)
+        fprintf(stderr, "Seeded games asked different questions\n");
+    printf("  \"early_seed\": {\"ok\": %s},\n", ok ? "true" : "false");
+    return ok;
+}
+
+
+
+/* Asks for addition only, with every sum too big, and checks that   */
+/* MC_StartGame() refuses rather than dealing blank cards. Prints a  */
+/* JSON member and returns 1 if it refused, 0 otherwise.             */
+static int check_no_questions(void)
+{
+    MC_MathGame game;
+    int ok = 0;
+
+    memset(&game, 0, sizeof(game));
+    if (MC_Initialize(&game))
+    {
+        MC_SetOpt(&game, COMPREHENSIVE, 0);
+        MC_SetOpt(&game, TYPING_PRACTICE_ALLOWED, 0);
+        MC_SetOpt(&game, ADDITION_ALLOWED, 1);
+        MC_SetOpt(&game, SUBTRACTION_ALLOWED, 0);
+        MC_SetOpt(&game, MULTIPLICATION_ALLOWED, 0);
+        MC_SetOpt(&game, DIVISION_ALLOWED, 0);
+        MC_SetOpt(&game, MIN_AUGEND, 10);
+        MC_SetOpt(&game, MAX_AUGEND, 10);
+        MC_SetOpt(&game, MIN_ADDEND, 10);
+        MC_SetOpt(&game, MAX_ADDEND, 10);
+        MC_SetOpt(&game, MAX_ANSWER, 5);
+        ok = !MC_StartGame(&game);
+    }
+    MC_EndGame(&game);
+
+    if (!ok)
+        fprintf(stderr, "Game started with no valid questions\n");
+    printf("  \"no_questions\": {\"ok\": %s},\n", ok ? "true" : "false");
+    return ok;
+}
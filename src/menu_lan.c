@@ -137,9 +137,14 @@ int ConnectToServer(void)
             ShowMessageWrap(DEFAULT_MENU_FONT_SIZE,buf); 
             servernames = malloc(servers_found * sizeof(char*));
 
+            //A server with several rooms shows up once for each room:
             for(i = 0; i < servers_found; i++)
             {
-                servernames[i] = LAN_ServerName(i);
+                servernames[i] = malloc(256);
+                if(LAN_ServerRoom(i))
+                    snprintf(servernames[i], 256, "%s: %s", LAN_ServerName(i), LAN_ServerRoom(i));
+                else
+                    snprintf(servernames[i], 256, "%s", LAN_ServerName(i));
             }
 
             T4K_CreateOneLevelMenu(MENU_SERVERSELECT, servers_found, servernames,
@@ -148,6 +153,10 @@ int ConnectToServer(void)
             server_choice = T4K_RunMenu(MENU_SERVERSELECT, true, &DrawTitleScreen,
                     &HandleTitleScreenEvents, &HandleTitleScreenAnimations, NULL);
 
+            for(i = 0; i < servers_found; i++)
+                free(servernames[i]);
+            free(servernames);
+
             if(!LAN_AutoSetup(server_choice))
             {
                 return 0;
@@ -491,6 +500,9 @@ void draw_player_table(void)
         if(LAN_PlayerConnected(i))
         {
             DEBUGMSG(debug_lan, "Socket %d is connected\n", i);
+            //No room for more once we reach the bottom of the screen:
+            if(loc.y + 2 * loc.h > screen->h)
+                break;
 
             surf = T4K_BlackOutline(LAN_PlayerName(i), DEFAULT_MENU_FONT_SIZE, col);
             if(surf)
@@ -0,0 +1,802 @@
+/*
+
+   netmsg.c
+
+   Encoding and framing of the messages between the LAN server and
+   its clients. Each end keeps whatever it has received in a
+   net_stream and decodes complete messages out of it one at a time,
+   so partial reads and several messages per read both work.
+
+   Copyright 2026.
+Author: agent.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+netmsg.c is part of "Tux, of Math Command", a.k.a. "tuxmath".
+
+Tuxmath is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+Tuxmath is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+
+
+/* Must have this first for the #ifdef HAVE_LIBSDL_NET to work */
+#include "globals.h"
+
+#ifdef HAVE_LIBSDL_NET
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "netmsg.h"
+
+
+/* Name and fields of each message type as the text protocol has    */
+/* them, tab separated: 'i' a number, 't' a time in seconds, 's' a   */
+/* string, and 'c' a flashcard (id, difficulty, answer, answer       */
+/* string and formula, which is followed by a newline).  Protocol 3  */
+/* sends the same fields after the opcode byte, numbers as zigzag    */
+/* varints (times in msec) and strings with a varint length:         */
+static const struct {
+    const char* name;
+    const char* fields;
+} op_info[NET_NUM_OPS] = {
+    {"",                     ""},     // NET_OP_UNKNOWN
+    {"PROTOCOL",             "i"},
+    {"SET_NAME",             "s"},
+    {"PLAYER_READY",         ""},
+    {"PLAYER_NOT_READY",     ""},
+    {"REQUEST_INDEX",        ""},
+    {"CORRECT_ANSWER",       "it"},
+    {"WRONG_ANSWER",         "i"},
+    {"LEAVE_GAME",           ""},
+    {"exit",                 ""},
+    {"quit",                 ""},
+    {"SOCKET_INDEX",         "i"},
+    {"CONNECTED_PLAYERS",    "i"},
+    {"UPDATE_PLAYER_INFO",   "iisi"},  // index, ready, name, score
+    {"PLAYER_LEFT",          "i"},
+    {"PLAYER_MSG",           "s"},
+    {"GAME_IN_PROGRESS",     ""},
+    {"GO_TO_GAME",           ""},
+    {"TOTAL_QUESTIONS",      "i"},
+    {"WAVE",                 "i"},
+    {"MISSION_ACCOMPLISHED", ""},
+    {"ADD_QUESTION",         "c"},
+    {"REMOVE_QUESTION",      "ii"},   // question id, answered by
+    {"GAME_HALTED",          ""},
+    {"PING",                 "i"},    // sender's clock, in msec
+    {"PONG",                 "i"},    // the PING's number, sent back
+    {"LAN_INTERCEPTED",      ""},
+    {"NETWORK_ERROR",        ""}
+};
+
+/* Local function prototypes: */
+static int frame_msg(int protocol, const char* data, int len, char* out);
+static void ring_move(net_queue* q, int to, int from, int len);
+static int encode_text(const net_msg* msg, char* out);
+static int encode_binary(const net_msg* msg, unsigned char* out);
+static void decode_text(const char* data, int len, net_msg* msg);
+static int decode_binary(const unsigned char* p, const unsigned char* end, net_msg* msg);
+static unsigned char* put_uint(unsigned char* p, unsigned char* end, unsigned int v);
+static unsigned char* put_int(unsigned char* p, unsigned char* end, int v);
+static unsigned char* put_str(unsigned char* p, unsigned char* end, const char* str, int max);
+static const unsigned char* get_uint(const unsigned char* p, const unsigned char* end, unsigned int* v);
+static const unsigned char* get_int(const unsigned char* p, const unsigned char* end, int* v);
+static const unsigned char* get_str(const unsigned char* p, const unsigned char* end, char* str, int size);
+
+
+
+/*  ----- Messages:  ------------------- */
+
+void Net_InitMsg(net_msg* msg, int op)
+{
+    if(!msg)
+        return;
+    msg->op = op;
+    msg->arg[0] = msg->arg[1] = msg->arg[2] = 0;
+    msg->time = -1;
+    memset(&msg->card, 0, sizeof(MC_FlashCard));
+    msg->card.question_id = -1;
+    msg->text[0] = '\0';
+}
+
+
+/* The message's name in the text protocol: */
+const char* Net_MsgName(int op)
+{
+    if(op < 0 || op >= NET_NUM_OPS)
+        op = NET_OP_UNKNOWN;
+    return op_info[op].name;
+}
+
+
+/* Writes msg into out (which must hold NET_BUF_LEN chars) as the */
+/* given protocol version sends it, returning the length. Text    */
+/* messages are NUL-terminated as well, so this also gives the    */
+/* strings the rest of the game works with:                        */
+int Net_EncodeMsg(const net_msg* msg, int protocol, char* out)
+{
+    if(!msg || !out)
+        return 0;
+    if(msg->op < 0 || msg->op >= NET_NUM_OPS)
+    {
+        out[0] = '\0';
+        return 0;
+    }
+    if(protocol >= NET_PROTOCOL_BINARY && msg->op != NET_OP_UNKNOWN)
+        return encode_binary(msg, (unsigned char*)out);
+    return encode_text(msg, out);
+}
+
+
+/* Fills in msg from a received message in either format. Returns  */
+/* 1 on success (text we don't recognize comes back as             */
+/* NET_OP_UNKNOWN with the text itself), or 0 if a binary message   */
+/* is malformed:                                                    */
+int Net_DecodeMsg(const char* data, int len, net_msg* msg)
+{
+    if(!data || !msg)
+        return 0;
+    Net_InitMsg(msg, NET_OP_UNKNOWN);
+    if(len <= 0)
+        return 1;
+
+    //Text messages always start with a letter, and opcodes are
+    //all control characters:
+    if((unsigned char)data[0] < ' ')
+        return decode_binary((const unsigned char*)data,
+                (const unsigned char*)data + len, msg);
+    decode_text(data, len, msg);
+    return 1;
+}
+
+
+
+/*  ----- Streams:  ------------------- */
+
+/* New connections start out in the old format until the other */
+/* side says it understands something newer:                   */
+void Net_ResetStream(net_stream* s)
+{
+    if(!s)
+        return;
+    s->protocol = NET_PROTOCOL_LEGACY;
+    s->start = 0;
+    s->len = 0;
+}
+
+
+/* Sends an already encoded message in the format the other side */
+/* expects. Returns 1 on success, 0 if the connection failed:    */
+int Net_SendEncoded(TCPsocket sock, net_stream* s, const char* data, int len)
+{
+    char out[NET_FRAME_HEADER_LEN + NET_BUF_LEN];
+
+    if(!sock || !s || !data || len < 0)
+        return 0;
+
+    //NOTE SDLNet's Send() keeps sending until the requested length is
+    //sent, so it really is an error if we send less:
+    len = frame_msg(s->protocol, data, len, out);
+    return (SDLNet_TCP_Send(sock, out, len) == len);
+}
+
+
+int Net_SendNetMsg(TCPsocket sock, net_stream* s, const net_msg* msg)
+{
+    char out[NET_BUF_LEN];
+    int len;
+
+    if(!s || !msg)
+        return 0;
+    len = Net_EncodeMsg(msg, s->protocol, out);
+    return Net_SendEncoded(sock, s, out, len);
+}
+
+
+/* Reads whatever has arrived on sock (which must be ready, or this */
+/* will block) into the stream. Returns the number of bytes read,   */
+/* or <= 0 if the connection is closed or broken:                   */
+int Net_ReadStream(TCPsocket sock, net_stream* s)
+{
+    int bytes;
+
+    if(!sock || !s)
+        return -1;
+
+    //Move any partial message down to make room behind it:
+    if(s->start > 0)
+    {
+        memmove(s->buf, s->buf + s->start, s->len);
+        s->start = 0;
+    }
+    //Can't happen as long as Net_NextMsg() keeps up:
+    if(s->len >= NET_STREAM_LEN)
+        return -1;
+
+    bytes = SDLNet_TCP_Recv(sock, s->buf + s->len, NET_STREAM_LEN - s->len);
+    if(bytes > 0)
+        s->len += bytes;
+    return bytes;
+}
+
+
+/* Decodes the next complete message in the stream into msg. Returns */
+/* 1 if there was one, 0 if we have to wait for more data, or -1 if  */
+/* the stream is garbled:                                            */
+int Net_NextMsg(net_stream* s, net_msg* msg)
+{
+    const unsigned char* p;
+    int len, used;
+
+    if(!s || !msg)
+        return -1;
+    if(s->len == 0)
+        return 0;
+
+    p = (const unsigned char*)s->buf + s->start;
+    if(p[0] == NET_FRAME_MARK)
+    {
+        if(s->len < NET_FRAME_HEADER_LEN)
+            return 0;
+        len = (p[1] << 8) | p[2];
+        if(len > NET_BUF_LEN - 1)
+        {
+            DEBUGMSG(debug_lan, "Net_NextMsg() - bad frame length %d\n", len);
+            return -1;
+        }
+        if(s->len < NET_FRAME_HEADER_LEN + len)
+            return 0;
+        p += NET_FRAME_HEADER_LEN;
+        used = NET_FRAME_HEADER_LEN + len;
+    }
+    else  //Old-style fixed length message:
+    {
+        if(s->len < NET_BUF_LEN)
+            return 0;
+        for(len = 0; len < NET_BUF_LEN - 1 && p[len]; len++) {}
+        used = NET_BUF_LEN;
+    }
+
+    s->start += used;
+    s->len -= used;
+    if(s->len == 0)
+        s->start = 0;
+
+    if(!Net_DecodeMsg((const char*)p, len, msg))
+    {
+        DEBUGMSG(debug_lan, "Net_NextMsg() - undecodable message, opcode %d\n", p[0]);
+        return -1;
+    }
+    return 1;
+}
+
+
+
+/* Allocates an empty queue that can hold size bytes. */
+/* Returns 1 on success, 0 if out of memory:          */
+int Net_InitQueue(net_queue* q, int size)
+{
+    if(!q || size < NET_FRAME_HEADER_LEN + NET_BUF_LEN)
+        return 0;
+    memset(q, 0, sizeof(net_queue));
+    q->max_msgs = size / NET_QUEUE_MSG_BYTES;
+    q->buf = (char*)malloc(size);
+    q->msgs = (net_queued_msg*)malloc(q->max_msgs * sizeof(net_queued_msg));
+    if(!q->buf || !q->msgs)
+    {
+        fprintf(stderr, "Net_InitQueue() - allocation failed\n");
+        Net_FreeQueue(q);
+        return 0;
+    }
+    q->size = size;
+    return 1;
+}
+
+
+void Net_FreeQueue(net_queue* q)
+{
+    if(!q)
+        return;
+    free(q->buf);
+    free(q->msgs);
+    memset(q, 0, sizeof(net_queue));
+}
+
+
+/* Updates that only matter until the next one like them arrives get */
+/* a slot number, anything else -1. Only the newest message queued   */
+/* for each slot has to be sent:                                     */
+int Net_UpdateSlot(const net_msg* msg)
+{
+    if(!msg)
+        return -1;
+    switch(msg->op)
+    {
+        case NET_OP_CONNECTED_PLAYERS:
+            return 0;
+        case NET_OP_TOTAL_QUESTIONS:
+            return 1;
+        case NET_OP_WAVE:
+            return 2;
+        case NET_OP_UPDATE_PLAYER_INFO:
+            if(msg->arg[0] >= 0 && msg->arg[0] < NET_UPDATE_SLOTS - 3)
+                return 3 + msg->arg[0];
+            break;
+    }
+    return -1;
+}
+
+
+/* Adds an already encoded message to the queue, framed for protocol. */
+/* Returns 1 on success, 0 if the queue is too full to take it:       */
+int Net_QueueEncoded(net_queue* q, int protocol, int slot, const char* data, int len)
+{
+    char out[NET_FRAME_HEADER_LEN + NET_BUF_LEN];
+    int end, n;
+
+    if(!q || !q->buf || !data || len < 0)
+        return 0;
+
+    len = frame_msg(protocol, data, len, out);
+    if(q->len + len > q->size || q->num_msgs == q->max_msgs)
+        return 0;
+
+    end = (q->start + q->len) % q->size;
+    n = q->size - end;
+    if(n > len)
+        n = len;
+    memcpy(q->buf + end, out, n);
+    memcpy(q->buf, out + n, len - n);
+    q->len += len;
+    if(q->len > q->peak)
+        q->peak = q->len;
+
+    n = (q->first_msg + q->num_msgs) % q->max_msgs;
+    q->msgs[n].len = len;
+    q->msgs[n].slot = slot;
+    q->num_msgs++;
+    return 1;
+}
+
+
+/* Drops every queued update that a newer one for the same slot has */
+/* made pointless, closing up the gaps. A message that has started  */
+/* going out has to finish, though. Returns the number dropped:     */
+int Net_DropStaleUpdates(net_queue* q)
+{
+    unsigned char seen[NET_UPDATE_SLOTS];
+    net_queued_msg* m;
+    int i, kept, from, to;
+    int dropped = 0;
+
+    if(!q || !q->buf)
+        return 0;
+
+    //Working back from the newest, anything already seen is stale:
+    memset(seen, 0, sizeof(seen));
+    for(i = q->num_msgs - 1; i >= (q->head_sent ? 1 : 0); i--)
+    {
+        m = &q->msgs[(q->first_msg + i) % q->max_msgs];
+        if(m->slot < 0 || m->slot >= NET_UPDATE_SLOTS)
+            continue;
+        if(seen[m->slot])
+        {
+            m->len = -m->len;   //marks it for removal below
+            dropped++;
+        }
+        seen[m->slot] = 1;
+    }
+    if(!dropped)
+        return 0;
+
+    from = to = kept = 0;
+    for(i = 0; i < q->num_msgs; i++)
+    {
+        m = &q->msgs[(q->first_msg + i) % q->max_msgs];
+        if(m->len < 0)
+        {
+            from -= m->len;
+            continue;
+        }
+        ring_move(q, to, from, m->len);
+        from += m->len;
+        to += m->len;
+        q->msgs[(q->first_msg + kept) % q->max_msgs] = *m;
+        kept++;
+    }
+    q->num_msgs = kept;
+    q->len = to;
+    q->dropped += dropped;
+    return dropped;
+}
+
+
+/* Points data[] at the bytes waiting to be sent, which are in one   */
+/* piece or, if they wrap around the end of the ring, two. Returns   */
+/* the number of pieces, with their lengths in len[]:                */
+int Net_QueueData(net_queue* q, const char* data[2], int len[2])
+{
+    if(!q || !q->buf || !data || !len || q->len == 0)
+        return 0;
+    data[0] = q->buf + q->start;
+    if(q->start + q->len <= q->size)
+    {
+        len[0] = q->len;
+        return 1;
+    }
+    len[0] = q->size - q->start;
+    data[1] = q->buf;
+    len[1] = q->len - len[0];
+    return 2;
+}
+
+
+/* Removes bytes that have been sent from the front of the queue: */
+void Net_QueueSent(net_queue* q, int bytes)
+{
+    net_queued_msg* m;
+
+    if(!q || !q->buf || bytes <= 0)
+        return;
+    if(bytes > q->len)
+        bytes = q->len;
+    q->start = (q->start + bytes) % q->size;
+    q->len -= bytes;
+
+    while(bytes > 0 && q->num_msgs > 0)
+    {
+        m = &q->msgs[q->first_msg];
+        if(bytes < m->len)
+        {
+            m->len -= bytes;
+            q->head_sent = 1;
+            break;
+        }
+        bytes -= m->len;
+        q->first_msg = (q->first_msg + 1) % q->max_msgs;
+        q->num_msgs--;
+        q->head_sent = 0;
+    }
+    if(q->len == 0)
+        q->start = q->first_msg = 0;
+}
+
+
+
+/*  ----- Private to netmsg.c:  ------------------- */
+
+/* Copies an encoded message into out in the format for protocol, */
+/* returning the number of bytes to send:                         */
+static int frame_msg(int protocol, const char* data, int len, char* out)
+{
+    if(len > NET_BUF_LEN - 1)
+    {
+        DEBUGMSG(debug_lan, "frame_msg() - message truncated to %d bytes\n",
+                NET_BUF_LEN - 1);
+        len = NET_BUF_LEN - 1;
+    }
+
+    if(protocol == NET_PROTOCOL_LEGACY)
+    {
+        //Zero the padding rather than send whatever was on the stack:
+        memcpy(out, data, len);
+        memset(out + len, 0, NET_BUF_LEN - len);
+        return NET_BUF_LEN;
+    }
+
+    out[0] = NET_FRAME_MARK;
+    out[1] = (len >> 8) & 0xff;
+    out[2] = len & 0xff;
+    memcpy(out + NET_FRAME_HEADER_LEN, data, len);
+    return NET_FRAME_HEADER_LEN + len;
+}
+
+
+/* Moves len queued bytes from offset "from" back to offset "to"   */
+/* (both counted from the start of the queue), wrapping as needed: */
+static void ring_move(net_queue* q, int to, int from, int len)
+{
+    int i;
+
+    if(to == from)
+        return;
+    for(i = 0; i < len; i++)
+        q->buf[(q->start + to + i) % q->size] = q->buf[(q->start + from + i) % q->size];
+}
+
+static int encode_text(const net_msg* msg, char* out)
+{
+    const char* f;
+    int n, k = 0;
+
+    if(msg->op == NET_OP_UNKNOWN)
+        n = snprintf(out, NET_BUF_LEN, "%s", msg->text);
+    else
+        n = snprintf(out, NET_BUF_LEN, "%s", op_info[msg->op].name);
+
+    for(f = op_info[msg->op].fields; *f && n < NET_BUF_LEN; f++)
+    {
+        switch(*f)
+        {
+            case 'i':
+                n += snprintf(out + n, NET_BUF_LEN - n, "\t%d", msg->arg[k++]);
+                break;
+            case 't':
+                n += snprintf(out + n, NET_BUF_LEN - n, "\t%f", msg->time);
+                break;
+            case 's':
+                n += snprintf(out + n, NET_BUF_LEN - n, "\t%s", msg->text);
+                break;
+            case 'c':
+                n += snprintf(out + n, NET_BUF_LEN - n, "\t%d\t%d\t%d\t%s\t%s\n",
+                        msg->card.question_id,
+                        msg->card.difficulty,
+                        msg->card.answer,
+                        msg->card.answer_string,
+                        msg->card.formula_string);
+                break;
+        }
+    }
+    if(n > NET_BUF_LEN - 1)
+        n = NET_BUF_LEN - 1;
+    return n;
+}
+
+
+static int encode_binary(const net_msg* msg, unsigned char* out)
+{
+    unsigned char* p = out;
+    unsigned char* end = out + NET_BUF_LEN - 1;
+    char answer[MC_ANSWER_LEN];
+    const char* f;
+    int k = 0;
+
+    *p++ = msg->op;
+    for(f = op_info[msg->op].fields; *f && p; f++)
+    {
+        switch(*f)
+        {
+            case 'i':
+                p = put_int(p, end, msg->arg[k++]);
+                break;
+            case 't':
+                p = put_int(p, end, (int)(msg->time * 1000
+                            + (msg->time < 0 ? -0.5 : 0.5)));
+                break;
+            case 's':
+                p = put_str(p, end, msg->text, NET_BUF_LEN);
+                break;
+            case 'c':
+                p = put_int(p, end, msg->card.question_id);
+                if(p)
+                    p = put_int(p, end, msg->card.difficulty);
+                if(p)
+                    p = put_int(p, end, msg->card.answer);
+                //The answer string is nearly always just the answer:
+                snprintf(answer, MC_ANSWER_LEN, "%d", msg->card.answer);
+                if(p && strcmp(answer, msg->card.answer_string) == 0)
+                    p = put_uint(p, end, 0);
+                else if(p)
+                    p = put_str(p, end, msg->card.answer_string, MC_ANSWER_LEN);
+                if(p)
+                    p = put_str(p, end, msg->card.formula_string, MC_FORMULA_LEN);
+                break;
+        }
+    }
+    //Strings get truncated to fit, so this shouldn't happen:
+    if(!p)
+    {
+        DEBUGMSG(debug_lan, "encode_binary() - message %s too long\n",
+                op_info[msg->op].name);
+        return 0;
+    }
+    return p - out;
+}
+
+
+static void decode_text(const char* data, int len, net_msg* msg)
+{
+    char buf[NET_BUF_LEN];
+    char* p;
+    const char* f;
+    int op, n, k = 0;
+
+    if(len > NET_BUF_LEN - 1)
+        len = NET_BUF_LEN - 1;
+    memcpy(buf, data, len);
+    buf[len] = '\0';
+
+    //The name runs up to the first tab (or the newline some end with):
+    n = strcspn(buf, "\t\n");
+    for(op = NET_OP_UNKNOWN + 1; op < NET_OP_INTERCEPTED; op++)
+        if(op_info[op].name[0] == buf[0]
+                && strncmp(op_info[op].name, buf, n) == 0
+                && op_info[op].name[n] == '\0')
+            break;
+    if(op == NET_OP_INTERCEPTED)
+    {
+        memcpy(msg->text, buf, len + 1);
+        return;
+    }
+
+    msg->op = op;
+    p = buf + n;
+    for(f = op_info[op].fields; *f && *p == '\t'; f++)
+    {
+        p++;
+        switch(*f)
+        {
+            case 'i':
+                msg->arg[k++] = strtol(p, &p, 10);
+                break;
+            case 't':
+                msg->time = strtod(p, &p);
+                break;
+            case 's':
+                //The last field gets the rest of the message:
+                n = f[1] ? strcspn(p, "\t") : strlen(p);
+                memcpy(msg->text, p, n);
+                msg->text[n] = '\0';
+                p += n;
+                break;
+            case 'c':
+                msg->card.question_id = strtol(p, &p, 10);
+                msg->card.difficulty = strtol(p, &p, 10);
+                msg->card.answer = strtol(p, &p, 10);
+                if(*p == '\t')
+                    p++;
+                n = strcspn(p, "\t");
+                snprintf(msg->card.answer_string, MC_ANSWER_LEN, "%.*s", n, p);
+                p += n;
+                if(*p == '\t')
+                    p++;
+                n = strcspn(p, "\n");
+                snprintf(msg->card.formula_string, MC_FORMULA_LEN, "%.*s", n, p);
+                p += n;
+                break;
+        }
+        //Skip anything left over in this field:
+        p += strcspn(p, "\t");
+    }
+}
+
+
+static int decode_binary(const unsigned char* p, const unsigned char* end, net_msg* msg)
+{
+    const char* f;
+    int op = *p++;
+    int ms, k = 0;
+
+    if(op <= NET_OP_UNKNOWN || op >= NET_OP_INTERCEPTED)
+        return 0;
+    msg->op = op;
+
+    for(f = op_info[op].fields; *f && p; f++)
+    {
+        switch(*f)
+        {
+            case 'i':
+                p = get_int(p, end, &msg->arg[k++]);
+                break;
+            case 't':
+                p = get_int(p, end, &ms);
+                msg->time = ms / 1000.0;
+                break;
+            case 's':
+                p = get_str(p, end, msg->text, NET_BUF_LEN);
+                break;
+            case 'c':
+                p = get_int(p, end, &msg->card.question_id);
+                if(p)
+                    p = get_int(p, end, &msg->card.difficulty);
+                if(p)
+                    p = get_int(p, end, &msg->card.answer);
+                if(p)
+                    p = get_str(p, end, msg->card.answer_string, MC_ANSWER_LEN);
+                if(p && msg->card.answer_string[0] == '\0')
+                    snprintf(msg->card.answer_string, MC_ANSWER_LEN, "%d",
+                            msg->card.answer);
+                if(p)
+                    p = get_str(p, end, msg->card.formula_string, MC_FORMULA_LEN);
+                break;
+        }
+    }
+    return (p != NULL);
+}
+
+
+/* Seven bits per byte, low bits first, with the top bit set on all */
+/* but the last byte. These return NULL if they run past end:       */
+static unsigned char* put_uint(unsigned char* p, unsigned char* end, unsigned int v)
+{
+    while(p < end)
+    {
+        if(v < 0x80)
+        {
+            *p++ = v;
+            return p;
+        }
+        *p++ = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    return NULL;
+}
+
+
+/* Zigzag encoding keeps small negative numbers (like the -1 for  */
+/* "nobody") down to one byte too:                                */
+static unsigned char* put_int(unsigned char* p, unsigned char* end, int v)
+{
+    return put_uint(p, end, ((unsigned int)v << 1) ^ (unsigned int)(v >> 31));
+}
+
+
+/* Strings longer than max, or than will fit, get truncated: */
+static unsigned char* put_str(unsigned char* p, unsigned char* end, const char* str, int max)
+{
+    int len;
+
+    for(len = 0; len < max - 1 && str[len]; len++) {}
+    if(len > end - p - 2)
+        len = end - p - 2;
+    if(len < 0)
+        return NULL;
+    p = put_uint(p, end, len);
+    if(!p)
+        return NULL;
+    memcpy(p, str, len);
+    return p + len;
+}
+
+
+static const unsigned char* get_uint(const unsigned char* p, const unsigned char* end, unsigned int* v)
+{
+    int shift;
+
+    *v = 0;
+    for(shift = 0; p < end && shift < 32; shift += 7)
+    {
+        *v |= (unsigned int)(*p & 0x7f) << shift;
+        if(!(*p++ & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+
+static const unsigned char* get_int(const unsigned char* p, const unsigned char* end, int* v)
+{
+    unsigned int u;
+
+    p = get_uint(p, end, &u);
+    *v = (int)(u >> 1) ^ -(int)(u & 1);
+    return p;
+}
+
+
+/* Copies at most size - 1 chars into str, but skips the whole string: */
+static const unsigned char* get_str(const unsigned char* p, const unsigned char* end, char* str, int size)
+{
+    unsigned int len;
+
+    p = get_uint(p, end, &len);
+    if(!p || len > (unsigned int)(end - p))
+        return NULL;
+    snprintf(str, size, "%.*s", (int)len, (const char*)p);
+    return p + len;
+}
+
+#endif // HAVE_LIBSDL_NET
@@ -0,0 +1,172 @@
+/*
+   netmsg.h:
+
+   Encoding LAN messages and splitting the TCP byte streams between
+   the server and its clients into them, for server.c and network.c.
+
+   Copyright 2026.
+Author: agent.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+
+netmsg.h is part of "Tux, of Math Command", a.k.a. "tuxmath".
+
+Tuxmath is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+Tuxmath is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef NETMSG_H
+#define NETMSG_H
+
+#include "config.h"
+
+#ifdef HAVE_LIBSDL_NET
+
+#include "transtruct.h"
+#include "SDL_net.h"
+
+/* Protocol 1 sends every message as a NUL-padded NET_BUF_LEN chunk.  */
+/* Protocol 2 sends a frame of NET_FRAME_MARK, the payload length     */
+/* (two bytes, big-endian) and the payload, without the padding.      */
+/* Protocol 3 keeps the frames but the payload is an opcode byte and  */
+/* the message's fields in binary (see netmsg.c) instead of text.     */
+/* Protocol 4 adds PING, which either end may send at any time and    */
+/* the other answers straight away with a PONG carrying the same     */
+/* number, so the sender can time the round trip.                     */
+/* Protocol 5 clients take player indices up to MAX_CLIENTS - 1.      */
+/* Older ones only have room for NET_LEGACY_CLIENTS players, so the   */
+/* server keeps them to the low slots and tells them nothing about    */
+/* anyone beyond.                                                     */
+/* A client asks for the newest it knows with "PROTOCOL\t<n>" right   */
+/* after connecting; old servers ignore that and a new server echoes  */
+/* the version it will use. Either way the receiving side can tell    */
+/* the formats apart by their first byte, so the switch needn't be    */
+/* synchronized:                                                     */
+#define NET_PROTOCOL_LEGACY   1
+#define NET_PROTOCOL_FRAMED   2
+#define NET_PROTOCOL_BINARY   3
+#define NET_PROTOCOL_PING     4
+#define NET_PROTOCOL_WIDE     5
+#define NET_PROTOCOL_VERSION  5
+#define NET_LEGACY_CLIENTS    16     // players a client before protocol 5 knows
+#define NET_PING_INTERVAL     2000   // msec between PINGs from either end
+#define NET_FRAME_MARK        0x1e   // ASCII record separator
+#define NET_FRAME_HEADER_LEN  3
+#define NET_STREAM_LEN        (4 * NET_BUF_LEN)
+
+/* Message types. The numbers are the protocol 3 opcodes, so new ones */
+/* go on the end:                                                     */
+enum {
+    NET_OP_UNKNOWN,             // text message we don't recognize
+    /* Client to server: */
+    NET_OP_PROTOCOL,
+    NET_OP_SET_NAME,
+    NET_OP_PLAYER_READY,
+    NET_OP_PLAYER_NOT_READY,
+    NET_OP_REQUEST_INDEX,
+    NET_OP_CORRECT_ANSWER,
+    NET_OP_WRONG_ANSWER,
+    NET_OP_LEAVE_GAME,
+    NET_OP_EXIT,
+    NET_OP_QUIT,
+    /* Server to client: */
+    NET_OP_SOCKET_INDEX,
+    NET_OP_CONNECTED_PLAYERS,
+    NET_OP_UPDATE_PLAYER_INFO,
+    NET_OP_PLAYER_LEFT,
+    NET_OP_PLAYER_MSG,
+    NET_OP_GAME_IN_PROGRESS,
+    NET_OP_GO_TO_GAME,
+    NET_OP_TOTAL_QUESTIONS,
+    NET_OP_WAVE,
+    NET_OP_MISSION_ACCOMPLISHED,
+    NET_OP_ADD_QUESTION,
+    NET_OP_REMOVE_QUESTION,
+    NET_OP_GAME_HALTED,
+    /* Either way: */
+    NET_OP_PING,
+    NET_OP_PONG,
+    /* Only passed from network.c to the game, never sent: */
+    NET_OP_INTERCEPTED,
+    NET_OP_NETWORK_ERROR,
+    NET_NUM_OPS
+};
+
+/* One decoded message. Which fields are used depends on op:  */
+typedef struct net_msg {
+    int op;
+    int arg[3];                 // numbers, in the order the text has them
+    float time;                 // CORRECT_ANSWER - seconds taken, or -1
+    MC_FlashCard card;          // ADD_QUESTION
+    char text[NET_BUF_LEN];     // player name or message
+} net_msg;
+
+/* Receive buffer and send format for one end of a connection: */
+typedef struct net_stream {
+    int protocol;               // format we send in
+    int start;                  // first unparsed byte in buf
+    int len;                    // bytes in buf from start
+    char buf[NET_STREAM_LEN];
+} net_stream;
+
+/* Bytes waiting to go out to one client, so that a reader that falls */
+/* behind holds up nobody else. The lengths of the messages are kept  */
+/* alongside, so updates overtaken by newer ones can still be dropped */
+/* while they wait:                                                   */
+#define NET_UPDATE_SLOTS      (3 + MAX_CLIENTS)
+#define NET_QUEUE_MSG_BYTES   16     // average message the index is sized for
+
+typedef struct net_queued_msg {
+    int len;                    // bytes left to send, framing included
+    int slot;                   // from Net_UpdateSlot(), or -1
+} net_queued_msg;
+
+typedef struct net_queue {
+    char* buf;                  // ring of size bytes
+    int size;
+    int start;                  // first unsent byte
+    int len;                    // unsent bytes
+    net_queued_msg* msgs;       // ring of max_msgs entries
+    int max_msgs;
+    int first_msg;
+    int num_msgs;
+    int head_sent;              // first message partly written already
+    int peak;                   // most bytes ever waiting
+    int dropped;                // stale updates discarded
+} net_queue;
+
+void Net_InitMsg(net_msg* msg, int op);
+const char* Net_MsgName(int op);
+int Net_EncodeMsg(const net_msg* msg, int protocol, char* out);
+int Net_DecodeMsg(const char* data, int len, net_msg* msg);
+
+void Net_ResetStream(net_stream* s);
+int Net_SendEncoded(TCPsocket sock, net_stream* s, const char* data, int len);
+int Net_SendNetMsg(TCPsocket sock, net_stream* s, const net_msg* msg);
+int Net_ReadStream(TCPsocket sock, net_stream* s);
+int Net_NextMsg(net_stream* s, net_msg* msg);
+
+int Net_InitQueue(net_queue* q, int size);
+void Net_FreeQueue(net_queue* q);
+int Net_UpdateSlot(const net_msg* msg);
+int Net_QueueEncoded(net_queue* q, int protocol, int slot, const char* data, int len);
+int Net_DropStaleUpdates(net_queue* q);
+int Net_QueueData(net_queue* q, const char* data[2], int len[2]);
+void Net_QueueSent(net_queue* q, int bytes);
+
+#endif // HAVE_LIBSDL_NET
+
+#endif // NETMSG_H
@@ -43,6 +43,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
 #include "mathcards.h"
 #include "transtruct.h"
 #include "network.h"
+#include "netmsg.h"
 #include "server.h"
 
 
@@ -52,22 +53,38 @@ IPaddress serv_ip;
 ServerEntry servers[MAX_SERVERS];
 static int connected_server = -1;
 static int my_index = -1;
+static net_stream stream;   /* What we have received but not yet handled */
+static Uint32 last_ping = 0;
+static lan_rtt_type rtt;
 
 /* Keep track of other connected players: */
 lan_player_type lan_player_info[MAX_CLIENTS];
 
 /* Local function prototypes: */
-int say_to_server(char *statement);
+int say_to_server(net_msg* msg);
 int evaluate(char *statement);
 int add_to_server_list(UDPpacket* pkt);
-void intercept(char* buf);
-int socket_index_recvd(char* buf);
-int connected_players_recvd(char* buf);
-int parse_player_info_msg(char* buf);
-int lan_player_left_recvd(char* buf);
+void intercept(net_msg* msg);
+int socket_index_recvd(int index);
+int connected_players_recvd(int n);
+int parse_player_info_msg(net_msg* msg);
+int lan_player_left_recvd(net_msg* msg);
+int protocol_recvd(int version);
+void ping_server(void);
+int pong_recvd(int sent);
 
 int LAN_DetectServers(void)
 {
+    return LAN_DetectRoom(NULL);
+}
+
+
+/* Like LAN_DetectServers(), but only rooms called room (by name or  */
+/* lesson title) answer. A server will open a room for that lesson   */
+/* if it hasn't got one already:                                     */
+int LAN_DetectRoom(const char* room)
+{
+    char query[NET_BUF_LEN];
     UDPsocket udpsock = NULL;  
     UDPpacket* out;
     UDPpacket* out_local;
@@ -122,17 +139,22 @@ int LAN_DetectServers(void)
     in = SDLNet_AllocPacket(NET_BUF_LEN);
 
     //Prepare packets for broadcast and (for testing) for localhost:
+    if(room)
+        snprintf(query, NET_BUF_LEN, "%s\t%s", "TUXMATH_CLIENT", room);
+    else
+        snprintf(query, NET_BUF_LEN, "%s", "TUXMATH_CLIENT");
+
     SDLNet_ResolveHost(&bcast_ip, "255.255.255.255", DEFAULT_PORT);
     out->address.host = bcast_ip.host;
-    sprintf(out->data, "TUXMATH_CLIENT");
+    sprintf(out->data, "%s", query);
     out->address.port = bcast_ip.port;
-    out->len = strlen("TUXMATH_CLIENT") + 1;
+    out->len = strlen(query) + 1;
 
     SDLNet_ResolveHost(&bcast_ip, "255.255.255.255", DEFAULT_PORT);
     out_local->address.host = bcast_ip.host;
-    sprintf(out_local->data, "TUXMATH_CLIENT");
+    sprintf(out_local->data, "%s", query);
     out_local->address.port = bcast_ip.port;
-    out_local->len = strlen("TUXMATH_CLIENT") + 1;
+    out_local->len = strlen(query) + 1;
 
 
     //Here we will need to send every few seconds until we hear back from server
@@ -194,6 +216,17 @@ char* LAN_ServerName(int i)
         return NULL; 
 }
 
+/* The room server i is playing in, or NULL if server doesn't have rooms: */
+char* LAN_ServerRoom(int i)
+{
+    if(i < 0 || i > MAX_SERVERS)
+        return NULL;
+    if(servers[i].ip.host != 0 && servers[i].room[0] != '\0')
+        return servers[i].room;
+    else
+        return NULL; 
+}
+
 char* LAN_ConnectedServerName(void)
 {
     return servers[connected_server].name;
@@ -211,6 +244,8 @@ char* LAN_ConnectedServerLesson(void)
 //via LAN_ServerName(i) to get the index 
 int LAN_AutoSetup(int i)
 {
+    net_msg msg;
+
     if(i < 0 || i > MAX_SERVERS)
         return 0;
 
@@ -238,6 +273,15 @@ int LAN_AutoSetup(int i)
 
     // Success - record the index for future reference:
     connected_server = i;
+
+    // Ask for the newest protocol we know. Old servers just ignore this,
+    // so until we hear back we keep to the old fixed-size messages:
+    Net_ResetStream(&stream);
+    memset(&rtt, 0, sizeof(rtt));
+    last_ping = 0;
+    Net_InitMsg(&msg, NET_OP_PROTOCOL);
+    msg.arg[0] = NET_PROTOCOL_VERSION;
+    say_to_server(&msg);
     return 1;
 }
 
@@ -265,6 +309,7 @@ void LAN_Cleanup(void)
         SDLNet_FreeSocketSet(set);
         set = NULL;
     }
+    Net_ResetStream(&stream);
 
     DEBUGMSG(debug_lan|debug_game, "Leave LAN_cleanup():\n");
 }
@@ -273,11 +318,12 @@ void LAN_Cleanup(void)
 
 int LAN_SetName(char* name)
 {
-    char buf[NET_BUF_LEN];
+    net_msg msg;
     if(!name)
         return 0;
-    snprintf(buf, NET_BUF_LEN, "%s\t%s", "SET_NAME", name);
-    return say_to_server(buf);
+    Net_InitMsg(&msg, NET_OP_SET_NAME);
+    snprintf(msg.text, NAME_SIZE, "%s", name);
+    return say_to_server(&msg);
 }
 
 
@@ -286,32 +332,86 @@ int LAN_SetName(char* name)
 /* We return 1 if a message received, 0 if no activity, -1 on errors */
 /* or if connection is lost.  Also, some messages are handled within */
 /* the network.c system instead of being passed to the rest of the   */
-/* program.                                                          */
+/* program.  The message comes back as the text the server would     */
+/* have sent before protocol 3, whatever it actually sent.           */
 int LAN_NextMsg(char* buf)
 { 
-    int numready = 0;
-
-    DEBUGMSG(debug_lan, "Enter LAN_NextMsg():\n");
+    net_msg msg;
+    int status = 0;
 
     /* Make sure we have place to put message: */
     if(buf == NULL)
     {
         DEBUGMSG(debug_lan, "get_next_msg() passed NULL buffer\n");
-        DEBUGMSG(debug_lan, "Leave LAN_NextMsg():\n");
         return -1;
     }
     else  //Make sure we start off with "empty" buffer
         buf[0] = '\0';
 
+    status = LAN_NextNetMsg(&msg);
+    if(status == 0)
+        return 0;
+
+    //The game wants the name of whoever left rather than their index:
+    if(msg.op == NET_OP_PLAYER_LEFT)
+        snprintf(buf, NET_BUF_LEN, "%s\t%.*s", "PLAYER_LEFT", NAME_SIZE - 1, msg.text);
+    else
+        Net_EncodeMsg(&msg, NET_PROTOCOL_LEGACY, buf);
+    return status;
+}
+
+
+/* As LAN_NextMsg(), but hands back the decoded message: */
+int LAN_NextNetMsg(net_msg* msg)
+{ 
+    int numready = 0;
+    int status = 0;
+
+    DEBUGMSG(debug_lan, "Enter LAN_NextNetMsg():\n");
+
+    /* Make sure we have place to put message: */
+    if(msg == NULL)
+    {
+        DEBUGMSG(debug_lan, "LAN_NextNetMsg() passed NULL msg\n");
+        DEBUGMSG(debug_lan, "Leave LAN_NextNetMsg():\n");
+        return -1;
+    }
+    Net_InitMsg(msg, NET_OP_UNKNOWN);
+
+    //Time the round trip every so often, if the server can:
+    ping_server();
+
+    //A single read often brings in several messages, so first see if
+    //we already have one:
+    status = Net_NextMsg(&stream, msg);
+    if(status == 1)
+    {
+        intercept(msg);
+        DEBUGMSG(debug_lan, "Leave LAN_NextNetMsg():\n");
+        return 1;
+    }
+    else if(status == -1)
+    {
+        DEBUGMSG(debug_lan, "In LAN_NextNetMsg(), garbled message from server\n");
+        SDLNet_TCP_DelSocket(set, sd);
+        if(sd != NULL)
+            SDLNet_TCP_Close(sd);
+        sd = NULL;
+        Net_ResetStream(&stream);
+        Net_InitMsg(msg, NET_OP_NETWORK_ERROR);
+        DEBUGMSG(debug_lan, "Leave LAN_NextNetMsg():\n");
+        return -1;
+    }
+
     //Check to see if there is socket activity:
     numready = SDLNet_CheckSockets(set, 0);
     if(numready == -1)
     {
-        DEBUGMSG(debug_lan, "In LAN_NextMsg(), SDLNet_CheckSockets: %s\n", SDLNet_GetError());
+        DEBUGMSG(debug_lan, "In LAN_NextNetMsg(), SDLNet_CheckSockets: %s\n", SDLNet_GetError());
         //most of the time this is a system error, where perror might help you.
-        perror("In LAN_NextMsg(), SDLNet_CheckSockets");
-        strncpy(buf, "NETWORK_ERROR", NET_BUF_LEN);
-        DEBUGMSG(debug_lan, "Leave LAN_NextMsg():\n");
+        perror("In LAN_NextNetMsg(), SDLNet_CheckSockets");
+        Net_InitMsg(msg, NET_OP_NETWORK_ERROR);
+        DEBUGMSG(debug_lan, "Leave LAN_NextNetMsg():\n");
         return -1;
     }
     else if(numready > 0)
@@ -319,78 +419,85 @@ int LAN_NextMsg(char* buf)
         // check with SDLNet_SocketReady():
         if(SDLNet_SocketReady(sd))
         {
-            if(SDLNet_TCP_Recv(sd, buf, NET_BUF_LEN) > 0)
+            if(Net_ReadStream(sd, &stream) > 0)
             {
-                //Success - message is now in buffer
+                //Success - but we may only have part of a message so far,
+                //and anything garbled gets caught next time through:
+                if(Net_NextMsg(&stream, msg) < 1)
+                {
+                    Net_InitMsg(msg, NET_OP_UNKNOWN);
+                    DEBUGMSG(debug_lan, "Leave LAN_NextNetMsg():\n");
+                    return 0;
+                }
                 //We take care of some housekeeping messages internally
                 //(e.g. player info) to hide complexity from rest of program;
-                //In this case, buf gets replaced with "LAN_INTERCEPTED"
-                intercept(buf);
-                DEBUGMSG(debug_lan, "Leave LAN_NextMsg():\n");
+                //In this case, msg becomes NET_OP_INTERCEPTED
+                intercept(msg);
+                DEBUGMSG(debug_lan, "Leave LAN_NextNetMsg():\n");
                 return 1;
             }
             else
             {
-                DEBUGMSG(debug_lan, "In get_next_msg(), SDLNet_TCP_Recv() failed!\n");
+                DEBUGMSG(debug_lan, "In LAN_NextNetMsg(), SDLNet_TCP_Recv() failed!\n");
                 SDLNet_TCP_DelSocket(set, sd);
                 if(sd != NULL)
                     SDLNet_TCP_Close(sd);
                 sd = NULL;
-                strncpy(buf, "NETWORK_ERROR", NET_BUF_LEN);
-                DEBUGMSG(debug_lan, "Leave LAN_NextMsg():\n");
+                Net_InitMsg(msg, NET_OP_NETWORK_ERROR);
+                DEBUGMSG(debug_lan, "Leave LAN_NextNetMsg():\n");
                 return -1;
             }
         }
         else
         {
-            DEBUGMSG(debug_lan, "In get_next_msg(), socket set reported active but no activity found\n");
+            DEBUGMSG(debug_lan, "In LAN_NextNetMsg(), socket set reported active but no activity found\n");
             SDLNet_TCP_DelSocket(set, sd);
             if(sd != NULL)
                 SDLNet_TCP_Close(sd);
             sd = NULL;
-            strncpy(buf, "NETWORK_ERROR", NET_BUF_LEN);
-            DEBUGMSG(debug_lan, "Leave LAN_NextMsg():\n");
+            Net_InitMsg(msg, NET_OP_NETWORK_ERROR);
+            DEBUGMSG(debug_lan, "Leave LAN_NextNetMsg():\n");
             return -1;
         }
     }
     // No socket activity - just return 0:
-    DEBUGMSG(debug_lan, "Leave LAN_NextMsg():\n");
+    DEBUGMSG(debug_lan, "Leave LAN_NextNetMsg():\n");
     return 0;
 }
 
 
 int LAN_SetReady(bool ready)
 {
-    char buffer[NET_BUF_LEN];
-    if(ready)
-        snprintf(buffer, NET_BUF_LEN, "%s", "PLAYER_READY");
-    else
-        snprintf(buffer, NET_BUF_LEN, "%s", "PLAYER_NOT_READY");
-    return say_to_server(buffer);
+    net_msg msg;
+    Net_InitMsg(&msg, ready ? NET_OP_PLAYER_READY : NET_OP_PLAYER_NOT_READY);
+    return say_to_server(&msg);
 }
 
 
 int LAN_RequestIndex(void)
 {
-    char buffer[NET_BUF_LEN];
-    snprintf(buffer, NET_BUF_LEN, "%s", "REQUEST_INDEX");
-    return say_to_server(buffer);
+    net_msg msg;
+    Net_InitMsg(&msg, NET_OP_REQUEST_INDEX);
+    return say_to_server(&msg);
 }
 
 
 int LAN_AnsweredCorrectly(int id, float t)
 {
-    char buffer[NET_BUF_LEN];
-    snprintf(buffer, NET_BUF_LEN, "%s\t%d\t%f", "CORRECT_ANSWER", id, t);
-    return say_to_server(buffer);
+    net_msg msg;
+    Net_InitMsg(&msg, NET_OP_CORRECT_ANSWER);
+    msg.arg[0] = id;
+    msg.time = t;
+    return say_to_server(&msg);
 }
 
 
 int LAN_NotAnsweredCorrectly(int id)
 {
-    char buffer[NET_BUF_LEN];
-    snprintf(buffer, NET_BUF_LEN, "%s\t%d", "WRONG_ANSWER", id);
-    return say_to_server(buffer);
+    net_msg msg;
+    Net_InitMsg(&msg, NET_OP_WRONG_ANSWER);
+    msg.arg[0] = id;
+    return say_to_server(&msg);
 }
 
 
@@ -398,9 +505,9 @@ int LAN_NotAnsweredCorrectly(int id)
 /* not disconnecting our socket:                                    */
 int LAN_LeaveGame(void)
 {
-    char buf[NET_BUF_LEN];
-    snprintf(buf, NET_BUF_LEN, "%s", "LEAVE_GAME");
-    return say_to_server(buf);
+    net_msg msg;
+    Net_InitMsg(&msg, NET_OP_LEAVE_GAME);
+    return say_to_server(&msg);
 }
 
 /* -------------------------------------------------------------------------   */
@@ -472,20 +579,25 @@ int LAN_MyIndex(void)
     return my_index;
 }
 
+/* The round trip times measured so far - samples is 0 if the   */
+/* server is too old to answer pings or hasn't had the chance: */
+void LAN_GetRoundTrip(lan_rtt_type* r)
+{
+    if(r)
+        *r = rtt;
+}
+
 
 
 
 /*private to network.c functions*/
 
-int say_to_server(char* statement)
+int say_to_server(net_msg* msg)
 {
-    char buffer[NET_BUF_LEN];
-
-    if(!statement)
+    if(!msg)
         return 0;
 
-    snprintf(buffer, NET_BUF_LEN, "%s", statement);
-    if (SDLNet_TCP_Send(sd, (void *)buffer, NET_BUF_LEN) < NET_BUF_LEN)
+    if (!Net_SendNetMsg(sd, &stream, msg))
     {
         DEBUGMSG(debug_lan, "SDLNet_TCP_Send: %s\n", SDLNet_GetError());
         return 0;
@@ -494,21 +606,46 @@ int say_to_server(char* statement)
     return 1;
 }
 
-//add name to list, checking for duplicates:
+//add name to list, checking for duplicates.
+//Servers with rooms answer "TUXMATH_SERVER\tname\tport\troom\tlesson" once
+//for each room, older ones "TUXMATH_SERVER\tname\tlesson":
 int add_to_server_list(UDPpacket* pkt)
 {
     int i = 0;
     int already_in = 0;
+    char data[NET_BUF_LEN];
+    char* field[5];
+    int num_fields = 0;
     char* p = NULL;
+    IPaddress ip;
 
     if(!pkt)
         return 0;
 
+    //split a terminated copy into its tab-separated fields:
+    snprintf(data, NET_BUF_LEN, "%.*s", pkt->len, (char*)pkt->data);
+    p = data;
+    while(p && num_fields < 5)
+    {
+        field[num_fields++] = p;
+        p = strchr(p, '\t');
+        if(p)
+            *p++ = '\0';
+    }
+    if(num_fields < 3)
+        return 0;
+
+    //each room has its own port:
+    ip.host = pkt->address.host;
+    ip.port = pkt->address.port;
+    if(num_fields == 5)
+        SDLNet_Write16((Uint16)atoi(field[2]), &ip.port);
+
     //first see if it is already in list:
     while((i < MAX_SERVERS)
             && (servers[i].ip.host != 0))
     {
-        if(pkt->address.host == servers[i].ip.host)
+        if(ip.host == servers[i].ip.host && ip.port == servers[i].ip.port)
             already_in = 1;
         i++;
     }
@@ -516,28 +653,21 @@ int add_to_server_list(UDPpacket* pkt)
     //Copy it in unless it's already there, or we are out of room:
     if(!already_in && i < MAX_SERVERS)
     {
-        servers[i].ip.host = pkt->address.host;
-        servers[i].ip.port = pkt->address.port;
-        // not using sscanf() because server_name could contain whitespace:
-        p = strchr((const char*)pkt->data, '\t');
-        p++;
-        if(p)
-            strncpy(servers[i].name, p, NAME_SIZE);
-        // this may have copied the next field as well, so we
-        // find the delimiter and terminate the string there:
-        p = strchr(servers[i].name, '\t');
-        if(p)
-            *p = '\0';
+        servers[i].ip = ip;
+        // server_name could contain whitespace, but not tabs:
+        strncpy(servers[i].name, field[1], NAME_SIZE);
+        servers[i].name[NAME_SIZE - 1] = '\0';
         // we also don't want a newline char at the end:
         p = strchr(servers[i].name, '\n');
         if(p)
             *p = '\0';
-        // now we go to the second '\t' (note the use of "strrchr()"
-        // rather than "strchr()") to get the lesson name:
-        p = strrchr((const char*)pkt->data, '\t');
-        p++;
-        if(p)
-            strncpy(servers[i].lesson, p, LESSON_TITLE_LENGTH);
+        if(num_fields == 5)
+            snprintf(servers[i].room, NAME_SIZE, "%s", field[3]);
+        else
+            servers[i].room[0] = '\0';
+        // the lesson name is always the last field:
+        snprintf(servers[i].lesson, LESSON_TITLE_LENGTH, "%.*s",
+                LESSON_TITLE_LENGTH - 1, field[num_fields - 1]);
 
         i++;
     }
@@ -551,61 +681,131 @@ void print_server_list(void)
     fprintf(stderr, "Detected servers:\n");
     while(i < MAX_SERVERS && servers[i].ip.host != 0)
     {
-        fprintf(stderr, "SERVER NUMBER %d: %s\n", i, servers[i].name);
+        if(servers[i].room[0] != '\0')
+            fprintf(stderr, "SERVER NUMBER %d: %s - room %s (%s)\n", i,
+                    servers[i].name, servers[i].room, servers[i].lesson);
+        else
+            fprintf(stderr, "SERVER NUMBER %d: %s\n", i, servers[i].name);
         i++;
     }
 }
 
 /* Some of the server messages are handled within network.c, such
  * as those which maintain the state of the list of connected clients.
- * We handle those here before passing 'buf' to the game itself.
+ * We handle those here before passing 'msg' to the game itself.
  */
-void intercept(char* buf)
+void intercept(net_msg* msg)
 {
-    if(!buf)
+    if(!msg)
         return;
 
-    if(strncmp(buf, "SOCKET_INDEX", strlen("SOCKET_INDEX")) == 0)
+    switch(msg->op)
     {
-        my_index = socket_index_recvd(buf);
-        snprintf(buf, NET_BUF_LEN, "%s", "LAN_INTERCEPTED");
+        case NET_OP_SOCKET_INDEX:
+            my_index = socket_index_recvd(msg->arg[0]);
+            Net_InitMsg(msg, NET_OP_INTERCEPTED);
+            break;
+        case NET_OP_CONNECTED_PLAYERS:
+            connected_players_recvd(msg->arg[0]);
+            Net_InitMsg(msg, NET_OP_INTERCEPTED);
+            break;
+        case NET_OP_UPDATE_PLAYER_INFO:
+            parse_player_info_msg(msg);
+            Net_InitMsg(msg, NET_OP_INTERCEPTED);
+            break;
+        case NET_OP_PLAYER_LEFT:
+            lan_player_left_recvd(msg); //for this one msg is modified but sent
+            break;
+        case NET_OP_PROTOCOL:
+            protocol_recvd(msg->arg[0]);
+            Net_InitMsg(msg, NET_OP_INTERCEPTED);
+            break;
+        case NET_OP_PING:
+            //Straight back, so the server can time it:
+            msg->op = NET_OP_PONG;
+            say_to_server(msg);
+            Net_InitMsg(msg, NET_OP_INTERCEPTED);
+            break;
+        case NET_OP_PONG:
+            pong_recvd(msg->arg[0]);
+            Net_InitMsg(msg, NET_OP_INTERCEPTED);
+            break;
+        default:
+            /* Otherwise we leave 'msg' unchanged to be handled elsewhere */
+            break;
     }
-    else if(strncmp(buf, "CONNECTED_PLAYERS", strlen("CONNECTED_PLAYERS")) == 0)
+}
+
+
+/* Server has agreed to the given protocol version, so from now */
+/* on we can send it messages in that format:                   */
+int protocol_recvd(int version)
+{
+    if(version < NET_PROTOCOL_LEGACY || version > NET_PROTOCOL_VERSION)
     {
-        connected_players_recvd(buf);
-        snprintf(buf, NET_BUF_LEN, "%s", "LAN_INTERCEPTED");
+        DEBUGMSG(debug_lan, "protocol_recvd() - bad version: %d\n", version);
+        return 0;
     }
-    else if(strncmp(buf, "UPDATE_PLAYER_INFO", strlen("UPDATE_PLAYER_INFO")) == 0)
+    stream.protocol = version;
+    DEBUGMSG(debug_lan, "Server using protocol %d\n", version);
+    return 1;
+}
+
+
+/* Sends the server a PING with our clock on it, if it is time: */
+void ping_server(void)
+{
+    net_msg msg;
+    Uint32 now;
+
+    if(!sd || stream.protocol < NET_PROTOCOL_PING)
+        return;
+    now = SDL_GetTicks();
+    if(last_ping != 0 && now - last_ping < NET_PING_INTERVAL)
+        return;
+
+    Net_InitMsg(&msg, NET_OP_PING);
+    msg.arg[0] = (int)now;
+    if(say_to_server(&msg))
+        last_ping = now;
+}
+
+
+/* Our PING sent at time "sent" has come back: */
+int pong_recvd(int sent)
+{
+    Uint32 ms = SDL_GetTicks() - (Uint32)sent;
+
+    if(ms > 10 * NET_PING_INTERVAL)   //not one of ours
+        return 0;
+
+    if(rtt.samples == 0)
     {
-        parse_player_info_msg(buf);
-        snprintf(buf, NET_BUF_LEN, "%s", "LAN_INTERCEPTED");
+        rtt.smoothed = rtt.mean = rtt.min = rtt.max = ms;
     }
-    else if(strncmp(buf, "PLAYER_LEFT", strlen("PLAYER_LEFT")) == 0)
+    else
     {
-        lan_player_left_recvd(buf); //for this one buf is modified but sent
+        rtt.smoothed += (ms - rtt.smoothed) / 8;
+        rtt.mean += (ms - rtt.mean) / (rtt.samples + 1);
+        if(ms < rtt.min)
+            rtt.min = ms;
+        if(ms > rtt.max)
+            rtt.max = ms;
     }
-    /* Otherwise we leave 'buf' unchanged to be handled elsewhere */
+    rtt.samples++;
+    DEBUGMSG(debug_lan, "pong_recvd() - round trip %u msec, smoothed %.1f\n",
+            ms, rtt.smoothed);
+    return 1;
 }
 
 
-int socket_index_recvd(char* buf)
+int socket_index_recvd(int index)
 {
     int i = 0;
-    int index = -1;
-    char* p = NULL;
-
-    if(!buf)
-        return -1;
-
-    p = strchr(buf, '\t');
-    if(!p)
-        return -1;
-    p++;
-    index = atoi(p);
 
     DEBUGMSG(debug_lan, "socket_index_recvd(): index = %d\n", index);
 
-    if(index < 0 || index > MAX_CLIENTS)
+    if(index < 0 || index >= MAX_CLIENTS)
     {
         fprintf(stderr, "socket_index_recvd() - illegal value: %d\n", index);
         return -1;
@@ -621,49 +821,17 @@ int socket_index_recvd(char* buf)
 }
 
 
-int parse_player_info_msg(char* buf)
+int parse_player_info_msg(net_msg* msg)
 {
-    int i = 0;
-    char* p = NULL;
+    int i = msg->arg[0];
 
-    if(buf == NULL)
-        return 0;
-    // get i:
-    p = strchr(buf, '\t');
-    if(!p)
+    if(i < 0 || i >= MAX_CLIENTS)
         return 0;
-    p++;
-    i = atoi(p);
     lan_player_info[i].connected = 1;
+    lan_player_info[i].ready = msg->arg[1];
+    snprintf(lan_player_info[i].name, NAME_SIZE, "%.*s", NAME_SIZE - 1, msg->text);
+    lan_player_info[i].score = msg->arg[2];
 
-    // get ready:
-    p = strchr(p, '\t');
-    if(!p)
-        return 0;
-    p++;
-    lan_player_info[i].ready = atoi(p);
-
-    //get name:
-    p = strchr(p, '\t');
-    if(!p)
-        return 0;
-    p++;
-    strncpy(lan_player_info[i].name, p, NAME_SIZE);
-    //This has most likely copied the score field as well, so replace the
-    //tab delimiter with a null to terminate the string:
-    {
-        char* p2 = strchr(lan_player_info[i].name, '\t');
-        if (p2)
-            *p2 = '\0';
-    }
-
-    //Now get score:
-    p = strchr(p, '\t');
-    p++;
-    if(p)
-        lan_player_info[i].score = atoi(p);
-
-    DEBUGMSG(debug_lan, "update_score_recvd() - buf is: %s\n", buf);
     DEBUGMSG(debug_lan, "i is: %d\tname is: %s\tscore is: %d\n", 
             i, lan_player_info[i].name, lan_player_info[i].score);
 
@@ -672,15 +840,14 @@ int parse_player_info_msg(char* buf)
 
 
 
-int lan_player_left_recvd(char* buf)
+int lan_player_left_recvd(net_msg* msg)
 {
-    int i;
-    if(!buf)
+    int i = msg->arg[0];
+    if(i < 0 || i >= MAX_CLIENTS)
         return 0;
-    i = atoi(buf + strlen("PLAYER_LEFT\t"));
-    //rewrite buf to contain name itself for "downstream" rather than index,
+    //put the name in msg for "downstream" along with the index,
     //because we are about to clobber name in lan_player_info[]
-    snprintf(buf, NET_BUF_LEN, "%s\t%s", "PLAYER_LEFT", LAN_PlayerName(i));
+    snprintf(msg->text, NAME_SIZE, "%s", LAN_PlayerName(i));
     strncpy(lan_player_info[i].name, _("Await player name"), NAME_SIZE);
     lan_player_info[i].score = -1;
     lan_player_info[i].ready = false;
@@ -696,20 +863,9 @@ int lan_player_left_recvd(char* buf)
 /* who has disconnected.                                         */
 /* FIXME do we really need this message anymore? - DSB
 */
-int connected_players_recvd(char* buf)
+int connected_players_recvd(int n)
 {
-    int n = 0;
     int i = 0;
-    char* p = NULL;
-
-    if(!buf)
-        return 0;
-
-    p = strchr(buf, '\t');
-    if(!p)
-        return 0;
-    p++;
-    n = atoi(p);
 
     DEBUGMSG(debug_lan, "connected_players_recvd() for n = %d\n", n);
 
@@ -38,12 +38,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifdef HAVE_LIBSDL_NET
 
 #include "transtruct.h"
+#include "netmsg.h"
 #include "SDL_net.h"
 
 
 typedef struct {
     IPaddress ip;            /* 32-bit IPv4 host address */
     char name[NAME_SIZE];
+    char room[NAME_SIZE];    /* empty for servers without rooms */
     char lesson[LESSON_TITLE_LENGTH];
 }ServerEntry;
 
@@ -56,10 +58,21 @@ typedef struct lan_player_type {
     int score;  
 } lan_player_type;
 
+/* Round trip times to the server, timed with PING messages: */
+typedef struct lan_rtt_type {
+    int samples;
+    float smoothed;   /* msec, weighted toward the latest */
+    float mean;
+    Uint32 min;
+    Uint32 max;
+} lan_rtt_type;
+
 /* Networking setup and cleanup: */
 int LAN_DetectServers(void);
+int LAN_DetectRoom(const char* room);
 int LAN_AutoSetup(int i);
 char* LAN_ServerName(int i);
+char* LAN_ServerRoom(int i);
 char* LAN_ConnectedServerName(void);
 char* LAN_ConnectedServerLesson(void);
 void print_server_list(void);
@@ -81,8 +94,10 @@ bool LAN_PlayerReady(int i);
 bool LAN_PlayerConnected(int i);
 int LAN_PlayerScore(int i);
 int LAN_MyIndex(void);
+void LAN_GetRoundTrip(lan_rtt_type* rtt);
 /* This is how the client receives messages from the server: */
 int LAN_NextMsg(char* buf);
+int LAN_NextNetMsg(net_msg* msg);
 
 
 
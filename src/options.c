@@ -78,6 +78,18 @@ const char* const OPTION_TEXT[NUM_GLOBAL_OPTS+1] = {
     "END_OF_OPTS"
 };
 
+/* OPTION_TEXT indices in strcasecmp() order for Opts_MapTextToIndex() */
+static const int OPTION_ORDER[NUM_GLOBAL_OPTS] = {
+    FULLSCREEN,
+    MENU_MUSIC,
+    MENU_SOUND,
+    PER_USER_CONFIG,
+    USE_IGLOOS,
+    USE_KEYPAD,
+    USE_SOUND,
+    USE_TTS,
+};
+
 const int DEFAULT_GLOBAL_OPTS[NUM_GLOBAL_OPTS] = {
     1,
     1,
@@ -199,18 +211,38 @@ void Opts_Cleanup(void)
 //* "Set" functions for tuxmath options struct: */
 unsigned int Opts_MapTextToIndex(const char* text)
 {
-    int i;
-    for (i = 0; i < NUM_GLOBAL_OPTS; ++i)
+    int lo = 0, hi = NUM_GLOBAL_OPTS - 1;
+    while (lo <= hi)
     {
-        if (0 == strcasecmp(text, OPTION_TEXT[i]) )
-        {
-            return i;
-        }
+        int mid = (lo + hi) / 2;
+        int cmp = strcasecmp(text, OPTION_TEXT[OPTION_ORDER[mid]]);
+        if (cmp == 0)
+            return OPTION_ORDER[mid];
+        if (cmp < 0)
+            hi = mid - 1;
+        else
+            lo = mid + 1;
     }
     DEBUGMSG(debug_options, "'%s' isn't a global option\n", text);
     return -1;
 }
 
+int Opts_VerifyOptionListSane(void)
+{
+    int i;
+    if (strcmp(OPTION_TEXT[NUM_GLOBAL_OPTS], "END_OF_OPTS") != 0)
+        return 0;
+    for (i = 0; i < NUM_GLOBAL_OPTS; ++i)
+    {
+        if (OPTION_ORDER[i] < 0 || OPTION_ORDER[i] >= NUM_GLOBAL_OPTS)
+            return 0;
+        if (i > 0 && strcasecmp(OPTION_TEXT[OPTION_ORDER[i - 1]],
+                                OPTION_TEXT[OPTION_ORDER[i]]) >= 0)
+            return 0;
+    }
+    return 1;
+}
+
 int Opts_GetGlobalOp(const char* text)
 {
     int index = Opts_MapTextToIndex(text);
@@ -135,6 +135,7 @@ void Opts_Cleanup(void);
 /* "Set" functions for tuxmath options struct: */
 
 unsigned int Opts_MapTextToIndex(const char* text);
+int Opts_VerifyOptionListSane(void);
 
 int  Opts_GetGlobalOpt(unsigned int index);
 void Opts_SetGlobalOpt(unsigned int index, int val);
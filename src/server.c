@@ -44,6 +44,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "server.h" 
 #include "transtruct.h"
 #include "mathcards.h"
+#include "fileops.h"
+#include "srvstats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -57,8 +59,34 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <pthread.h>
 #endif
 
+/* On Linux the main loop sleeps in epoll_wait() until a socket, the   */
+/* console or the question timer needs attention. Elsewhere it polls   */
+/* every SRV_POLL_INTERVAL msec as it always has:                       */
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_TIMERFD_H)
+#define SRV_USE_EPOLL
+#include <errno.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#endif
+
 #define MAX_ARGS 16
 #define SRV_QUEST_INTERVAL 2000
+#define SRV_QUEST_QUEUE_SIZE 64   //questions drawn from mathcards at a time
+#define SRV_POLL_INTERVAL 5       //min loop time in msec without epoll
+#define SRV_STDIN_POLL 100        //max msec between stdin checks if it can't be watched
+#define SRV_SEND_HIGH_WATER (64 * NET_BUF_LEN)  //default bytes queued for a client before
+                                                //stale updates are dropped - it is hung
+                                                //up on if it gets twice as far behind
+#define SRV_STATS_INTERVAL 5000   //msec between rewrites of the --stats-file
+#define SRV_PING_INTERVAL NET_PING_INTERVAL
+#define SRV_SENT_QUESTIONS MAX_MAX_COMETS   //send times kept for scoring answers
+#define SRV_INITIAL_CLIENTS 16    //client slots a room starts with - it doubles them
+                                  //as players arrive, up to MAX_CLIENTS
+#define SRV_MAX_EVENTS 256        //epoll events taken at once
+#define SRV_IDLE_ROOM_TIME 60000  //msec a room opened on demand stays open with nobody in it
 
 typedef struct srv_game_type {
     char lesson_name[NAME_SIZE];
@@ -69,52 +97,150 @@ typedef struct srv_game_type {
     int rem_in_wave;          //Number still to be issued in wave
 }srv_game_type;
 
+/* A room is one independent game with its own players, listening on */
+/* its own port (DEFAULT_PORT plus its slot in rooms[]).  Rooms are   */
+/* named for the lesson they play, so a single server can host every */
+/* class at once:                                                     */
+typedef struct srv_room {
+    char name[NAME_SIZE];     /* Lesson file the room was opened with   */
+    char lesson_title[LESSON_TITLE_LENGTH];
+    int slot;                 /* Index in rooms[]                       */
+    TCPsocket server_sock;    /* Socket descriptor for server to accept client TCP sockets. */
+    IPaddress ip;
+    SDLNet_SocketSet client_set;
+    /* Client slots, grown by grow_clients() as players arrive. Each   */
+    /* player keeps its slot, which is its index on the wire, while    */
+    /* active[] lists just the slots in use so that the work done each */
+    /* pass goes by how many are connected rather than how many could  */
+    /* be. readable[] lists those with input waiting:                  */
+    client_type* client;
+    int max_clients;
+    int* active;
+    int num_active;
+    int* readable;
+    int num_readable;
+    int num_clients;
+    int game_in_progress;
+    Uint32 last_quest_time;   /* When game_msg_next_question() last ran  */
+    Uint32 quest_free_time;   /* When the game started or a full screen  */
+                              /* last got room - for the dispatch lag    */
+    Uint32 last_ping_time;    /* When ping_clients() last sent PINGs     */
+    srv_game_type srv_game;
+    MC_MathGame* math_game;   /* MathCards state - never shared between rooms */
+    int own_math_game;        /* math_game allocated by open_room()     */
+    int on_demand;            /* opened for a client - closed once idle */
+    Uint32 empty_since;       /* When it opened or its last player left */
+    /* Questions already drawn from mathcards for the current wave, */
+    /* waiting to be sent out by game_msg_next_question():          */
+    MC_FlashCard quest_queue[SRV_QUEST_QUEUE_SIZE];
+    int quest_queue_len;
+    int quest_queue_next;
+    /* Answers received since the last apply_answers(), at most one */
+    /* per client per pass through server_check_messages():         */
+    MC_AnswerRecord* answers;
+    int* answer_client;
+    int num_answers;
+    /* When each question still in play was sent, so answers can be */
+    /* timed by our clock instead of the client's:                  */
+    int sent_id[SRV_SENT_QUESTIONS];
+    Uint32 sent_time[SRV_SENT_QUESTIONS];
+    int sent_next;
+}srv_room;
+
 
 
 
 /*  -----------  Local function prototypes:   ------------  */
 
 // setup and cleanup:
-int setup_server(int thread_id_no);
-void cleanup_server(int thread_id_no);
+int setup_server(void);
+void cleanup_server(void);
 void server_handle_command_args(int argc, char* argv[]);
 void* run_server_local_args(void* data);
 
+// rooms:
+srv_room* open_room(const char* name, MC_MathGame* game);
+void close_room(srv_room* room);
+srv_room* find_room(const char* name);
+int valid_room_name(const char* name);
+void list_rooms(void);
+int idle_room_timeout(srv_room* room, Uint32 now);
+void close_idle_rooms(void);
+
+// event loop:
+int setup_event_loop(void);
+void cleanup_event_loop(void);
+void watch_socket(void* sock);
+void unwatch_socket(void* sock);
+void watch_client(srv_room* room, int i);
+void unwatch_client(srv_room* room, int i);
+void wait_for_events(Uint32* timer);
+void watch_socket_output(void* sock, int on);
+int send_nonblock(TCPsocket sock, const char* data[], int len[], int n);
+int room_next_timeout(srv_room* room, Uint32 now);
+int ping_timeout(srv_room* room, Uint32 now);
+Uint32 quest_wait_time(srv_room* room);
+
 // top level functions in main loop:
-void check_UDP(int thread_id_no);
-void update_clients(int thread_id_no);
-int server_check_messages(int thread_id_no);
-void server_update_game(int thread_id_no);
-void server_check_stdin(int thread_id_no);
+void check_UDP(void);
+int send_room_info(srv_room* room, IPaddress* address);
+void update_clients(srv_room* room);
+int server_check_messages(srv_room* room);
+void server_update_game(srv_room* room);
+void server_check_stdin(void);
 // client management utilities:
-int find_vacant_client(int thread_id_no);
-void remove_client(int thread_id_no, int i);
-void check_game_clients(int thread_id_no);
+int grow_clients(srv_room* room);
+int find_vacant_client(srv_room* room);
+void client_readable(srv_room* room, int i);
+void poll_client_sockets(srv_room* room);
+int join_client(srv_room* room, int i);
+void remove_client(srv_room* room, int i);
+void close_client_socket(srv_room* room, int i);
+void check_game_clients(srv_room* room);
+int flush_client(srv_room* room, int i);
+void flush_clients(srv_room* room);
+void flush_output(int frame);
+void list_queues(void);
+void print_stats(void);
+void write_stats_file(void);
+int stats_file_timeout(Uint32 now);
 
 // message reception:
-int handle_client_game_msg(int thread_id_no, int i, char* buffer);
-void handle_client_nongame_msg(int thread_id_no, int i, char* buffer);
-int msg_set_name(int thread_id_no, int i, char* buf);
-void msg_socket_index(int thread_id_no, int i, char* buf);
-void start_game(int thread_id_no);
-void end_game(int thread_id_no);
-void game_msg_correct_answer(int thread_id_no, int i, char* inbuf);
-void game_msg_wrong_answer(int thread_id_no, int i, char* inbuf);
-void game_msg_quit(int thread_id_no, int i);
-void game_msg_exit(int thread_id_no, int i);
+int handle_client_game_msg(srv_room* room, int i, net_msg* msg);
+void handle_client_nongame_msg(srv_room* room, int i, net_msg* msg);
+int msg_set_name(srv_room* room, int i, net_msg* msg);
+void msg_socket_index(srv_room* room, int i);
+void msg_protocol(srv_room* room, int i, net_msg* msg);
+void msg_ping(srv_room* room, int i, net_msg* msg);
+void msg_pong(srv_room* room, int i, net_msg* msg);
+void ping_clients(srv_room* room);
+void start_game(srv_room* room);
+void end_game(srv_room* room);
+void game_msg_correct_answer(srv_room* room, int i, net_msg* msg);
+void game_msg_wrong_answer(srv_room* room, int i, net_msg* msg);
+void queue_answer(srv_room* room, int i, int id, int correct, float t);
+float answer_time(srv_room* room, int i, int id, float client_time);
+void apply_answers(srv_room* room);
+void game_msg_quit(srv_room* room, int i);
+void game_msg_exit(srv_room* room, int i);
 int calc_score(int difficulty, float t);
+void print_scoreboard(srv_room* room);
 
 //message sending:
-int add_question(int thread_id_no, MC_FlashCard* fc);
-int remove_question(int thread_id_no, int quest_id, int answered_by);
-int send_counter_updates(int thread_id_no);
-int send_player_updates(int thread_id_no);
+int add_question(srv_room* room, MC_FlashCard* fc);
+int remove_question(srv_room* room, int quest_id, int answered_by);
+int send_counter_updates(srv_room* room);
+int send_player_updates(srv_room* room);
+int send_player_update(srv_room* room, int i);
+int send_player_list(srv_room* room, int i);
 //int SendQuestion(MC_FlashCard flash, TCPsocket client_sock);
 int SendMessage(int message, int ques_id, char* name, TCPsocket client_sock);
-int player_msg(int thread_id_no, int i, char* msg);
-void broadcast_msg(int thread_id_no, char* msg);
-int transmit(int thread_id_no, int i, char* msg);
-int transmit_all(int thread_id_no, char* msg);
+int player_msg(srv_room* room, int i, char* msg);
+void broadcast_msg(srv_room* room, char* msg);
+int transmit(srv_room* room, int i, net_msg* msg);
+int transmit_all(srv_room* room, net_msg* msg);
+int transmit_encoded(srv_room* room, int i, net_msg* msg, char* data, int len);
+int too_wide_for(srv_room* room, int i, const net_msg* msg);
 
 // For non-blocking input:
 int read_stdin_nonblock(char* buf, size_t max_length);
@@ -122,7 +248,7 @@ int read_stdin_nonblock(char* buf, size_t max_length);
 
 // not really deprecated but not done in response to 
 // client message --needs better name:
-void game_msg_next_question(int thread_id_no);
+void game_msg_next_question(srv_room* room);
 
 /* global mathgame struct for lan game: */
 extern MC_MathGame* lan_game_settings;  //TODO Deepak:- see its effect and change it accordingly
@@ -130,23 +256,35 @@ extern MC_MathGame* lan_game_settings;  //TODO Deepak:- see its effect and chang
 /*  ------------   "Local globals" for server.c: ----------  */
 char server_name[NAME_SIZE];  /* User-visible name for server selection  */
 int need_server_name = 1;     /* Always request server name */
-static int game_in_progress = 0;
 static int server_running = 0;
 static int quit = 0;
 static int ignore_stdin = 0;    //TODO not needed as all work is done in threads
-
-/* used for keeping record of every instance of a thread running within a server */
-struct threadID   
-{
-    UDPsocket udpsock ;              /* Used to listen for client's server autodetection           */
-    TCPsocket server_sock;    /* Socket descriptor for server to accept client TCP sockets. */
-    IPaddress ip;
-    SDLNet_SocketSet client_set;
-    struct client_type client[MAX_CLIENTS];  //TODO Deepak removed static from it as they can't be declared inside it. might result problem in future 
-    int num_clients;
-    struct srv_game_type srv_game;
-};
-struct threadID slave_thread[2]; //TODO it might have to be replaced with a pointer pointing to head of the stack when integrating thread in it.
+static UDPsocket udpsock = NULL;  /* Used to listen for client's server autodetection */
+static srv_room* rooms[MAX_ROOMS];  /* rooms[0] plays lan_game_settings */
+/* Lessons named with --lesson, opened as rooms at startup: */
+static char* startup_lessons[MAX_ARGS];
+static int num_startup_lessons = 0;
+static int send_high_water = SRV_SEND_HIGH_WATER;
+/* Output is queued during a pass through the main loop and written out */
+/* at the end of it, at most one write per client. Counted for debugging: */
+static int tick_msgs = 0;
+static int tick_writes = 0;
+/* Prometheus-style copy of the stats, if wanted: */
+static char stats_file[PATH_MAX] = "";
+static Uint32 last_stats_write = 0;
+#ifdef SRV_USE_EPOLL
+static int epoll_fd = -1;
+static int timer_fd = -1;       /* Wakes us when the next question is due */
+static int stdin_watched = 0;
+/* The room and client each socket descriptor belongs to, so epoll's */
+/* events lead straight to the clients with something to read:       */
+typedef struct srv_socket_owner {
+    int room;                   /* -1 if not a client's */
+    int client;
+} srv_socket_owner;
+static srv_socket_owner* socket_owners = NULL;
+static int num_socket_owners = 0;
+#endif
 
 // These are to allow the server to be invoked in a thread
 // with the same syntax as used to launch it as a standalone
@@ -168,23 +306,29 @@ char local_argv_storage[MAX_ARGS][256];
 int RunServer(int argc, char* argv[])
 { 
     Uint32 timer = 0;
+    Uint32 pass_start;
     ignore_stdin = 0;
     int frame = 0;
+    int i;
 
     fprintf(stderr, "Started tuxmathserver, waiting for client to connect:\n>\n");
 
     server_handle_command_args(argc, argv);
+    Stats_Init();
 
     /*     ---------------- Setup: ---------------------------   */
-    if (!setup_server(0)) //FIXME Deepak its hard coded.
+    if (!setup_server())
     {
         fprintf(stderr, "setup_server() failed - exiting.\n");
-        cleanup_server(0);  //FIXME Deepak its hard coded.
+        cleanup_server();
         return EXIT_FAILURE;
     }
 
     DEBUGMSG(debug_lan, "In RunServer(), server_name is: %s\n", server_name);
 
+    if (!setup_event_loop())
+        DEBUGMSG(debug_lan, "In RunServer(), polling every %d msec\n", SRV_POLL_INTERVAL);
+
     server_running = 1;
     quit = 0;
 
@@ -195,6 +339,7 @@ int RunServer(int argc, char* argv[])
     /*    ------------- Main server loop:  ------------------   */
     while (!quit)
     {
+        pass_start = SDL_GetTicks();
         DEBUGCODE(debug_lan)
         {
             if(frame % 1000 == 0)
@@ -202,27 +347,38 @@ int RunServer(int argc, char* argv[])
         }
 
         /* Respond to any clients pinging us to find the server: */
-        check_UDP(0);    //FIXME Deepak its hard coded.
-        /* Now we check to see if anyone is trying to connect. */
-        update_clients(0); //FIXME Deepak its hard coded.
-        /* Check for any pending messages from clients already connected: */
-        server_check_messages(0);  //FIXME Deepak its hard coded.
-        /* Handle any game updates not driven by received messages:  */
-        server_update_game(0);     //FIXME Deepak its hard coded
+        check_UDP();
+        for (i = 0; i < MAX_ROOMS; i++)
+        {
+            if (!rooms[i])
+                continue;
+            /* Now we check to see if anyone is trying to connect. */
+            update_clients(rooms[i]);
+            /* Check for any pending messages from clients already connected: */
+            server_check_messages(rooms[i]);
+            /* Handle any game updates not driven by received messages:  */
+            server_update_game(rooms[i]);
+            /* Time the round trip to each client every so often: */
+            ping_clients(rooms[i]);
+        }
+        /* Free the ports of rooms clients asked for but have left: */
+        close_idle_rooms();
         /* Check for command line input, if appropriate: */
-        server_check_stdin(0);   // FIXME Deepak its hard coded
-        /* Limit frame rate to keep from eating all CPU: */
-        /* NOTE almost certainly could make this longer wtihout noticably */
-        /* affecting performance, but even throttling to 1 msec/loop cuts */
-        /* CPU from 100% to ~2% on my desktop - DSB                       */
-        T4K_Throttle(5, &timer);  //min loop time 5 msec
+        server_check_stdin();
+        /* Write out whatever the above had to say, as far as we can: */
+        flush_output(frame);
+        Stats_Observe(STAT_LOOP_TIME, SDL_GetTicks() - pass_start);
+        if (stats_file_timeout(SDL_GetTicks()) == 0)
+            write_stats_file();
+        /* Sleep until there is something more to do: */
+        wait_for_events(&timer);
         frame++;
     }
 
     server_running = 0;
 
     /*   -----  Free resources before exiting: -------    */
-    cleanup_server(0); //FIXME Deepak its hard coded.
+    cleanup_server();
 
     return EXIT_SUCCESS;
 }
@@ -364,10 +520,14 @@ int PortAvailable(Uint16 port)
 }
 
 
-/* Find out if game is already in progress: */
+/* Find out if a game is already in progress in any room: */
 int SrvrGameInProgress(void)
 {
-    return game_in_progress;
+    int i;
+    for (i = 0; i < MAX_ROOMS; i++)
+        if (rooms[i] && rooms[i]->game_in_progress)
+            return 1;
+    return 0;
 }
 
 /* FIXME make these more civilized - notify players, clean up game
@@ -377,15 +537,18 @@ int SrvrGameInProgress(void)
 /* Stop Server */
 void StopServer(void)
 {
-    StopSrvrGame(0);   // FIXME Deepak its hard coded. StopServer is called from somewhere else
+    StopSrvrGame();
     quit = 1;
 }
 
 
-/* Stop currently running game: */
-void StopSrvrGame(int thread_id_no)
+/* Stop currently running games: */
+void StopSrvrGame(void)
 {
-    end_game(thread_id_no);
+    int i;
+    for (i = 0; i < MAX_ROOMS; i++)
+        if (rooms[i])
+            end_game(rooms[i]);
     //TODO send notifications to players
 }
 
@@ -407,32 +570,10 @@ void StopSrvrGame(int thread_id_no)
  */
 
 // setup_server() - all the things needed to get server running:
-int setup_server(int thread_id_no)
+int setup_server(void)
 {
     Uint32 timer = 0;
-
-    slave_thread[thread_id_no].num_clients=0; // To ensure no garbage value is used. 
-
-    /* Resolving the host using NULL make network interface to listen */
-    if (SDLNet_ResolveHost(&(slave_thread[thread_id_no].ip), NULL, DEFAULT_PORT) < 0)
-    {
-        fprintf(stderr, "SDLNet_ResolveHost: %s\n", SDLNet_GetError());
-        return 0;
-    }
-
-    /* Open a connection with the IP provided (listen on the host's port) */
-    if (!(slave_thread[thread_id_no].server_sock = SDLNet_TCP_Open(&(slave_thread[thread_id_no].ip)) ) )
-    {
-        fprintf(stderr, "SDLNet_TCP_Open: %s\n", SDLNet_GetError());
-        return 0;
-    }
-
-    slave_thread[thread_id_no].client_set = SDLNet_AllocSocketSet(MAX_CLIENTS);
-    if(!(slave_thread[thread_id_no].client_set) )
-    { 
-        fprintf(stderr, "SDLNet_AllocSocketSet: %s\n", SDLNet_GetError());
-        return 0;
-    }
+    int i;
 
     //this sets up our mathcards "library" with hard-coded defaults - no
     //settings read from config file here as of yet:
@@ -442,6 +583,13 @@ int setup_server(int thread_id_no)
         return 0;
     }
 
+    /* The console commands in server_check_stdin() mustn't hold up */
+    /* the rooms' games while waiting for input:                    */
+#ifdef HAVE_FCNTL
+    if(!ignore_stdin)
+        fcntl(0, F_SETFL, fcntl(0, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
     /* Get server name: */
     /* We use default name after 30 sec timeout if no name entered. */
     /* FIXME we should save this to disc so it doesn't */
@@ -484,23 +632,17 @@ int setup_server(int thread_id_no)
         DEBUGMSG(debug_lan, "server_name has been set to: %s\n", server_name);
     }
 
-
-    // Zero out our client list:
-    {
-        int i = 0;
-        for(i = 0; i < MAX_CLIENTS; i++)
-        {
-            slave_thread[thread_id_no].client[i].game_ready = 0;   /* waiting for user to OK game start */
-            strncpy(slave_thread[thread_id_no].client[i].name, _("Await player name"), NAME_SIZE);   /* no nicknames yet                  */
-            slave_thread[thread_id_no].client[i].sock = NULL;      /* sockets start out unconnected     */
-            slave_thread[thread_id_no].client[i].score = 0;
-        }
-    }
-
+    /* The first room plays whatever lesson lan_game_settings was set  */
+    /* up with, on DEFAULT_PORT so that older clients still find it:   */
+    if (!open_room(Opts_LessonTitle(), lan_game_settings))
+        return 0;
+    for (i = 0; i < num_startup_lessons; i++)
+        if (!open_room(startup_lessons[i], NULL))
+            fprintf(stderr, "Could not open room for lesson %s\n", startup_lessons[i]);
 
     //Now open a UDP socket to listen for clients broadcasting to find the server:
-    slave_thread[thread_id_no].udpsock = SDLNet_UDP_Open(DEFAULT_PORT);
-    if(!slave_thread[thread_id_no].udpsock)
+    udpsock = SDLNet_UDP_Open(DEFAULT_PORT);
+    if(!udpsock)
     {
         fprintf(stderr, "SDLNet_UDP_Open: %s\n", SDLNet_GetError());
         return 0;
@@ -513,398 +655,1586 @@ int setup_server(int thread_id_no)
 
 
 //Free resources, closing sockets, and so forth:
-void cleanup_server(int thread_id_no)
+void cleanup_server(void)
 {
     int i;
-    /* Close the client socket(s) */
-
-    for(i = 0; i < MAX_CLIENTS; i++)
-    {
-        if(slave_thread[thread_id_no].client[i].sock != NULL)
-        {
-            SDLNet_TCP_Close(slave_thread[thread_id_no].client[i].sock);    //close all the client sockets one by one
-            slave_thread[thread_id_no].client[i].sock = NULL;               // So we don't segfault in case cleanup()
-        }                                      // somehow gets called more than once.
-    } 
 
-    if (slave_thread[thread_id_no].client_set != NULL)
-    {
-        SDLNet_FreeSocketSet(slave_thread[thread_id_no].client_set);    //releasing the memory of the client socket set
-        slave_thread[thread_id_no].client_set = NULL;                   //this helps us remember that this set is not allocated
-    } 
+    for (i = 0; i < MAX_ROOMS; i++)
+        if (rooms[i])
+            close_room(rooms[i]);
 
-    if(slave_thread[thread_id_no].server_sock != NULL)
+    if(udpsock != NULL)
     {
-        SDLNet_TCP_Close(slave_thread[thread_id_no].server_sock);
-        slave_thread[thread_id_no].server_sock = NULL;
+        unwatch_socket(udpsock);
+        SDLNet_UDP_Close(udpsock);
+        udpsock = NULL;
     }
 
-    if(slave_thread[thread_id_no].udpsock != NULL)
-    {
-        SDLNet_UDP_Close(slave_thread[thread_id_no].udpsock);
-        slave_thread[thread_id_no].udpsock = NULL;
-    }
+    cleanup_event_loop();
 }
 
 
-/* Handle any arguments passed from command line */
-void server_handle_command_args(int argc, char* argv[])
+/*  ----- Rooms:  ------------------- */
+
+/* Opens a room in the first free slot, listening on DEFAULT_PORT plus */
+/* the slot number. If game is NULL, the room gets its own MathCards   */
+/* instance with settings read from the lesson file called name.       */
+/* Returns the new room, or NULL on failure.                           */
+srv_room* open_room(const char* name, MC_MathGame* game)
 {
-    int i;
+    srv_room* room;
+    int slot;
 
-    for (i = 1; i < argc; i++)
+    if (!name)
+        return NULL;
+
+    for (slot = 0; slot < MAX_ROOMS && rooms[slot]; slot++) {}
+    if (slot == MAX_ROOMS)
     {
-        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
-        {
-            /* Display help message: */
-            fprintf(stderr, "\n");
-            cleanup_server(0);                                //FIXME Deepak its hard coded.
-            exit(0);
-        }
-        else if (strcmp(argv[i], "--debug-lan") == 0)
-        {
-            debug_status |= debug_lan;
-        }
-        else if (strcmp(argv[i], "--ignore-stdin") == 0)
-        {
-            ignore_stdin = 1;
-        }
+        fprintf(stderr, "open_room() - already have %d rooms open\n", MAX_ROOMS);
+        return NULL;
+    }
 
-        else if (strcmp(argv[i], "--copyright") == 0 ||
-                strcmp(argv[i], "-c") == 0)
-        {
-            printf(
-                    "\n\"Tux, of Math Command Server\" version " VERSION ", Copyright (C) 2009, 2010\n"
-                    "David Bruce, Akash Gangil, and the Tux4Kids Project.\n"
-                    "This program is free software; you can redistribute it and/or\n"
-                    "modify it under the terms of the GNU General Public License\n"
-                    "as published by the Free Software Foundation.  See COPYING.txt\n"
-                    "\n"
-                    "This program is distributed in the hope that it will be useful,\n"
-                    "but WITHOUT ANY WARRANTY; without even the implied warranty of\n"
-                    "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n"
-                    "\n");
+    room = (srv_room*)calloc(1, sizeof(srv_room));
+    if (!room)
+    {
+        fprintf(stderr, "open_room() - allocation failed\n");
+        return NULL;
+    }
+    strncpy(room->name, name, NAME_SIZE);
+    room->name[NAME_SIZE - 1] = '\0';
+    room->slot = slot;
+    room->empty_since = SDL_GetTicks();
 
-            cleanup_server(0);             //FIXME Deepak its hard coded.
-            exit(0);
-        }
-        else if (strcmp(argv[i], "--usage") == 0 ||
-                strcmp(argv[i], "-u") == 0)
-        {
-            /* Display (happy) usage: */
-            // TODO write usage() for server
-            //      usage(0, argv[0]);
-        }
-        else if ((strcmp(argv[i], "--name") == 0 || strcmp(argv[i], "-n") == 0)
-                && (i + 1 < argc))
+    if (game)
+    {
+        room->math_game = game;
+        snprintf(room->lesson_title, LESSON_TITLE_LENGTH, "%s", Opts_LessonTitle());
+    }
+    else
+    {
+        /* The lesson title lives with the global game options, so put */
+        /* back whatever was there once we have read the room's own:   */
+        char saved_title[LESSON_TITLE_LENGTH];
+        snprintf(saved_title, LESSON_TITLE_LENGTH, "%s", Opts_LessonTitle());
+
+        room->math_game = (MC_MathGame*)calloc(1, sizeof(MC_MathGame));
+        room->own_math_game = 1;
+        if (!room->math_game
+                || !MC_Initialize(room->math_game)
+                || !read_named_config_file(room->math_game, name))
         {
-            strncpy(server_name, argv[i + 1], NAME_SIZE);
-            need_server_name = 0;
+            fprintf(stderr, "open_room() - could not read lesson %s\n", name);
+            Opts_SetLessonTitle(saved_title);
+            close_room(room);
+            return NULL;
         }
+        snprintf(room->lesson_title, LESSON_TITLE_LENGTH, "%s", Opts_LessonTitle());
+        Opts_SetLessonTitle(saved_title);
     }
-}
-
-
-// ----------- Top level functions in main loop ---------------:
-
-//check_UDP() is the server side of the client-server autodetection system.
-//When a client wants to connect, it sends a UDP broadcast to the local
-//network on this port, and the server sends a response.
-//The client will then try to open a TCP socket at the server's ip address,
-//which will be picked up in update_clients() below.
-void check_UDP(int thread_id_no)
-{
-    int recvd = 0;
-    UDPpacket* in = NULL;
 
-    if(slave_thread[thread_id_no].udpsock == NULL)
+    /* Resolving the host using NULL make network interface to listen */
+    if (SDLNet_ResolveHost(&room->ip, NULL, DEFAULT_PORT + slot) < 0)
     {
-        fprintf(stderr, "warning - check_UDP() called but udpsock == NULL\n");
-        return;
+        fprintf(stderr, "SDLNet_ResolveHost: %s\n", SDLNet_GetError());
+        close_room(room);
+        return NULL;
     }
 
-    in = SDLNet_AllocPacket(NET_BUF_LEN);
-    recvd = SDLNet_UDP_Recv(slave_thread[thread_id_no].udpsock, in);
+    /* Open a connection with the IP provided (listen on the host's port) */
+    if (!(room->server_sock = SDLNet_TCP_Open(&room->ip)))
+    {
+        fprintf(stderr, "SDLNet_TCP_Open: %s\n", SDLNet_GetError());
+        close_room(room);
+        return NULL;
+    }
 
-    if(recvd > 0)
-    {   
-        DEBUGMSG(debug_lan, "check_UDP() received packet: %s\n", (char*)in->data);  
-        // See if packet contains identifying string:
-        if(strncmp((char*)in->data, "TUXMATH_CLIENT", strlen("TUXMATH_CLIENT")) == 0)
-        {
-            UDPpacket* out;
-            int sent = 0;
-            char buf[NET_BUF_LEN];
-            // Send "I am here" reply so client knows where to connect socket,
-            // with configurable identifying string so user can distinguish 
-            // between multiple servers on same network (e.g. "Mrs. Adams' Class");
-            out = SDLNet_AllocPacket(NET_BUF_LEN); 
-            snprintf(buf, NET_BUF_LEN, "%s\t%s\t%s",
-                    "TUXMATH_SERVER", server_name, Opts_LessonTitle());
-            snprintf(out->data, NET_BUF_LEN, "%s", buf);
-            out->len = strlen(buf) + 1;
-            out->address.host = in->address.host;
-            out->address.port = in->address.port;
-            sent = SDLNet_UDP_Send(slave_thread[thread_id_no].udpsock, -1, out);
-            SDLNet_FreePacket(out);
-        }
+    //The client list and its socket set start small and grow as needed:
+    if(!grow_clients(room))
+    { 
+        close_room(room);
+        return NULL;
     }
 
-    SDLNet_FreePacket(in);
+    rooms[slot] = room;
+    watch_socket(room->server_sock);
+    fprintf(stderr, "Opened room %d: %s (%s) on port %d\n",
+            slot, room->name, room->lesson_title, DEFAULT_PORT + slot);
+    return room;
 }
 
 
-
-
-//update_clients() sees if anyone is trying to connect, and connects if a slot
-//is open and the game is not in progress. The purpose is to make sure our
-//client set accurately reflects the current state.
-void update_clients(int thread_id_no)
+/* Hangs up on everyone in the room and frees it: */
+void close_room(srv_room* room)
 {
-    TCPsocket temp_sock = NULL;        /* Just used when client can't be accepted */
-    int slot = 0;
-    int sockets_used = 0;
-    char buffer[NET_BUF_LEN];
+    if (!room)
+        return;
 
-    /* See if we have a pending connection: */
-    temp_sock = SDLNet_TCP_Accept(slave_thread[thread_id_no].server_sock);
-    if (!temp_sock)  /* No one waiting to join - do nothing */
-    {
-        return;   // Leave num_clients unchanged
-    }
+    /* Close the client socket(s) */
+    while (room->num_active > 0)
+        close_client_socket(room, room->active[room->num_active - 1]);
 
-    // See if any slots are available:
-    slot = find_vacant_client(thread_id_no);
-    if (slot == -1) /* No vacancies: */
+    if (room->client_set != NULL)
     {
-        snprintf(buffer, NET_BUF_LEN, 
-                "%s\t%s",
-                "PLAYER_MSG",
-                "Sorry, already have maximum number of clients connected");
-        SDLNet_TCP_Send(temp_sock, buffer, NET_BUF_LEN);
-        //hang up:
-        SDLNet_TCP_Close(temp_sock);
-        temp_sock = NULL;
-
-        DEBUGMSG(debug_lan, "update_clients() - no vacant slot found\n");
+        SDLNet_FreeSocketSet(room->client_set);    //releasing the memory of the client socket set
+        room->client_set = NULL;                   //this helps us remember that this set is not allocated
+    } 
+    free(room->client);
+    free(room->active);
+    free(room->readable);
+    free(room->answers);
+    free(room->answer_client);
 
-        return;   // Leave num_clients unchanged
+    if(room->server_sock != NULL)
+    {
+        unwatch_socket(room->server_sock);
+        SDLNet_TCP_Close(room->server_sock);
+        room->server_sock = NULL;
     }
 
-    //If everyone is disconnected, game no longer in progress:
-    check_game_clients(thread_id_no); 
-
-    // If game already started, send our regrets:
-    if(game_in_progress)
+    if (room->own_math_game && room->math_game)
     {
-        snprintf(buffer, NET_BUF_LEN, 
-                "%s",
-                "GAME_IN_PROGRESS");
-        SDLNet_TCP_Send(temp_sock, buffer, NET_BUF_LEN);
-        //hang up:
-        SDLNet_TCP_Close(temp_sock);
-        temp_sock = NULL;
-
-        DEBUGMSG(debug_lan, "update_clients() - game already started\n");
-
-        return;   // Leave num_clients unchanged
+        MC_EndGame(room->math_game);
+        free(room->math_game);
     }
+    room->math_game = NULL;
 
-    // If we get to here, we have room for the new connection and the
-    // game is not in progress, so we connect:
-    DEBUGMSG(debug_lan, "creating connection for client[%d].sock:\n", slot);
+    if (rooms[room->slot] == room)
+        rooms[room->slot] = NULL;
+    free(room);
+}
 
-    slave_thread[thread_id_no].client[slot].sock = temp_sock;
 
-    /* Add client socket to set: */
-    sockets_used = SDLNet_TCP_AddSocket(slave_thread[thread_id_no].client_set, slave_thread[thread_id_no].client[slot].sock);
-    if(sockets_used == -1) //No way this should happen
-    {
-        fprintf(stderr, "SDLNet_AddSocket: %s\n", SDLNet_GetError());
-        cleanup_server(0);                            //FIXME Deepak its hard coded.
-        exit(EXIT_FAILURE);
-    }
+/* Milliseconds until close_idle_rooms() should close the room, or */
+/* -1 if it isn't to be closed:                                    */
+int idle_room_timeout(srv_room* room, Uint32 now)
+{
+    Uint32 elapsed;
 
-    /* At this point num_clients can be updated: */
-    slave_thread[thread_id_no].num_clients = sockets_used;
+    if (!room->on_demand || room->num_active > 0 || room->game_in_progress)
+        return -1;
+    elapsed = now - room->empty_since;
+    if (elapsed >= SRV_IDLE_ROOM_TIME)
+        return 0;
+    return SRV_IDLE_ROOM_TIME - elapsed;
+}
 
-    /* Now we can communicate with the client using slave_thread[thread_id_no].client[i].sock socket */
-    /* serv_sock will remain opened waiting other connections.            */
 
-    /* Send message informing client of successful connection:            */
-    msg_socket_index(thread_id_no, slot, buffer);
-    /* Now tell rest of clients that another has joined: */
-    send_player_updates(thread_id_no);
-    /* Get the remote address */
-    DEBUGCODE(debug_lan)
-    {
-        IPaddress* client_ip = NULL;
-        client_ip = SDLNet_TCP_GetPeerAddress(slave_thread[thread_id_no].client[slot].sock);
+/* Closes the rooms opened for clients that have stood empty for */
+/* SRV_IDLE_ROOM_TIME, so their slots and ports can be reused -  */
+/* otherwise a long-running server would run out of rooms:       */
+void close_idle_rooms(void)
+{
+    Uint32 now = SDL_GetTicks();
+    int i;
 
-        fprintf(stderr, "num_clients = %d\n", slave_thread[thread_id_no].num_clients);
-        if (client_ip != NULL)
-            /* Print the address, converting in the host format */
+    for (i = 0; i < MAX_ROOMS; i++)
+    {
+        if (rooms[i] && idle_room_timeout(rooms[i], now) == 0)
         {
-            fprintf(stderr, "Client connected\n>\n");
-            fprintf(stderr, "Client: IP = %x, Port = %d\n",
-                    SDLNet_Read32(&client_ip->host),
-                    SDLNet_Read16(&client_ip->port));
+            fprintf(stderr, "Closing room %d: %s - nobody has used it for %d seconds\n",
+                    i, rooms[i]->name, SRV_IDLE_ROOM_TIME / 1000);
+            close_room(rooms[i]);
         }
-        else
-            fprintf(stderr, "SDLNet_TCP_GetPeerAddress: %s\n", SDLNet_GetError());
     }
+}
 
-    return;
+
+/* Finds an open room by name or lesson title, or NULL if none: */
+srv_room* find_room(const char* name)
+{
+    int i;
+
+    if (!name)
+        return NULL;
+    for (i = 0; i < MAX_ROOMS; i++)
+        if (rooms[i] && (strcasecmp(rooms[i]->name, name) == 0
+                    || strcasecmp(rooms[i]->lesson_title, name) == 0))
+            return rooms[i];
+    return NULL;
 }
 
 
+/* Rooms can be opened at a client's request, so make sure the name */
+/* is a plain lesson file name and not a path to something else:    */
+int valid_room_name(const char* name)
+{
+    if (!name || name[0] == '\0' || name[0] == '.')
+        return 0;
+    if (strlen(name) >= NAME_SIZE)
+        return 0;
+    if (strchr(name, '/') || strchr(name, '\\') || strchr(name, ':'))
+        return 0;
+    return 1;
+}
 
-// check_messages() is where we look at the client socket set to see which 
-// have sent us messages. This function is used in each server loop whether
-// or not a math game is in progress (although we expect different messages
-// during a game from those encountered outside of a game)
 
-int server_check_messages(int thread_id_no)
+/* For the server console: */
+void list_rooms(void)
 {
-    int actives = 0, i = 0;
-    int ready_found = 0;
-    char buffer[NET_BUF_LEN];
+    int i;
 
-    /* Check the client socket set for activity: */
-    actives = SDLNet_CheckSockets(slave_thread[thread_id_no].client_set, 0);
-    //  fprintf(stderr, "in check_messages(), actives = %d\n", actives);
-    if(actives == -1)
+    for (i = 0; i < MAX_ROOMS; i++)
     {
-        fprintf(stderr, "In server_check_messages(), SDLNet_CheckSockets: %s\n", SDLNet_GetError());
-        //most of the time this is a system error, where perror might help you.
-        perror("In server_check_messages(), SDLNet_CheckSockets");
+        if (!rooms[i])
+            continue;
+        fprintf(stderr, "Room %d: %s (%s), port %d, %d players, %s\n",
+                i, rooms[i]->name, rooms[i]->lesson_title, DEFAULT_PORT + i,
+                rooms[i]->num_active,
+                rooms[i]->game_in_progress ? "game in progress" : "waiting");
     }
+}
 
-    else if(actives) 
-    {
-        DEBUGMSG(debug_lan, "There are %d sockets with activity\n", actives);
 
-        // check all sockets with SDLNet_SocketReady and handle the active ones.
-        // NOTE we have to check all the slots in the set because
-        // the set will become discontinuous if someone disconnects
-        // NOTE this will only pick up the first message for each socket each time
-        // check_messages() called - probably OK if we just get it next time through.
-        for(i = 0; i < MAX_CLIENTS; i++)
-        {
-            if((slave_thread[thread_id_no].client[i].sock != NULL)
-                    && (SDLNet_SocketReady(slave_thread[thread_id_no].client[i].sock))) 
-            { 
-                ready_found++;
+/*  ----- Event loop:  ------------------- */
 
-                DEBUGMSG(debug_lan, "client socket %d is ready\n", i);
+#ifdef SRV_USE_EPOLL
+/* SDL_net doesn't hand out its descriptors, but both its TCP and UDP */
+/* sockets start with these two fields - struct _TCPsocket in         */
+/* SDLnetTCP.c and struct _UDPsocket in SDLnetUDP.c, as they are in   */
+/* every SDL_net 1.2 release (and SDL2_net 2.0 too). As that is       */
+/* SDL_net's private business, setup_event_loop() makes sure it still */
+/* holds with socket_fd_ok() before trusting it:                      */
+typedef struct sdlnet_socket_head {
+    int ready;
+    int channel;
+} sdlnet_socket_head;
 
-                if (SDLNet_TCP_Recv(slave_thread[thread_id_no].client[i].sock, buffer, NET_BUF_LEN) > 0)
-                {
-                    DEBUGMSG(debug_lan, "buffer received from client %d is: %s\n", i, buffer);
+static int socket_fd(void* sock)
+{
+    return ((sdlnet_socket_head*)sock)->channel;
+}
 
-                    /* Here we pass the client number and the message buffer */
-                    /* to a suitable function for further action:                */
-                    if(game_in_progress)
-                    {
-                        handle_client_game_msg(thread_id_no, i, buffer);
-                    }
-                    else
-                    {
-                        handle_client_nongame_msg(thread_id_no, i, buffer);
-                    }
-                    // See if game is ended because everyone has left:
-                    check_game_clients(thread_id_no); 
-                }
-                else  // Socket activity but cannot receive - client invalid
-                {
-                    fprintf(stderr, "Client %d active but receive failed - apparently disconnected\n>\n", i);
-                    remove_client(thread_id_no,i);
-                }
-            }
-        }  // end of for() loop - all client sockets checked
-        check_game_clients(thread_id_no); //APPARENTLY checking one more time "just in case"???
-        // Make sure all the active sockets reported by SDLNet_CheckSockets()
-        // are accounted for:
+/* Returns 1 if socket_fd() gives a socket of the given type bound to */
+/* the given port, i.e. the one SDL_net really opened, 0 otherwise:   */
+static int socket_fd_ok(void* sock, int type, int port)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int fd = socket_fd(sock);
+    int t;
+    socklen_t tlen = sizeof(t);
 
-        if(actives > ready_found)
+    if(fd < 0)
+        return 0;
+    if(getsockopt(fd, SOL_SOCKET, SO_TYPE, &t, &tlen) < 0 || t != type)
+        return 0;
+    if(getsockname(fd, (struct sockaddr*)&addr, &len) < 0)
+        return 0;
+    return addr.sin_family == AF_INET && ntohs(addr.sin_port) == port;
+}
+#endif
+
+
+/* Sets up epoll, if we have it, with everything already open. */
+/* Returns 1 if so, 0 if wait_for_events() will just poll.     */
+int setup_event_loop(void)
+{
+#ifdef SRV_USE_EPOLL
+    struct epoll_event ev;
+    int i, ok;
+
+    //if SDL_net's sockets aren't laid out as we expect, we would watch
+    //the wrong descriptors and never hear from anyone - so say so, and
+    //carry on polling through SDL_net:
+    ok = socket_fd_ok(udpsock, SOCK_DGRAM, DEFAULT_PORT);
+    for(i = 0; ok && i < MAX_ROOMS; i++)
+        if(rooms[i])
+            ok = socket_fd_ok(rooms[i]->server_sock, SOCK_STREAM, DEFAULT_PORT + i);
+    if(!ok)
+    {
+        fprintf(stderr, "\n*** This SDL_net's sockets don't look as server.c expects"
+                " (see socket_fd()) - not using epoll ***\n");
+        return 0;
+    }
+
+    epoll_fd = epoll_create(MAX_ROOMS * (MAX_CLIENTS + 1) + 3);
+    if(epoll_fd < 0)
+    {
+        perror("In setup_event_loop(), epoll_create");
+        return 0;
+    }
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if(timer_fd < 0)
+    {
+        perror("In setup_event_loop(), timerfd_create");
+        cleanup_event_loop();
+        return 0;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = timer_fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+    //epoll refuses regular files, so stdin may still need polling:
+    if(!ignore_stdin)
+    {
+        ev.data.fd = 0;
+        stdin_watched = (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, 0, &ev) == 0);
+    }
+
+    watch_socket(udpsock);
+    for(i = 0; i < MAX_ROOMS; i++)
+        if(rooms[i])
+            watch_socket(rooms[i]->server_sock);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+
+void cleanup_event_loop(void)
+{
+#ifdef SRV_USE_EPOLL
+    if(timer_fd >= 0)
+        close(timer_fd);
+    if(epoll_fd >= 0)
+        close(epoll_fd);
+    timer_fd = epoll_fd = -1;
+    stdin_watched = 0;
+    free(socket_owners);
+    socket_owners = NULL;
+    num_socket_owners = 0;
+#endif
+}
+
+
+/* Any socket with something to read (or a connection to accept) */
+/* wakes up the main loop:                                        */
+void watch_socket(void* sock)
+{
+#ifdef SRV_USE_EPOLL
+    struct epoll_event ev;
+
+    if(epoll_fd < 0 || !sock)
+        return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = socket_fd(sock);
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ev.data.fd, &ev) < 0)
+        perror("In watch_socket(), epoll_ctl");
+#endif
+}
+
+
+void unwatch_socket(void* sock)
+{
+#ifdef SRV_USE_EPOLL
+    struct epoll_event ev;
+
+    if(epoll_fd < 0 || !sock)
+        return;
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, socket_fd(sock), &ev);
+#endif
+}
+
+
+/* Watches client i's socket, noting whose it is so that wait_for_events() */
+/* can tell the room straight away when it has something to read:         */
+void watch_client(srv_room* room, int i)
+{
+#ifdef SRV_USE_EPOLL
+    srv_socket_owner* owners;
+    int fd, n;
+
+    if(epoll_fd < 0 || !room->client[i].sock)
+        return;
+    fd = socket_fd(room->client[i].sock);
+    if(fd >= num_socket_owners)
+    {
+        n = 2 * num_socket_owners;
+        if(n <= fd)
+            n = fd + 64;
+        owners = (srv_socket_owner*)realloc(socket_owners, n * sizeof(srv_socket_owner));
+        if(!owners)
         {
-            fprintf(stderr, "Warning: SDLNet_CheckSockets() reported %d active sockets,\n"
-                    "but only %d detected by SDLNet_SocketReady()\n", actives, ready_found);
-            //Presently, this just runs ping_client() on all the sockets:
-            //test_connections();
+            fprintf(stderr, "watch_client() - allocation failed\n");
+            return;
+        }
+        for(; num_socket_owners < n; num_socket_owners++)
+            owners[num_socket_owners].room = -1;
+        socket_owners = owners;
+    }
+    socket_owners[fd].room = room->slot;
+    socket_owners[fd].client = i;
+    watch_socket(room->client[i].sock);
+#endif
+}
+
+
+void unwatch_client(srv_room* room, int i)
+{
+#ifdef SRV_USE_EPOLL
+    int fd;
+
+    if(epoll_fd < 0 || !room->client[i].sock)
+        return;
+    fd = socket_fd(room->client[i].sock);
+    if(fd < num_socket_owners)
+        socket_owners[fd].room = -1;
+    unwatch_socket(room->client[i].sock);
+#endif
+}
+
+
+/* Also wake up when sock can take more output, or stop doing so: */
+void watch_socket_output(void* sock, int on)
+{
+#ifdef SRV_USE_EPOLL
+    struct epoll_event ev;
+
+    if(epoll_fd < 0 || !sock)
+        return;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = on ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+    ev.data.fd = socket_fd(sock);
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_MOD, ev.data.fd, &ev) < 0)
+        perror("In watch_socket_output(), epoll_ctl");
+#endif
+}
+
+
+/* Sends as much as sock will take without waiting of the n pieces  */
+/* of data, lengths in len[], in one system call. Returns the number */
+/* of bytes sent, or -1 if the connection is broken. SDL_net only    */
+/* has blocking sends, so without epoll (i.e. off Linux) this waits  */
+/* until everything has gone, one piece at a time:                   */
+int send_nonblock(TCPsocket sock, const char* data[], int len[], int n)
+{
+    int i, sent = 0;
+#ifdef SRV_USE_EPOLL
+    //sendmsg() rather than writev(), which can't be told not to block:
+    struct iovec iov[2];
+    struct msghdr mh;
+
+    if(epoll_fd >= 0)
+    {
+        if(n > 2)
+            n = 2;
+        memset(&mh, 0, sizeof(mh));
+        for(i = 0; i < n; i++)
+        {
+            iov[i].iov_base = (void*)data[i];
+            iov[i].iov_len = len[i];
+        }
+        mh.msg_iov = iov;
+        mh.msg_iovlen = n;
+        sent = sendmsg(socket_fd(sock), &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if(sent < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        return sent;
+    }
+#endif
+    for(i = 0; i < n; i++)
+    {
+        if(SDLNet_TCP_Send(sock, data[i], len[i]) != len[i])
+            return -1;
+        sent += len[i];
+    }
+    return sent;
+}
+
+
+/* Sleeps until a watched socket or the console has input, or until */
+/* a client's socket can take the rest of its queued output, or     */
+/* the next question is due in some room.  Everything is then done  */
+/* by the same functions as without epoll, which simply find their  */
+/* work waiting for them - clients with input are put straight on   */
+/* their room's readable[] list:                                    */
+void wait_for_events(Uint32* timer)
+{
+#ifdef SRV_USE_EPOLL
+    struct epoll_event events[SRV_MAX_EVENTS];
+    struct itimerspec its;
+    srv_socket_owner* owner;
+    Uint32 now;
+    uint64_t expirations;
+    int timeout = -1;
+    int t, i, n, fd;
+
+    if(epoll_fd < 0)
+    {
+        T4K_Throttle(SRV_POLL_INTERVAL, timer);
+        return;
+    }
+
+    now = SDL_GetTicks();
+    for(i = 0; i < MAX_ROOMS; i++)
+    {
+        if(!rooms[i])
+            continue;
+        t = room_next_timeout(rooms[i], now);
+        if(t >= 0 && (timeout < 0 || t < timeout))
+            timeout = t;
+        t = ping_timeout(rooms[i], now);
+        if(t >= 0 && (timeout < 0 || t < timeout))
+            timeout = t;
+        t = idle_room_timeout(rooms[i], now);
+        if(t >= 0 && (timeout < 0 || t < timeout))
+            timeout = t;
+    }
+    t = stats_file_timeout(now);
+    if(t >= 0 && (timeout < 0 || t < timeout))
+        timeout = t;
+    if(!ignore_stdin && !stdin_watched
+            && (timeout < 0 || timeout > SRV_STDIN_POLL))
+        timeout = SRV_STDIN_POLL;
+
+    //Nothing to sleep for if something is already due, but we still
+    //want to know who has sent us something:
+    if(timeout == 0)
+        n = epoll_wait(epoll_fd, events, SRV_MAX_EVENTS, 0);
+    else
+    {
+        memset(&its, 0, sizeof(its));
+        if(timeout > 0)
+        {
+            its.it_value.tv_sec = timeout / 1000;
+            its.it_value.tv_nsec = (long)(timeout % 1000) * 1000000;
+        }
+        timerfd_settime(timer_fd, 0, &its, NULL);  //zero disarms it
+
+        n = epoll_wait(epoll_fd, events, SRV_MAX_EVENTS, -1);
+    }
+    if(n < 0 && errno != EINTR)
+        perror("In wait_for_events(), epoll_wait");
+
+    //NOTE any more than SRV_MAX_EVENTS are still there next time:
+    for(i = 0; i < n; i++)
+    {
+        fd = events[i].data.fd;
+        owner = (fd >= 0 && fd < num_socket_owners) ? &socket_owners[fd] : NULL;
+        if(owner && owner->room >= 0 && rooms[owner->room])
+        {
+            if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                client_readable(rooms[owner->room], owner->client);
+        }
+        else if(events[i].data.fd == timer_fd)
+        {
+            if(read(timer_fd, &expirations, sizeof(expirations)) < 0)
+                DEBUGMSG(debug_lan, "wait_for_events() - timer read failed\n");
+        }
+        //Once whatever feeds stdin goes away it stays readable forever,
+        //so go back to polling it (its last command may still be unread):
+        else if(events[i].data.fd == 0 && (events[i].events & (EPOLLHUP | EPOLLERR)))
+        {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, 0, &events[i]);
+            stdin_watched = 0;
+        }
+    }
+#else
+    /* Limit frame rate to keep from eating all CPU: */
+    /* NOTE almost certainly could make this longer wtihout noticably */
+    /* affecting performance, but even throttling to 1 msec/loop cuts */
+    /* CPU from 100% to ~2% on my desktop - DSB                       */
+    T4K_Throttle(SRV_POLL_INTERVAL, timer);
+#endif
+}
+
+
+/* Wait time is shorter in higher waves because the comets move faster: */
+Uint32 quest_wait_time(srv_room* room)
+{
+    return SRV_QUEST_INTERVAL/pow(DEFAULT_SPEEDUP_FACTOR, room->srv_game.wave);
+}
+
+
+/* Milliseconds until server_update_game() will next send a question */
+/* in the room, or -1 if it is waiting on the players instead:       */
+int room_next_timeout(srv_room* room, Uint32 now)
+{
+    Uint32 elapsed, wait_time;
+
+    if(!room->game_in_progress
+            || room->srv_game.active_quests >= room->srv_game.max_quests_on_screen
+            || room->srv_game.rem_in_wave <= 0)
+        return -1;
+
+    elapsed = now - room->last_quest_time;
+    wait_time = quest_wait_time(room);
+    if(elapsed > wait_time)
+        return 0;
+    return wait_time - elapsed + 1;
+}
+
+
+/* Milliseconds until ping_clients() is due in the room, or -1 if */
+/* nobody there understands PING:                                 */
+int ping_timeout(srv_room* room, Uint32 now)
+{
+    Uint32 elapsed;
+    int k;
+
+    for(k = 0; k < room->num_active; k++)
+        if(room->client[room->active[k]].stream.protocol >= NET_PROTOCOL_PING)
+            break;
+    if(k == room->num_active)
+        return -1;
+
+    elapsed = now - room->last_ping_time;
+    if(elapsed >= SRV_PING_INTERVAL)
+        return 0;
+    return SRV_PING_INTERVAL - elapsed;
+}
+
+
+/* Handle any arguments passed from command line */
+void server_handle_command_args(int argc, char* argv[])
+{
+    int i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+        {
+            /* Display help message: */
+            fprintf(stderr, "\n");
+            cleanup_server();
+            exit(0);
+        }
+        else if (strcmp(argv[i], "--debug-lan") == 0)
+        {
+            debug_status |= debug_lan;
+        }
+        else if (strcmp(argv[i], "--ignore-stdin") == 0)
+        {
+            ignore_stdin = 1;
+        }
+
+        else if (strcmp(argv[i], "--copyright") == 0 ||
+                strcmp(argv[i], "-c") == 0)
+        {
+            printf(
+                    "\n\"Tux, of Math Command Server\" version " VERSION ", Copyright (C) 2009, 2010\n"
+                    "David Bruce, Akash Gangil, and the Tux4Kids Project.\n"
+                    "This program is free software; you can redistribute it and/or\n"
+                    "modify it under the terms of the GNU General Public License\n"
+                    "as published by the Free Software Foundation.  See COPYING.txt\n"
+                    "\n"
+                    "This program is distributed in the hope that it will be useful,\n"
+                    "but WITHOUT ANY WARRANTY; without even the implied warranty of\n"
+                    "MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.\n"
+                    "\n");
+
+            cleanup_server();
+            exit(0);
+        }
+        else if (strcmp(argv[i], "--usage") == 0 ||
+                strcmp(argv[i], "-u") == 0)
+        {
+            /* Display (happy) usage: */
+            // TODO write usage() for server
+            //      usage(0, argv[0]);
+        }
+        else if ((strcmp(argv[i], "--name") == 0 || strcmp(argv[i], "-n") == 0)
+                && (i + 1 < argc))
+        {
+            strncpy(server_name, argv[i + 1], NAME_SIZE);
+            need_server_name = 0;
+        }
+        else if (strcmp(argv[i], "--send-queue") == 0 && (i + 1 < argc))
+        {
+            //Kilobytes a client can fall behind before it loses updates:
+            send_high_water = atoi(argv[i + 1]) * 1024;
+            if (send_high_water < 2 * NET_BUF_LEN)
+                send_high_water = 2 * NET_BUF_LEN;
+            i++;
+        }
+        else if (strcmp(argv[i], "--stats-file") == 0 && (i + 1 < argc))
+        {
+            //Rewritten every SRV_STATS_INTERVAL msec:
+            snprintf(stats_file, PATH_MAX, "%s", argv[i + 1]);
+            i++;
+        }
+        else if ((strcmp(argv[i], "--lesson") == 0 || strcmp(argv[i], "-l") == 0)
+                && (i + 1 < argc))
+        {
+            //Each lesson named gets a room of its own:
+            if (num_startup_lessons < MAX_ARGS)
+                startup_lessons[num_startup_lessons++] = argv[i + 1];
+            i++;
+        }
+    }
+}
+
+
+// ----------- Top level functions in main loop ---------------:
+
+//check_UDP() is the server side of the client-server autodetection system.
+//When a client wants to connect, it sends a UDP broadcast to the local
+//network on this port, and the server sends a response for each room.
+//A client can name the room it wants after a tab ("TUXMATH_CLIENT\tlesson05"),
+//in which case only that room answers - and if there isn't one yet, it is
+//opened from the lesson file of that name.
+//The client will then try to open a TCP socket at the room's ip address and
+//port, which will be picked up in update_clients() below.
+void check_UDP(void)
+{
+    int recvd = 0;
+    int i;
+    UDPpacket* in = NULL;
+    char* wanted = NULL;
+    srv_room* room = NULL;
+
+    if(udpsock == NULL)
+    {
+        fprintf(stderr, "warning - check_UDP() called but udpsock == NULL\n");
+        return;
+    }
+
+    in = SDLNet_AllocPacket(NET_BUF_LEN);
+    recvd = SDLNet_UDP_Recv(udpsock, in);
+
+    if(recvd > 0)
+    {   
+        //Make sure we have a terminated string whatever was sent:
+        in->data[in->len < NET_BUF_LEN ? in->len : NET_BUF_LEN - 1] = '\0';
+        DEBUGMSG(debug_lan, "check_UDP() received packet: %s\n", (char*)in->data);  
+        // See if packet contains identifying string:
+        if(strncmp((char*)in->data, "TUXMATH_CLIENT", strlen("TUXMATH_CLIENT")) == 0)
+        {
+            wanted = strchr((char*)in->data, '\t');
+            if(wanted)
+            {
+                wanted++;
+                room = find_room(wanted);
+                if(!room && valid_room_name(wanted))
+                {
+                    room = open_room(wanted, NULL);
+                    if(room)
+                        room->on_demand = 1;
+                }
+                if(room)
+                {
+                    //Someone still wants it, so don't close it just yet:
+                    if(room->num_active == 0)
+                        room->empty_since = SDL_GetTicks();
+                    send_room_info(room, &in->address);
+                }
+            }
+            else
+            {
+                //rooms[0] goes first, as older clients only keep the first
+                //reply from each server:
+                for(i = 0; i < MAX_ROOMS; i++)
+                    if(rooms[i])
+                        send_room_info(rooms[i], &in->address);
+            }
+        }
+    }
+
+    SDLNet_FreePacket(in);
+}
+
+
+// Send "I am here" reply so client knows where to connect socket,
+// with configurable identifying string so user can distinguish 
+// between multiple servers on same network (e.g. "Mrs. Adams' Class").
+// The room's port and name go in the middle, where clients that
+// predate rooms ignore them:
+int send_room_info(srv_room* room, IPaddress* address)
+{
+    UDPpacket* out;
+    int sent = 0;
+    char buf[NET_BUF_LEN];
+
+    out = SDLNet_AllocPacket(NET_BUF_LEN); 
+    if(!out)
+        return 0;
+    snprintf(buf, NET_BUF_LEN, "%s\t%s\t%d\t%s\t%s",
+            "TUXMATH_SERVER", server_name, DEFAULT_PORT + room->slot,
+            room->name, room->lesson_title);
+    snprintf((char*)out->data, NET_BUF_LEN, "%s", buf);
+    out->len = strlen(buf) + 1;
+    out->address.host = address->host;
+    out->address.port = address->port;
+    sent = SDLNet_UDP_Send(udpsock, -1, out);
+    SDLNet_FreePacket(out);
+    return sent;
+}
+
+
+
+
+//update_clients() sees if anyone is trying to connect, and connects if a slot
+//is open and the game is not in progress. The purpose is to make sure our
+//client set accurately reflects the current state.
+void update_clients(srv_room* room)
+{
+    TCPsocket temp_sock = NULL;        /* Just used when client can't be accepted */
+    int slot = 0;
+    int sockets_used = 0;
+    char buffer[NET_BUF_LEN];
+
+    /* See if we have a pending connection: */
+    temp_sock = SDLNet_TCP_Accept(room->server_sock);
+    if (!temp_sock)  /* No one waiting to join - do nothing */
+    {
+        return;   // Leave num_clients unchanged
+    }
+
+    // See if any slots are available:
+    slot = find_vacant_client(room);
+    if (slot == -1) /* No vacancies: */
+    {
+        snprintf(buffer, NET_BUF_LEN, 
+                "%s\t%s",
+                "PLAYER_MSG",
+                "Sorry, already have maximum number of clients connected");
+        SDLNet_TCP_Send(temp_sock, buffer, NET_BUF_LEN);
+        Stats_Add(STAT_REFUSED, 1);
+        //hang up:
+        SDLNet_TCP_Close(temp_sock);
+        temp_sock = NULL;
+
+        DEBUGMSG(debug_lan, "update_clients() - no vacant slot found\n");
+
+        return;   // Leave num_clients unchanged
+    }
+
+    //If everyone is disconnected, game no longer in progress:
+    check_game_clients(room); 
+
+    // If game already started, send our regrets:
+    if(room->game_in_progress)
+    {
+        snprintf(buffer, NET_BUF_LEN, 
+                "%s",
+                "GAME_IN_PROGRESS");
+        SDLNet_TCP_Send(temp_sock, buffer, NET_BUF_LEN);
+        Stats_Add(STAT_REFUSED, 1);
+        //hang up:
+        SDLNet_TCP_Close(temp_sock);
+        temp_sock = NULL;
+
+        DEBUGMSG(debug_lan, "update_clients() - game already started\n");
+
+        return;   // Leave num_clients unchanged
+    }
+
+    // If we get to here, we have room for the new connection and the
+    // game is not in progress, so we connect:
+    DEBUGMSG(debug_lan, "creating connection for client[%d].sock:\n", slot);
+
+    if(!Net_InitQueue(&room->client[slot].queue, 2 * send_high_water))
+    {
+        SDLNet_TCP_Close(temp_sock);
+        return;
+    }
+    room->client[slot].want_write = 0;
+    room->client[slot].connect_time = SDL_GetTicks();
+    room->client[slot].answers = 0;
+    room->client[slot].correct = 0;
+    room->client[slot].rtt = -1;
+    room->client[slot].readable = 0;
+    room->client[slot].need_list = 1;
+    room->client[slot].joined = 0;
+    room->client[slot].sock = temp_sock;
+    Stats_Add(STAT_CONNECTS, 1);
+    Net_ResetStream(&room->client[slot].stream);
+    watch_client(room, slot);
+
+    /* Add client socket to set (grow_clients() made it big enough): */
+    sockets_used = SDLNet_TCP_AddSocket(room->client_set, room->client[slot].sock);
+    if(sockets_used == -1) //No way this should happen
+    {
+        fprintf(stderr, "SDLNet_AddSocket: %s\n", SDLNet_GetError());
+        cleanup_server();
+        exit(EXIT_FAILURE);
+    }
+    room->client[slot].active_pos = room->num_active;
+    room->active[room->num_active++] = slot;
+
+    /* At this point num_clients can be updated: */
+    room->num_clients = room->num_active;
+
+    /* Now we can communicate with the client using room->client[i].sock socket */
+    /* serv_sock will remain opened waiting other connections.            */
+
+    /* Any client can take an index in the low slots, so it gets its */
+    /* straight away. Beyond them we wait to hear which protocol it  */
+    /* speaks (see join_client()). It hears about the other players  */
+    /* then too, once the list can go out compact:                   */
+    if(slot < NET_LEGACY_CLIENTS)
+        join_client(room, slot);
+    /* Get the remote address */
+    DEBUGCODE(debug_lan)
+    {
+        IPaddress* client_ip = NULL;
+        client_ip = SDLNet_TCP_GetPeerAddress(room->client[slot].sock);
+
+        fprintf(stderr, "num_clients = %d\n", room->num_clients);
+        if (client_ip != NULL)
+            /* Print the address, converting in the host format */
+        {
+            fprintf(stderr, "Client connected\n>\n");
+            fprintf(stderr, "Client: IP = %x, Port = %d\n",
+                    SDLNet_Read32(&client_ip->host),
+                    SDLNet_Read16(&client_ip->port));
+        }
+        else
+            fprintf(stderr, "SDLNet_TCP_GetPeerAddress: %s\n", SDLNet_GetError());
+    }
+
+    return;
+}
+
+
+
+// check_messages() is where we look at the clients with input waiting to see
+// which have sent us messages. This function is used in each server loop whether
+// or not a math game is in progress (although we expect different messages
+// during a game from those encountered outside of a game)
+
+int server_check_messages(srv_room* room)
+{
+    int i = 0, k;
+    int status = 0;
+    int bytes;
+    net_msg msg;
+
+    /* With epoll, wait_for_events() has already listed who has sent */
+    /* us something - otherwise we ask SDL_net:                      */
+#ifdef SRV_USE_EPOLL
+    if(epoll_fd < 0)
+#endif
+        poll_client_sockets(room);
+
+    if(room->num_readable > 0) 
+    {
+        DEBUGMSG(debug_lan, "There are %d sockets with activity\n", room->num_readable);
+
+        // NOTE each read may bring in several messages, or only part of one,
+        // so we handle every complete message in the client's stream:
+        for(k = 0; k < room->num_readable; k++)
+        {
+            i = room->readable[k];
+            //Anyone hung up on since then is no longer marked:
+            if(!room->client[i].readable)
+                continue;
+            room->client[i].readable = 0;
+
+            DEBUGMSG(debug_lan, "client socket %d is ready\n", i);
+
+            bytes = Net_ReadStream(room->client[i].sock, &room->client[i].stream);
+            if (bytes > 0)
+            {
+                Stats_Add(STAT_BYTES_IN, bytes);
+                //NOTE the handlers may hang up on the client, which
+                //also empties its stream:
+                while((status = Net_NextMsg(&room->client[i].stream, &msg)) > 0)
+                {
+                    DEBUGMSG(debug_lan, "message received from client %d is: %s\n",
+                            i, Net_MsgName(msg.op));
+                    Stats_MsgIn(msg.op);
+
+                    //A newcomer waiting for its index gets it once it has
+                    //said which protocol it speaks - anything else first
+                    //means it is too old to say:
+                    if(!room->client[i].joined && msg.op != NET_OP_PROTOCOL
+                            && !join_client(room, i))
+                        break;
+
+                    /* Here we pass the client number and the message buffer */
+                    /* to a suitable function for further action:                */
+                    if(room->game_in_progress)
+                    {
+                        handle_client_game_msg(room, i, &msg);
+                    }
+                    else
+                    {
+                        handle_client_nongame_msg(room, i, &msg);
+                    }
+                    if(room->client[i].sock && !room->client[i].joined
+                            && msg.op == NET_OP_PROTOCOL && !join_client(room, i))
+                        break;
+                    // See if game is ended because everyone has left:
+                    check_game_clients(room); 
+                }
+                if(status == -1)
+                {
+                    fprintf(stderr, "Client %d sent garbled message - disconnecting\n>\n", i);
+                    Stats_Add(STAT_LOST, 1);
+                    remove_client(room, i);
+                }
+                //A newcomer's first message is normally PROTOCOL, so the
+                //player list goes out compact rather than a padded legacy
+                //message per player, which would swamp its queue:
+                else if(room->client[i].sock && room->client[i].joined
+                        && room->client[i].need_list)
+                {
+                    room->client[i].need_list = 0;
+                    send_player_list(room, i);
+                }
+            }
+            else  // Socket activity but cannot receive - client invalid
+            {
+                fprintf(stderr, "Client %d active but receive failed - apparently disconnected\n>\n", i);
+                Stats_Add(STAT_LOST, 1);
+                remove_client(room,i);
+            }
+        }  // end of for() loop - all readable clients handled
+        room->num_readable = 0;
+        //Let mathcards know about all the answers that came in at once:
+        apply_answers(room);
+        check_game_clients(room); //APPARENTLY checking one more time "just in case"???
+    } 
+    return 1;
+}
+
+
+void server_check_stdin(void)
+{
+    char buffer[NET_BUF_LEN];
+    char* arg;
+    srv_room* room;
+    int i;
+
+    /* Get out if we are ignoring stdin, e.g. thread in tuxmath gui program: */
+    if(ignore_stdin)
+        return;
+    /* Otherwise handle any new messages from command line: */
+    if(read_stdin_nonblock(buffer, NET_BUF_LEN))
+    { 
+        //Anything after the command word is its argument:
+        arg = strchr(buffer, ' ');
+        if(arg)
+            while(*arg == ' ')
+                arg++;
+
+        if( (strncmp(buffer, "exit", 4) == 0) // shut down server thread or prog
+                ||(strncmp(buffer, "quit", 4) == 0))
+
+        {
+            //FIXME notify clients that we are shutting down
+            quit = 1;
+        }
+        else if (strncmp(buffer, "endgame", 7) == 0) // stop game(s) leaving server running
+        {
+            if(arg && *arg)
+            {
+                room = find_room(arg);
+                if(room)
+                    end_game(room);
+                else
+                    fprintf(stderr, "No room called %s.\n", arg);
+            }
+            else
+            {
+                for(i = 0; i < MAX_ROOMS; i++)
+                    if(rooms[i])
+                        end_game(rooms[i]);
+            }
+        }
+        else if (strncmp(buffer, "rooms", 5) == 0)
+        {
+            list_rooms();
+        }
+        else if (strncmp(buffer, "queues", 6) == 0) // how far behind clients are
+        {
+            list_queues();
+        }
+        else if (strncmp(buffer, "stats", 5) == 0)
+        {
+            print_stats();
+        }
+        else if (strncmp(buffer, "open", 4) == 0) // new room for named lesson
+        {
+            if(!arg || !*arg)
+                fprintf(stderr, "Usage: open <lesson>\n");
+            else if(find_room(arg))
+                fprintf(stderr, "Room %s is already open.\n", arg);
+            else
+                open_room(arg, NULL);
+        }
+        else if (strncmp(buffer, "close", 5) == 0) // end game and close room
+        {
+            room = (arg && *arg) ? find_room(arg) : NULL;
+            if(!room)
+                fprintf(stderr, "Usage: close <room>\n");
+            else if(room == rooms[0])
+                fprintf(stderr, "The first room stays open until the server quits.\n");
+            else
+            {
+                if(room->game_in_progress)
+                    end_game(room);
+                close_room(room);
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Command not recognized.\n");
+        }
+    }
+}
+
+
+// client management utilities:
+
+/* Doubles the room's client table, up to MAX_CLIENTS, along with    */
+/* everything sized to match. Slots keep their numbers. Returns 0 if */
+/* the table is as big as it gets or we are out of memory:           */
+int grow_clients(srv_room* room)
+{
+    SDLNet_SocketSet set;
+    client_type* client;
+    MC_AnswerRecord* answers;
+    int* list;
+    int n, i, k;
+
+    n = room->max_clients ? 2 * room->max_clients : SRV_INITIAL_CLIENTS;
+    if (n > MAX_CLIENTS)
+        n = MAX_CLIENTS;
+    if (n <= room->max_clients)
+        return 0;
+
+    //Tables only ever get bigger, so one that fails leaves the rest usable:
+    client = (client_type*)realloc(room->client, n * sizeof(client_type));
+    if (client)
+        room->client = client;
+    answers = (MC_AnswerRecord*)realloc(room->answers, n * sizeof(MC_AnswerRecord));
+    if (answers)
+        room->answers = answers;
+    list = (int*)realloc(room->answer_client, n * sizeof(int));
+    if (list)
+        room->answer_client = list;
+    list = (int*)realloc(room->active, n * sizeof(int));
+    if (list)
+        room->active = list;
+    list = (int*)realloc(room->readable, n * sizeof(int));
+    if (list)
+        room->readable = list;
+    if (!client || !answers || !room->answer_client || !room->active || !room->readable)
+    {
+        fprintf(stderr, "grow_clients() - allocation failed\n");
+        return 0;
+    }
+
+    //SDL_net's socket sets are a fixed size, so we need a new one:
+    set = SDLNet_AllocSocketSet(n);
+    if (!set)
+    { 
+        fprintf(stderr, "SDLNet_AllocSocketSet: %s\n", SDLNet_GetError());
+        return 0;
+    }
+    for (k = 0; k < room->num_active; k++)
+        SDLNet_TCP_AddSocket(set, room->client[room->active[k]].sock);
+    if (room->client_set)
+        SDLNet_FreeSocketSet(room->client_set);
+    room->client_set = set;
+
+    for (i = room->max_clients; i < n; i++)
+    {
+        memset(&room->client[i], 0, sizeof(client_type));
+        strncpy(room->client[i].name, _("Await player name"), NAME_SIZE);   /* no nicknames yet                  */
+        room->client[i].sock = NULL;      /* sockets start out unconnected     */
+        room->client[i].active_pos = -1;
+    }
+    DEBUGMSG(debug_lan, "Room %d now has room for %d clients\n", room->slot, n);
+    room->max_clients = n;
+    return 1;
+}
+
+
+//Returns the index of the first vacant client, making more room if
+//need be, or -1 if all clients full
+int find_vacant_client(srv_room* room)
+{
+    int i = 0;
+
+    if (room->num_active == room->max_clients)
+    {
+        i = room->max_clients;
+        if (!grow_clients(room))
+        {
+            fprintf(stderr, "All %d clients in use, none vacant\n", room->max_clients);
+            return -1;
+        }
+        return i;
+    }
+    while (room->client[i].sock)
+        i++;
+    return i;
+}
+
+
+/* Puts client i on the room's list of those with input waiting: */
+void client_readable(srv_room* room, int i)
+{
+    if (i < 0 || i >= room->max_clients || !room->client[i].sock
+            || room->client[i].readable || room->num_readable >= room->max_clients)
+        return;
+    room->client[i].readable = 1;
+    room->readable[room->num_readable++] = i;
+}
+
+
+/* Without epoll, SDL_net finds out which clients have sent us something: */
+void poll_client_sockets(srv_room* room)
+{
+    int actives, i, k;
+
+    actives = SDLNet_CheckSockets(room->client_set, 0);
+    if(actives == -1)
+    {
+        fprintf(stderr, "In poll_client_sockets(), SDLNet_CheckSockets: %s\n", SDLNet_GetError());
+        //most of the time this is a system error, where perror might help you.
+        perror("In poll_client_sockets(), SDLNet_CheckSockets");
+        return;
+    }
+    for(k = 0; k < room->num_active && actives > 0; k++)
+    {
+        i = room->active[k];
+        if(SDLNet_SocketReady(room->client[i].sock))
+        {
+            client_readable(room, i);
+            actives--;
+        }
+    }
+}
+
+
+void remove_client(srv_room* room, int i)
+{
+    int j, k, len;
+    char buf[NET_BUF_LEN];
+    net_msg msg;
+
+    fprintf(stderr, "Removing client[%d] - name: %s\n>\n", i, room->client[i].name);
+    Net_InitMsg(&msg, NET_OP_PLAYER_LEFT);
+    msg.arg[0] = i;
+
+    //NOTE not transmit(), which calls us if the queue overflows - anyone
+    //that far behind gets dropped by the next message they can't take.
+    //Nobody was told of a client that hadn't joined yet:
+    for(k = 0; k < room->num_active && room->client[i].joined; k++) {
+        j = room->active[k];
+        if(j != i && !too_wide_for(room, j, &msg)) {
+            len = Net_EncodeMsg(&msg, room->client[j].stream.protocol, buf);
+            if(Net_QueueEncoded(&room->client[j].queue, room->client[j].stream.protocol,
+                        -1, buf, len))
+            {
+                tick_msgs++;
+                Stats_MsgOut(msg.op);
+            }
         }
-    } 
+    }
+
+    close_client_socket(room, i);
+    room->client[i].game_ready = 0;
+    room->client[i].name[0] = '\0';
+}
+
+
+/* Gives client i its index and tells the others about it. A client   */
+/* older than protocol 5 has no room for a player in a slot beyond    */
+/* NET_LEGACY_CLIENTS, so one there is told the room is full and hung */
+/* up on. Returns 0 if it was:                                        */
+int join_client(srv_room* room, int i)
+{
+    if(i >= NET_LEGACY_CLIENTS && room->client[i].stream.protocol < NET_PROTOCOL_WIDE)
+    {
+        fprintf(stderr, "Client %d is too old for slots beyond %d - disconnecting\n>\n",
+                i, NET_LEGACY_CLIENTS - 1);
+        Stats_Add(STAT_REFUSED, 1);
+        //Write it out now, as the queue goes with the socket:
+        player_msg(room, i, "Sorry, already have maximum number of clients connected");
+        flush_client(room, i);
+        close_client_socket(room, i);
+        room->client[i].game_ready = 0;
+        room->client[i].name[0] = '\0';
+        room->num_clients = room->num_active;
+        return 0;
+    }
+
+    room->client[i].joined = 1;
+    msg_socket_index(room, i);
+    send_player_update(room, i);
     return 1;
 }
 
 
-void server_check_stdin(int thread_id_no)
+/* Hangs up on client i. The room's socket set and the event loop  */
+/* outlive any one game, so the socket comes out of those as well: */
+void close_client_socket(srv_room* room, int i)
 {
-    char buffer[NET_BUF_LEN];
-    /* Get out if we are ignoring stdin, e.g. thread in tuxmath gui program: */
-    if(ignore_stdin)
+    int k;
+
+    if(room->client[i].sock == NULL)
         return;
-    /* Otherwise handle any new messages from command line: */
-    if(read_stdin_nonblock(buffer, NET_BUF_LEN))
-    { 
-        if( (strncmp(buffer, "exit", 4) == 0) // shut down server thread or prog
-                ||(strncmp(buffer, "quit", 4) == 0))
+    SDLNet_TCP_DelSocket(room->client_set, room->client[i].sock);
+    unwatch_client(room, i);
+    SDLNet_TCP_Close(room->client[i].sock);
+    room->client[i].sock = NULL;  // So we don't segfault in case this
+    Net_ResetStream(&room->client[i].stream);  // somehow gets called
+    Net_FreeQueue(&room->client[i].queue);     // more than once.
+    room->client[i].want_write = 0;
+    room->client[i].readable = 0;
+    room->client[i].joined = 0;
+
+    //The last in active[] takes its place:
+    k = room->client[i].active_pos;
+    room->active[k] = room->active[--room->num_active];
+    room->client[room->active[k]].active_pos = k;
+    room->client[i].active_pos = -1;
+    if(room->num_active == 0)
+        room->empty_since = SDL_GetTicks();
+}
 
+
+/* Writes as much of client i's queue as its socket will take without */
+/* waiting, and has epoll wake us when it can take the rest. Returns  */
+/* 0 if the connection turned out to be broken:                       */
+int flush_client(srv_room* room, int i)
+{
+    client_type* c = &room->client[i];
+    const char* data[2];
+    int len[2];
+    int n, sent;
+
+    if(!c->sock)
+        return 0;
+
+    n = Net_QueueData(&c->queue, data, len);
+    if(n > 0)
+    {
+        sent = send_nonblock(c->sock, data, len, n);
+        tick_writes++;
+        Stats_Add(STAT_WRITES, 1);
+        if(sent < 0)
         {
-            //FIXME notify clients that we are shutting down
-            quit = 1;
-        }
-        else if (strncmp(buffer, "endgame", 7) == 0) // stop game leaving server running
-        {
-            end_game(thread_id_no);
+            fprintf(stderr, "The client %s is disconnected\n", c->name);
+            Stats_Add(STAT_LOST, 1);
+            remove_client(room, i);
+            return 0;
         }
-        else
+        Stats_Add(STAT_BYTES_OUT, sent);
+        Net_QueueSent(&c->queue, sent);
+    }
+
+    if(c->want_write != (c->queue.len > 0))
+    {
+        c->want_write = (c->queue.len > 0);
+        watch_socket_output(c->sock, c->want_write);
+    }
+    return 1;
+}
+
+
+void flush_clients(srv_room* room)
+{
+    int i, k;
+
+    //Backwards, as anyone hung up on is replaced by the last in the list:
+    for(k = room->num_active - 1; k >= 0; k--)
+    {
+        if(k >= room->num_active)
+            continue;
+        i = room->active[k];
+        if(room->client[i].queue.len > 0)
+            flush_client(room, i);
+    }
+}
+
+
+/* End of a pass through the main loop - everything queued for the */
+/* clients during it goes out together:                            */
+void flush_output(int frame)
+{
+    int i;
+
+    for (i = 0; i < MAX_ROOMS; i++)
+        if (rooms[i])
+            flush_clients(rooms[i]);
+
+    if (tick_msgs > 0)
+        DEBUGMSG(debug_lan, "Pass %d: %d messages queued, %d writes\n",
+                frame, tick_msgs, tick_writes);
+    tick_msgs = tick_writes = 0;
+}
+
+
+/* For the server console - how much output is waiting for each client: */
+void list_queues(void)
+{
+    int i, j, k;
+    net_queue* q;
+
+    for (i = 0; i < MAX_ROOMS; i++)
+    {
+        if (!rooms[i])
+            continue;
+        for (k = 0; k < rooms[i]->num_active; k++)
         {
-            fprintf(stderr, "Command not recognized.\n");
+            j = rooms[i]->active[k];
+            q = &rooms[i]->client[j].queue;
+            fprintf(stderr, "Room %d client %d (%s): %d bytes in %d messages queued, "
+                    "peak %d, %d stale updates dropped\n",
+                    i, j, rooms[i]->client[j].name, q->len, q->num_msgs,
+                    q->peak, q->dropped);
         }
     }
+    fprintf(stderr, "High-water mark %d bytes, %lu clients dropped for falling behind\n",
+            send_high_water, Stats_Get(STAT_TOO_SLOW));
 }
 
 
-// client management utilities:
-
-//Returns the index of the first vacant client, or -1 if all clients full
-int find_vacant_client(int thread_id_no)
+/* For the server console - the overall figures, then how each */
+/* player is doing:                                             */
+void print_stats(void)
 {
-    int i = 0;
-    while (slave_thread[thread_id_no].client[i].sock && i < MAX_CLIENTS)
-        i++;
-    if (i == MAX_CLIENTS)
+    Uint32 now = SDL_GetTicks();
+    float minutes;
+    client_type* c;
+    int i, j, k;
+
+    Stats_Print(stderr);
+    for (i = 0; i < MAX_ROOMS; i++)
     {
-        fprintf(stderr, "All clients checked, none vacant\n");
-        i = -1;
+        if (!rooms[i])
+            continue;
+        for (k = 0; k < rooms[i]->num_active; k++)
+        {
+            j = rooms[i]->active[k];
+            c = &rooms[i]->client[j];
+            minutes = (now - c->connect_time) / 60000.0;
+            fprintf(stderr, "Room %d client %d (%s): %d answers, %d correct, %.1f per minute",
+                    i, j, c->name, c->answers, c->correct,
+                    minutes > 0 ? c->answers / minutes : 0.0);
+            if (c->rtt >= 0)
+                fprintf(stderr, ", round trip %.1f msec\n", c->rtt);
+            else
+                fprintf(stderr, "\n");
+        }
     }
-    return i;
 }
 
 
-void remove_client(int thread_id_no, int i)
+/* Rewrites the --stats-file in the Prometheus text format. It is */
+/* written to a temporary file first and renamed over the old one */
+/* so that whatever reads it never sees half a file:              */
+void write_stats_file(void)
 {
-    int j;
-    char buf[256];
+    static const char* room_metrics[] = {
+        "tuxmath_room_players", "tuxmath_room_game_in_progress", "tuxmath_room_wave"
+    };
+    static const char* client_metrics[][2] = {
+        {"tuxmath_client_answers_total", "counter"},
+        {"tuxmath_client_correct_answers_total", "counter"},
+        {"tuxmath_client_queued_bytes", "gauge"},
+        {"tuxmath_client_queue_peak_bytes", "gauge"},
+    };
+    char tmp[PATH_MAX + 4];
+    FILE* fp;
+    srv_room* room;
+    client_type* c;
+    int i, j, k, m, value;
+
+    last_stats_write = SDL_GetTicks();
+    snprintf(tmp, sizeof(tmp), "%s.tmp", stats_file);
+    fp = fopen(tmp, "w");
+    if (!fp)
+    {
+        perror("In write_stats_file(), fopen");
+        return;
+    }
+
+    Stats_WritePrometheus(fp);
+
+    for (m = 0; m < 3; m++)
+    {
+        fprintf(fp, "# TYPE %s gauge\n", room_metrics[m]);
+        for (i = 0; i < MAX_ROOMS; i++)
+        {
+            room = rooms[i];
+            if (!room)
+                continue;
+            if (m == 0)
+                value = room->num_active;
+            else if (m == 1)
+                value = room->game_in_progress;
+            else
+                value = room->game_in_progress ? room->srv_game.wave : 0;
+            fprintf(fp, "%s{room=", room_metrics[m]);
+            Stats_PromLabel(fp, room->name);
+            fprintf(fp, "} %d\n", value);
+        }
+    }
 
-    fprintf(stderr, "Removing client[%d] - name: %s\n>\n", i, slave_thread[thread_id_no].client[i].name);
-    sprintf(buf, "PLAYER_LEFT\t%d", i);
+    for (m = 0; m < 4; m++)
+    {
+        fprintf(fp, "# TYPE %s %s\n", client_metrics[m][0], client_metrics[m][1]);
+        for (i = 0; i < MAX_ROOMS; i++)
+        {
+            if (!rooms[i])
+                continue;
+            for (k = 0; k < rooms[i]->num_active; k++)
+            {
+                j = rooms[i]->active[k];
+                c = &rooms[i]->client[j];
+                switch (m)
+                {
+                    case 0: value = c->answers; break;
+                    case 1: value = c->correct; break;
+                    case 2: value = c->queue.len; break;
+                    default: value = c->queue.peak; break;
+                }
+                fprintf(fp, "%s{room=", client_metrics[m][0]);
+                Stats_PromLabel(fp, rooms[i]->name);
+                fprintf(fp, ",client=\"%d\",name=", j);
+                Stats_PromLabel(fp, c->name);
+                fprintf(fp, "} %d\n", value);
+            }
+        }
+    }
 
-    for(j=0; j<MAX_CLIENTS; j++) {
-        if(j != i && slave_thread[thread_id_no].client[j].sock) {
-            SDLNet_TCP_Send(slave_thread[thread_id_no].client[j].sock, buf, strlen(buf) + 1);
+    //Only clients that answer PINGs have a round trip time:
+    fprintf(fp, "# TYPE tuxmath_client_rtt_seconds gauge\n");
+    for (i = 0; i < MAX_ROOMS; i++)
+    {
+        if (!rooms[i])
+            continue;
+        for (k = 0; k < rooms[i]->num_active; k++)
+        {
+            j = rooms[i]->active[k];
+            c = &rooms[i]->client[j];
+            if (c->rtt < 0)
+                continue;
+            fprintf(fp, "tuxmath_client_rtt_seconds{room=");
+            Stats_PromLabel(fp, rooms[i]->name);
+            fprintf(fp, ",client=\"%d\",name=", j);
+            Stats_PromLabel(fp, c->name);
+            fprintf(fp, "} %.4f\n", c->rtt / 1000.0);
         }
     }
 
-    SDLNet_TCP_DelSocket(slave_thread[thread_id_no].client_set, slave_thread[thread_id_no].client[i].sock);
+    if (fclose(fp) != 0)
+    {
+        perror("In write_stats_file(), fclose");
+        return;
+    }
+#ifdef BUILD_MINGW32
+    remove(stats_file);   //Windows won't rename over an existing file
+#endif
+    if (rename(tmp, stats_file) != 0)
+        perror("In write_stats_file(), rename");
+}
+
 
-    if(slave_thread[thread_id_no].client[i].sock != NULL)
-        SDLNet_TCP_Close(slave_thread[thread_id_no].client[i].sock);
+/* Milliseconds until the --stats-file is due to be rewritten, */
+/* or -1 if there isn't one:                                   */
+int stats_file_timeout(Uint32 now)
+{
+    Uint32 elapsed;
 
-    slave_thread[thread_id_no].client[i].sock = NULL;  
-    slave_thread[thread_id_no].client[i].game_ready = 0;
-    slave_thread[thread_id_no].client[i].name[0] = '\0';
+    if (stats_file[0] == '\0')
+        return -1;
+    elapsed = now - last_stats_write;
+    if (elapsed >= SRV_STATS_INTERVAL)
+        return 0;
+    return SRV_STATS_INTERVAL - elapsed;
 }
 
 
@@ -913,25 +2243,23 @@ void remove_client(int thread_id_no, int i)
 // to be ended because all the players have left.  If it finds both "playing"
 // and "nonplaying clients", it leaves game_in_progress unchanged.
 
-// TODO this is not very sophisticated, and only supports one game at a time.
-// We may want to make this extensible to multiple simultaneous games, perhaps
-// with each game in its own thread with its own socket set and mathcards instance.
+// TODO this is not very sophisticated. Each room runs at most one game at a
+// time - more simultaneous games just means more rooms.
 // FIXME we need to do more than just toggle game_in_progress - should have
 // start_game() and end_game() functions that make sure mathcards is 
 // properly set up or cleaned up.
-void check_game_clients(int thread_id_no)
+void check_game_clients(srv_room* room)
 {
-    int i = 0;
+    int i, k;
 
     //If the game is already started, we leave it running as long as at least
     //one client is both connected and willing to play:
-    if(game_in_progress)
+    if(room->game_in_progress)
     {
         int someone_still_playing = 0;
-        for(i = 0; i < MAX_CLIENTS; i++)
+        for(k = 0; k < room->num_active; k++)
         {
-            if((slave_thread[thread_id_no].client[i].sock != NULL)
-                    && slave_thread[thread_id_no].client[i].game_ready)
+            if(room->client[room->active[k]].game_ready)
             {
                 someone_still_playing = 1;
                 break;
@@ -943,15 +2271,15 @@ void check_game_clients(int thread_id_no)
             DEBUGMSG(debug_lan, "All the clients have left the game, setting game_in_progress = 0.\n");
 
             /* Now make sure all clients are closed: */ 
-            for(i = 0; i < MAX_CLIENTS; i++)
+            while(room->num_active > 0)
             {
-                SDLNet_TCP_Close(slave_thread[thread_id_no].client[i].sock);
-                slave_thread[thread_id_no].client[i].sock = NULL;
-                slave_thread[thread_id_no].client[i].game_ready = 0;
+                i = room->active[room->num_active - 1];
+                close_client_socket(room, i);
+                room->client[i].game_ready = 0;
             }
 
-            game_in_progress = 0;
-            end_game(thread_id_no);
+            room->game_in_progress = 0;
+            end_game(room);
         }
     }
     //If the game hasn't started yet, we only start it 
@@ -962,293 +2290,419 @@ void check_game_clients(int thread_id_no)
     {
         int someone_connected = 0;
         int someone_not_ready = 0;
-        for(i = 0; i < MAX_CLIENTS; i++)
+        for(k = 0; k < room->num_active; k++)
         {
-            if(slave_thread[thread_id_no].client[i].sock != NULL)
-            { 
-                someone_connected = 1;
-                if (!slave_thread[thread_id_no].client[i].game_ready)
-                {
-                    someone_not_ready = 1;
-                }
+            someone_connected = 1;
+            if (!room->client[room->active[k]].game_ready)
+            {
+                someone_not_ready = 1;
+                break;
             }
         }
         if(someone_connected && !someone_not_ready)
-            start_game(thread_id_no); 
+            start_game(room); 
     }
 }
 
 
 
-void handle_client_nongame_msg(int thread_id_no, int i, char* buffer)
+void handle_client_nongame_msg(srv_room* room, int i, net_msg* msg)
 {
-    DEBUGMSG(debug_lan, "nongame_msg received from client: %s\n", buffer);
+    DEBUGMSG(debug_lan, "nongame_msg received from client: %s\n", Net_MsgName(msg->op));
 
-    if(strncmp(buffer, "PLAYER_READY", strlen("PLAYER_READY")) == 0)
-    {
-        slave_thread[thread_id_no].client[i].game_ready = 1;
-        //Inform other clients:
-        send_player_updates(thread_id_no);
-        //This will call start_game() if all the other clients are ready:
-        check_game_clients(thread_id_no);
-    }
-    else if(strncmp(buffer, "PLAYER_NOT_READY", strlen("PLAYER_NOT_READY")) == 0)
+    switch(msg->op)
     {
-        slave_thread[thread_id_no].client[i].game_ready = 0;
-        //Inform other clients:
-        send_player_updates(thread_id_no);
-        check_game_clients(thread_id_no);
+        case NET_OP_PLAYER_READY:
+            room->client[i].game_ready = 1;
+            //Inform other clients:
+            send_player_update(room, i);
+            //This will call start_game() if all the other clients are ready:
+            check_game_clients(room);
+            break;
+        case NET_OP_PLAYER_NOT_READY:
+            room->client[i].game_ready = 0;
+            //Inform other clients:
+            send_player_update(room, i);
+            check_game_clients(room);
+            break;
+        case NET_OP_SET_NAME:
+            msg_set_name(room, i, msg);
+            break;
+        case NET_OP_REQUEST_INDEX:
+            msg_socket_index(room, i);
+            break;
+        case NET_OP_PROTOCOL:
+            msg_protocol(room, i, msg);
+            break;
+        case NET_OP_PING:
+            msg_ping(room, i, msg);
+            break;
+        case NET_OP_PONG:
+            msg_pong(room, i, msg);
+            break;
+        default:
+            break;
     }
-    else if(strncmp(buffer, "SET_NAME", strlen("SET_NAME")) == 0)
-    {
-        msg_set_name(thread_id_no, i, buffer);
-    }
-    else if(strncmp(buffer, "REQUEST_INDEX", strlen("REQUEST_INDEX")) == 0)
-    {
-        msg_socket_index(thread_id_no, i, buffer);
-    }                            
 }
 
 
-int handle_client_game_msg(int thread_id_no, int i , char* buffer)
+int handle_client_game_msg(srv_room* room, int i , net_msg* msg)
 {
-    DEBUGMSG(debug_lan, "game_msg received from client: %s\n", buffer);
-
-    if(strncmp(buffer, "CORRECT_ANSWER", strlen("CORRECT_ANSWER")) == 0)
-    {
-        game_msg_correct_answer(thread_id_no,i, buffer);
-    }                            
-    else if(strncmp(buffer, "REQUEST_INDEX", strlen("REQUEST_INDEX")) == 0)
-    {
-        msg_socket_index(thread_id_no, i, buffer);
-    }                            
+    DEBUGMSG(debug_lan, "game_msg received from client: %s\n", Net_MsgName(msg->op));
 
-    else if(strncmp(buffer, "WRONG_ANSWER",strlen("WRONG_ANSWER")) == 0) /* Player answered the question incorrectly , meaning comet crashed into a city or an igloo */
+    switch(msg->op)
     {
-        game_msg_wrong_answer(thread_id_no,i, buffer);
+        case NET_OP_CORRECT_ANSWER:
+            game_msg_correct_answer(room, i, msg);
+            break;
+        case NET_OP_REQUEST_INDEX:
+            msg_socket_index(room, i);
+            break;
+        case NET_OP_PROTOCOL:
+            msg_protocol(room, i, msg);
+            break;
+        case NET_OP_PING:
+            msg_ping(room, i, msg);
+            break;
+        case NET_OP_PONG:
+            msg_pong(room, i, msg);
+            break;
+        /* Player answered the question incorrectly , meaning comet crashed into a city or an igloo */
+        case NET_OP_WRONG_ANSWER:
+            game_msg_wrong_answer(room, i, msg);
+            break;
+        case NET_OP_LEAVE_GAME:
+            room->client[i].game_ready = 0;  /* Player quitting game but not disconnecting */
+            break;
+        case NET_OP_EXIT:   /* Terminate this connection */
+            game_msg_exit(room, i);
+            break;
+        case NET_OP_QUIT:   /* Quit the program */
+            game_msg_quit(room, i);
+            return(1);
+        default:
+            fprintf(stderr, "command %s not recognized\n",
+                    msg->op == NET_OP_UNKNOWN ? msg->text : Net_MsgName(msg->op));
     }
+    return(0);
+}
 
-    else if(strncmp(buffer, "LEAVE_GAME", strlen("LEAVE_GAME")) == 0) 
-    {
-        slave_thread[thread_id_no].client[i].game_ready = 0;  /* Player quitting game but not disconnecting */
-    }
 
-    else if(strncmp(buffer, "exit",strlen("exit")) == 0) /* Terminate this connection */
-    {
-        game_msg_exit(thread_id_no, i);
-    }
 
-    else if(strncmp(buffer, "quit",strlen("quit")) == 0) /* Quit the program */
-    {
-        game_msg_quit(thread_id_no, i);
-        return(1);
-    }
-    else
-    {
-        fprintf(stderr, "command %s not recognized\n", buffer);
-    }
-    return(0);
+int msg_set_name(srv_room* room,int i, net_msg* msg)
+{
+    snprintf(room->client[i].name, NAME_SIZE, "%.*s", NAME_SIZE - 1, msg->text);
+    send_player_update(room, i);
+    return 1;
 }
 
 
+void msg_socket_index(srv_room* room, int i)
+{  
+    net_msg msg;
+    Net_InitMsg(&msg, NET_OP_SOCKET_INDEX);
+    msg.arg[0] = i;
+    transmit(room, i, &msg);
+}
 
-int msg_set_name(int thread_id_no,int i, char* buf)
+
+/* Client asks for a newer wire protocol. We answer in the format it */
+/* used to ask, then use the highest version we both know:          */
+void msg_protocol(srv_room* room, int i, net_msg* msg)
 {
-    char* p;
+    int version = msg->arg[0];
 
-    if(buf == NULL)
-        return 0;
+    if(version < NET_PROTOCOL_LEGACY)
+        version = NET_PROTOCOL_LEGACY;
+    if(version > NET_PROTOCOL_VERSION)
+        version = NET_PROTOCOL_VERSION;
 
-    p = strchr(buf, '\t');
-    if(p)
-    { 
-        p++;
-        strncpy(slave_thread[thread_id_no].client[i].name, p, NAME_SIZE);
-        send_player_updates(thread_id_no);
-        return 1;
-    }
-    else
-        return 0;
+    msg->arg[0] = version;
+    if(transmit(room, i, msg))
+        room->client[i].stream.protocol = version;
+    DEBUGMSG(debug_lan, "Client %d using protocol %d\n", i, version);
 }
 
 
-void msg_socket_index(int thread_id_no, int i, char* buf)
-{  
-    snprintf(buf, NET_BUF_LEN, "%s\t%d", "SOCKET_INDEX", i);
-    SDLNet_TCP_Send(slave_thread[thread_id_no].client[i].sock, buf, NET_BUF_LEN);
+/* Client wants to time the round trip, so send it straight back: */
+void msg_ping(srv_room* room, int i, net_msg* msg)
+{
+    msg->op = NET_OP_PONG;
+    transmit(room, i, msg);
 }
 
 
-void game_msg_correct_answer(int thread_id_no,int i, char* inbuf)
+/* One of our PINGs has come back from client i: */
+void msg_pong(srv_room* room, int i, net_msg* msg)
 {
-    char outbuf[NET_BUF_LEN];
-    char* p = NULL;
-    int id = -1;
-    float t = -1;
-    int points = 0;
+    Uint32 sample = SDL_GetTicks() - (Uint32)msg->arg[0];
+    client_type* c = &room->client[i];
 
-    if(!inbuf)
+    if(sample > 10 * SRV_PING_INTERVAL)   //not one of ours
         return;
-
-    //parse inbuf to get question id:
-    p = strchr(inbuf, '\t');
-    if(!p)
-        return; 
-    p++;
-    id = atoi(p);
-    //Now get time player took to answer:
-    p = strchr(p, '\t');
-    if(!p)
-        t = -1;
+    Stats_Observe(STAT_RTT, sample);
+    if(c->rtt < 0)
+        c->rtt = sample;
     else
+        c->rtt += (sample - c->rtt) / 8;
+    DEBUGMSG(debug_lan, "Client %d round trip %u msec, smoothed %.1f\n",
+            i, sample, c->rtt);
+}
+
+
+/* Sends a PING with our clock on it to every client in the room that */
+/* understands one, every SRV_PING_INTERVAL msec:                     */
+void ping_clients(srv_room* room)
+{
+    Uint32 now = SDL_GetTicks();
+    net_msg msg;
+    int j, k;
+
+    if(ping_timeout(room, now) != 0)
+        return;
+    room->last_ping_time = now;
+
+    Net_InitMsg(&msg, NET_OP_PING);
+    msg.arg[0] = (int)now;
+    //Backwards, as transmit() may hang up on someone:
+    for(k = room->num_active - 1; k >= 0; k--)
     {
-        p++;
-        t = atof(p);
+        if(k >= room->num_active)
+            continue;
+        j = room->active[k];
+        if(room->client[j].stream.protocol >= NET_PROTOCOL_PING)
+            transmit(room, j, &msg);
     }
+}
 
-    //Tell mathcards so lists get updated:
-    points = MC_AnsweredCorrectly(lan_game_settings, id, t);
-    if(!points)
-        return;
-    //If we get to here, the id was successfully parsed out of inbuf
-    //and the corresponding question was found.
-    slave_thread[thread_id_no].client[i].score += points;
-    slave_thread[thread_id_no].srv_game.active_quests--;
-
-    //Announcement for server and all clients:
-    snprintf(outbuf, NET_BUF_LEN, 
-            "question id %d was answered in %f seconds for %d points by %s",
-            id, t, points, slave_thread[thread_id_no].client[i].name);             
-    broadcast_msg(thread_id_no, outbuf);
-
-    DEBUGMSG(debug_lan, "\ngame_msg_correct_answer(): %s\n", outbuf);
-    DEBUGMSG(debug_lan, "After correct answer, wave %d\n"
-            "srv_game.max_quests_on_screen = %d\n"
-            "srv_game.rem_in_wave = %d\n"
-            "srv_game.active_quests = %d\n\n",
-            slave_thread[thread_id_no].srv_game.wave, slave_thread[thread_id_no].srv_game.max_quests_on_screen,
-            slave_thread[thread_id_no].srv_game.rem_in_wave, slave_thread[thread_id_no].srv_game.active_quests);   
 
-    //Tell all players to remove that question:
-    remove_question(thread_id_no, id, i);
-    //and update the game counters:
-    send_counter_updates(thread_id_no);
-    //and the scores:
-    send_player_updates(thread_id_no);
+void game_msg_correct_answer(srv_room* room,int i, net_msg* msg)
+{
+    float t = answer_time(room, i, msg->arg[0], msg->time);
+
+    //Hold on to it until the rest of this pass's answers are in:
+    queue_answer(room, i, msg->arg[0], 1, t);
+}
+
+
+void game_msg_wrong_answer(srv_room* room, int i, net_msg* msg)
+{
+    //Hold on to it until the rest of this pass's answers are in:
+    queue_answer(room, i, msg->arg[0], 0, -1);
+}
+
+
+/* Saves an answer from client i for the next apply_answers(): */
+void queue_answer(srv_room* room, int i, int id, int correct, float t)
+{
+    MC_AnswerRecord* rec;
+
+    //Shouldn't fill up, as each client gets one message per pass:
+    if(room->num_answers >= room->max_clients)
+        apply_answers(room);
+
+    rec = &room->answers[room->num_answers];
+    rec->question_id = id;
+    rec->correct = correct;
+    rec->time = t;
+    room->answer_client[room->num_answers] = i;
+    room->num_answers++;
+}
+
+
+/* Seconds client i took to answer question id, by our clock: from   */
+/* when we sent the question to when the answer got here, less the    */
+/* round trip (half on the way out and half on the way back). Clients */
+/* that can't be timed keep the time they reported:                   */
+float answer_time(srv_room* room, int i, int id, float client_time)
+{
+    Uint32 elapsed;
+    float t;
+    int k;
+
+    if(room->client[i].rtt < 0)
+        return client_time;
+
+    for(k = 0; k < SRV_SENT_QUESTIONS; k++)
+        if(room->sent_id[k] == id)
+            break;
+    if(k == SRV_SENT_QUESTIONS)
+        return client_time;
+
+    elapsed = SDL_GetTicks() - room->sent_time[k];
+    t = (elapsed - room->client[i].rtt) / 1000.0;
+    if(t < 0)
+        t = 0;
+    DEBUGMSG(debug_lan, "answer_time() - client %d says %.3f sec, we make it %.3f\n",
+            i, client_time, t);
+    return t;
 }
 
 
-void game_msg_wrong_answer(int thread_id_no, int i, char* inbuf)
+/* Hands all the queued answers to mathcards in one go, then tells */
+/* the clients about them:                                         */
+void apply_answers(srv_room* room)
 {
     char outbuf[NET_BUF_LEN];
-    char* p;
-    int id;
+    MC_AnswerRecord* rec;
+    int num = room->num_answers;
+    int i, j;
+    int recorded, correct = 0;
 
-    if(!inbuf)
+    if(num == 0)
+        return;
+    room->num_answers = 0;
+    //Nothing to do if the game ended while the answers were coming in:
+    if(!room->game_in_progress)
         return;
-
-    //parse inbuf to get question id:
-    p = strchr(inbuf, '\t');
-    if(!p)
-        return; 
-    p++;
-    id = atoi(p);
 
     //Tell mathcards so lists get updated:
-    if(!MC_NotAnsweredCorrectly(lan_game_settings, id))
+    recorded = MC_RecordAnswers(room->math_game,
+            room->answers, num);
+    if(!recorded)
         return;
-    //If we get to here, the id was successfully parsed out of inbuf
-    //and the corresponding question was found.
 
-    //One less comet in play:
-    slave_thread[thread_id_no].srv_game.active_quests--;
+    for(j = 0; j < num; j++)
+    {
+        rec = &room->answers[j];
+        i = room->answer_client[j];
+        //Skip any whose question wasn't found:
+        if(!rec->recorded)
+            continue;
+
+        //One less comet in play:
+        if(room->srv_game.active_quests-- >= room->srv_game.max_quests_on_screen)
+            room->quest_free_time = SDL_GetTicks();
+        room->client[i].answers++;
+
+        if(rec->correct)
+        {
+            room->client[i].score += rec->points;
+            room->client[i].correct++;
+            correct++;
+
+            //Announcement for server and all clients:
+            snprintf(outbuf, NET_BUF_LEN, 
+                    "question id %d was answered in %f seconds for %d points by %s",
+                    rec->question_id, rec->time, rec->points, room->client[i].name);             
+            broadcast_msg(room, outbuf);
+            DEBUGMSG(debug_lan, "\napply_answers(): %s\n", outbuf);
+
+            //Tell all players to remove that question:
+            remove_question(room, rec->question_id, i);
+        }
+        else
+        {
+            //Announcement for server and all clients:
+            snprintf(outbuf, NET_BUF_LEN, 
+                    "question id %d was missed by %s\n",
+                    rec->question_id, room->client[i].name);             
+            broadcast_msg(room, outbuf);
+            //Tell all players to remove that question:
+            //-1 means question was missed.
+            remove_question(room, rec->question_id, -1);
+        }
+    }
+
+    Stats_Add(STAT_CORRECT_ANSWERS, correct);
+    Stats_Add(STAT_WRONG_ANSWERS, recorded - correct);
 
-    DEBUGMSG(debug_lan, "\nAfter wrong answer: wave %d\n"
+    DEBUGMSG(debug_lan, "\nAfter %d answers (%d correct): wave %d\n"
             "srv_game.max_quests_on_screen = %d\n"
             "srv_game.rem_in_wave = %d\n"
             "srv_game.active_quests = %d\n\n",
-            slave_thread[thread_id_no].srv_game.wave, slave_thread[thread_id_no].srv_game.max_quests_on_screen,
-            slave_thread[thread_id_no].srv_game.rem_in_wave, slave_thread[thread_id_no].srv_game.active_quests);   
-    //Announcement for server and all clients:
-    snprintf(outbuf, NET_BUF_LEN, 
-            "question id %d was missed by %s\n",
-            id, slave_thread[thread_id_no].client[i].name);             
-    broadcast_msg(thread_id_no,outbuf);
-    //Tell all players to remove that question:
-    //-1 means question was missed.
-    remove_question(thread_id_no, id, -1);
+            recorded, correct,
+            room->srv_game.wave, room->srv_game.max_quests_on_screen,
+            room->srv_game.rem_in_wave, room->srv_game.active_quests);   
+
     //and update the game counters:
-    send_counter_updates(thread_id_no);
+    send_counter_updates(room);
+    //and the scores of those who got one right:
+    for(j = 0; j < num; j++)
+        if(room->answers[j].recorded && room->answers[j].correct
+                && room->client[room->answer_client[j]].sock)
+            send_player_update(room, room->answer_client[j]);
 }
 
 
 
-void game_msg_next_question(int thread_id_no)
+void game_msg_next_question(srv_room* room)
 {
-    MC_FlashCard flash;
+    MC_FlashCard* flash;
 
-    /* Get next question from MathCards: */
-    if (!MC_NextQuestion(lan_game_settings, &flash))
+    /* Get the rest of the wave's questions from MathCards if we've */
+    /* sent all the ones we had:                                    */
+    if (room->quest_queue_next >= room->quest_queue_len)
+    {
+        int n = room->srv_game.rem_in_wave;
+        if (n > SRV_QUEST_QUEUE_SIZE)
+            n = SRV_QUEST_QUEUE_SIZE;
+        room->quest_queue_len =
+            MC_NextQuestions(room->math_game, room->quest_queue, n);
+        room->quest_queue_next = 0;
+    }
+    if (room->quest_queue_next >= room->quest_queue_len)
     { 
         /* no more questions available */
-        DEBUGMSG(debug_lan, "MC_NextQuestion() returned NULL - no questions available\n");
+        DEBUGMSG(debug_lan, "MC_NextQuestions() returned none - no questions available\n");
         return;
     }
+    flash = &room->quest_queue[room->quest_queue_next++];
 
     DEBUGMSG(debug_lan, "In game_msg_next_question(), about to send:\n");
-    DEBUGCODE(debug_lan) print_card(flash); 
+    DEBUGCODE(debug_lan) print_card(*flash); 
 
     /* Send it to all the clients: */ 
-    add_question(thread_id_no, &flash);
+    add_question(room, flash);
+    Stats_Add(STAT_QUESTIONS_SENT, 1);
     /* Adjust counters accordingly: */
-    slave_thread[thread_id_no].srv_game.active_quests++;
-    slave_thread[thread_id_no].srv_game.rem_in_wave--;
+    room->srv_game.active_quests++;
+    room->srv_game.rem_in_wave--;
 
     DEBUGMSG(debug_lan, "In game_msg_next_question(), after quest added, wave %d\n"
             "srv_game.max_quests_on_screen = %d\n"
             "srv_game.rem_in_wave = %d\n"
             "srv_game.active_quests = %d\n\n",
-            slave_thread[thread_id_no].srv_game.wave, slave_thread[thread_id_no].srv_game.max_quests_on_screen,
-            slave_thread[thread_id_no].srv_game.rem_in_wave, slave_thread[thread_id_no].srv_game.active_quests);   
+            room->srv_game.wave, room->srv_game.max_quests_on_screen,
+            room->srv_game.rem_in_wave, room->srv_game.active_quests);   
 }
 
 
 
 
 
-void game_msg_exit(int thread_id_no, int i)
+void game_msg_exit(srv_room* room, int i)
 {
-    fprintf(stderr, "LEFT the GAME : %s",slave_thread[thread_id_no].client[i].name);
-    remove_client(thread_id_no, i);
+    fprintf(stderr, "LEFT the GAME : %s",room->client[i].name);
+    Stats_Add(STAT_LEFT, 1);
+    remove_client(room, i);
 }
 
 
 
 //FIXME don't think we want to allow players to shut down the server
-void game_msg_quit(int thread_id_no, int i)
+void game_msg_quit(srv_room* room, int i)
 {
-    fprintf(stderr, "Server has been shut down by %s\n", slave_thread[thread_id_no].client[i].name); 
-    cleanup_server(0);                 //FIXME Deepak its hard coded.  
+    fprintf(stderr, "Server has been shut down by %s\n", room->client[i].name); 
+    cleanup_server();
     exit(9);                           // '9' means exit ;)  (just taken an arbitary no:)
 }
 
 
 /* Now this gets called to actually start the game once all the players */
 /* have indicated that they are ready:                                  */
-void start_game(int thread_id_no)
+void start_game(srv_room* room)
 {
-    char buf[NET_BUF_LEN];
-    int j;
+    net_msg msg;
+    int j, k;
 
 
     /* NOTE this should no longer be needed - doing the same thing earlier    */
     /*This loop sees that the game starts only when all the players are ready */
     /* i.e. if someone is connected but not ready, we return.                 */
-    for(j = 0; j < MAX_CLIENTS; j++)
+    for(k = 0; k < room->num_active; k++)
     {
-        // Only check sockets that aren't null:
-        if((slave_thread[thread_id_no].client[j].game_ready != 1)
-                && (slave_thread[thread_id_no].client[j].sock != NULL))
+        if(room->client[room->active[k]].game_ready != 1)
         {
             fprintf(stderr, "Warning - start_game() entered when someone not ready\n");
             return;      
@@ -1258,58 +2712,64 @@ void start_game(int thread_id_no)
 
     /***********************Will be modified**************/
     //Tell everyone we are starting and count who's really in:
-    slave_thread[thread_id_no].num_clients = 0;
-    snprintf(buf, NET_BUF_LEN, 
-            "%s\n",
-            "GO_TO_GAME");          
-    for(j = 0; j < MAX_CLIENTS; j++)
-    {
-        if((slave_thread[thread_id_no].client[j].game_ready == 1)
-                && (slave_thread[thread_id_no].client[j].sock != NULL))
+    room->num_clients = 0;
+    Net_InitMsg(&msg, NET_OP_GO_TO_GAME);
+    //Backwards, as anyone removed is replaced by the last in the list:
+    for(k = room->num_active - 1; k >= 0; k--)
+    {
+        if(k >= room->num_active)
+            continue;
+        j = room->active[k];
+        if(room->client[j].game_ready == 1)
         {
-            if(SDLNet_TCP_Send(slave_thread[thread_id_no].client[j].sock, buf, NET_BUF_LEN) == NET_BUF_LEN)
-                slave_thread[thread_id_no].num_clients++;
+            //NOTE transmit() removes the client if the send fails
+            if(transmit(room, j, &msg))
+                room->num_clients++;
             else
-            {
-                fprintf(stderr, "in start_game() - failed to send to client %d, removing\n", j);
-                remove_client(thread_id_no, j);
-            }
+                fprintf(stderr, "in start_game() - failed to send to client %d, removed\n", j);
         }
     }
     /*****************************************************/
 
 
     /* If no players join the game (should not happen) */
-    if(slave_thread[thread_id_no].num_clients == 0)
+    if(room->num_clients == 0)
     {
         fprintf(stderr, "There were no players........=(\n");
         return;
     }
 
-    DEBUGMSG(debug_lan, "We have %d players.......\n", slave_thread[thread_id_no].num_clients);
+    DEBUGMSG(debug_lan, "We have %d players.......\n", room->num_clients);
 
-    game_in_progress = 1;  //setting the game_in_progress flag to '1'
+    room->game_in_progress = 1;  //setting the game_in_progress flag to '1'
     //Start a new math game as far as mathcards is concerned:
-    //TODO we could create more than one MathCards instance here when
-    //we start supporting multiple simultaneous games in the future.  For now
-    //we just use the lan_game_settings instance - DSB.
-    if (!MC_StartGame(lan_game_settings))
+    //MathCards keeps all its state in the MC_MathGame, so each room
+    //runs its own game - rooms[0] uses the lan_game_settings instance:
+    if (!MC_StartGame(room->math_game))
     {
         fprintf(stderr, "\nMC_StartGame() failed!");
         return;
     }
 
     /* Initialize game data that isn't handled by mathcards: */
-    slave_thread[thread_id_no].srv_game.wave = 1;
-    slave_thread[thread_id_no].srv_game.active_quests = 0;
-    slave_thread[thread_id_no].srv_game.max_quests_on_screen = Opts_StartingComets();
-    slave_thread[thread_id_no].srv_game.quests_in_wave = slave_thread[thread_id_no].srv_game.rem_in_wave = Opts_StartingComets() * 2;
-
-    game_in_progress = 1;
+    room->quest_queue_len = 0;
+    room->quest_queue_next = 0;
+    room->num_answers = 0;
+    for(j = 0; j < SRV_SENT_QUESTIONS; j++)
+        room->sent_id[j] = -1;
+    room->sent_next = 0;
+    room->srv_game.wave = 1;
+    room->srv_game.active_quests = 0;
+    room->srv_game.max_quests_on_screen = Opts_StartingComets();
+    room->srv_game.quests_in_wave = room->srv_game.rem_in_wave = Opts_StartingComets() * 2;
+    room->quest_free_time = SDL_GetTicks();
+
+    room->game_in_progress = 1;
+    Stats_Add(STAT_GAMES_STARTED, 1);
 
     // Zero out scores:
-    for(j = 0; j < MAX_CLIENTS; j++)
-        slave_thread[thread_id_no].client[j].score = 0;
+    for(j = 0; j < room->max_clients; j++)
+        room->client[j].score = 0;
 
     // Initialize game data:
 
@@ -1334,33 +2794,32 @@ void start_game(int thread_id_no)
     //}
 
     //Send all the clients the counter totals:
-    send_counter_updates(thread_id_no);
-    send_player_updates(thread_id_no);
+    send_counter_updates(room);
+    send_player_updates(room);
 }
 
 /* Update anything that isn't a response to a client message, such
  * as timer-based events:
  */
-void server_update_game(int thread_id_no)
+void server_update_game(srv_room* room)
 {
-    static Uint32 last_time, now_time, wait_time;
+    Uint32 now_time, wait_time, due_time;
 
     /* Do nothing unless game started: */
-    if(!game_in_progress)
+    if(!room->game_in_progress)
     {
         return;
     }
 
     now_time = SDL_GetTicks();
 
-    /* Wait time is shorter in higher waves because the comets move faster: */
-    wait_time = SRV_QUEST_INTERVAL/pow(DEFAULT_SPEEDUP_FACTOR, slave_thread[thread_id_no].srv_game.wave);
+    wait_time = quest_wait_time(room);
 
     /* Send another question if there is room and enough time has elapsed: */
-    if(now_time - last_time > wait_time)
+    if(now_time - room->last_quest_time > wait_time)
     {     
-        if((slave_thread[thread_id_no].srv_game.active_quests < slave_thread[thread_id_no].srv_game.max_quests_on_screen)
-                && (slave_thread[thread_id_no].srv_game.rem_in_wave > 0))
+        if((room->srv_game.active_quests < room->srv_game.max_quests_on_screen)
+                && (room->srv_game.rem_in_wave > 0))
         {
             DEBUGMSG(debug_lan, "\nAbout to add next question:\n"
                     "srv_game.max_quests_on_screen = %d\n"
@@ -1368,208 +2827,282 @@ void server_update_game(int thread_id_no)
                     "srv_game.active_quests = %d\n"
                     "last_time = %d\n"
                     "now_time = %d\n\n",
-                    slave_thread[thread_id_no].srv_game.max_quests_on_screen,
-                    slave_thread[thread_id_no].srv_game.rem_in_wave, slave_thread[thread_id_no].srv_game.active_quests,
-                    last_time, now_time);   
-            game_msg_next_question(thread_id_no);
-            last_time = now_time;
+                    room->srv_game.max_quests_on_screen,
+                    room->srv_game.rem_in_wave, room->srv_game.active_quests,
+                    room->last_quest_time, now_time);   
+            //How late is it, counting from when there was room for it?
+            due_time = room->last_quest_time + wait_time;
+            if((Sint32)(room->quest_free_time - due_time) > 0)
+                due_time = room->quest_free_time;
+            Stats_Observe(STAT_DISPATCH_LAG, now_time - due_time);
+            game_msg_next_question(room);
+            room->last_quest_time = now_time;
         }
     }
 
     /* Go on to next wave when appropriate: */
-    if(  slave_thread[thread_id_no].srv_game.rem_in_wave <= 0
-            && slave_thread[thread_id_no].srv_game.active_quests <= 0)
-    {
-        slave_thread[thread_id_no].srv_game.wave++;
-        slave_thread[thread_id_no].srv_game.active_quests = 0; 
-        slave_thread[thread_id_no].srv_game.max_quests_on_screen += Opts_ExtraCometsPerWave(); 
-        if(slave_thread[thread_id_no].srv_game.max_quests_on_screen > Opts_MaxComets()) 
-            slave_thread[thread_id_no].srv_game.max_quests_on_screen = Opts_MaxComets(); 
-        slave_thread[thread_id_no].srv_game.rem_in_wave = slave_thread[thread_id_no].srv_game.max_quests_on_screen * 2;
-        send_counter_updates(thread_id_no); 
+    if(  room->srv_game.rem_in_wave <= 0
+            && room->srv_game.active_quests <= 0)
+    {
+        room->srv_game.wave++;
+        room->srv_game.active_quests = 0; 
+        room->srv_game.max_quests_on_screen += Opts_ExtraCometsPerWave(); 
+        if(room->srv_game.max_quests_on_screen > Opts_MaxComets()) 
+            room->srv_game.max_quests_on_screen = Opts_MaxComets(); 
+        room->srv_game.rem_in_wave = room->srv_game.max_quests_on_screen * 2;
+        room->quest_free_time = now_time;
+        send_counter_updates(room); 
         DEBUGMSG(debug_lan, "/nAdvance to wave %d\n"
                 "srv_game.max_quests_on_screen = %d\n"
                 "srv_game.rem_in_wave = %d\n"
                 "srv_game.active_quests = %d\n\n",
-                slave_thread[thread_id_no].srv_game.wave, slave_thread[thread_id_no].srv_game.max_quests_on_screen,
-                slave_thread[thread_id_no].srv_game.rem_in_wave, slave_thread[thread_id_no].srv_game.active_quests);   
+                room->srv_game.wave, room->srv_game.max_quests_on_screen,
+                room->srv_game.rem_in_wave, room->srv_game.active_quests);   
 
     }
 
     /* Find out from mathcards if we're done: */
-    if(MC_TotalQuestionsLeft(lan_game_settings) == 0)
+    if(MC_TotalQuestionsLeft(room->math_game) == 0)
     {
-        game_in_progress = 0;
+        room->game_in_progress = 0;
+        print_scoreboard(room);
         DEBUGMSG(debug_lan, "/nGame over:\nwave = %d\n"
                 "srv_game.max_quests_on_screen = %d\n"
                 "srv_game.rem_in_wave = %d\n"
                 "srv_game.active_quests = %d\n\n",
-                slave_thread[thread_id_no].srv_game.wave, slave_thread[thread_id_no].srv_game.max_quests_on_screen,
-                slave_thread[thread_id_no].srv_game.rem_in_wave, slave_thread[thread_id_no].srv_game.active_quests);   
+                room->srv_game.wave, room->srv_game.max_quests_on_screen,
+                room->srv_game.rem_in_wave, room->srv_game.active_quests);   
 
     }
 }
 
 
 /* Shut down game in progress: */
-void end_game(int thread_id_no)
+void end_game(srv_room* room)
 {
-    int i = 0;
-    char buf[NET_BUF_LEN];
+    int i;
+    net_msg msg;
 
     DEBUGMSG(debug_lan, "Enter end_game()\n");
 
     /* Broadcast notice to anyone who is left: */
-    snprintf(buf, NET_BUF_LEN, "%s", "GAME_HALTED");
-    transmit_all(thread_id_no,buf);
+    Net_InitMsg(&msg, NET_OP_GAME_HALTED);
+    transmit_all(room, &msg);
 
     /* Now make sure all clients are closed: */ 
-    for(i = 0; i < MAX_CLIENTS; i++)
+    while(room->num_active > 0)
     {
-        SDLNet_TCP_Close(slave_thread[thread_id_no].client[i].sock);
-        slave_thread[thread_id_no].client[i].sock = NULL;
-        slave_thread[thread_id_no].client[i].game_ready = 0;
+        i = room->active[room->num_active - 1];
+        close_client_socket(room, i);
+        room->client[i].game_ready = 0;
     }
 
-    game_in_progress = 0;
+    room->game_in_progress = 0;
+    print_scoreboard(room);
     //  NOTE: we only want to call MC_EndGame() when the program exits,
     //  not when an individual math game ends.
     //  MC_EndGame();
+    DEBUGMSG(debug_lan, "Peak memory used for question lists: %lu bytes\n",
+            (unsigned long)MC_PeakMemoryUsage(room->math_game));
     DEBUGMSG(debug_lan, "Leave end_game()\n");
 }
 
 
+//Final scores and answer times for the server console:
+void print_scoreboard(srv_room* room)
+{
+    int i;
+    MC_MathGame* game = room->math_game;
+
+    printf("\nFinal scores:\n");
+    for(i = 0; i < room->max_clients; i++)
+        if(room->client[i].name[0] != '\0')
+            printf("%-20s %d\n", room->client[i].name,
+                    room->client[i].score);
+
+    printf("Answers: %d correct, %d missed\n",
+            MC_NumAnsweredCorrectly(game), MC_NumNotAnsweredCorrectly(game));
+    printf("Answer time (sec): mean %.2f  p50 %.2f  p90 %.2f  p99 %.2f\n",
+            MC_MeanTimePerQuestion(game),
+            MC_TimePerQuestionPercentile(game, 50),
+            MC_TimePerQuestionPercentile(game, 90),
+            MC_TimePerQuestionPercentile(game, 99));
+}
+
+
 //More centralized function to update the clients of the number of 
 //questions remaining, whether the mission has been accomplished,
 //and so forth:
-int send_counter_updates(int thread_id_no)
+int send_counter_updates(srv_room* room)
 {
-    int total_questions;
+    net_msg msg;
 
     //If game won, tell everyone:
-    if(MC_MissionAccomplished(lan_game_settings))
+    if(MC_MissionAccomplished(room->math_game))
     {
-        char buf[NET_BUF_LEN];
-        snprintf(buf, NET_BUF_LEN, "%s", "MISSION_ACCOMPLISHED");
-        transmit_all(thread_id_no, buf);
+        Net_InitMsg(&msg, NET_OP_MISSION_ACCOMPLISHED);
+        transmit_all(room, &msg);
     }
 
     //Tell everyone how many questions left:
-    total_questions = MC_TotalQuestionsLeft(lan_game_settings);
-    {
-        char buf[NET_BUF_LEN];
-        snprintf(buf, NET_BUF_LEN, "%s\t%d", "TOTAL_QUESTIONS", total_questions);
-        transmit_all(thread_id_no, buf);
-    }
+    Net_InitMsg(&msg, NET_OP_TOTAL_QUESTIONS);
+    msg.arg[0] = MC_TotalQuestionsLeft(room->math_game);
+    transmit_all(room, &msg);
 
     //Tell everyone what wave we are on:
-    {
-        char buf[NET_BUF_LEN];
-        snprintf(buf, NET_BUF_LEN, "%s\t%d", "WAVE", slave_thread[thread_id_no].srv_game.wave);
-        transmit_all(thread_id_no, buf);
-    }
+    Net_InitMsg(&msg, NET_OP_WAVE);
+    msg.arg[0] = room->srv_game.wave;
+    transmit_all(room, &msg);
     return 1;
 }
 
 
-int send_player_updates(int thread_id_no)
+/* Sends everyone the whole player list. That is a message per player */
+/* to each of them, so it is only done as a game starts - otherwise   */
+/* send_player_update() passes on just what changed:                   */
+int send_player_updates(srv_room* room)
 {
-    int i = 0;
+    int i, k;
+    net_msg msg;
 
-    /* Count how many players are active and send number to clients: */
+    /* Count how many players are active and send number to clients - */
+    /* one at a time, as transmit() cuts it down for older ones:      */
     {
         int connected_players = 0;
-        char buf[NET_BUF_LEN];
-        for(i = 0; i < MAX_CLIENTS; i++)
-            if((slave_thread[thread_id_no].client[i].game_ready == 1) && (slave_thread[thread_id_no].client[i].sock != NULL))
+        for(k = 0; k < room->num_active; k++)
+            if(room->client[room->active[k]].game_ready == 1)
                 connected_players++;
 
-        snprintf(buf, NET_BUF_LEN, "%s\t%d", "CONNECTED_PLAYERS",
-                connected_players);
-        transmit_all(thread_id_no, buf);
+        Net_InitMsg(&msg, NET_OP_CONNECTED_PLAYERS);
+        msg.arg[0] = connected_players;
+        for(k = room->num_active - 1; k >= 0; k--)
+        {
+            if(k >= room->num_active)
+                continue;
+            transmit(room, room->active[k], &msg);
+        }
     }
 
     /* Now send out all the names and scores: */
-    for(i = 0; i < MAX_CLIENTS; i++)
+    for(i = 0; i < room->max_clients; i++)
+        if(room->client[i].sock != NULL && room->client[i].joined)
+            send_player_update(room, i);
+
+    return 1;
+}
+
+
+/* Tells everyone the name, readiness and score of client i: */
+int send_player_update(srv_room* room, int i)
+{
+    net_msg msg;
+
+    Net_InitMsg(&msg, NET_OP_UPDATE_PLAYER_INFO);
+    msg.arg[0] = i;
+    msg.arg[1] = room->client[i].game_ready;
+    snprintf(msg.text, NAME_SIZE, "%s", room->client[i].name);
+    msg.arg[2] = room->client[i].score;
+    return transmit_all(room, &msg);
+}
+
+
+/* Brings a newcomer, client i, up to date with everyone already here: */
+int send_player_list(srv_room* room, int i)
+{
+    int j, k;
+    net_msg msg;
+
+    Net_InitMsg(&msg, NET_OP_CONNECTED_PLAYERS);
+    msg.arg[0] = 0;
+    for(k = 0; k < room->num_active; k++)
+        if(room->client[room->active[k]].game_ready == 1)
+            msg.arg[0]++;
+    if(!transmit(room, i, &msg))
+        return 0;
+
+    for(k = 0; k < room->num_active; k++)
     {
-        if(slave_thread[thread_id_no].client[i].sock != NULL)
-        {
-            char buf[NET_BUF_LEN];
-            snprintf(buf, NET_BUF_LEN, "%s\t%d\t%d\t%s\t%d", "UPDATE_PLAYER_INFO",
-                    i,
-                    slave_thread[thread_id_no].client[i].game_ready,
-                    slave_thread[thread_id_no].client[i].name,
-                    slave_thread[thread_id_no].client[i].score);
-            transmit_all(thread_id_no, buf);
-        }
+        j = room->active[k];
+        if(!room->client[j].joined)
+            continue;
+        Net_InitMsg(&msg, NET_OP_UPDATE_PLAYER_INFO);
+        msg.arg[0] = j;
+        msg.arg[1] = room->client[j].game_ready;
+        snprintf(msg.text, NAME_SIZE, "%s", room->client[j].name);
+        msg.arg[2] = room->client[j].score;
+        if(!transmit(room, i, &msg))
+            return 0;
     }
-
     return 1;
 }
 
 
 /* Sends a new question to all clients: */
-int add_question(int thread_id_no, MC_FlashCard* fc)
+int add_question(srv_room* room, MC_FlashCard* fc)
 {
-    char buf[NET_BUF_LEN];
+    net_msg msg;
 
     if(!fc)
         return 0;
 
-    snprintf(buf, NET_BUF_LEN,"%s\t%d\t%d\t%d\t%s\t%s\n",
-            "ADD_QUESTION",
-            fc->question_id,
-            fc->difficulty,
-            fc->answer,
-            fc->answer_string,
-            fc->formula_string);
-    transmit_all(thread_id_no, buf);
+    Net_InitMsg(&msg, NET_OP_ADD_QUESTION);
+    msg.card = *fc;
+    transmit_all(room, &msg);
+
+    //Note when it went out, for answer_time():
+    room->sent_id[room->sent_next] = fc->question_id;
+    room->sent_time[room->sent_next] = SDL_GetTicks();
+    room->sent_next = (room->sent_next + 1) % SRV_SENT_QUESTIONS;
     return 1;
 }
 
 /* Tells all clients to remove a specific question: */
-int remove_question(int thread_id_no, int quest_id, int answered_by)
+int remove_question(srv_room* room, int quest_id, int answered_by)
 {
-    char buf[NET_BUF_LEN];
-    snprintf(buf, NET_BUF_LEN, "%s\t%d\t%d", "REMOVE_QUESTION", quest_id, answered_by);
-    transmit_all(thread_id_no, buf);
+    net_msg msg;
+    Net_InitMsg(&msg, NET_OP_REMOVE_QUESTION);
+    msg.arg[0] = quest_id;
+    msg.arg[1] = answered_by;
+    transmit_all(room, &msg);
     return 1;
 }
 
 
 /* Sends a string for the client to display to player: */
-int player_msg(int thread_id_no, int i, char* msg)
+int player_msg(srv_room* room, int i, char* msg)
 {
-    char buf[NET_BUF_LEN];
+    net_msg out;
     if(!msg)
     {
         DEBUGMSG(debug_lan, "player_msg() - msg argument is NULL\n");
         return 0;
     }
 
-    /* Add header: */
-    snprintf(buf, NET_BUF_LEN, "%s\t%s", "PLAYER_MSG", msg);
+    Net_InitMsg(&out, NET_OP_PLAYER_MSG);
+    snprintf(out.text, NET_BUF_LEN, "%s", msg);
     //NOTE transmit() validates index and socket
-    return transmit(thread_id_no, i, buf);
+    return transmit(room, i, &out);
 }
 
 /* Send a player message to all clients: */
-void broadcast_msg(int thread_id_no, char* msg)
+void broadcast_msg(srv_room* room, char* msg)
 {
-    int i = 0;
+    net_msg out;
     if (!msg)
         return;
-    for(i = 0; i < MAX_CLIENTS; i++)
-        player_msg(thread_id_no, i, msg);
+    Net_InitMsg(&out, NET_OP_PLAYER_MSG);
+    snprintf(out.text, NET_BUF_LEN, "%s", msg);
+    transmit_all(room, &out);
 }
 
-/* Send string to client. String should already have its header */ 
-int transmit(int thread_id_no, int i, char* msg)
+/* Send message to client in whatever format it understands: */ 
+int transmit(srv_room* room, int i, net_msg* msg)
 {
     char buf[NET_BUF_LEN];
+    int len;
 
     //Validate arguments;
-    if(i < 0 || i > MAX_CLIENTS)
+    if(i < 0 || i >= room->max_clients)
     {
         DEBUGMSG(debug_lan,"transmit() - invalid index argument\n");
         return 0;
@@ -1581,35 +3114,120 @@ int transmit(int thread_id_no, int i, char* msg)
         return 0;
     }
 
-    if(!slave_thread[thread_id_no].client[i].sock)
+    if(!room->client[i].sock)
     {
         return 0;
     }
 
-    //NOTE SDLNet's Send() keeps sending until the requested length is
-    //sent, so it really is an error if we send less thatn NET_BUF_LEN
-    snprintf(buf, NET_BUF_LEN, "%s", msg);
-    if(SDLNet_TCP_Send(slave_thread[thread_id_no].client[i].sock, buf, NET_BUF_LEN) < NET_BUF_LEN)
+    //Older clients only hear about the players they have room for:
+    if(too_wide_for(room, i, msg))
+        return 1;
+    if(msg->op == NET_OP_CONNECTED_PLAYERS && msg->arg[0] > NET_LEGACY_CLIENTS
+            && room->client[i].stream.protocol < NET_PROTOCOL_WIDE)
     {
-        fprintf(stderr, "The client %s is disconnected\n", slave_thread[thread_id_no].client[i].name);
-        remove_client(thread_id_no, i);
+        net_msg narrow = *msg;
+        narrow.arg[0] = NET_LEGACY_CLIENTS;
+        len = Net_EncodeMsg(&narrow, room->client[i].stream.protocol, buf);
+        return transmit_encoded(room, i, &narrow, buf, len);
+    }
+
+    len = Net_EncodeMsg(msg, room->client[i].stream.protocol, buf);
+    return transmit_encoded(room, i, msg, buf, len);
+}
+
+
+/* Send the message to all clients, encoding it only once for */
+/* each format in use:                                         */
+int transmit_all(srv_room* room, net_msg* msg)
+{
+    char text[NET_BUF_LEN];
+    char binary[NET_BUF_LEN];
+    int text_len = -1, binary_len = -1;
+    int i, k;
+
+    if (!msg)
         return 0;
+
+    //Backwards, as anyone hung up on is replaced by the last in the list:
+    for(k = room->num_active - 1; k >= 0; k--)
+    {
+        if(k >= room->num_active)
+            continue;
+        i = room->active[k];
+        if(too_wide_for(room, i, msg))
+            continue;
+        if(room->client[i].stream.protocol >= NET_PROTOCOL_BINARY)
+        {
+            if(binary_len < 0)
+                binary_len = Net_EncodeMsg(msg, NET_PROTOCOL_BINARY, binary);
+            transmit_encoded(room, i, msg, binary, binary_len);
+        }
+        else
+        {
+            if(text_len < 0)
+                text_len = Net_EncodeMsg(msg, NET_PROTOCOL_LEGACY, text);
+            transmit_encoded(room, i, msg, text, text_len);
+        }
     }
-    //Success:
+
     return 1;
 }
 
 
-/* Send the message to all clients: */
-int transmit_all(int thread_id_no, char* msg)
+/* Clients before protocol 5 have room for only NET_LEGACY_CLIENTS  */
+/* players and complain about any message naming one beyond those - */
+/* returns 1 if msg is such a message and client i such a client:    */
+int too_wide_for(srv_room* room, int i, const net_msg* msg)
 {
-    int i = 0;
-    if (!msg)
+    if(room->client[i].stream.protocol >= NET_PROTOCOL_WIDE)
         return 0;
+    switch(msg->op)
+    {
+        case NET_OP_SOCKET_INDEX:
+        case NET_OP_UPDATE_PLAYER_INFO:
+        case NET_OP_PLAYER_LEFT:
+            return msg->arg[0] >= NET_LEGACY_CLIENTS;
+        default:
+            return 0;
+    }
+}
+
+
+/* Queues an encoded message for flush_client() to send. Once the */
+/* client has more than send_high_water bytes waiting, updates    */
+/* that newer ones have overtaken are dropped, and if even that   */
+/* doesn't make room the client is hopelessly behind and gets     */
+/* hung up on:                                                    */
+int transmit_encoded(srv_room* room, int i, net_msg* msg, char* data, int len)
+{
+    client_type* c = &room->client[i];
+    int protocol = c->stream.protocol;
+    int slot = Net_UpdateSlot(msg);
+    int dropped = 0;
 
-    for(i = 0; i < MAX_CLIENTS; i++)
-        transmit(thread_id_no, i, msg);
+    if(!Net_QueueEncoded(&c->queue, protocol, slot, data, len))
+    {
+        dropped = Net_DropStaleUpdates(&c->queue);
+        Stats_Add(STAT_STALE_DROPPED, dropped);
+        if(!dropped || !Net_QueueEncoded(&c->queue, protocol, slot, data, len))
+        {
+            fprintf(stderr, "The client %s has fallen too far behind - disconnecting\n", c->name);
+            Stats_Add(STAT_TOO_SLOW, 1);
+            remove_client(room, i);
+            return 0;
+        }
+    }
+    tick_msgs++;
+    Stats_MsgOut(msg->op);
 
+    if(c->queue.len > send_high_water)
+    {
+        dropped = Net_DropStaleUpdates(&c->queue);
+        Stats_Add(STAT_STALE_DROPPED, dropped);
+        DEBUGMSG(debug_lan, "transmit_encoded() - dropped %d stale updates for client %d, "
+                "%d bytes still queued\n", dropped, i, c->queue.len);
+    }
+    //Success:
     return 1;
 }
 
@@ -38,17 +38,30 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifdef HAVE_LIBSDL_NET
 
 #include "SDL_net.h"
+#include "netmsg.h"
 
 #define NAME_SIZE 50
 #define DEFAULT_SERVER_NAME "TuxMath LAN Server"
 #define SERVER_NAME_TIMEOUT 30000
 #define DEFAULT_PORT 4779
+#define MAX_ROOMS 32          //rooms listen on DEFAULT_PORT up to DEFAULT_PORT + MAX_ROOMS - 1
 
 typedef struct client_type {
     int game_ready;   //game_ready = 1 means client has said OK to start
     char name[NAME_SIZE];
     int score;
     TCPsocket sock;
+    net_stream stream;   //partial messages received, and how we reply
+    net_queue queue;     //messages waiting for the socket to take them
+    int want_write;      //asked to be woken when the socket can take more
+    Uint32 connect_time; //for the answer rate in the server's stats
+    int answers;
+    int correct;
+    float rtt;           //smoothed PING round trip in msec, -1 until measured
+    int active_pos;      //where it is in its room's active[], -1 if not connected
+    int readable;        //has sent us something we haven't read yet
+    int need_list;       //still to be sent the other players' details
+    int joined;          //has its index and the others have been told of it
 }client_type;
 
 
@@ -79,12 +92,12 @@ int OurServerRunning(void);
 /* Find out if another program (perhaps another tuxmath server program)
  * is using the desired port: */
 int PortAvailable(Uint16 port);
-/* Find out if game is already in progress: */
+/* Find out if a game is already in progress in any room: */
 int SrvrGameInProgress(void);
 /* Stop Server */
 void StopServer(void);
-/* Stop currently running game: */
-void StopSrvrGame(int thread_id_no);
+/* Stop currently running games in all rooms: */
+void StopSrvrGame(void);
 
 #endif
 
@@ -29,6 +29,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "server.h"
 #include "mathcards.h"
+#include "options.h"
 
 /* This function has to be in its own file that is not linked into tuxmath */
 /* itself because there can only be one main() in a program.  All of the   */
@@ -38,24 +39,46 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * server is running in a thread. Similar considerations apply to MC_EndGame().
  */
 MC_MathGame* lan_game_settings = NULL;
+/* Declarations needed for fileops.c, which the server uses to read */
+/* the lesson file for each room it opens:                          */
+char **lesson_list_titles = NULL;
+char **lesson_list_filenames = NULL;
+int num_lessons = 0;
+
+int read_high_scores_fp(FILE* fp)
+{
+    /* This is a stub to let things compile */
+    return 1;
+}
+
+void initialize_scores(void)
+{
+    /* This is a stub to let things compile */
+}
 
 int main(int argc, char** argv)
 {
     int ret;
 #ifdef HAVE_LIBSDL_NET
     //Initialize a copy of mathcards to hold settings:
-    lan_game_settings = (MC_MathGame*) malloc(sizeof(MC_MathGame));
+    lan_game_settings = (MC_MathGame*) calloc(1, sizeof(MC_MathGame));
     if (lan_game_settings == NULL)
     {
         fprintf(stderr, "\nUnable to allocate MC_MathGame\n");
         exit(1);
     }
-    lan_game_settings->math_opts = NULL;
     if (!MC_Initialize(lan_game_settings))
     {
         fprintf(stderr, "\nUnable to initialize MathCards\n");
         exit(1);
     }
+    //The global options hold the comet counts, and the lesson title
+    //for each room:
+    if (!Opts_Initialize())
+    {
+        fprintf(stderr, "\nUnable to initialize game options\n");
+        exit(1);
+    }
     //Initialize SDL and SDL_net:
     if(SDL_Init(0) == -1)
     {
@@ -79,6 +102,7 @@ int main(int argc, char** argv)
         free(lan_game_settings);
         lan_game_settings = NULL;
     }
+    Opts_Cleanup();
     return ret;
 #else
     return 0;
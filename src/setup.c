@@ -210,13 +210,12 @@ void print_locale_info(FILE* fp)
 void initialize_options(void)
 {
     /* Initialize MathCards backend for math questions: */
-    local_game = (MC_MathGame*) malloc(sizeof(MC_MathGame));
+    local_game = (MC_MathGame*) calloc(1, sizeof(MC_MathGame));
     if (local_game == NULL)
     {
         fprintf(stderr, "\nUnable to allocate MC_MathGame\n");
         exit(1);
     }
-    local_game->math_opts = NULL;
     if (!MC_Initialize(local_game))
     {
         fprintf(stderr, "\nUnable to initialize MathCards\n");
@@ -224,13 +223,12 @@ void initialize_options(void)
     }
 
 
-    lan_game_settings = (MC_MathGame*) malloc(sizeof(MC_MathGame));
+    lan_game_settings = (MC_MathGame*) calloc(1, sizeof(MC_MathGame));
     if (lan_game_settings == NULL)
     {
         fprintf(stderr, "\nUnable to allocate MC_MathGame\n");
         exit(1);
     }
-    lan_game_settings->math_opts = NULL;
     if (!MC_Initialize(lan_game_settings))
     {
         fprintf(stderr, "\nUnable to initialize MathCards\n");
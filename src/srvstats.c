@@ -0,0 +1,313 @@
+/*
+
+   srvstats.c
+
+   Counters and histograms kept by the LAN server. server.c adds
+   to them as things happen; they are printed by the "stats"
+   console command and written out in the Prometheus text format
+   for whatever is watching a big contest.
+
+   Copyright 2026.
+Author: agent.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+srvstats.c is part of "Tux, of Math Command", a.k.a. "tuxmath".
+
+Tuxmath is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+Tuxmath is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+
+
+/* Must have this first for the #ifdef HAVE_LIBSDL_NET to work */
+#include "globals.h"
+
+#ifdef HAVE_LIBSDL_NET
+
+#include <stdio.h>
+#include <string.h>
+
+#include "srvstats.h"
+#include "netmsg.h"
+
+/* Prometheus name (and label, for counters that share one) of each */
+/* counter, and what the console calls it:                          */
+static const struct {
+    const char* metric;
+    const char* label;
+    const char* desc;
+} counter_info[STAT_NUM_COUNTERS] = {
+    {"tuxmath_received_bytes_total", NULL, "bytes received"},
+    {"tuxmath_sent_bytes_total", NULL, "bytes sent"},
+    {"tuxmath_writes_total", NULL, "writes"},
+    {"tuxmath_connections_total", NULL, "connections"},
+    {"tuxmath_connections_refused_total", NULL, "refused"},
+    {"tuxmath_disconnects_total", "reason=\"left\"", "left"},
+    {"tuxmath_disconnects_total", "reason=\"lost\"", "lost"},
+    {"tuxmath_disconnects_total", "reason=\"too_slow\"", "too slow"},
+    {"tuxmath_stale_updates_dropped_total", NULL, "stale updates dropped"},
+    {"tuxmath_games_started_total", NULL, "games started"},
+    {"tuxmath_questions_sent_total", NULL, "questions sent"},
+    {"tuxmath_answers_total", "result=\"correct\"", "correct"},
+    {"tuxmath_answers_total", "result=\"wrong\"", "wrong"},
+};
+
+static const struct {
+    const char* metric;
+    const char* desc;
+} histogram_info[STAT_NUM_HISTOGRAMS] = {
+    {"tuxmath_loop_seconds", "Loop time"},
+    {"tuxmath_dispatch_lag_seconds", "Dispatch lag"},
+    {"tuxmath_rtt_seconds", "Round trip"},
+};
+
+/* Histogram bucket upper bounds in msec, the last catching the rest: */
+#define STATS_NUM_BUCKETS 14
+static const Uint32 bucket_max[STATS_NUM_BUCKETS - 1] = {
+    0, 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000
+};
+
+typedef struct stats_histogram {
+    unsigned long count;
+    unsigned long sum;          // msec
+    Uint32 max;
+    unsigned long bucket[STATS_NUM_BUCKETS];
+} stats_histogram;
+
+static unsigned long counters[STAT_NUM_COUNTERS];
+static unsigned long msgs_in[NET_NUM_OPS];
+static unsigned long msgs_out[NET_NUM_OPS];
+static stats_histogram histograms[STAT_NUM_HISTOGRAMS];
+static Uint32 start_time = 0;
+
+static void print_msg_counts(FILE* fp, const char* title, const unsigned long* counts);
+static void write_msg_counts(FILE* fp, const char* metric, const char* help,
+                             const unsigned long* counts);
+
+
+/* Starts everything over from zero, e.g. when the server is restarted: */
+void Stats_Init(void)
+{
+    memset(counters, 0, sizeof(counters));
+    memset(msgs_in, 0, sizeof(msgs_in));
+    memset(msgs_out, 0, sizeof(msgs_out));
+    memset(histograms, 0, sizeof(histograms));
+    start_time = SDL_GetTicks();
+}
+
+
+void Stats_Add(int counter, unsigned long n)
+{
+    if(counter >= 0 && counter < STAT_NUM_COUNTERS)
+        counters[counter] += n;
+}
+
+
+unsigned long Stats_Get(int counter)
+{
+    if(counter >= 0 && counter < STAT_NUM_COUNTERS)
+        return counters[counter];
+    return 0;
+}
+
+
+/* A message of type op received from a client: */
+void Stats_MsgIn(int op)
+{
+    if(op >= 0 && op < NET_NUM_OPS)
+        msgs_in[op]++;
+}
+
+
+/* A message of type op queued for a client: */
+void Stats_MsgOut(int op)
+{
+    if(op >= 0 && op < NET_NUM_OPS)
+        msgs_out[op]++;
+}
+
+
+void Stats_Observe(int histogram, Uint32 msec)
+{
+    stats_histogram* h;
+    int b;
+
+    if(histogram < 0 || histogram >= STAT_NUM_HISTOGRAMS)
+        return;
+    h = &histograms[histogram];
+    for(b = 0; b < STATS_NUM_BUCKETS - 1 && msec > bucket_max[b]; b++) {}
+    h->bucket[b]++;
+    h->count++;
+    h->sum += msec;
+    if(msec > h->max)
+        h->max = msec;
+}
+
+
+/* The upper bound of the bucket holding the given percentile, */
+/* or the largest value seen if that is less:                  */
+Uint32 Stats_Percentile(int histogram, int percentile)
+{
+    stats_histogram* h;
+    unsigned long n = 0, target;
+    int b;
+
+    if(histogram < 0 || histogram >= STAT_NUM_HISTOGRAMS)
+        return 0;
+    h = &histograms[histogram];
+    if(h->count == 0)
+        return 0;
+
+    target = (h->count * percentile + 99) / 100;
+    for(b = 0; b < STATS_NUM_BUCKETS - 1; b++)
+    {
+        n += h->bucket[b];
+        if(n >= target)
+            return (bucket_max[b] < h->max) ? bucket_max[b] : h->max;
+    }
+    return h->max;
+}
+
+
+/* Msec since Stats_Init(): */
+Uint32 Stats_Uptime(void)
+{
+    return SDL_GetTicks() - start_time;
+}
+
+
+/* For the server console: */
+void Stats_Print(FILE* fp)
+{
+    stats_histogram* h;
+    int i;
+
+    fprintf(fp, "Up %lu seconds\n", (unsigned long)(Stats_Uptime() / 1000));
+    print_msg_counts(fp, "Messages in:", msgs_in);
+    print_msg_counts(fp, "Messages out:", msgs_out);
+    fprintf(fp, "%lu bytes in, %lu bytes out in %lu writes, %lu %s\n",
+            counters[STAT_BYTES_IN], counters[STAT_BYTES_OUT], counters[STAT_WRITES],
+            counters[STAT_STALE_DROPPED], counter_info[STAT_STALE_DROPPED].desc);
+    fprintf(fp, "%lu connections, %lu refused; disconnects: %lu left, %lu lost, %lu too slow\n",
+            counters[STAT_CONNECTS], counters[STAT_REFUSED],
+            counters[STAT_LEFT], counters[STAT_LOST], counters[STAT_TOO_SLOW]);
+    fprintf(fp, "%lu games started, %lu questions sent, %lu answered correctly, %lu wrong\n",
+            counters[STAT_GAMES_STARTED], counters[STAT_QUESTIONS_SENT],
+            counters[STAT_CORRECT_ANSWERS], counters[STAT_WRONG_ANSWERS]);
+
+    for(i = 0; i < STAT_NUM_HISTOGRAMS; i++)
+    {
+        h = &histograms[i];
+        fprintf(fp, "%s (msec): %lu samples, mean %.1f, 50%% <= %lu, 90%% <= %lu, "
+                "99%% <= %lu, max %lu\n",
+                histogram_info[i].desc, h->count,
+                h->count ? (double)h->sum / h->count : 0.0,
+                (unsigned long)Stats_Percentile(i, 50),
+                (unsigned long)Stats_Percentile(i, 90),
+                (unsigned long)Stats_Percentile(i, 99),
+                (unsigned long)h->max);
+    }
+}
+
+
+/* Writes the counters and histograms in the Prometheus text format. */
+/* The server adds its per-room and per-client figures after them:   */
+void Stats_WritePrometheus(FILE* fp)
+{
+    stats_histogram* h;
+    unsigned long n;
+    int i, b;
+
+    fprintf(fp, "# HELP tuxmath_uptime_seconds Time since the server started.\n"
+            "# TYPE tuxmath_uptime_seconds gauge\n"
+            "tuxmath_uptime_seconds %.3f\n", Stats_Uptime() / 1000.0);
+
+    write_msg_counts(fp, "tuxmath_messages_received_total",
+            "Messages received from clients, by type.", msgs_in);
+    write_msg_counts(fp, "tuxmath_messages_sent_total",
+            "Messages queued for clients, by type.", msgs_out);
+
+    for(i = 0; i < STAT_NUM_COUNTERS; i++)
+    {
+        //Counters sharing a name are next to each other in the table:
+        if(i == 0 || strcmp(counter_info[i].metric, counter_info[i - 1].metric) != 0)
+            fprintf(fp, "# TYPE %s counter\n", counter_info[i].metric);
+        if(counter_info[i].label)
+            fprintf(fp, "%s{%s} %lu\n", counter_info[i].metric,
+                    counter_info[i].label, counters[i]);
+        else
+            fprintf(fp, "%s %lu\n", counter_info[i].metric, counters[i]);
+    }
+
+    for(i = 0; i < STAT_NUM_HISTOGRAMS; i++)
+    {
+        h = &histograms[i];
+        fprintf(fp, "# TYPE %s histogram\n", histogram_info[i].metric);
+        for(b = 0, n = 0; b < STATS_NUM_BUCKETS - 1; b++)
+        {
+            n += h->bucket[b];
+            fprintf(fp, "%s_bucket{le=\"%g\"} %lu\n", histogram_info[i].metric,
+                    bucket_max[b] / 1000.0, n);
+        }
+        fprintf(fp, "%s_bucket{le=\"+Inf\"} %lu\n", histogram_info[i].metric, h->count);
+        fprintf(fp, "%s_sum %.3f\n", histogram_info[i].metric, h->sum / 1000.0);
+        fprintf(fp, "%s_count %lu\n", histogram_info[i].metric, h->count);
+    }
+}
+
+
+/* Writes value as a quoted label value, escaped as Prometheus wants: */
+void Stats_PromLabel(FILE* fp, const char* value)
+{
+    fputc('"', fp);
+    for(; value && *value; value++)
+    {
+        if(*value == '\\' || *value == '"')
+            fputc('\\', fp);
+        if(*value == '\n')
+            fputs("\\n", fp);
+        else
+            fputc(*value, fp);
+    }
+    fputc('"', fp);
+}
+
+
+
+/*  ----- Private to srvstats.c:  ------------------- */
+
+static void print_msg_counts(FILE* fp, const char* title, const unsigned long* counts)
+{
+    int op;
+
+    fprintf(fp, "%s", title);
+    for(op = 0; op < NET_NUM_OPS; op++)
+        if(counts[op])
+            fprintf(fp, " %s %lu", Net_MsgName(op), counts[op]);
+    fprintf(fp, "\n");
+}
+
+
+static void write_msg_counts(FILE* fp, const char* metric, const char* help,
+                             const unsigned long* counts)
+{
+    int op;
+
+    fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n", metric, help, metric);
+    for(op = 0; op < NET_NUM_OPS; op++)
+        if(counts[op])
+            fprintf(fp, "%s{type=\"%s\"} %lu\n", metric, Net_MsgName(op), counts[op]);
+}
+
+#endif // HAVE_LIBSDL_NET
@@ -0,0 +1,82 @@
+/*
+   srvstats.h:
+
+   Counters and histograms kept by the LAN server, for its "stats"
+   console command and the Prometheus-style file it can write.
+
+   Copyright 2026.
+Author: agent.
+Project email: <tuxmath-devel@lists.sourceforge.net>
+Project website: http://tux4kids.alioth.debian.org
+
+
+srvstats.h is part of "Tux, of Math Command", a.k.a. "tuxmath".
+
+Tuxmath is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+Tuxmath is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef SRVSTATS_H
+#define SRVSTATS_H
+
+#include "config.h"
+
+#ifdef HAVE_LIBSDL_NET
+
+#include <stdio.h>
+#include "SDL.h"
+
+/* Counters, all since the server started: */
+enum {
+    STAT_BYTES_IN,
+    STAT_BYTES_OUT,
+    STAT_WRITES,
+    STAT_CONNECTS,
+    STAT_REFUSED,               // room full or game already started
+    STAT_LEFT,                  // disconnects, by reason
+    STAT_LOST,
+    STAT_TOO_SLOW,
+    STAT_STALE_DROPPED,
+    STAT_GAMES_STARTED,
+    STAT_QUESTIONS_SENT,
+    STAT_CORRECT_ANSWERS,
+    STAT_WRONG_ANSWERS,
+    STAT_NUM_COUNTERS
+};
+
+/* Histograms, in msec: */
+enum {
+    STAT_LOOP_TIME,             // work done per pass through the main loop
+    STAT_DISPATCH_LAG,          // questions sent later than they were due
+    STAT_RTT,                   // PING round trips to clients
+    STAT_NUM_HISTOGRAMS
+};
+
+void Stats_Init(void);
+void Stats_Add(int counter, unsigned long n);
+unsigned long Stats_Get(int counter);
+void Stats_MsgIn(int op);
+void Stats_MsgOut(int op);
+void Stats_Observe(int histogram, Uint32 msec);
+Uint32 Stats_Percentile(int histogram, int percentile);
+Uint32 Stats_Uptime(void);
+
+void Stats_Print(FILE* fp);
+void Stats_WritePrometheus(FILE* fp);
+void Stats_PromLabel(FILE* fp, const char* value);
+
+#endif // HAVE_LIBSDL_NET
+
+#endif // SRVSTATS_H
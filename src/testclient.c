@@ -35,13 +35,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 
 
+/* This must come before #ifdef HAVE_LIBSDL_NET to get "config.h" */
+#include "globals.h"
+
 #ifdef HAVE_LIBSDL_NET
 
-#include "globals.h"
 #include "transtruct.h"
 #include "mathcards.h"
 #include "testclient.h"
-#include "throttle.h"
 #include "network.h"
 
 #include <stdio.h>
@@ -72,14 +73,14 @@ int read_stdin_nonblock(char* buf, size_t max_length);
 
 /* Functions to handle messages from server: */
 int game_check_msgs(void);
-int add_quest_recvd(char* buf);
-int remove_quest_recvd(char* buf);
-int player_msg_recvd(char* buf);
-int total_quests_recvd(char* buf);
-int mission_accompl_recvd(char* buf);
+int add_quest_recvd(net_msg* msg);
+int remove_quest_recvd(net_msg* msg);
+int player_msg_recvd(net_msg* msg);
+int total_quests_recvd(net_msg* msg);
 
 /* Display to player: */
 void print_current_quests(void);
+void print_round_trip(void);
 
 /* Main function: ------------------------------------- */
 
@@ -90,8 +91,12 @@ int main(int argc, char **argv)
     int server_number = -1;
     Uint32 timer = 0;
 
-    //Scan local network to find running server:
-    servers_found = LAN_DetectServers();
+    //Scan local network to find running server, or just the
+    //room asked for with "--room <lesson>":
+    if(argc > 2 && strcmp(argv[1], "--room") == 0)
+        servers_found = LAN_DetectRoom(argv[2]);
+    else
+        servers_found = LAN_DetectServers();
 
     if(servers_found < 1)
     {
@@ -199,9 +204,10 @@ int main(int argc, char **argv)
             }
         }
         //Limit loop to once per 10 msec so we don't eat all CPU
-        Throttle(10, &timer);
+        T4K_Throttle(10, &timer);
     }
 
+    print_round_trip();
     LAN_Cleanup();
 
     return EXIT_SUCCESS;
@@ -213,12 +219,11 @@ int main(int argc, char **argv)
 
 int game_check_msgs(void)
 {
-    char buf[NET_BUF_LEN];
+    net_msg msg;
     int status = 1;
     while(1)
     {
-        buf[0] = '\0';
-        status = LAN_NextMsg(buf);
+        status = LAN_NextNetMsg(&msg);
         if (status == -1)  //Fatal error
         {
             fprintf(stderr, "Error - LAN_NextMsg() returned -1\n");
@@ -230,51 +235,36 @@ int game_check_msgs(void)
             break;
         }
 
-        DEBUGMSG(debug_lan, "Buffer from server is: %s\n", buf);
+        DEBUGMSG(debug_lan, "Message from server is: %s\n", Net_MsgName(msg.op));
 
-        /* Now we process the buffer according to the command: */
-        if(strncmp(buf, "SEND_QUESTION", strlen("SEND_QUESTION")) == 0)
-        {
-            if(!add_quest_recvd(buf))
-                fprintf(stderr, "SEND_QUESTION received but could not add question\n");
-            else
-                // If we successfully added question, show new questions to user:
-                print_current_quests();
-        }
-        else if(strncmp(buf, "ADD_QUESTION", strlen("ADD_QUESTION")) == 0)
-        {
-            if(!add_quest_recvd(buf))
-                fprintf(stderr, "ADD_QUESTION received but could not add question\n");
-            else  
-                print_current_quests();
-        }
-        else if(strncmp(buf, "REMOVE_QUESTION", strlen("REMOVE_QUESTION")) == 0)
-        {
-            if(!remove_quest_recvd(buf)) //remove the question with id in buf
-                fprintf(stderr, "REMOVE_QUESTION received but could not remove question\n");
-            else 
-                print_current_quests();
-        }
-        else if(strncmp(buf, "SEND_MESSAGE", strlen("SEND_MESSAGE")) == 0)
+        /* Now we process the message according to the command: */
+        switch(msg.op)
         {
-            fprintf(stderr, "%s\n", buf);
-        }
-        else if(strncmp(buf, "PLAYER_MSG", strlen("PLAYER_MSG")) == 0)
-        {
-            player_msg_recvd(buf);
-        }
-        else if(strncmp(buf, "TOTAL_QUESTIONS", strlen("TOTAL_QUESTIONS")) == 0)
-        {
-            //update the "questions remaining" counter
-            total_quests_recvd(buf);
-        }
-        else if(strncmp(buf, "MISSION_ACCOMPLISHED", strlen("MISSION_ACCOMPLISHED")) == 0)
-        {
-            game_status = GAME_OVER_WON; 
-        }
-        else 
-        {
-            fprintf(stderr, "game_check_msgs() - unrecognized message: %s\n", buf);
+            case NET_OP_ADD_QUESTION:
+                if(!add_quest_recvd(&msg))
+                    fprintf(stderr, "ADD_QUESTION received but could not add question\n");
+                else  
+                    print_current_quests();
+                break;
+            case NET_OP_REMOVE_QUESTION:
+                if(!remove_quest_recvd(&msg)) //remove the question with id in msg
+                    fprintf(stderr, "REMOVE_QUESTION received but could not remove question\n");
+                else 
+                    print_current_quests();
+                break;
+            case NET_OP_PLAYER_MSG:
+                player_msg_recvd(&msg);
+                break;
+            case NET_OP_TOTAL_QUESTIONS:
+                //update the "questions remaining" counter
+                total_quests_recvd(&msg);
+                break;
+            case NET_OP_MISSION_ACCOMPLISHED:
+                game_status = GAME_OVER_WON; 
+                break;
+            default:
+                fprintf(stderr, "game_check_msgs() - unrecognized message: %s\n",
+                        msg.op == NET_OP_UNKNOWN ? msg.text : Net_MsgName(msg.op));
         }
     }
 
@@ -283,42 +273,30 @@ int game_check_msgs(void)
 
 
 
-int add_quest_recvd(char* buf)
+int add_quest_recvd(net_msg* msg)
 {
     MC_FlashCard* fc = find_comet_by_id(-1);
 
-    if(!fc || !buf)
+    if(!fc || !msg)
     {
-        fprintf(stderr, "NULL fc or buf\n");
+        fprintf(stderr, "NULL fc or msg\n");
         return 0;
     }
-    /* function call to parse buffer and receive question */
-    if(!Make_Flashcard(buf, fc))
-    {
-        fprintf(stderr, "Unable to parse buffer into FlashCard\n");
-        return 0;
-    }
-
+    //The question arrives already decoded:
+    *fc = msg->card;
     return 1;
 }
 
 
 
-int remove_quest_recvd(char* buf)
+int remove_quest_recvd(net_msg* msg)
 {
-    int id = 0;
-    char* p = NULL;
     MC_FlashCard* fc = NULL;
 
-    if(!buf)
+    if(!msg)
         return 0;
 
-    p = strchr(buf, '\t');
-    if(!p)
-        return 0;
-
-    id = atoi(p);
-    fc = find_comet_by_id(id);
+    fc = find_comet_by_id(msg->arg[0]);
     if(!fc)
         return 0;
 
@@ -328,39 +306,22 @@ int remove_quest_recvd(char* buf)
 
 
 
-/* This function prints the 'msg' part of the buffer (i.e. everything */
-/* after the first '\t') to stdout.                                   */
-int player_msg_recvd(char* buf)
+/* This function prints the message text to stdout. */
+int player_msg_recvd(net_msg* msg)
 {
-    char* p;
-    if(buf == NULL)
-        return 0;
-    p = strchr(buf, '\t');
-    if(p)
-    { 
-        p++;
-        fprintf(stderr, "%s\n", p);
-        return 1;
-    }
-    else
+    if(msg == NULL)
         return 0;
+    fprintf(stderr, "%s\n", msg->text);
+    return 1;
 }
 
 
-int total_quests_recvd(char* buf)
+int total_quests_recvd(net_msg* msg)
 {
-    char* p;
-    if(buf == NULL)
-        return 0;
-    p = strchr(buf, '\t');
-    if(p)
-    { 
-        p++;
-        remaining_quests = atoi(p); 
-        return 1;
-    }
-    else
+    if(msg == NULL)
         return 0;
+    remaining_quests = msg->arg[0]; 
+    return 1;
 }
 
 
@@ -379,7 +340,7 @@ int playgame(void)
     fprintf(stderr, "Waiting for other players to be ready...\n\n");
 
     //Tell server we're ready to start:
-    LAN_StartGame(); 
+    LAN_SetReady(true);
     game_status = GAME_IN_PROGRESS;
 
     /* Start out with our "comets" empty: */
@@ -446,7 +407,7 @@ int playgame(void)
             }  //input wasn't any of our keywords
         } // Input was received 
 
-        Throttle(10, &timer);  //so don't eat all CPU
+        T4K_Throttle(10, &timer);  //so don't eat all CPU
     } //End of game loop 
 
     switch(game_status)
@@ -457,6 +418,7 @@ int playgame(void)
         case GAME_OVER_WON:
             fprintf(stderr, "You won! :-)\n");
     }
+    print_round_trip();
 
     DEBUGMSG(debug_lan, "Leaving playgame()\n");
 
@@ -508,6 +470,23 @@ void print_current_quests(void)
 }
 
 
+/* Display what the PINGs have shown of the round trip to the server: */
+void print_round_trip(void)
+{
+    lan_rtt_type rtt;
+
+    LAN_GetRoundTrip(&rtt);
+    if(rtt.samples == 0)
+    {
+        fprintf(stderr, "Round trip to server: not measured\n");
+        return;
+    }
+    fprintf(stderr, "Round trip to server (msec): %d samples, smoothed %.1f, "
+            "mean %.1f, min %u, max %u\n",
+            rtt.samples, rtt.smoothed, rtt.mean, rtt.min, rtt.max);
+}
+
+
 int erase_flashcard(MC_FlashCard* fc)
 {
     if(!fc)
@@ -36,7 +36,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define NET_BUF_LEN 512
 #define NAME_SIZE 50
 #define MAX_SERVERS 50
-#define MAX_CLIENTS 16
+#define MAX_CLIENTS 512    //player indices run from 0 to MAX_CLIENTS - 1 - the
+                           //server only makes room for as many as turn up
 
 #define MC_USE_NEWARC
 #define MC_FORMULA_LEN 40